@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include "DldAuditEventQueue.h"
+
+//--------------------------------------------------------------------
+
+DldAuditEventQueue*   gAuditEventQueue = NULL;
+
+//--------------------------------------------------------------------
+
+#define super OSObject
+
+OSDefineMetaClassAndStructors( DldAuditEventQueue, OSObject )
+
+//--------------------------------------------------------------------
+
+bool
+DldAuditEventQueue::init()
+{
+    if( !super::init() )
+        return false;
+
+    this->Lock = IOLockAlloc();
+    assert( this->Lock );
+    if( !this->Lock )
+        return false;
+
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+void
+DldAuditEventQueue::free()
+{
+    assert( preemption_enabled() );
+
+    if( this->Thread )
+        this->stopThread();
+
+    if( this->Slots )
+        IOFree( this->Slots, this->Capacity*sizeof( this->Slots[ 0 ] ) );
+
+    if( this->Lock )
+        IOLockFree( this->Lock );
+
+    super::free();
+}
+
+//--------------------------------------------------------------------
+
+DldAuditEventQueue*
+DldAuditEventQueue::withCapacity(
+    __in UInt32 capacity,
+    __in DldAuditEventConsumer consumer,
+    __in_opt void* consumerContext
+    )
+{
+    DldAuditEventQueue*  queue;
+    UInt32               roundedCapacity;
+
+    assert( preemption_enabled() );
+    assert( consumer );
+    assert( capacity >= 0x2 && capacity <= 0x10000000 );
+
+    roundedCapacity = 0x2;
+    while( roundedCapacity < capacity )
+        roundedCapacity = roundedCapacity << 0x1;
+
+    queue = new DldAuditEventQueue();
+    assert( queue );
+    if( !queue )
+        return NULL;
+
+    if( !queue->init() ){
+
+        queue->release();
+        return NULL;
+    }
+
+    queue->Slots = (DldAuditEventSlot*)IOMalloc( roundedCapacity*sizeof( queue->Slots[ 0 ] ) );
+    assert( queue->Slots );
+    if( !queue->Slots ){
+
+        queue->release();
+        return NULL;
+    }
+
+    queue->Capacity = roundedCapacity;
+    queue->Mask = roundedCapacity - 0x1;
+    queue->Consumer = consumer;
+    queue->ConsumerContext = consumerContext;
+
+    //
+    // a slot with the index i is free for the producer at the position i
+    //
+    for( UInt32 i = 0x0; i < roundedCapacity; ++i )
+        queue->Slots[ i ].Sequence = i;
+
+    if( KERN_SUCCESS != kernel_thread_start( DldAuditEventQueue::DrainThreadRoutine, queue, &queue->Thread ) ){
+
+        DBG_PRINT_ERROR(( "kernel_thread_start() failed\n" ));
+        queue->Thread = NULL;
+        queue->release();
+        return NULL;
+    }
+
+    return queue;
+}
+
+//--------------------------------------------------------------------
+
+bool
+DldAuditEventQueue::enqueue(
+    __in const DldAuditEvent* event
+    )
+{
+    DldAuditEventSlot*  slot;
+    UInt32              position;
+    SInt32              difference;
+
+    //
+    // reserve a slot, the CAS fails only if there is a concurrent producer
+    //
+    while( true ){
+
+        position = this->Tail;
+        slot = &this->Slots[ position & this->Mask ];
+        difference = (SInt32)( slot->Sequence - position );
+
+        if( 0x0 == difference ){
+
+            if( OSCompareAndSwap( position, position + 0x1, &this->Tail ) )
+                break;
+
+        } else if( difference < 0x0 ){
+
+            //
+            // the slot has not been consumed yet, the queue is full
+            //
+            OSIncrementAtomic( &this->DroppedEvents );
+            return false;
+        }
+
+        //
+        // another producer has taken the position, retry with the new tail
+        //
+    }// end while
+
+    slot->Event = *event;
+
+    //
+    // publish the slot for the consumer, the compiler must not move the copy
+    // after the sequence's update, the x86 doesn't reorder stores
+    //
+    DldCompilerBarrier();
+    slot->Sequence = position + 0x1;
+
+    //
+    // wake up the consumer if the queue is half full, only one producer does this
+    //
+    if( ( position - this->Head ) >= ( this->Capacity >> 0x1 ) &&
+        0x0 == this->WakeupRequested &&
+        OSCompareAndSwap( 0x0, 0x1, &this->WakeupRequested ) ){
+
+        IOLockWakeup( this->Lock, (void*)&this->WakeupRequested, true );
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+unsigned int
+DldAuditEventQueue::dequeueBatch(
+    __out DldAuditEvent* events,
+    __in unsigned int maxCount
+    )
+{
+    unsigned int  count = 0x0;
+
+    //
+    // only the queue's thread calls this function so the head is not contended
+    //
+    while( count < maxCount ){
+
+        UInt32              position = this->Head;
+        DldAuditEventSlot*  slot = &this->Slots[ position & this->Mask ];
+
+        if( slot->Sequence != position + 0x1 )
+            break;
+
+        DldCompilerBarrier();
+        events[ count ] = slot->Event;
+        DldCompilerBarrier();
+
+        //
+        // make the slot free for the producer at the position of the next round
+        //
+        slot->Sequence = position + this->Capacity;
+        this->Head = position + 0x1;
+
+        ++count;
+    }// end while
+
+    return count;
+}
+
+//--------------------------------------------------------------------
+
+void
+DldAuditEventQueue::DrainThreadRoutine(
+    __in void* context,
+    __in wait_result_t waitResult
+    )
+{
+    DldAuditEventQueue*  queue = (DldAuditEventQueue*)context;
+    DldAuditEvent        events[ DLD_AUDIT_DRAIN_BATCH_SIZE ];
+
+    assert( queue );
+
+    while( true ){
+
+        unsigned int  count;
+        UInt64        deadline;
+        bool          terminate;
+
+        while( 0x0 != ( count = queue->dequeueBatch( events, DLD_AUDIT_DRAIN_BATCH_SIZE ) ) )
+            queue->Consumer( queue->ConsumerContext, events, count );
+
+        OSCompareAndSwap( 0x1, 0x0, &queue->WakeupRequested );
+
+        IOLockLock( queue->Lock );
+        {// start of the lock
+
+            terminate = queue->Terminate;
+            if( !terminate ){
+
+                clock_interval_to_deadline( DLD_AUDIT_DRAIN_INTERVAL_MS, kMillisecondScale, &deadline );
+                IOLockSleepDeadline( queue->Lock, (void*)&queue->WakeupRequested, *(AbsoluteTime*)&deadline, THREAD_UNINT );
+            }
+
+        }// end of the lock
+        IOLockUnlock( queue->Lock );
+
+        if( terminate )
+            break;
+
+    }// end while
+
+    IOLockLock( queue->Lock );
+    {// start of the lock
+
+        queue->ThreadExited = true;
+        IOLockWakeup( queue->Lock, (void*)&queue->ThreadExited, true );
+
+    }// end of the lock
+    IOLockUnlock( queue->Lock );
+
+    thread_terminate( current_thread() );
+}
+
+//--------------------------------------------------------------------
+
+void
+DldAuditEventQueue::stopThread()
+{
+    assert( preemption_enabled() );
+    assert( this->Thread );
+
+    IOLockLock( this->Lock );
+    {// start of the lock
+
+        this->Terminate = true;
+        IOLockWakeup( this->Lock, (void*)&this->WakeupRequested, true );
+
+        while( !this->ThreadExited )
+            IOLockSleep( this->Lock, (void*)&this->ThreadExited, THREAD_UNINT );
+
+    }// end of the lock
+    IOLockUnlock( this->Lock );
+
+    thread_deallocate( this->Thread );
+    this->Thread = NULL;
+}
+
+//--------------------------------------------------------------------
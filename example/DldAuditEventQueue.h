@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#ifndef _DLDAUDITEVENTQUEUE_H
+#define _DLDAUDITEVENTQUEUE_H
+
+#include <IOKit/IOLib.h>
+#include <libkern/c++/OSContainers.h>
+#include <IOKit/assert.h>
+#include <kern/thread.h>
+#include "DldCommon.h"
+
+//--------------------------------------------------------------------
+
+//
+// the consumer thread drains the queue with this interval or earlier
+// if the queue is half full
+//
+#define DLD_AUDIT_DRAIN_INTERVAL_MS   (10)
+
+//
+// the number of events passed to a consumer in one call
+//
+#define DLD_AUDIT_DRAIN_BATCH_SIZE    (64)
+
+//
+// the size of a client's class name copied in an event, a longer name is truncated
+//
+#define DLD_AUDIT_CLASS_NAME_LENGTH   (64)
+
+//--------------------------------------------------------------------
+
+typedef enum _DldAuditOperation{
+    DldAuditOperationUnknown = 0x0,
+    DldAuditOperationExternalMethod,
+    DldAuditOperationMethodIndex,
+    DldAuditOperationMemoryType,
+    DldAuditOperationMaximum
+} DldAuditOperation;
+
+//
+// a fixed size record, the producers copy it in a reserved slot
+//
+typedef struct _DldAuditEvent{
+
+    //
+    // an uptime in absolute time units
+    //
+    UInt64               Timestamp;
+    const void*          Client;
+    SInt32               Pid;
+    UInt32               Operation;// DldAuditOperation
+    UInt32               Selector;
+    IOReturn             Result;
+
+    //
+    // copied as the client's class might be unloaded before the event is consumed
+    //
+    char                 ClientClassName[ DLD_AUDIT_CLASS_NAME_LENGTH ];
+
+} DldAuditEvent;
+
+//
+// a consumer is called by the queue's thread for a batch of events
+//
+typedef void (*DldAuditEventConsumer)( __in void* context,
+                                       __in const DldAuditEvent* events,
+                                       __in unsigned int count );
+
+//--------------------------------------------------------------------
+
+//
+// a slot of a bounded multiple producers queue, the sequence tells
+// whether the slot is free for a producer with a given position
+// ( Sequence == position ) or has been filled and is ready for
+// the consumer ( Sequence == position + 1 )
+//
+typedef struct _DldAuditEventSlot{
+    volatile UInt32   Sequence;
+    DldAuditEvent     Event;
+} DldAuditEventSlot;
+
+//--------------------------------------------------------------------
+
+//
+// a lock free multiple producers single consumer queue with a kernel thread
+// as the consumer, a producer never blocks and an event is dropped if the queue is full
+//
+class DldAuditEventQueue : public OSObject {
+
+    OSDeclareDefaultStructors( DldAuditEventQueue )
+
+private:
+
+    DldAuditEventSlot*      Slots;
+    UInt32                  Capacity;// a power of two
+    UInt32                  Mask;
+
+    //
+    // the producers' position and the consumer's position are placed
+    // on different cache lines as they are modified by different CPUs
+    //
+    volatile UInt32         Tail __attribute__((aligned(64)));
+    volatile UInt32         Head __attribute__((aligned(64)));
+
+    //
+    // the number of events dropped as the queue was full
+    //
+    volatile SInt32         DroppedEvents;
+
+    DldAuditEventConsumer   Consumer;
+    void*                   ConsumerContext;
+
+    //
+    // set by a producer which woke up the consumer thread, prevents
+    // the producers from issuing a wakeup for each event
+    //
+    volatile UInt32         WakeupRequested;
+
+    IOLock*                 Lock;
+    thread_t                Thread;
+    bool                    Terminate;
+    bool                    ThreadExited;
+
+    static void DrainThreadRoutine( __in void* context, __in wait_result_t waitResult );
+
+    unsigned int dequeueBatch( __out DldAuditEvent* events, __in unsigned int maxCount );
+
+    void stopThread();
+
+protected:
+
+    virtual bool init();
+    virtual void free();
+
+public:
+
+    //
+    // the capacity is rounded up to a power of two
+    //
+    static DldAuditEventQueue* withCapacity( __in UInt32 capacity,
+                                             __in DldAuditEventConsumer consumer,
+                                             __in_opt void* consumerContext );
+
+    //
+    // called by the hooks, returns false if the event has been dropped
+    //
+    bool enqueue( __in const DldAuditEvent* event );
+
+    SInt32 getDroppedEventsCount(){ return this->DroppedEvents; };
+};
+
+//--------------------------------------------------------------------
+
+extern DldAuditEventQueue*   gAuditEventQueue;
+
+//--------------------------------------------------------------------
+
+#endif//_DLDAUDITEVENTQUEUE_H
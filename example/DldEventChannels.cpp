@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include "DldEventChannels.h"
+
+extern "C" {
+    extern int cpu_number( void );
+    extern boolean_t ml_set_interrupts_enabled( boolean_t enable );
+    extern int ml_get_max_cpus( void );
+}
+
+//--------------------------------------------------------------------
+
+DldEventChannelsReaderCpu*   DldEventChannels::sReaderCpus = NULL;
+unsigned int                 DldEventChannels::sCpusNumber = 0x0;
+
+//--------------------------------------------------------------------
+
+bool
+DldEventChannels::Initialize()
+{
+    DldEventChannelsReaderCpu*  readerCpus;
+    unsigned int                cpusNumber;
+
+    assert( preemption_enabled() );
+
+    if( DldEventChannels::sReaderCpus )
+        return true;
+
+    cpusNumber = ml_get_max_cpus();
+    readerCpus = (DldEventChannelsReaderCpu*)IOMallocAligned( cpusNumber*sizeof( DldEventChannelsReaderCpu ),
+                                                              sizeof( DldEventChannelsReaderCpu ) );
+    assert( readerCpus );
+    if( NULL == readerCpus )
+        return false;
+
+    bzero( readerCpus, cpusNumber*sizeof( DldEventChannelsReaderCpu ) );
+
+    DldEventChannels::sCpusNumber = cpusNumber;
+    DldCompilerBarrier();
+    DldEventChannels::sReaderCpus = readerCpus;
+
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+boolean_t
+DldEventChannels::ReadBegin()
+{
+    boolean_t  interruptsState;
+
+    //
+    // the interrupts are disabled so the CPU's state is changed only by this reader
+    //
+    interruptsState = ml_set_interrupts_enabled( FALSE );
+
+    if( DldEventChannels::sReaderCpus ){
+
+        DldEventChannelsReaderCpu*  readerCpu;
+
+        assert( (unsigned int)cpu_number() < DldEventChannels::sCpusNumber );
+        readerCpu = &DldEventChannels::sReaderCpus[ cpu_number() ];
+
+        //
+        // enter the section before loading the pointers, see WaitForReaders()
+        //
+        readerCpu->Sequence = readerCpu->Sequence + 0x1;
+        DldMemoryBarrier();
+    }
+
+    return interruptsState;
+}
+
+//--------------------------------------------------------------------
+
+void
+DldEventChannels::ReadEnd(
+    __in boolean_t interruptsState
+    )
+{
+    if( DldEventChannels::sReaderCpus ){
+
+        DldEventChannelsReaderCpu*  readerCpu = &DldEventChannels::sReaderCpus[ cpu_number() ];
+
+        //
+        // the channels must be used before the section is left
+        //
+        DldCompilerBarrier();
+        readerCpu->Sequence = readerCpu->Sequence + 0x1;
+    }
+
+    ml_set_interrupts_enabled( interruptsState );
+}
+
+//--------------------------------------------------------------------
+
+void
+DldEventChannels::WaitForReaders()
+{
+    assert( preemption_enabled() );
+
+    if( NULL == DldEventChannels::sReaderCpus )
+        return;
+
+    //
+    // a reader publishes the odd sequence before loading the pointers,
+    // so a CPU which is not in the section or has reentered it after
+    // the pointers were cleared can't be using a released channel
+    //
+    DldMemoryBarrier();
+
+    for( unsigned int cpu = 0x0; cpu < DldEventChannels::sCpusNumber; ++cpu ){
+
+        UInt32  readerSequence = DldEventChannels::sReaderCpus[ cpu ].Sequence;
+
+        if( readerSequence & 0x1 ){
+
+            while( readerSequence == DldEventChannels::sReaderCpus[ cpu ].Sequence )
+                DldCpuPause();
+        }
+    }// end for
+}
+
+//--------------------------------------------------------------------
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#ifndef _DLDEVENTCHANNELS_H
+#define _DLDEVENTCHANNELS_H
+
+#include <IOKit/IOLib.h>
+#include <IOKit/assert.h>
+#include "DldCommon.h"
+
+//--------------------------------------------------------------------
+
+//
+// a CPU's reader state, the Sequence is odd while the CPU is using
+// the event channels, see DldEventChannels::ReadBegin()
+//
+typedef struct _DldEventChannelsReaderCpu{
+
+    volatile UInt32  Sequence;
+
+} __attribute__((aligned(64))) DldEventChannelsReaderCpu;
+
+//--------------------------------------------------------------------
+
+//
+// the hooks load and use gAuditEventQueue, gEventRing and gEventDataQueue
+// in a per CPU read section with the interrupts disabled, the engine can't
+// remove the hooks so a channel is released when its pointer has been
+// cleared and the readers which might have loaded it have left the section,
+// the section must not block
+//
+class DldEventChannels{
+
+private:
+
+    //
+    // allocated before the hooks are installed and never freed as the hooks
+    // are called after the channels have been released
+    //
+    static DldEventChannelsReaderCpu*   sReaderCpus;
+    static unsigned int                 sCpusNumber;
+
+public:
+
+    //
+    // must be called before the hooks are installed, a repeated call is a no-op
+    //
+    static bool Initialize();
+
+    //
+    // returns the interrupts state for ReadEnd()
+    //
+    static boolean_t ReadBegin();
+    static void ReadEnd( __in boolean_t interruptsState );
+
+    //
+    // called after the channels' pointers have been cleared
+    //
+    static void WaitForReaders();
+};
+
+//--------------------------------------------------------------------
+
+#endif//_DLDEVENTCHANNELS_H
@@ -0,0 +1,353 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include "DldEventDataQueue.h"
+
+extern "C" {
+    extern long random( void );
+}
+
+//--------------------------------------------------------------------
+
+DldEventDataQueue*   gEventDataQueue = NULL;
+
+//--------------------------------------------------------------------
+
+#define super IODataQueue
+
+OSDefineMetaClassAndStructors( DldEventDataQueue, IODataQueue )
+
+//--------------------------------------------------------------------
+
+DldEventDataQueue*
+DldEventDataQueue::withCapacity(
+    __in UInt32 size,
+    __in UInt32 watermarkBytes,
+    __in UInt32 maxLatencyUs
+    )
+{
+    DldEventDataQueue*  queue;
+
+    assert( preemption_enabled() );
+    assert( watermarkBytes < size );
+
+    queue = new DldEventDataQueue();
+    assert( queue );
+    if( !queue )
+        return NULL;
+
+    if( !queue->initWithCapacity( size ) ){
+
+        DBG_PRINT_ERROR(( "queue->initWithCapacity( %u ) failed\n", (unsigned int)size ));
+        queue->release();
+        return NULL;
+    }
+
+    //
+    // initWithCapacity() has zeroed the shared tail
+    //
+    queue->Tail = 0x0;
+
+    queue->Lock = IOSimpleLockAlloc();
+    assert( queue->Lock );
+    if( !queue->Lock ){
+
+        queue->release();
+        return NULL;
+    }
+
+    queue->LatencyTimer = thread_call_allocate( DldEventDataQueue::LatencyTimerRoutine, (thread_call_param_t)queue );
+    assert( queue->LatencyTimer );
+    if( !queue->LatencyTimer ){
+
+        queue->release();
+        return NULL;
+    }
+
+    queue->WatermarkBytes = watermarkBytes;
+    queue->MaxLatencyUs = maxLatencyUs;
+    queue->ObjectIdSalt = ( (UInt64)random() << 32 ) | (UInt64)random();
+
+    return queue;
+}
+
+//--------------------------------------------------------------------
+
+void
+DldEventDataQueue::free()
+{
+    //
+    // an armed timer holds a reference so it can't be pending here
+    //
+    assert( !this->TimerArmed );
+
+    if( this->LatencyTimer )
+        thread_call_free( this->LatencyTimer );
+
+    if( this->Lock )
+        IOSimpleLockFree( this->Lock );
+
+    super::free();
+}
+
+//--------------------------------------------------------------------
+
+UInt32
+DldEventDataQueue::consumerHead()
+{
+    //
+    // the head is read once as the consumer changes it concurrently
+    //
+    UInt32  head = *(volatile UInt32*)&this->dataQueue->head;
+
+    if( head > this->dataQueue->queueSize )
+        return this->dataQueue->queueSize + 0x1;
+
+    return head;
+}
+
+//--------------------------------------------------------------------
+
+UInt32
+DldEventDataQueue::queuedBytes()
+{
+    UInt32  head = this->consumerHead();
+    UInt32  tail = this->Tail;
+
+    if( head > this->dataQueue->queueSize )
+        return 0x0;
+
+    if( tail >= head )
+        return tail - head;
+
+    //
+    // the queue has wrapped around
+    //
+    return this->dataQueue->queueSize - ( head - tail );
+}
+
+//--------------------------------------------------------------------
+
+bool
+DldEventDataQueue::copyToQueue(
+    __in void* data,
+    __in UInt32 dataSize
+    )
+{
+    const UInt32        queueSize = this->dataQueue->queueSize;
+    const UInt32        head      = this->consumerHead();
+    const UInt32        tail      = this->Tail;
+    const UInt32        entrySize = dataSize + DATA_QUEUE_ENTRY_HEADER_SIZE;
+    IODataQueueEntry*   entry;
+
+    assert( tail <= queueSize );
+
+    //
+    // the head is written by the user space, a corrupted head stops
+    // the producer instead of directing the writes out of the queue
+    //
+    if( head > queueSize ){
+
+        DBG_PRINT_ERROR(( "the consumer's head %u is out of the queue's size %u\n", (unsigned int)head, (unsigned int)queueSize ));
+        return false;
+    }
+
+    if( entrySize < dataSize || entrySize > queueSize )
+        return false;
+
+    //
+    // the code follows IODataQueue::enqueue() as the consumer
+    // side is IODataQueueDequeue() from IOKit.framework
+    //
+    if( tail >= head ){
+
+        if( entrySize <= queueSize - tail ){
+
+            //
+            // there is enough room at the end
+            //
+            entry = (IODataQueueEntry*)( (UInt8*)this->dataQueue->queue + tail );
+            entry->size = dataSize;
+            memcpy( &entry->data, data, dataSize );
+
+            this->Tail = tail + entrySize;
+
+        } else if( head > entrySize ){
+
+            //
+            // wrap around to the beginning, but do not allow the tail to catch up to the head,
+            // the consumer looks for the size at the beginning if there is no room for it at the end
+            //
+            this->dataQueue->queue->size = dataSize;
+
+            if( ( queueSize - tail ) >= DATA_QUEUE_ENTRY_HEADER_SIZE )
+                ((IODataQueueEntry*)( (UInt8*)this->dataQueue->queue + tail ))->size = dataSize;
+
+            memcpy( &this->dataQueue->queue->data, data, dataSize );
+
+            this->Tail = entrySize;
+
+        } else {
+
+            return false;// the queue is full
+        }
+
+    } else {
+
+        //
+        // do not allow the tail to catch up to the head when the queue is full
+        //
+        if( ( head - tail ) > entrySize ){
+
+            entry = (IODataQueueEntry*)( (UInt8*)this->dataQueue->queue + tail );
+            entry->size = dataSize;
+            memcpy( &entry->data, data, dataSize );
+
+            this->Tail = tail + entrySize;
+
+        } else {
+
+            return false;// the queue is full
+        }
+    }
+
+    //
+    // the entry must be visible before the tail, the x86 doesn't reorder stores
+    //
+    DldCompilerBarrier();
+    this->dataQueue->tail = this->Tail;
+
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+Boolean
+DldEventDataQueue::enqueue(
+    void* data,
+    UInt32 dataSize
+    )
+{
+    IOInterruptState  intState;
+    bool              queued;
+    bool              notify = false;
+    bool              armTimer = false;
+
+    assert( this->Lock );
+
+    intState = IOSimpleLockLockDisableInterrupt( this->Lock );
+    {// start of the lock
+
+        UInt32  bytesBefore = this->queuedBytes();
+
+        queued = this->copyToQueue( data, dataSize );
+        if( queued ){
+
+            //
+            // notify only when the watermark is crossed, the consumer
+            // drains the queue till it is empty after a notification
+            //
+            if( bytesBefore < this->WatermarkBytes && this->queuedBytes() >= this->WatermarkBytes ){
+
+                notify = true;
+
+            } else if( !this->TimerArmed ){
+
+                this->TimerArmed = true;
+                armTimer = true;
+            }
+        }// end if( queued )
+
+    }// end of the lock
+    IOSimpleLockUnlockEnableInterrupt( this->Lock, intState );
+
+    if( !queued ){
+
+        OSIncrementAtomic( &this->DroppedEvents );
+        return false;
+    }
+
+    OSIncrementAtomic( &this->EnqueuedEvents );
+
+    if( notify ){
+
+        OSIncrementAtomic( &this->WatermarkNotifications );
+        this->sendDataAvailableNotification();
+    }
+
+    if( armTimer ){
+
+        UInt64  deadline;
+
+        //
+        // the reference is released by the timer routine
+        //
+        this->retain();
+
+        clock_interval_to_deadline( this->MaxLatencyUs, kMicrosecondScale, &deadline );
+        if( thread_call_enter_delayed( this->LatencyTimer, deadline ) ){
+
+            //
+            // the timer was already pending, this is not expected as TimerArmed is checked
+            //
+            assert( !"the latency timer was already pending" );
+            this->release();
+        }
+    }// end if( armTimer )
+
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+void
+DldEventDataQueue::LatencyTimerRoutine(
+    __in thread_call_param_t param0,
+    __in thread_call_param_t param1
+    )
+{
+    DldEventDataQueue*  queue = (DldEventDataQueue*)param0;
+    IOInterruptState    intState;
+    bool                pending;
+
+    assert( queue );
+
+    intState = IOSimpleLockLockDisableInterrupt( queue->Lock );
+    {// start of the lock
+
+        queue->TimerArmed = false;
+        pending = ( 0x0 != queue->queuedBytes() );
+
+    }// end of the lock
+    IOSimpleLockUnlockEnableInterrupt( queue->Lock, intState );
+
+    if( pending ){
+
+        OSIncrementAtomic( &queue->TimerNotifications );
+        queue->sendDataAvailableNotification();
+    }
+
+    //
+    // the reference was taken when the timer was armed
+    //
+    queue->release();
+}
+
+//--------------------------------------------------------------------
+
+void
+DldEventDataQueue::getStatistics(
+    __out SInt32* enqueued,
+    __out SInt32* dropped,
+    __out SInt32* watermarkNotifications,
+    __out SInt32* timerNotifications
+    )
+{
+    *enqueued = this->EnqueuedEvents;
+    *dropped = this->DroppedEvents;
+    *watermarkNotifications = this->WatermarkNotifications;
+    *timerNotifications = this->TimerNotifications;
+}
+
+//--------------------------------------------------------------------
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#ifndef _DLDEVENTDATAQUEUE_H
+#define _DLDEVENTDATAQUEUE_H
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IODataQueue.h>
+#include <IOKit/IODataQueueShared.h>
+#include <IOKit/assert.h>
+#include <kern/thread_call.h>
+#include "DldCommon.h"
+#include "DldEventRingShared.h"
+
+//--------------------------------------------------------------------
+
+//
+// an IODataQueue which coalesces the consumer's wakeups, the native
+// IODataQueue::enqueue() sends a Mach message each time it finds the queue
+// empty, so a consumer which keeps up with the producers is woken up
+// for each event, this queue sends a notification only when the queued
+// data crosses a watermark or when the oldest not notified event has
+// waited for the maximum latency
+//
+class DldEventDataQueue : public IODataQueue {
+
+    OSDeclareDefaultStructors( DldEventDataQueue )
+
+private:
+
+    //
+    // the queue is a single producer structure, the lock serializes
+    // the producers, the notification is sent outside the lock
+    //
+    IOSimpleLock*       Lock;
+
+    //
+    // the producer's tail, the shared header's head and tail are writable
+    // by the user space so the tail is never read back from the header
+    // and the head is checked before it is used, see copyToQueue()
+    //
+    UInt32              Tail;
+
+    //
+    // a notification is sent when the queued data exceeds the watermark
+    //
+    UInt32              WatermarkBytes;
+
+    //
+    // a notification is sent not later than after this interval, in microseconds
+    //
+    UInt32              MaxLatencyUs;
+
+    //
+    // the timer is armed by the first enqueue after a notification,
+    // the queue is retained while the timer is armed
+    //
+    thread_call_t       LatencyTimer;
+    bool                TimerArmed;
+
+    //
+    // the statistics to measure the coalescing efficiency
+    //
+    volatile SInt32     EnqueuedEvents;
+    volatile SInt32     DroppedEvents;
+    volatile SInt32     WatermarkNotifications;
+    volatile SInt32     TimerNotifications;
+
+    //
+    // see DldEventRing::getObjectId()
+    //
+    UInt64              ObjectIdSalt;
+
+    static void LatencyTimerRoutine( __in thread_call_param_t param0, __in thread_call_param_t param1 );
+
+    //
+    // returns the consumer's head or queueSize + 1 if the head is not valid
+    //
+    UInt32 consumerHead();
+
+    //
+    // returns the number of bytes in the queue, must be called with the lock held
+    //
+    UInt32 queuedBytes();
+
+    //
+    // a copy of IODataQueue::enqueue() without the notification
+    //
+    bool copyToQueue( __in void* data, __in UInt32 dataSize );
+
+protected:
+
+    virtual void free();
+
+public:
+
+    static DldEventDataQueue* withCapacity( __in UInt32 size,
+                                            __in UInt32 watermarkBytes,
+                                            __in UInt32 maxLatencyUs );
+
+    virtual Boolean enqueue( void* data, UInt32 dataSize );
+
+    UInt64 getObjectId( __in const void* object )
+    {
+        return ( (UInt64)(vm_address_t)object ^ this->ObjectIdSalt ) * 0x9E3779B97F4A7C15ULL;
+    };
+
+    void getStatistics( __out SInt32* enqueued,
+                        __out SInt32* dropped,
+                        __out SInt32* watermarkNotifications,
+                        __out SInt32* timerNotifications );
+};
+
+//--------------------------------------------------------------------
+
+extern DldEventDataQueue*   gEventDataQueue;
+
+//--------------------------------------------------------------------
+
+#endif//_DLDEVENTDATAQUEUE_H
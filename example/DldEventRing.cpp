@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include "DldEventRing.h"
+#include "DldEventChannels.h"
+
+extern "C" {
+    extern int cpu_number( void );
+    extern boolean_t ml_set_interrupts_enabled( boolean_t enable );
+    extern int ml_get_max_cpus( void );
+    extern long random( void );
+}
+
+//--------------------------------------------------------------------
+
+DldEventRing*   gEventRing = NULL;
+
+volatile SInt32  DldEventRing::sHookTraceUsers = 0x0;
+
+//--------------------------------------------------------------------
+
+#define super OSObject
+
+OSDefineMetaClassAndStructors( DldEventRing, OSObject )
+
+//--------------------------------------------------------------------
+
+void
+DldEventRing::free()
+{
+    if( this->Memory )
+        this->Memory->release();
+
+    super::free();
+}
+
+//--------------------------------------------------------------------
+
+DldEventRing*
+DldEventRing::withRecordsPerCpu(
+    __in UInt32 recordsPerCpu
+    )
+{
+    DldEventRing*   ring;
+    UInt32          roundedRecords;
+    UInt32          cpusNumber;
+    UInt64          size;
+
+    assert( preemption_enabled() );
+    assert( recordsPerCpu > 0x0 && recordsPerCpu <= 0x100000 );
+
+    roundedRecords = 0x1;
+    while( roundedRecords < recordsPerCpu )
+        roundedRecords = roundedRecords << 0x1;
+
+    cpusNumber = (UInt32)ml_get_max_cpus();
+    assert( cpusNumber > 0x0 );
+
+    size = DLD_EVENT_RING_SIZE( cpusNumber, roundedRecords );
+
+    ring = new DldEventRing();
+    assert( ring );
+    if( !ring )
+        return NULL;
+
+    if( !ring->init() ){
+
+        ring->release();
+        return NULL;
+    }
+
+    //
+    // the memory is wired and can be mapped in a user task
+    //
+    ring->Memory = IOBufferMemoryDescriptor::withOptions( kIODirectionInOut | kIOMemoryKernelUserShared,
+                                                          (vm_size_t)size,
+                                                          PAGE_SIZE );
+    assert( ring->Memory );
+    if( !ring->Memory ){
+
+        DBG_PRINT_ERROR(( "IOBufferMemoryDescriptor::withOptions( %llu ) failed\n", size ));
+        ring->release();
+        return NULL;
+    }
+
+    ring->Header = (DldEventRingHeader*)ring->Memory->getBytesNoCopy();
+    assert( ring->Header );
+
+    bzero( ring->Header, (vm_size_t)size );
+
+    ring->Header->CpusNumber = cpusNumber;
+    ring->Header->RecordsPerCpu = roundedRecords;
+    ring->Header->RecordSize = sizeof( DldEventRecord );
+    ring->Header->TotalSize = size;
+    ring->Header->Version = DLD_EVENT_RING_VERSION;
+
+    //
+    // the magic is the last as the reader checks it first
+    //
+    DldCompilerBarrier();
+    ring->Header->Magic = DLD_EVENT_RING_MAGIC;
+
+    ring->CpusNumber = cpusNumber;
+    ring->RecordsPerCpu = roundedRecords;
+    ring->Mask = roundedRecords - 0x1;
+    ring->CpuRings = DLD_EVENT_RING_CPU( ring->Header, 0x0 );
+    ring->Records = DLD_EVENT_RING_RECORDS( ring->Header, 0x0 );
+    ring->ObjectIdSalt = ( (UInt64)random() << 32 ) | (UInt64)random();
+
+    return ring;
+}
+
+//--------------------------------------------------------------------
+
+bool
+DldEventRing::write(
+    __in const DldEventRecord* record
+    )
+{
+    DldEventRingCpu*  cpuRing;
+    DldEventRecord*   records;
+    UInt64            head;
+    unsigned int      cpu;
+    boolean_t         interruptsState;
+    bool              written = false;
+
+    //
+    // the interrupts are disabled so this is the only producer for the CPU's ring
+    //
+    interruptsState = ml_set_interrupts_enabled( FALSE );
+    {// start of the single producer section
+
+        cpu = cpu_number();
+        assert( cpu < this->CpusNumber );
+
+        if( cpu < this->CpusNumber ){
+
+            cpuRing = &this->CpuRings[ cpu ];
+            records = &this->Records[ (vm_size_t)cpu*this->RecordsPerCpu ];
+            head = cpuRing->Head;
+
+            //
+            // the Head and Tail are in the memory writable by the user space so
+            // they are used only to estimate the free space, the record's index
+            // is always masked to the ring's size
+            //
+            if( ( head - cpuRing->Tail ) < this->RecordsPerCpu ){
+
+                records[ head & this->Mask ] = *record;
+
+                //
+                // the record must be visible before the Head, the x86 doesn't reorder stores
+                //
+                DldCompilerBarrier();
+                cpuRing->Head = head + 0x1;
+                written = true;
+
+            } else {
+
+                cpuRing->Dropped = cpuRing->Dropped + 0x1;
+            }
+
+        }// end if( cpu < this->CpusNumber )
+
+    }// end of the single producer section
+    ml_set_interrupts_enabled( interruptsState );
+
+    return written;
+}
+
+//--------------------------------------------------------------------
+
+void
+DldEventRing::HookTraceCallback(
+    __in DldHookTraceEvent event,
+    __in DldHookerCommonClass* hooker,
+    __in const OSObject* object,
+    __in unsigned int indx
+    )
+{
+    DldEventRing*   ring;
+    DldEventRecord  record;
+    boolean_t       interruptsState;
+
+    if( NULL == gEventRing )
+        return;
+
+    bzero( &record, sizeof( record ) );
+
+    clock_get_uptime( &record.Timestamp );
+
+    switch( event ){
+
+        case DldHookTraceEventCall:
+            record.Type = DLD_EVENT_TYPE_CALL;
+            break;
+        case DldHookTraceEventHook:
+            record.Type = DLD_EVENT_TYPE_HOOK;
+            break;
+        case DldHookTraceEventUnHook:
+            record.Type = DLD_EVENT_TYPE_UNHOOK;
+            break;
+        default:
+            assert( !"an unknown hook trace event" );
+            return;
+    }
+
+    record.Pid = proc_selfpid();
+    record.Hooker = hooker->GetHookerId();
+
+    //
+    // a replayer learns the hookers' types from the hook and unhook records
+    //
+    if( DldHookTraceEventCall == event )
+        record.HookIndex = indx;
+    else
+        record.HookIndex = DLD_EVENT_HOOKER_INFO( hooker->GetHookType(), hooker->GetInheritanceDepth() );
+
+    //
+    // the ring is released after the readers have left the section, see HookExampleStop()
+    //
+    interruptsState = DldEventChannels::ReadBegin();
+    {// start of the channels' section
+
+        ring = gEventRing;
+        if( ring ){
+
+            record.Object = ring->getObjectId( object );
+            record.MetaClass = ring->getObjectId( object->getMetaClass() );
+            record.Thread = ring->getObjectId( current_thread() );
+
+            ring->write( &record );
+        }
+
+    }// end of the channels' section
+    DldEventChannels::ReadEnd( interruptsState );
+}
+
+//--------------------------------------------------------------------
+
+void
+DldEventRing::setHookTrace(
+    __in bool enable
+    )
+{
+    SInt32  users;
+
+    if( enable )
+        OSIncrementAtomic( &DldEventRing::sHookTraceUsers );
+    else
+        OSDecrementAtomic( &DldEventRing::sHookTraceUsers );
+
+    assert( DldEventRing::sHookTraceUsers >= 0x0 );
+
+    //
+    // the callback is set after the counter has been changed so a concurrent
+    // call might set a value for a stale counter, the value is set again
+    // until the counter has not changed while the value was being set, the
+    // last writer has always seen the current counter
+    //
+    do{
+
+        users = DldEventRing::sHookTraceUsers;
+        gHookTraceCallback = ( users > 0x0 ) ? DldEventRing::HookTraceCallback : NULL;
+        DldMemoryBarrier();
+
+    } while( users != DldEventRing::sHookTraceUsers );
+}
+
+//--------------------------------------------------------------------
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#ifndef _DLDEVENTRING_H
+#define _DLDEVENTRING_H
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
+#include <libkern/c++/OSContainers.h>
+#include <IOKit/assert.h>
+#include "DldCommon.h"
+#include "DldEventRingShared.h"
+#include "DldHookerCommonClass.h"
+
+//--------------------------------------------------------------------
+
+//
+// a kernel side of the event ring, the memory is shared with a user space
+// reader through DldEventRingUserClient, the reader polls the rings
+// without a system call per event
+//
+class DldEventRing : public OSObject {
+
+    OSDeclareDefaultStructors( DldEventRing )
+
+private:
+
+    IOBufferMemoryDescriptor*   Memory;
+    DldEventRingHeader*         Header;
+
+    //
+    // the private copies of the layout, the shared memory is writable
+    // by the reader so the kernel never uses the values from the header
+    //
+    UInt32                      CpusNumber;
+    UInt32                      RecordsPerCpu;
+    UInt32                      Mask;
+    DldEventRingCpu*            CpuRings;
+    DldEventRecord*             Records;
+
+    //
+    // used to convert object addresses to opaque identifiers
+    //
+    UInt64                      ObjectIdSalt;
+
+    //
+    // the number of the setHookTrace( true ) calls not matched by setHookTrace( false )
+    //
+    static volatile SInt32      sHookTraceUsers;
+
+    //
+    // a gHookTraceCallback routine, writes the records to gEventRing
+    //
+    static void HookTraceCallback( __in DldHookTraceEvent event,
+                                   __in DldHookerCommonClass* hooker,
+                                   __in const OSObject* object,
+                                   __in unsigned int indx );
+
+protected:
+
+    virtual void free();
+
+public:
+
+    //
+    // the records number is rounded up to a power of two
+    //
+    static DldEventRing* withRecordsPerCpu( __in UInt32 recordsPerCpu );
+
+    //
+    // can be called at any IRQL, returns false if the record has been dropped
+    //
+    bool write( __in const DldEventRecord* record );
+
+    UInt64 getObjectId( __in const void* object )
+    {
+        return ( (UInt64)(vm_address_t)object ^ this->ObjectIdSalt ) * 0x9E3779B97F4A7C15ULL;
+    };
+
+    //
+    // starts or stops capturing the hooked calls and the hook and unhook events
+    // in gEventRing, the capture is system wide as gHookTraceCallback is global
+    // so the calls are counted, the capture stops when every caller that
+    // started it has stopped it
+    //
+    static void setHookTrace( __in bool enable );
+
+    //
+    // the returned descriptor is not referenced
+    //
+    IOMemoryDescriptor* getMemoryDescriptor(){ return this->Memory; };
+};
+
+//--------------------------------------------------------------------
+
+extern DldEventRing*   gEventRing;
+
+//--------------------------------------------------------------------
+
+#endif//_DLDEVENTRING_H
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#ifndef _DLDEVENTRINGSHARED_H
+#define _DLDEVENTRINGSHARED_H
+
+//
+// the layout of the event ring shared by the kernel and a user space reader,
+// the file must be includable in user space and must not depend on IOKit
+//
+
+#include <stdint.h>
+
+//--------------------------------------------------------------------
+
+#define DLD_EVENT_RING_MAGIC        (0x52444c44)// "DLDR"
+#define DLD_EVENT_RING_VERSION      (0x3)
+
+//
+// the service which creates DldEventRingUserClient for IOServiceOpen()
+// with the DLD_EVENT_RING_USER_CLIENT_TYPE type
+//
+#define DLD_EVENT_RING_SERVICE_CLASS        "DldHookExampleService"
+#define DLD_EVENT_RING_USER_CLIENT_TYPE     (0x0)
+
+//
+// types for IOConnectMapMemory64, the data queue is an IODataQueueMemory
+// structure which is read by IODataQueueDequeue() after a notification
+// sent to the port registered by IOConnectSetNotificationPort()
+//
+#define DLD_EVENT_RING_MEMORY_TYPE          (0x0)
+#define DLD_EVENT_DATA_QUEUE_MEMORY_TYPE    (0x1)
+
+#define DLD_EVENT_RING_CACHE_LINE   (64)
+
+//
+// a selector for IOConnectCallScalarMethod, the scalar input is 0 or 1,
+// enables or disables DLD_EVENT_TYPE_CALL, DLD_EVENT_TYPE_HOOK and
+// DLD_EVENT_TYPE_UNHOOK records which capture the hooker's workload
+//
+#define DLD_EVENT_RING_METHOD_SET_HOOK_TRACE    (0x0)
+
+//
+// a selector for IOConnectCallStructMethod, returns DldMemoryUsageReport
+// followed by DldMemoryUsageHooker structures, see DldMemoryUsageShared.h
+//
+#define DLD_EVENT_RING_METHOD_GET_MEMORY_USAGE  (0x1)
+
+//
+// a selector for IOConnectCallStructMethod, returns DldHookStatisticsReport,
+// see DldHookStatisticsShared.h, fails with kIOReturnUnsupported if the
+// driver has been built without DLD_HOOK_STATS
+//
+#define DLD_EVENT_RING_METHOD_GET_HOOK_STATISTICS  (0x2)
+
+//
+// the record types
+//
+#define DLD_EVENT_TYPE_EXTERNAL_METHOD  (0x0)// an IOUserClient::externalMethod call with its duration and result
+#define DLD_EVENT_TYPE_CALL             (0x1)// a hooked function call, the hook index is the hooker's internal one
+#define DLD_EVENT_TYPE_HOOK             (0x2)// an object has been hooked
+#define DLD_EVENT_TYPE_UNHOOK           (0x3)// an object has been unhooked
+
+//
+// the HookIndex of the DLD_EVENT_TYPE_HOOK and DLD_EVENT_TYPE_UNHOOK records,
+// the hook type is DldHookType, i.e. 0x1 for an object hook and 0x2 for
+// a vtable hook, the depth is the hooked class's inheritance depth
+//
+#define DLD_EVENT_HOOKER_INFO( _TYPE_, _DEPTH_ )  ( ( (uint32_t)(_TYPE_) << 16 ) | ( (uint32_t)(_DEPTH_) & 0xFFFF ) )
+#define DLD_EVENT_HOOKER_TYPE( _INFO_ )           ( (uint32_t)(_INFO_) >> 16 )
+#define DLD_EVENT_HOOKER_DEPTH( _INFO_ )          ( (uint32_t)(_INFO_) & 0xFFFF )
+
+//--------------------------------------------------------------------
+
+//
+// a hook event, the object, meta class and thread are opaque identifiers
+// which are stable for an object's lifetime but are not kernel addresses,
+// the record's size is a cache line, a trace is a sequence of records
+// which can be saved as is and replayed after sorting by the timestamp,
+// see host/benchmarks/DldTraceReplayBenchmark.cpp
+//
+typedef struct _DldEventRecord{
+
+    //
+    // in absolute time units
+    //
+    uint64_t    Timestamp;
+    uint64_t    Duration;
+
+    uint64_t    Object;
+    uint64_t    MetaClass;
+    uint64_t    Thread;
+
+    uint32_t    Type;
+    uint32_t    HookIndex;
+    uint32_t    Selector;
+    int32_t     Result;
+    int32_t     Pid;
+
+    //
+    // the hooker's identifier for the DLD_EVENT_TYPE_CALL, DLD_EVENT_TYPE_HOOK
+    // and DLD_EVENT_TYPE_UNHOOK records, the identifiers are small numbers
+    // assigned to the hookers in the order of their creation
+    //
+    uint32_t    Hooker;
+
+} DldEventRecord;
+
+//
+// a ring per CPU, there is a single producer for each ring as a producer
+// writes with interrupts disabled, the Head and Tail are free running
+// counters, a ring is empty if Head == Tail and full if Head - Tail == RecordsPerCpu,
+// the producer drops the records if the ring is full
+//
+typedef struct _DldEventRingCpu{
+
+    //
+    // written only by the kernel
+    //
+    volatile uint64_t   Head;
+    volatile uint64_t   Dropped;
+    uint8_t             Reserved1[ DLD_EVENT_RING_CACHE_LINE - 2*sizeof( uint64_t ) ];
+
+    //
+    // written only by the reader, the kernel never trusts this value
+    // for anything but a free space estimation
+    //
+    volatile uint64_t   Tail;
+    uint8_t             Reserved2[ DLD_EVENT_RING_CACHE_LINE - sizeof( uint64_t ) ];
+
+} DldEventRingCpu;
+
+//
+// the memory layout is
+//   DldEventRingHeader
+//   DldEventRingCpu[ CpusNumber ]
+//   DldEventRecord[ CpusNumber ][ RecordsPerCpu ]
+//
+typedef struct _DldEventRingHeader{
+
+    uint32_t    Magic;
+    uint32_t    Version;
+    uint32_t    CpusNumber;
+    uint32_t    RecordsPerCpu;// a power of two
+    uint32_t    RecordSize;
+    uint32_t    Reserved;
+    uint64_t    TotalSize;
+
+    uint8_t     Padding[ DLD_EVENT_RING_CACHE_LINE - 6*sizeof( uint32_t ) - sizeof( uint64_t ) ];
+
+} DldEventRingHeader;
+
+//--------------------------------------------------------------------
+
+#define DLD_EVENT_RING_CPU( _HEADER_, _CPU_ ) \
+    ( (DldEventRingCpu*)( (uint8_t*)(_HEADER_) + sizeof( DldEventRingHeader ) ) + (_CPU_) )
+
+#define DLD_EVENT_RING_RECORDS( _HEADER_, _CPU_ ) \
+    ( (DldEventRecord*)( (uint8_t*)DLD_EVENT_RING_CPU( (_HEADER_), (_HEADER_)->CpusNumber ) ) + \
+      (uint64_t)(_CPU_)*(_HEADER_)->RecordsPerCpu )
+
+#define DLD_EVENT_RING_SIZE( _CPUS_, _RECORDS_PER_CPU_ ) \
+    ( sizeof( DldEventRingHeader ) + \
+      (uint64_t)(_CPUS_)*sizeof( DldEventRingCpu ) + \
+      (uint64_t)(_CPUS_)*(_RECORDS_PER_CPU_)*sizeof( DldEventRecord ) )
+
+//--------------------------------------------------------------------
+
+#endif//_DLDEVENTRINGSHARED_H
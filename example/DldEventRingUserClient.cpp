@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include "DldEventRingUserClient.h"
+
+//--------------------------------------------------------------------
+
+#define super IOUserClient
+
+OSDefineMetaClassAndStructors( DldEventRingUserClient, IOUserClient )
+
+//--------------------------------------------------------------------
+
+bool
+DldEventRingUserClient::initWithTask(
+    task_t owningTask,
+    void * securityID,
+    UInt32 type,
+    OSDictionary * properties
+    )
+{
+    //
+    // the events disclose the activity of all processes so only the administrator can read them
+    //
+    if( kIOReturnSuccess != IOUserClient::clientHasPrivilege( securityID, kIOClientPrivilegeAdministrator ) ){
+
+        DBG_PRINT_ERROR(( "a non privileged process tried to open the event ring\n" ));
+        return false;
+    }
+
+    if( !super::initWithTask( owningTask, securityID, type, properties ) )
+        return false;
+
+    this->ClientTask = owningTask;
+
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+bool
+DldEventRingUserClient::start(
+    IOService * provider
+    )
+{
+    if( NULL == gEventRing && NULL == gEventDataQueue ){
+
+        DBG_PRINT_ERROR(( "neither the event ring nor the data queue has been created\n" ));
+        return false;
+    }
+
+    if( !super::start( provider ) )
+        return false;
+
+    this->Ring = gEventRing;
+    if( this->Ring )
+        this->Ring->retain();
+
+    this->DataQueue = gEventDataQueue;
+    if( this->DataQueue )
+        this->DataQueue->retain();
+
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+void
+DldEventRingUserClient::free()
+{
+    if( this->Ring )
+        this->Ring->release();
+
+    if( this->DataQueue )
+        this->DataQueue->release();
+
+    super::free();
+}
+
+//--------------------------------------------------------------------
+
+IOReturn
+DldEventRingUserClient::clientClose( void )
+{
+    if( OSCompareAndSwap( 0x1, 0x0, &this->HookTraceEnabled ) )
+        DldEventRing::setHookTrace( false );
+
+    this->terminate();
+    return kIOReturnSuccess;
+}
+
+//--------------------------------------------------------------------
+
+IOReturn
+DldEventRingUserClient::clientMemoryForType(
+    UInt32 type,
+    IOOptionBits * options,
+    IOMemoryDescriptor ** memory
+    )
+{
+    IOMemoryDescriptor*  sharedMemory;
+
+    if( DLD_EVENT_RING_MEMORY_TYPE == type && NULL != this->Ring ){
+
+        sharedMemory = this->Ring->getMemoryDescriptor();
+        assert( sharedMemory );
+
+        //
+        // the caller releases the returned descriptor after mapping it
+        //
+        sharedMemory->retain();
+
+    } else if( DLD_EVENT_DATA_QUEUE_MEMORY_TYPE == type && NULL != this->DataQueue ){
+
+        //
+        // IODataQueue::getMemoryDescriptor() returns a new descriptor
+        //
+        sharedMemory = this->DataQueue->getMemoryDescriptor();
+        if( NULL == sharedMemory )
+            return kIOReturnNoMemory;
+
+    } else {
+
+        return kIOReturnBadArgument;
+    }
+
+    //
+    // the reader advances the tails or the queue's head so the mapping is writable
+    //
+    *options = 0x0;
+    *memory = sharedMemory;
+
+    return kIOReturnSuccess;
+}
+
+//--------------------------------------------------------------------
+
+IOReturn
+DldEventRingUserClient::registerNotificationPort(
+    mach_port_t port,
+    UInt32 type,
+    UInt32 refCon
+    )
+{
+    if( DLD_EVENT_DATA_QUEUE_MEMORY_TYPE != type || NULL == this->DataQueue )
+        return kIOReturnBadArgument;
+
+    //
+    // MACH_PORT_NULL stops the notifications
+    //
+    this->DataQueue->setNotificationPort( port );
+
+    return kIOReturnSuccess;
+}
+
+//--------------------------------------------------------------------
+
+IOReturn
+DldEventRingUserClient::externalMethod(
+    uint32_t selector,
+    IOExternalMethodArguments * arguments,
+    IOExternalMethodDispatch * dispatch,
+    OSObject * target,
+    void * reference
+    )
+{
+    switch( selector ){
+
+        case DLD_EVENT_RING_METHOD_SET_HOOK_TRACE:
+
+            if( 0x1 != arguments->scalarInputCount || 0x0 != arguments->scalarOutputCount )
+                return kIOReturnBadArgument;
+
+            //
+            // the trace is written only to the ring
+            //
+            if( NULL == this->Ring )
+                return kIOReturnNotReady;
+
+            {
+                UInt32  enable = ( 0x0 != arguments->scalarInput[ 0 ] ) ? 0x1 : 0x0;
+
+                //
+                // the trace users are counted by DldEventRing so a client is counted
+                // once, the calls from the client's threads are not serialized
+                //
+                if( OSCompareAndSwap( enable ^ 0x1, enable, &this->HookTraceEnabled ) )
+                    DldEventRing::setHookTrace( 0x0 != enable );
+            }
+            return kIOReturnSuccess;
+
+        case DLD_EVENT_RING_METHOD_GET_MEMORY_USAGE:
+            {
+                DldMemoryUsageReport*  report = (DldMemoryUsageReport*)arguments->structureOutput;
+
+                //
+                // only the inline structure output is supported, it is enough for
+                // a few dozens of hooking classes, TotalHookersNumber tells the caller
+                // that the report has been truncated
+                //
+                if( NULL == gHookEngine || NULL == report || arguments->structureOutputSize < sizeof( *report ) )
+                    return kIOReturnBadArgument;
+
+                gHookEngine->GetMemoryUsage( report, arguments->structureOutputSize );
+                arguments->structureOutputSize = (uint32_t)DLD_MEMORY_USAGE_REPORT_SIZE( report->HookersNumber );
+            }
+            return kIOReturnSuccess;
+
+        case DLD_EVENT_RING_METHOD_GET_HOOK_STATISTICS:
+            {
+                DldHookStatisticsReport*  report = (DldHookStatisticsReport*)arguments->structureOutput;
+
+                if( NULL == gHookEngine || NULL == report || arguments->structureOutputSize < sizeof( *report ) )
+                    return kIOReturnBadArgument;
+
+                arguments->structureOutputSize = sizeof( *report );
+                return gHookEngine->GetHookStatistics( report );
+            }
+
+        default:
+            return kIOReturnBadArgument;
+    }
+}
+
+//--------------------------------------------------------------------
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#ifndef _DLDEVENTRINGUSERCLIENT_H
+#define _DLDEVENTRINGUSERCLIENT_H
+
+#include <IOKit/IOService.h>
+#include <IOKit/IOUserClient.h>
+#include <IOKit/assert.h>
+#include "DldCommon.h"
+#include "DldEventRing.h"
+#include "DldEventDataQueue.h"
+#include "DldIOKitHookEngine.h"
+
+//--------------------------------------------------------------------
+
+//
+// a user client which maps the event ring in a reader's task, the client
+// is created by a hosting driver's newUserClient(), see DldHookExampleService, the reader calls
+// IOConnectMapMemory64() with DLD_EVENT_RING_MEMORY_TYPE and then
+// polls the rings by the functions from DldEventRingReader.h, a reader
+// which doesn't poll maps DLD_EVENT_DATA_QUEUE_MEMORY_TYPE, registers
+// a port by IOConnectSetNotificationPort() and waits for notifications
+//
+class DldEventRingUserClient : public IOUserClient {
+
+    OSDeclareDefaultStructors( DldEventRingUserClient )
+
+private:
+
+    task_t              ClientTask;
+    DldEventRing*       Ring;
+    DldEventDataQueue*  DataQueue;
+
+    //
+    // 0x1 if the client has enabled the trace, the trace enabled by
+    // the client is disabled when the client is closed
+    //
+    volatile UInt32     HookTraceEnabled;
+
+protected:
+
+    virtual void free();
+
+public:
+
+    virtual bool initWithTask( task_t owningTask, void * securityID, UInt32 type, OSDictionary * properties );
+
+    virtual bool start( IOService * provider );
+
+    virtual IOReturn clientClose( void );
+
+    virtual IOReturn clientMemoryForType( UInt32 type,
+                                          IOOptionBits * options,
+                                          IOMemoryDescriptor ** memory );
+
+    virtual IOReturn registerNotificationPort( mach_port_t port, UInt32 type, UInt32 refCon );
+
+    virtual IOReturn externalMethod( uint32_t selector, IOExternalMethodArguments * arguments,
+                                     IOExternalMethodDispatch * dispatch, OSObject * target, void * reference );
+};
+
+//--------------------------------------------------------------------
+
+#endif//_DLDEVENTRINGUSERCLIENT_H
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include "DldHookExampleService.h"
+#include "DldEventRingUserClient.h"
+#include "HookExample.h"
+
+//--------------------------------------------------------------------
+
+#define super IOService
+
+OSDefineMetaClassAndStructors( DldHookExampleService, IOService )
+
+//--------------------------------------------------------------------
+
+bool
+DldHookExampleService::start(
+    IOService * provider
+    )
+{
+    if( !super::start( provider ) )
+        return false;
+
+    if( !HookExample() ){
+
+        DBG_PRINT_ERROR(( "HookExample() failed\n" ));
+        super::stop( provider );
+        return false;
+    }
+
+    //
+    // the readers find the service by the class name
+    //
+    this->registerService();
+
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+void
+DldHookExampleService::stop(
+    IOService * provider
+    )
+{
+    HookExampleStop();
+
+    super::stop( provider );
+}
+
+//--------------------------------------------------------------------
+
+IOReturn
+DldHookExampleService::newUserClient(
+    task_t owningTask,
+    void * securityID,
+    UInt32 type,
+    IOUserClient ** handler
+    )
+{
+    DldEventRingUserClient*  client;
+
+    if( DLD_EVENT_RING_USER_CLIENT_TYPE != type )
+        return kIOReturnBadArgument;
+
+    client = new DldEventRingUserClient();
+    assert( client );
+    if( !client )
+        return kIOReturnNoMemory;
+
+    //
+    // initWithTask() refuses a non privileged process
+    //
+    if( !client->initWithTask( owningTask, securityID, type, NULL ) ){
+
+        client->release();
+        return kIOReturnNotPermitted;
+    }
+
+    if( !client->attach( this ) ){
+
+        client->release();
+        return kIOReturnError;
+    }
+
+    if( !client->start( this ) ){
+
+        client->detach( this );
+        client->release();
+        return kIOReturnNotReady;
+    }
+
+    //
+    // the caller consumes the reference
+    //
+    *handler = client;
+
+    return kIOReturnSuccess;
+}
+
+//--------------------------------------------------------------------
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#ifndef _DLDHOOKEXAMPLESERVICE_H
+#define _DLDHOOKEXAMPLESERVICE_H
+
+#include <IOKit/IOService.h>
+#include <IOKit/IOUserClient.h>
+#include <IOKit/assert.h>
+#include "DldCommon.h"
+#include "DldEventRingShared.h"
+
+//--------------------------------------------------------------------
+
+//
+// the example's driver, matched on IOResources by the kext's personality,
+// starts hooking and is the provider for DldEventRingUserClient, a reader
+// finds the service by DLD_EVENT_RING_SERVICE_CLASS and opens the client
+// by IOServiceOpen() with DLD_EVENT_RING_USER_CLIENT_TYPE
+//
+class DldHookExampleService : public IOService {
+
+    OSDeclareDefaultStructors( DldHookExampleService )
+
+public:
+
+    virtual bool start( IOService * provider );
+
+    virtual void stop( IOService * provider );
+
+    virtual IOReturn newUserClient( task_t owningTask, void * securityID,
+                                    UInt32 type, IOUserClient ** handler );
+};
+
+//--------------------------------------------------------------------
+
+#endif//_DLDHOOKEXAMPLESERVICE_H
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#ifndef _DLDHOOKSTATISTICSSHARED_H
+#define _DLDHOOKSTATISTICSSHARED_H
+
+//
+// the hooked objects table statistics returned to a user space tool when
+// the driver is built with DLD_HOOK_STATS, the file must be includable
+// in user space and must not depend on IOKit
+//
+
+#include <stdint.h>
+
+//--------------------------------------------------------------------
+
+#define DLD_HOOK_STATISTICS_VERSION             (0x1)
+
+//
+// a bucket N counts the exclusive lock hold times in the [2^N, 2^(N+1)) nanoseconds range
+//
+#define DLD_HOOK_STATISTICS_HISTOGRAM_BUCKETS   (32)
+
+//--------------------------------------------------------------------
+
+//
+// the times are in nanoseconds, the exclusive lock is taken by hooking
+// and unhooking, the shared lock and the lock free reads by the hooked calls
+//
+typedef struct _DldHookStatisticsReport{
+
+    uint32_t    Version;
+    uint32_t    Reserved;
+
+    uint64_t    ExclusiveLocks;
+    uint64_t    ExclusiveWaitTime;
+    uint64_t    ExclusiveHoldTime;
+    uint64_t    MaxExclusiveHoldTime;
+    uint64_t    ExclusiveHoldTimeHistogram[ DLD_HOOK_STATISTICS_HISTOGRAM_BUCKETS ];
+
+    uint64_t    SharedLocks;
+    uint64_t    SharedWaitTime;
+    uint64_t    MaxSharedWaitTime;
+
+    uint64_t    LockFreeReads;
+    uint64_t    LockFreeReadsFailed;
+
+    uint32_t    Entries;
+    uint32_t    PeakEntries;
+
+} DldHookStatisticsReport;
+
+//--------------------------------------------------------------------
+
+#endif//_DLDHOOKSTATISTICSSHARED_H
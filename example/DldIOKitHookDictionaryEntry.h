@@ -19,6 +19,8 @@
 typedef IOReturn ( *DldStaticClassHookFunction )( __inout OSObject* ObjectTooHook, __in DldHookType type );
 typedef IOReturn ( *DldStaticClassUnHookFunction )( __inout OSObject* ObjectTooHook, __in DldHookType type, __in DldInheritanceDepth Depth );
 
+typedef bool (*DldStaticClassMemoryUsageFunction)( __out DldHookerMemoryUsage* usage );
+
 typedef bool (*DldObjectFirstPublishCallback)( IOService * newService );
 typedef bool (*DldObjectTerminatedCallback)( IOService * newService ); 
 
@@ -28,6 +30,7 @@ typedef struct _DldHookDictionaryEntryData{
     __in     const char*                         IOKitClassName;
     __in     DldStaticClassHookFunction          HookFunction;
     __in     DldStaticClassUnHookFunction        UnHookFunction;
+    __in     DldStaticClassMemoryUsageFunction   MemoryUsageFunction;
     __in     DldHookType                         HookType;
     __in     DldInheritanceDepth                 Depth;
     
@@ -96,8 +99,14 @@ public:
     
     DldStaticClassUnHookFunction    getUnHookFunction(){ return this->HookData.UnHookFunction; };
     
+    DldStaticClassMemoryUsageFunction    getMemoryUsageFunction(){ return this->HookData.MemoryUsageFunction; };
+    
     DldHookType    getHookType(){ return this->HookData.HookType; };
     
+    DldInheritanceDepth    getDepth(){ return this->HookData.Depth; };
+    
+    const char*    getIOKitClassNameNoCopy(){ return this->IOKitClassName->getCStringNoCopy(); };
+    
     DldObjectFirstPublishCallback getFirstPublishCallback(){ return this->HookData.ObjectFirstPublishCallback; };
     
     DldObjectTerminatedCallback getTerminationCallback(){ return this->HookData.ObjectTerminatedCallback; };
@@ -13,13 +13,57 @@ OSDefineMetaClassAndStructors( DldIOKitHookEngine, OSObject )
 
 //--------------------------------------------------------------------
 
+//
+// the limits for the initial size of the hooked objects table
+//
+#define DLD_HOOKED_OBJECTS_TABLE_MIN_SIZE    (100)
+#define DLD_HOOKED_OBJECTS_TABLE_MAX_SIZE    (0x10000)
+
+//--------------------------------------------------------------------
+
+//
+// returns the number of entries in the IOService plane, the hooked
+// objects are mostly services and user clients so their number
+// follows the plane population, as the bucket pages are allocated
+// on demand an overestimated hint costs only the page directory
+//
+unsigned int
+DldIOKitHookEngine::GetHookedObjectsTableSizeHint()
+{
+    IORegistryIterator*  iterator;
+    unsigned int         entries = 0x0;
+    
+    iterator = IORegistryIterator::iterateOver( gIOServicePlane, kIORegistryIterateRecursively );
+    assert( iterator );
+    if( !iterator )
+        return DLD_HOOKED_OBJECTS_TABLE_MIN_SIZE;
+    
+    //
+    // the iteration stops if the registry is changed, the count is a hint so it is not restarted
+    //
+    while( iterator->getNextObject() )
+        ++entries;
+    
+    iterator->release();
+    
+    if( entries < DLD_HOOKED_OBJECTS_TABLE_MIN_SIZE )
+        return DLD_HOOKED_OBJECTS_TABLE_MIN_SIZE;
+    
+    if( entries > DLD_HOOKED_OBJECTS_TABLE_MAX_SIZE )
+        return DLD_HOOKED_OBJECTS_TABLE_MAX_SIZE;
+    
+    return entries;
+}
+
+//--------------------------------------------------------------------
+
 bool
 DldIOKitHookEngine::init()
 {
     if( !super::init() )
         return false;
     
-    if( !DldHookedObjectsHashTable::CreateStaticTableWithSize( 100, false ) )
+    if( !DldHookedObjectsHashTable::CreateStaticTableWithSize( GetHookedObjectsTableSizeHint(), false ) )
         return false;
     
     return true;
@@ -717,3 +761,141 @@ DldIOKitHookEngine::CallObjectTerminatedCallback(
 }
 
 //--------------------------------------------------------------------
+
+void
+DldIOKitHookEngine::AddDictionaryMemoryUsage(
+    __in OSDictionary* Dictionary,
+    __inout DldMemoryUsageReport* Report,
+    __in vm_size_t ReportSize
+    )
+{
+    OSCollectionIterator*  iterator;
+    OSObject*              key;
+    
+    assert( Dictionary );
+    
+    iterator = OSCollectionIterator::withCollection( Dictionary );
+    assert( iterator );
+    if( NULL == iterator )
+        return;
+    
+    while( NULL != ( key = iterator->getNextObject() ) ){
+        
+        DldIOKitHookDictionaryEntry*   pEntry;
+        DldHookerMemoryUsage           usage;
+        
+        pEntry = OSDynamicCast( DldIOKitHookDictionaryEntry, Dictionary->getObject( (const OSSymbol*)key ) );
+        assert( pEntry );
+        if( NULL == pEntry || NULL == pEntry->getMemoryUsageFunction() )
+            continue;
+        
+        if( !( pEntry->getMemoryUsageFunction() )( &usage ) )
+            continue;
+        
+        Report->TotalHookersNumber += 0x1;
+        Report->TotalBytes += usage.EntriesBytes + usage.VtableFunctionsInfoBytes +
+                              usage.VtableBufferBytes + usage.HookerInstanceBytes;
+        
+        if( DLD_MEMORY_USAGE_REPORT_SIZE( Report->HookersNumber + 0x1 ) > ReportSize )
+            continue;
+        
+        DldMemoryUsageHooker*  hooker = &DLD_MEMORY_USAGE_HOOKERS( Report )[ Report->HookersNumber ];
+        
+        strlcpy( hooker->ClassName, pEntry->getIOKitClassNameNoCopy(), sizeof( hooker->ClassName ) );
+        hooker->HookType = pEntry->getHookType();
+        hooker->Depth = pEntry->getDepth();
+        hooker->HookedObjects = usage.HookedObjects;
+        hooker->Entries = usage.Entries;
+        hooker->EntriesBytes = usage.EntriesBytes;
+        hooker->VtableFunctionsInfoBytes = usage.VtableFunctionsInfoBytes;
+        hooker->VtableBufferBytes = usage.VtableBufferBytes;
+        hooker->HookerInstanceBytes = usage.HookerInstanceBytes;
+        
+        Report->HookersNumber += 0x1;
+        
+    }// end while
+    
+    iterator->release();
+}
+
+//--------------------------------------------------------------------
+
+bool
+DldIOKitHookEngine::GetMemoryUsage(
+    __out DldMemoryUsageReport* Report,
+    __in vm_size_t ReportSize
+    )
+{
+    DldHashTableMemoryUsage  tableUsage;
+    
+    assert( preemption_enabled() );
+    
+    if( ReportSize < sizeof( *Report ) )
+        return false;
+    
+    bzero( Report, ReportSize );
+    Report->Version = DLD_MEMORY_USAGE_VERSION;
+    
+    DldHookedObjectsHashTable::sHashTable->GetMemoryUsage( &tableUsage );
+    
+    Report->TableBuckets = tableUsage.Buckets;
+    Report->TableItems = tableUsage.Items;
+    Report->TableBytes = tableUsage.TableBytes;
+    Report->TableEntriesBytes = tableUsage.EntriesBytes;
+    Report->TotalBytes = tableUsage.TableBytes + tableUsage.EntriesBytes;
+    
+    this->AddDictionaryMemoryUsage( this->DictionaryPerObjectHooks, Report, ReportSize );
+    
+    for( unsigned int i = 0x0; i < DldInheritanceDepth_Maximum; ++i )
+        this->AddDictionaryMemoryUsage( this->DictionaryVtableClassHooks[ i ], Report, ReportSize );
+    
+    return ( Report->HookersNumber == Report->TotalHookersNumber );
+}
+
+//--------------------------------------------------------------------
+
+IOReturn
+DldIOKitHookEngine::GetHookStatistics(
+    __out DldHookStatisticsReport* Report
+    )
+{
+    assert( preemption_enabled() );
+    
+    bzero( Report, sizeof( *Report ) );
+    Report->Version = DLD_HOOK_STATISTICS_VERSION;
+    
+#if defined(DLD_HOOK_STATS)
+    
+    static_assert( DLD_HOOK_STATISTICS_HISTOGRAM_BUCKETS == DLD_LOCK_HISTOGRAM_BUCKETS,
+                   "the shared histogram doesn't match the table's one" );
+    
+    DldHashTableStatistics  statistics;
+    
+    DldHookedObjectsHashTable::sHashTable->GetStatistics( &statistics );
+    
+    Report->ExclusiveLocks = statistics.ExclusiveLocks;
+    Report->ExclusiveWaitTime = statistics.ExclusiveWaitTime;
+    Report->ExclusiveHoldTime = statistics.ExclusiveHoldTime;
+    Report->MaxExclusiveHoldTime = statistics.MaxExclusiveHoldTime;
+    
+    for( unsigned int i = 0x0; i < DLD_HOOK_STATISTICS_HISTOGRAM_BUCKETS; ++i )
+        Report->ExclusiveHoldTimeHistogram[ i ] = statistics.ExclusiveHoldTimeHistogram[ i ];
+    
+    Report->SharedLocks = statistics.SharedLocks;
+    Report->SharedWaitTime = statistics.SharedWaitTime;
+    Report->MaxSharedWaitTime = statistics.MaxSharedWaitTime;
+    Report->LockFreeReads = statistics.LockFreeReads;
+    Report->LockFreeReadsFailed = statistics.LockFreeReadsFailed;
+    Report->Entries = statistics.Entries;
+    Report->PeakEntries = statistics.PeakEntries;
+    
+    return kIOReturnSuccess;
+    
+#else
+    
+    return kIOReturnUnsupported;
+    
+#endif//DLD_HOOK_STATS
+}
+
+//--------------------------------------------------------------------
@@ -15,6 +15,8 @@
 #include "DldIOKitHookDictionaryEntry.h"
 #include "DldHookerCommonClass.h"
 #include "DldHookerCommonClass2.h"
+#include "DldMemoryUsageShared.h"
+#include "DldHookStatisticsShared.h"
 
 //--------------------------------------------------------------------
 
@@ -70,6 +72,12 @@ private:
     
     bool        CallObjectTerminatedCallback( __in IOService* NewService );
     
+    static unsigned int GetHookedObjectsTableSizeHint();
+    
+    void        AddDictionaryMemoryUsage( __in OSDictionary* Dictionary,
+                                          __inout DldMemoryUsageReport* Report,
+                                          __in vm_size_t ReportSize );
+    
 protected:
     
     virtual bool init();
@@ -83,6 +91,19 @@ public:
     
     IOReturn    HookObject( __inout OSObject* object );
     
+    //
+    // fills the report with the memory used by the hooked objects table and
+    // each hooking class, the report is followed by as many DldMemoryUsageHooker
+    // structures as fit in ReportSize, returns false if the report doesn't fit
+    //
+    bool        GetMemoryUsage( __out DldMemoryUsageReport* Report, __in vm_size_t ReportSize );
+    
+    //
+    // fills the report with the hooked objects table statistics, returns
+    // kIOReturnUnsupported if the driver has been built without DLD_HOOK_STATS
+    //
+    IOReturn    GetHookStatistics( __out DldHookStatisticsReport* Report );
+    
     //
     // CC stands for Containing Class
     // HC stands for Hooked Class
@@ -122,6 +143,7 @@ DldIOKitHookEngine::DldAddHookingClassInstance( __in DldHookType HookType )
     HookEntryData.IOKitClassName = DldHookerCommonClass2<CC,HC>::fGetHookedClassName();
     HookEntryData.HookFunction = DldHookerCommonClass2<CC,HC>::fHookObject;
     HookEntryData.UnHookFunction = DldHookerCommonClass2<CC,HC>::fUnHookObject;
+    HookEntryData.MemoryUsageFunction = DldHookerCommonClass2<CC,HC>::fGetMemoryUsage;
     
     HookEntryData.ObjectFirstPublishCallback = (DldHookTypeObject == HookType)?
     DldHookerCommonClass2<CC,HC>::fObjectFirstPublishCallback:
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#ifndef _DLDMEMORYUSAGESHARED_H
+#define _DLDMEMORYUSAGESHARED_H
+
+//
+// the hooker's memory usage report returned to a user space tool,
+// the file must be includable in user space and must not depend on IOKit
+//
+
+#include <stdint.h>
+
+//--------------------------------------------------------------------
+
+#define DLD_MEMORY_USAGE_VERSION            (0x1)
+#define DLD_MEMORY_USAGE_CLASS_NAME_SIZE    (64)
+
+//--------------------------------------------------------------------
+
+//
+// a hooked class at an inheritance depth
+//
+typedef struct _DldMemoryUsageHooker{
+
+    char        ClassName[ DLD_MEMORY_USAGE_CLASS_NAME_SIZE ];
+    uint32_t    HookType;// DldHookType
+    uint32_t    Depth;
+
+    uint32_t    HookedObjects;
+    uint32_t    Entries;
+
+    uint64_t    EntriesBytes;
+    uint64_t    VtableFunctionsInfoBytes;
+    uint64_t    VtableBufferBytes;
+    uint64_t    HookerInstanceBytes;
+
+} DldMemoryUsageHooker;
+
+//
+// the report is followed by HookersNumber DldMemoryUsageHooker structures,
+// TotalHookersNumber might be bigger than HookersNumber if the buffer was too small
+//
+typedef struct _DldMemoryUsageReport{
+
+    uint32_t    Version;
+    uint32_t    HookersNumber;
+    uint32_t    TotalHookersNumber;
+
+    uint32_t    TableBuckets;
+    uint32_t    TableItems;
+    uint32_t    Reserved;
+
+    //
+    // the hash table structure with the bucket arrays and the hash entries with the keys
+    //
+    uint64_t    TableBytes;
+    uint64_t    TableEntriesBytes;
+
+    //
+    // the table and all hookers including those which have not fit in the buffer
+    //
+    uint64_t    TotalBytes;
+
+} DldMemoryUsageReport;
+
+//--------------------------------------------------------------------
+
+#define DLD_MEMORY_USAGE_HOOKERS( _REPORT_ ) \
+    ( (DldMemoryUsageHooker*)( (DldMemoryUsageReport*)(_REPORT_) + 1 ) )
+
+#define DLD_MEMORY_USAGE_REPORT_SIZE( _HOOKERS_ ) \
+    ( sizeof( DldMemoryUsageReport ) + (uint64_t)(_HOOKERS_)*sizeof( DldMemoryUsageHooker ) )
+
+//--------------------------------------------------------------------
+
+#endif//_DLDMEMORYUSAGESHARED_H
@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include "DldSelectorPolicyCompiler.h"
+
+//--------------------------------------------------------------------
+
+UInt32*
+DldSelectorPolicyBitmap(
+    __in DldSelectorPolicyClass* classEntry,
+    __in DldSelectorPolicyKind kind,
+    __out UInt32* bitsNumber
+    )
+{
+    switch( kind ){
+
+        case DldSelectorPolicyKindExternalMethod:
+            *bitsNumber = DLD_SELECTOR_POLICY_MAX_SELECTOR;
+            return classEntry->ExternalMethodBitmap;
+
+        case DldSelectorPolicyKindMethodIndex:
+            *bitsNumber = DLD_SELECTOR_POLICY_MAX_SELECTOR;
+            return classEntry->MethodIndexBitmap;
+
+        case DldSelectorPolicyKindMemoryType:
+            *bitsNumber = DLD_SELECTOR_POLICY_MAX_MEMORY_TYPE;
+            return classEntry->MemoryTypeBitmap;
+
+        default:
+            assert( !"an unknown selector policy kind" );
+            *bitsNumber = 0x0;
+            return NULL;
+    }// end switch
+}
+
+//--------------------------------------------------------------------
+
+bool
+DldSelectorPolicyIsAllowed(
+    __in const DldSelectorPolicyClass* classEntry,
+    __in DldSelectorPolicyKind kind,
+    __in UInt32 selector
+    )
+{
+    UInt32   bitsNumber;
+    UInt32*  bitmap = DldSelectorPolicyBitmap( const_cast<DldSelectorPolicyClass*>(classEntry), kind, &bitsNumber );
+
+    if( selector < bitsNumber )
+        return DlIsFlagOn( bitmap[ selector / 32 ], ( (UInt32)0x1 << ( selector % 32 ) ) );
+
+    return DlIsFlagOn( classEntry->DefaultAllow, ( 0x1 << kind ) );
+}
+
+//--------------------------------------------------------------------
+
+static
+bool
+DldSelectorPolicyIsRuleValid(
+    __in const DldSelectorPolicyRule* rule
+    )
+{
+    DldSelectorPolicyClass  dummy;
+    UInt32                  bitsNumber;
+
+    if( NULL == rule->ClassName || rule->Kind >= DldSelectorPolicyKindMaximum || rule->FirstSelector > rule->LastSelector )
+        return false;
+
+    DldSelectorPolicyBitmap( &dummy, rule->Kind, &bitsNumber );
+
+    return ( (UInt32)(-1) == rule->LastSelector || rule->LastSelector < bitsNumber );
+}
+
+//--------------------------------------------------------------------
+
+//
+// returns true if the rule's class name has been seen in the previous rules
+//
+static
+bool
+DldSelectorPolicyIsClassRepeated(
+    __in const DldSelectorPolicyRule* rules,
+    __in unsigned int ruleIndex
+    )
+{
+    for( unsigned int r = 0x0; r < ruleIndex; ++r ){
+
+        if( 0x0 == strcmp( rules[ r ].ClassName, rules[ ruleIndex ].ClassName ) )
+            return true;
+    }// end for
+
+    return false;
+}
+
+//--------------------------------------------------------------------
+
+static
+unsigned int
+DldSelectorPolicyBucketsNumber(
+    __in unsigned int classesCount
+    )
+{
+    unsigned int  bucketsNumber = 0x4;
+
+    //
+    // the buckets number is a power of two at least twice bigger
+    // than the classes number so the table is never full
+    //
+    while( bucketsNumber < 0x2 * classesCount )
+        bucketsNumber = bucketsNumber << 0x1;
+
+    return bucketsNumber;
+}
+
+//--------------------------------------------------------------------
+
+vm_size_t
+DldSelectorPolicyCompiledSize(
+    __in_opt const DldSelectorPolicyRule* rules,
+    __in unsigned int rulesCount
+    )
+{
+    unsigned int  classesCount = 0x0;
+    vm_size_t     namesSize = 0x0;
+
+    if( rulesCount && NULL == rules )
+        return 0x0;
+
+    for( unsigned int r = 0x0; r < rulesCount; ++r ){
+
+        if( !DldSelectorPolicyIsRuleValid( &rules[ r ] ) ){
+
+            DBG_PRINT_ERROR(( "an invalid selector policy rule %u\n", r ));
+            return 0x0;
+        }
+
+        if( !DldSelectorPolicyIsClassRepeated( rules, r ) ){
+
+            classesCount += 0x1;
+            namesSize += strlen( rules[ r ].ClassName ) + 0x1;
+        }
+    }// end for
+
+    return sizeof( DldSelectorPolicy ) +
+           classesCount*sizeof( DldSelectorPolicyClass ) +
+           DldSelectorPolicyBucketsNumber( classesCount )*sizeof( UInt32 ) +
+           namesSize;
+}
+
+//--------------------------------------------------------------------
+
+IOReturn
+DldSelectorPolicyCompileRules(
+    __in_opt const DldSelectorPolicyRule* rules,
+    __in unsigned int rulesCount,
+    __out void* buffer,
+    __in vm_size_t bufferSize
+    )
+{
+    DldSelectorPolicy*  policy = (DldSelectorPolicy*)buffer;
+    vm_size_t           size;
+    unsigned int        classesCount = 0x0;
+    char*               names;
+
+    size = DldSelectorPolicyCompiledSize( rules, rulesCount );
+    if( 0x0 == size )
+        return kIOReturnBadArgument;
+
+    if( bufferSize < size )
+        return kIOReturnNoSpace;
+
+    for( unsigned int r = 0x0; r < rulesCount; ++r ){
+
+        if( !DldSelectorPolicyIsClassRepeated( rules, r ) )
+            classesCount += 0x1;
+    }// end for
+
+    bzero( policy, size );
+    policy->Size = size;
+    policy->ClassesCount = classesCount;
+    policy->BucketsMask = DldSelectorPolicyBucketsNumber( classesCount ) - 0x1;
+    policy->Classes = (DldSelectorPolicyClass*)( policy + 0x1 );
+    policy->Buckets = (UInt32*)( policy->Classes + classesCount );
+    names = (char*)( policy->Buckets + policy->BucketsMask + 0x1 );
+
+    classesCount = 0x0;
+
+    for( unsigned int r = 0x0; r < rulesCount; ++r ){
+
+        const DldSelectorPolicyRule*  rule = &rules[ r ];
+        DldSelectorPolicyClass*       classEntry = NULL;
+        UInt32*                       bitmap;
+        UInt32                        bitsNumber;
+        UInt32                        last;
+
+        for( unsigned int c = 0x0; c < classesCount && NULL == classEntry; ++c ){
+
+            if( 0x0 == strcmp( policy->Classes[ c ].ClassName, rule->ClassName ) )
+                classEntry = &policy->Classes[ c ];
+        }// end for
+
+        if( NULL == classEntry ){
+
+            vm_size_t  nameSize = strlen( rule->ClassName ) + 0x1;
+
+            //
+            // a new class, everything is allowed until a rule says otherwise
+            //
+            classEntry = &policy->Classes[ classesCount ];
+            classesCount += 0x1;
+
+            memset( classEntry, 0xFF, sizeof( *classEntry ) );
+            classEntry->MetaClass = NULL;
+
+            memcpy( names, rule->ClassName, nameSize );
+            classEntry->ClassName = names;
+            names += nameSize;
+        }
+
+        bitmap = DldSelectorPolicyBitmap( classEntry, rule->Kind, &bitsNumber );
+        assert( bitmap );
+
+        if( (UInt32)(-1) == rule->LastSelector ){
+
+            //
+            // the rule covers all selectors starting from FirstSelector
+            //
+            last = bitsNumber - 0x1;
+
+            if( rule->Allow )
+                DlSetFlag( classEntry->DefaultAllow, ( 0x1 << rule->Kind ) );
+            else
+                DlClearFlag( classEntry->DefaultAllow, ( 0x1 << rule->Kind ) );
+
+        } else {
+
+            last = rule->LastSelector;
+        }
+
+        for( UInt32 sel = rule->FirstSelector; sel <= last && sel < bitsNumber; ++sel ){
+
+            if( rule->Allow )
+                DlSetFlag( bitmap[ sel / 32 ], ( (UInt32)0x1 << ( sel % 32 ) ) );
+            else
+                DlClearFlag( bitmap[ sel / 32 ], ( (UInt32)0x1 << ( sel % 32 ) ) );
+
+        }// end for
+
+    }// end for
+
+    assert( classesCount == policy->ClassesCount );
+    assert( (vm_size_t)( names - (char*)policy ) == size );
+
+    return kIOReturnSuccess;
+}
+
+//--------------------------------------------------------------------
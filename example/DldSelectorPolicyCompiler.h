@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#ifndef _DLDSELECTORPOLICYCOMPILER_H
+#define _DLDSELECTORPOLICYCOMPILER_H
+
+#include "DldCommon.h"
+
+//--------------------------------------------------------------------
+
+//
+// the selectors and memory types outside the bitmaps are processed
+// in accordance with a class's default action
+//
+#define DLD_SELECTOR_POLICY_MAX_SELECTOR      (256)
+#define DLD_SELECTOR_POLICY_MAX_MEMORY_TYPE   (64)
+
+#define DLD_SELECTOR_POLICY_BITMAP_WORDS( _BITS_ )  ( ( (_BITS_) + 31 ) / 32 )
+
+typedef enum _DldSelectorPolicyKind{
+
+    //
+    // IOUserClient::externalMethod selectors
+    //
+    DldSelectorPolicyKindExternalMethod = 0x0,
+
+    //
+    // IOUserClient::getTargetAndMethodForIndex indices
+    //
+    DldSelectorPolicyKindMethodIndex,
+
+    //
+    // IOUserClient::clientMemoryForType types
+    //
+    DldSelectorPolicyKindMemoryType,
+
+    //
+    // a terminating value, not an actual kind
+    //
+    DldSelectorPolicyKindMaximum
+
+} DldSelectorPolicyKind;
+
+//
+// a rule as provided by a policy source, the rules are applied in order
+// so a later rule overrides an earlier one for the same selectors
+//
+typedef struct _DldSelectorPolicyRule{
+
+    //
+    // a name of an exact user client class, a class which is not loaded
+    // when the policy is loaded is bound when its kext has been loaded,
+    // see DldUserClientSelectorPolicy::BindPendingClasses()
+    //
+    const char*             ClassName;
+    DldSelectorPolicyKind   Kind;
+
+    //
+    // an inclusive range, (-1) as LastSelector means all selectors
+    // including the ones outside the bitmap, i.e. it sets the default action
+    //
+    UInt32                  FirstSelector;
+    UInt32                  LastSelector;
+
+    bool                    Allow;
+
+} DldSelectorPolicyRule;
+
+//
+// a compiled policy for a class, a set bit means "allow"
+//
+typedef struct _DldSelectorPolicyClass{
+
+    //
+    // the class's name is in the policy's names area
+    //
+    const char*         ClassName;
+
+    //
+    // set when the policy is loaded or when the class has been loaded,
+    // NULL for a class which has not been loaded
+    //
+    const OSMetaClass*  MetaClass;
+
+    //
+    // a bit per DldSelectorPolicyKind, set if the default action is "allow"
+    //
+    UInt32              DefaultAllow;
+
+    UInt32              ExternalMethodBitmap[ DLD_SELECTOR_POLICY_BITMAP_WORDS( DLD_SELECTOR_POLICY_MAX_SELECTOR ) ];
+    UInt32              MethodIndexBitmap[ DLD_SELECTOR_POLICY_BITMAP_WORDS( DLD_SELECTOR_POLICY_MAX_SELECTOR ) ];
+    UInt32              MemoryTypeBitmap[ DLD_SELECTOR_POLICY_BITMAP_WORDS( DLD_SELECTOR_POLICY_MAX_MEMORY_TYPE ) ];
+
+} DldSelectorPolicyClass;
+
+//
+// a compiled policy is a single allocation which is never modified after
+// it has been published, the layout is
+//   DldSelectorPolicy
+//   DldSelectorPolicyClass Classes[ ClassesCount ]
+//   UInt32 Buckets[ BucketsMask + 1 ]
+//   the classes' names
+// the buckets are an open addressing table indexed by a metaclass address,
+// a bucket contains a class's index plus one, zero marks an empty bucket
+//
+typedef struct _DldSelectorPolicy{
+
+    vm_size_t                Size;
+    unsigned int             ClassesCount;
+
+    //
+    // the number of classes which have not been bound as they have not been loaded
+    //
+    unsigned int             PendingClassesCount;
+
+    unsigned int             BucketsMask;
+    DldSelectorPolicyClass*  Classes;
+    UInt32*                  Buckets;
+
+} DldSelectorPolicy;
+
+//--------------------------------------------------------------------
+
+//
+// the compiler's pure part, it neither allocates memory nor looks
+// up the classes so it is tested by the host build, the kernel's part
+// is DldUserClientSelectorPolicy::Compile()
+//
+
+//
+// returns the size of the buffer for a compiled policy, zero for invalid rules
+//
+vm_size_t
+DldSelectorPolicyCompiledSize(
+    __in_opt const DldSelectorPolicyRule* rules,
+    __in unsigned int rulesCount
+    );
+
+//
+// compiles the rules into the buffer, the classes' MetaClass fields
+// are left NULL and the buckets are empty
+//
+IOReturn
+DldSelectorPolicyCompileRules(
+    __in_opt const DldSelectorPolicyRule* rules,
+    __in unsigned int rulesCount,
+    __out void* buffer,
+    __in vm_size_t bufferSize
+    );
+
+//
+// returns the bitmap for the kind and its size in bits
+//
+UInt32*
+DldSelectorPolicyBitmap(
+    __in DldSelectorPolicyClass* classEntry,
+    __in DldSelectorPolicyKind kind,
+    __out UInt32* bitsNumber
+    );
+
+//
+// returns true if the class's policy allows the selector
+//
+bool
+DldSelectorPolicyIsAllowed(
+    __in const DldSelectorPolicyClass* classEntry,
+    __in DldSelectorPolicyKind kind,
+    __in UInt32 selector
+    );
+
+//--------------------------------------------------------------------
+
+#endif//_DLDSELECTORPOLICYCOMPILER_H
@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include "DldUserClientAccessCache.h"
+
+//--------------------------------------------------------------------
+
+DldUserClientAccessCacheSlot   DldUserClientAccessCache::sSlots[ DLD_USER_CLIENT_ACCESS_CACHE_SIZE ];
+volatile SInt32                DldUserClientAccessCache::sPolicyGeneration = 0x1;
+volatile SInt32                DldUserClientAccessCache::sClientGenerations[ DLD_USER_CLIENT_ACCESS_CACHE_SIZE ];
+
+//--------------------------------------------------------------------
+
+unsigned int
+DldUserClientAccessCache::SlotIndex(
+    __in const IOUserClient* client,
+    __in task_t task
+    )
+{
+    vm_address_t   hash;
+
+    //
+    // the low bits are always zero for the objects allocated by kalloc
+    //
+    hash = ( (vm_address_t)client >> 0x4 ) ^ ( (vm_address_t)task >> 0x6 );
+    hash ^= ( hash >> 0x8 );
+
+    return (unsigned int)( hash & ( DLD_USER_CLIENT_ACCESS_CACHE_SIZE - 0x1 ) );
+}
+
+//--------------------------------------------------------------------
+
+unsigned int
+DldUserClientAccessCache::ClientIndex(
+    __in const IOUserClient* client
+    )
+{
+    vm_address_t   hash;
+
+    hash = ( (vm_address_t)client >> 0x4 );
+    hash ^= ( hash >> 0x8 );
+
+    return (unsigned int)( hash & ( DLD_USER_CLIENT_ACCESS_CACHE_SIZE - 0x1 ) );
+}
+
+//--------------------------------------------------------------------
+
+UInt32
+DldUserClientAccessCache::GetClientGeneration(
+    __in const IOUserClient* client
+    )
+{
+    UInt32   generation;
+
+    generation = (UInt32)DldUserClientAccessCache::sClientGenerations[ DldUserClientAccessCache::ClientIndex( client ) ];
+
+    //
+    // the generation must be read before the decision is made
+    //
+    DldCompilerBarrier();
+
+    return generation;
+}
+
+//--------------------------------------------------------------------
+
+bool
+DldUserClientAccessCache::LookupDecision(
+    __in const IOUserClient* client,
+    __in task_t task,
+    __out IOReturn* decision
+    )
+{
+    DldUserClientAccessCacheSlot*  slot;
+    UInt32                         sequence;
+    const IOUserClient*            slotClient;
+    task_t                         slotTask;
+    UInt32                         slotGeneration;
+    UInt32                         slotClientGeneration;
+    IOReturn                       slotDecision;
+
+    assert( client );
+
+    slot = &DldUserClientAccessCache::sSlots[ DldUserClientAccessCache::SlotIndex( client, task ) ];
+
+    sequence = slot->Sequence;
+    if( 0x1 & sequence )
+        return false;
+
+    DldCompilerBarrier();
+
+    slotClient     = slot->Client;
+    slotTask       = slot->Task;
+    slotGeneration = slot->Generation;
+    slotDecision   = slot->Decision;
+    slotClientGeneration = slot->ClientGeneration;
+
+    DldCompilerBarrier();
+
+    //
+    // the slot was updated while being read
+    //
+    if( sequence != slot->Sequence )
+        return false;
+
+    if( slotClient != client ||
+        slotTask != task ||
+        slotGeneration != DldUserClientAccessCache::GetPolicyGeneration() ||
+        slotClientGeneration != DldUserClientAccessCache::GetClientGeneration( client ) )
+        return false;
+
+    *decision = slotDecision;
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+void
+DldUserClientAccessCache::SaveDecision(
+    __in const IOUserClient* client,
+    __in task_t task,
+    __in UInt32 generation,
+    __in UInt32 clientGeneration,
+    __in IOReturn decision
+    )
+{
+    DldUserClientAccessCacheSlot*  slot;
+    UInt32                         sequence;
+
+    assert( client );
+
+    slot = &DldUserClientAccessCache::sSlots[ DldUserClientAccessCache::SlotIndex( client, task ) ];
+
+    //
+    // the cache is a hint, so the slot is not updated if there is a concurrent writer
+    //
+    sequence = slot->Sequence;
+    if( ( 0x1 & sequence ) || !OSCompareAndSwap( sequence, sequence + 0x1, &slot->Sequence ) )
+        return;
+
+    slot->Client     = client;
+    slot->Task       = task;
+    slot->Generation = generation;
+    slot->Decision   = decision;
+    slot->ClientGeneration = clientGeneration;
+
+    //
+    // the atomic operation is a barrier for the stores above
+    //
+    OSIncrementAtomic( (volatile SInt32*)&slot->Sequence );
+}
+
+//--------------------------------------------------------------------
+
+void
+DldUserClientAccessCache::InvalidateClient(
+    __in const IOUserClient* client
+    )
+{
+    assert( client );
+
+    //
+    // the task is unknown here( e.g. clientDied is called in the context
+    // of a kernel thread ) so instead of looking for the client's slots
+    // the client generation is bumped, this also invalidates a decision
+    // that is being made concurrently as it is saved with the old generation,
+    // the decisions for the other clients with the same generation index
+    // are lost but the cache is just a hint
+    //
+    OSIncrementAtomic( &DldUserClientAccessCache::sClientGenerations[ DldUserClientAccessCache::ClientIndex( client ) ] );
+}
+
+//--------------------------------------------------------------------
+
+void
+DldUserClientAccessCache::PolicyChanged()
+{
+    //
+    // all slots with the previous generation become invalid,
+    // skip 0x0 on wrap around as this is a value for the zeroed slots
+    //
+    if( 0x0 == ( OSIncrementAtomic( &DldUserClientAccessCache::sPolicyGeneration ) + 0x1 ) )
+        OSIncrementAtomic( &DldUserClientAccessCache::sPolicyGeneration );
+}
+
+//--------------------------------------------------------------------
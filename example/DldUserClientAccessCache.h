@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#ifndef _DLDUSERCLIENTACCESSCACHE_H
+#define _DLDUSERCLIENTACCESSCACHE_H
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOUserClient.h>
+#include <IOKit/assert.h>
+#include "DldCommon.h"
+
+//--------------------------------------------------------------------
+
+//
+// the number of slots must be a power of two
+//
+#define DLD_USER_CLIENT_ACCESS_CACHE_SIZE   (256)
+
+//
+// a slot is aligned on a cache line so the concurrent updates for
+// different clients don't invalidate each other's cache lines
+//
+typedef struct _DldUserClientAccessCacheSlot{
+
+    //
+    // the sequence is odd while the slot is being updated,
+    // a reader retries( i.e. reports a miss ) if the sequence
+    // has been changed while the slot was being read
+    //
+    volatile UInt32       Sequence;
+
+    //
+    // a policy generation for which the decision was made
+    //
+    UInt32                Generation;
+
+    //
+    // a client generation for which the decision was made
+    //
+    UInt32                ClientGeneration;
+
+    const IOUserClient*   Client;
+    task_t                Task;
+    IOReturn              Decision;
+
+} __attribute__((aligned(64))) DldUserClientAccessCacheSlot;
+
+//--------------------------------------------------------------------
+
+//
+// a direct mapped cache of the access decisions made by
+// IOUserClientDldHook::checkAndLogUserClientAccess(), the key
+// is a pair of a user client object and a calling task,
+// the cache is lock free and never blocks a caller
+//
+// a decision is valid only for the policy and client generations
+// read before it was made, a client generation is shared by all
+// clients with the same hash and is bumped when any of them is
+// closed, unhooked or freed, so neither a decision saved by
+// a call that was in flight at that moment nor a decision for
+// a freed client whose address has been reused is ever returned
+//
+class DldUserClientAccessCache{
+
+private:
+
+    static DldUserClientAccessCacheSlot   sSlots[ DLD_USER_CLIENT_ACCESS_CACHE_SIZE ];
+
+    //
+    // the zeroed slots are never valid as the generation starts from 0x1
+    //
+    static volatile SInt32                sPolicyGeneration;
+
+    //
+    // the client generations indexed by ClientIndex(), bumped by InvalidateClient()
+    //
+    static volatile SInt32                sClientGenerations[ DLD_USER_CLIENT_ACCESS_CACHE_SIZE ];
+
+    static unsigned int SlotIndex( __in const IOUserClient* client, __in task_t task );
+
+    static unsigned int ClientIndex( __in const IOUserClient* client );
+
+public:
+
+    //
+    // must be read before a decision is made and then passed to SaveDecision()
+    // so a decision made concurrently with a policy change is never used
+    //
+    static UInt32 GetPolicyGeneration(){ return (UInt32)sPolicyGeneration; };
+
+    //
+    // the same as GetPolicyGeneration() but for the client
+    //
+    static UInt32 GetClientGeneration( __in const IOUserClient* client );
+
+    //
+    // returns true if there is a valid cached decision for the client and task
+    //
+    static bool LookupDecision( __in const IOUserClient* client,
+                                __in task_t task,
+                                __out IOReturn* decision );
+
+    static void SaveDecision( __in const IOUserClient* client,
+                              __in task_t task,
+                              __in UInt32 generation,
+                              __in UInt32 clientGeneration,
+                              __in IOReturn decision );
+
+    //
+    // invalidates all decisions for the client including the ones being made
+    // concurrently, must be called when the client is closed and before the
+    // client object is freed as its address might be reused for a new client
+    //
+    static void InvalidateClient( __in const IOUserClient* client );
+
+    //
+    // invalidates all cached decisions, must be called when the access policy changes
+    //
+    static void PolicyChanged();
+};
+
+//--------------------------------------------------------------------
+
+#endif//_DLDUSERCLIENTACCESSCACHE_H
@@ -0,0 +1,480 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include "DldUserClientSelectorPolicy.h"
+
+extern "C" {
+    extern int cpu_number( void );
+    extern boolean_t ml_set_interrupts_enabled( boolean_t enable );
+    extern int ml_get_max_cpus( void );
+}
+
+//--------------------------------------------------------------------
+
+DldSelectorPolicy* volatile   DldUserClientSelectorPolicy::sPolicy = NULL;
+DldSelectorPolicyReaderCpu*   DldUserClientSelectorPolicy::sReaderCpus = NULL;
+unsigned int                  DldUserClientSelectorPolicy::sCpusNumber = 0x0;
+IOLock*                       DldUserClientSelectorPolicy::sWriterLock = NULL;
+
+//--------------------------------------------------------------------
+
+static
+unsigned int
+DldSelectorPolicyHash(
+    __in const OSMetaClass* metaClass
+    )
+{
+    vm_address_t  hash = (vm_address_t)metaClass;
+
+    //
+    // metaclass objects are allocated by kalloc so the low bits are zero
+    //
+    hash = ( hash >> 0x4 ) ^ ( hash >> 0xC );
+    return (unsigned int)hash;
+}
+
+//--------------------------------------------------------------------
+
+bool
+DldUserClientSelectorPolicy::Initialize()
+{
+    assert( preemption_enabled() );
+
+    //
+    // the readers' states and the lock are kept by Free(), so a restarted driver reuses them
+    //
+    if( DldUserClientSelectorPolicy::sWriterLock )
+        return true;
+
+    DldUserClientSelectorPolicy::sCpusNumber = ml_get_max_cpus();
+    DldUserClientSelectorPolicy::sReaderCpus = (DldSelectorPolicyReaderCpu*)IOMallocAligned( DldUserClientSelectorPolicy::sCpusNumber*sizeof( DldSelectorPolicyReaderCpu ),
+                                                                                             sizeof( DldSelectorPolicyReaderCpu ) );
+    assert( DldUserClientSelectorPolicy::sReaderCpus );
+    if( NULL == DldUserClientSelectorPolicy::sReaderCpus )
+        return false;
+
+    bzero( DldUserClientSelectorPolicy::sReaderCpus, DldUserClientSelectorPolicy::sCpusNumber*sizeof( DldSelectorPolicyReaderCpu ) );
+
+    DldUserClientSelectorPolicy::sWriterLock = IOLockAlloc();
+    assert( DldUserClientSelectorPolicy::sWriterLock );
+    if( NULL == DldUserClientSelectorPolicy::sWriterLock ){
+
+        IOFreeAligned( DldUserClientSelectorPolicy::sReaderCpus, DldUserClientSelectorPolicy::sCpusNumber*sizeof( DldSelectorPolicyReaderCpu ) );
+        DldUserClientSelectorPolicy::sReaderCpus = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+void
+DldUserClientSelectorPolicy::Free()
+{
+    assert( preemption_enabled() );
+
+    if( NULL == DldUserClientSelectorPolicy::sWriterLock )
+        return;
+
+    //
+    // the hooks are not removed when the driver stops, so the policy is removed
+    // as by the zero rules and freed after the readers have left the section,
+    // the readers' states and the lock are not freed as a hook which has found
+    // the policy might be entering the section
+    //
+    DldUserClientSelectorPolicy::LoadRules( NULL, 0x0 );
+}
+
+//--------------------------------------------------------------------
+
+const DldSelectorPolicyClass*
+DldUserClientSelectorPolicy::FindClass(
+    __in const DldSelectorPolicy* policy,
+    __in const OSMetaClass* metaClass
+    )
+{
+    unsigned int  i;
+
+    //
+    // the table is never full so the loop is terminated by an empty bucket
+    //
+    for( i = DldSelectorPolicyHash( metaClass ) & policy->BucketsMask;
+         0x0 != policy->Buckets[ i ];
+         i = ( i + 0x1 ) & policy->BucketsMask ){
+
+        const DldSelectorPolicyClass*  classEntry = &policy->Classes[ policy->Buckets[ i ] - 0x1 ];
+
+        if( metaClass == classEntry->MetaClass )
+            return classEntry;
+
+    }// end for
+
+    //
+    // the classes which were not loaded when the policy was loaded are not
+    // in the buckets until BindPendingClasses() has found them loaded
+    //
+    return NULL;
+}
+
+//--------------------------------------------------------------------
+
+const OSMetaClass*
+DldUserClientSelectorPolicy::FindLoadedClass(
+    __in const char* name
+    )
+{
+    const OSSymbol*     className;
+    const OSMetaClass*  metaClass;
+
+    assert( preemption_enabled() );
+
+    className = OSSymbol::withCString( name );
+    assert( className );
+    if( !className )
+        return NULL;
+
+    metaClass = OSMetaClass::getMetaClassWithName( className );
+    className->release();
+
+    return metaClass;
+}
+
+//--------------------------------------------------------------------
+
+unsigned int
+DldUserClientSelectorPolicy::BindClasses(
+    __inout DldSelectorPolicy* policy
+    )
+/*
+ binds the loaded classes which have not been bound and adds them in the buckets,
+ the policy must not have been published, returns the number of bound classes
+ */
+{
+    unsigned int  bound = 0x0;
+
+    policy->PendingClassesCount = 0x0;
+
+    for( unsigned int c = 0x0; c < policy->ClassesCount; ++c ){
+
+        DldSelectorPolicyClass*  classEntry = &policy->Classes[ c ];
+        unsigned int             i;
+
+        if( NULL == classEntry->MetaClass ){
+
+            classEntry->MetaClass = DldUserClientSelectorPolicy::FindLoadedClass( classEntry->ClassName );
+
+            if( NULL == classEntry->MetaClass ){
+
+                DBG_PRINT(( "the %s class is not loaded, its rules are applied when it is loaded\n", classEntry->ClassName ));
+                policy->PendingClassesCount += 0x1;
+
+            } else {
+
+                for( i = DldSelectorPolicyHash( classEntry->MetaClass ) & policy->BucketsMask;
+                     0x0 != policy->Buckets[ i ];
+                     i = ( i + 0x1 ) & policy->BucketsMask ){;}
+
+                policy->Buckets[ i ] = c + 0x1;
+                bound += 0x1;
+            }
+        }
+    }// end for
+
+    return bound;
+}
+
+//--------------------------------------------------------------------
+
+IOReturn
+DldUserClientSelectorPolicy::Compile(
+    __in_opt const DldSelectorPolicyRule* rules,
+    __in unsigned int rulesCount,
+    __out DldSelectorPolicy** compiledPolicy
+    )
+{
+    DldSelectorPolicy*  policy;
+    vm_size_t           size;
+    IOReturn            RC;
+
+    assert( preemption_enabled() );
+    assert( !( rulesCount && NULL == rules ) );
+
+    *compiledPolicy = NULL;
+
+    size = DldSelectorPolicyCompiledSize( rules, rulesCount );
+    if( 0x0 == size )
+        return kIOReturnBadArgument;
+
+    policy = (DldSelectorPolicy*)IOMalloc( size );
+    assert( policy );
+    if( !policy )
+        return kIOReturnNoMemory;
+
+    RC = DldSelectorPolicyCompileRules( rules, rulesCount, policy, size );
+    if( kIOReturnSuccess != RC ){
+
+        DBG_PRINT_ERROR(( "DldSelectorPolicyCompileRules() failed with 0x%X\n", RC ));
+        IOFree( policy, size );
+        return RC;
+    }
+
+    //
+    // bind the loaded classes, the others are bound by BindPendingClasses()
+    //
+    DldUserClientSelectorPolicy::BindClasses( policy );
+
+    *compiledPolicy = policy;
+    return kIOReturnSuccess;
+}
+
+//--------------------------------------------------------------------
+
+void
+DldUserClientSelectorPolicy::FreePolicy(
+    __in DldSelectorPolicy* policy
+    )
+{
+    vm_size_t  size;
+
+    assert( policy );
+
+    size = policy->Size;
+
+#if defined(DBG)
+    //
+    // a reader which has not been waited for crashes on the garbage
+    //
+    memset( policy, 0xDB, size );
+#endif//DBG
+
+    IOFree( policy, size );
+}
+
+//--------------------------------------------------------------------
+
+void
+DldUserClientSelectorPolicy::WaitForReaders()
+/*
+ called by a writer after the policy pointer has been replaced
+ */
+{
+    //
+    // a reader publishes the odd sequence before reading the policy pointer,
+    // so a CPU which is not in the section or has reentered it after
+    // the pointer was replaced can't be using the old policy, a reader's
+    // section is short as it runs with the interrupts disabled
+    //
+    DldMemoryBarrier();
+
+    for( unsigned int cpu = 0x0; cpu < DldUserClientSelectorPolicy::sCpusNumber; ++cpu ){
+
+        UInt32  readerSequence = DldUserClientSelectorPolicy::sReaderCpus[ cpu ].Sequence;
+
+        if( readerSequence & 0x1 ){
+
+            while( readerSequence == DldUserClientSelectorPolicy::sReaderCpus[ cpu ].Sequence )
+                DldCpuPause();
+        }
+    }// end for
+}
+
+//--------------------------------------------------------------------
+
+IOReturn
+DldUserClientSelectorPolicy::LoadRules(
+    __in_opt const DldSelectorPolicyRule* rules,
+    __in unsigned int rulesCount
+    )
+{
+    DldSelectorPolicy*  newPolicy = NULL;
+    IOReturn            RC;
+
+    assert( preemption_enabled() );
+    assert( DldUserClientSelectorPolicy::sWriterLock );
+
+    if( NULL == DldUserClientSelectorPolicy::sWriterLock )
+        return kIOReturnNotReady;
+
+    if( rulesCount ){
+
+        RC = DldUserClientSelectorPolicy::Compile( rules, rulesCount, &newPolicy );
+        if( kIOReturnSuccess != RC ){
+
+            DBG_PRINT_ERROR(( "DldUserClientSelectorPolicy::Compile() failed with 0x%X\n", RC ));
+            return RC;
+        }
+    }// end if( rulesCount )
+
+    IOLockLock( DldUserClientSelectorPolicy::sWriterLock );
+    {// start of the lock
+
+        DldUserClientSelectorPolicy::PublishWoLock( newPolicy );
+
+    }// end of the lock
+    IOLockUnlock( DldUserClientSelectorPolicy::sWriterLock );
+
+    return kIOReturnSuccess;
+}
+
+//--------------------------------------------------------------------
+
+void
+DldUserClientSelectorPolicy::BindPendingClasses()
+/*
+ called when a kext might have been loaded, the pending classes which have been
+ loaded are bound in a copy of the current policy which replaces it, so the readers
+ find the classes in the buckets and never match the classes by their names
+ */
+{
+    DldSelectorPolicy*  policy;
+    DldSelectorPolicy*  newPolicy = NULL;
+    vm_address_t        delta;
+    bool                loaded = false;
+
+    assert( preemption_enabled() );
+
+    if( NULL == DldUserClientSelectorPolicy::sWriterLock )
+        return;
+
+    IOLockLock( DldUserClientSelectorPolicy::sWriterLock );
+    {// start of the lock
+
+        //
+        // the writers are serialized so the policy is not freed under the lock
+        //
+        policy = DldUserClientSelectorPolicy::sPolicy;
+
+        for( unsigned int c = 0x0; policy && c < policy->ClassesCount && 0x0 != policy->PendingClassesCount && !loaded; ++c ){
+
+            if( NULL == policy->Classes[ c ].MetaClass )
+                loaded = ( NULL != DldUserClientSelectorPolicy::FindLoadedClass( policy->Classes[ c ].ClassName ) );
+        }// end for
+
+        if( loaded ){
+
+            newPolicy = (DldSelectorPolicy*)IOMalloc( policy->Size );
+            assert( newPolicy );
+        }
+
+        if( newPolicy ){
+
+            //
+            // the policy is a single allocation, its pointers are relocated to the copy
+            //
+            memcpy( newPolicy, policy, policy->Size );
+            delta = (vm_address_t)newPolicy - (vm_address_t)policy;
+
+            newPolicy->Classes = (DldSelectorPolicyClass*)( (vm_address_t)policy->Classes + delta );
+            newPolicy->Buckets = (UInt32*)( (vm_address_t)policy->Buckets + delta );
+
+            for( unsigned int c = 0x0; c < newPolicy->ClassesCount; ++c )
+                newPolicy->Classes[ c ].ClassName = (const char*)( (vm_address_t)policy->Classes[ c ].ClassName + delta );
+
+            DldUserClientSelectorPolicy::BindClasses( newPolicy );
+            DldUserClientSelectorPolicy::PublishWoLock( newPolicy );
+        }
+
+    }// end of the lock
+    IOLockUnlock( DldUserClientSelectorPolicy::sWriterLock );
+
+    if( loaded && NULL == newPolicy )
+        DBG_PRINT_ERROR(( "IOMalloc() failed, the loaded classes are not bound\n" ));
+}
+
+//--------------------------------------------------------------------
+
+void
+DldUserClientSelectorPolicy::PublishWoLock(
+    __in_opt DldSelectorPolicy* newPolicy
+    )
+/*
+ called under the writer's lock, replaces the current policy and frees it
+ */
+{
+    DldSelectorPolicy*  oldPolicy;
+
+    //
+    // the policy must be visible before the pointer, the x86 doesn't reorder stores,
+    // the readers which load the new pointer never see the old policy
+    //
+    oldPolicy = DldUserClientSelectorPolicy::sPolicy;
+    DldCompilerBarrier();
+    DldUserClientSelectorPolicy::sPolicy = newPolicy;
+
+    //
+    // the grace period, the old policy is freed when the readers which
+    // might have loaded the old pointer have left the section
+    //
+    if( oldPolicy ){
+
+        DldUserClientSelectorPolicy::WaitForReaders();
+        DldUserClientSelectorPolicy::FreePolicy( oldPolicy );
+    }
+}
+
+//--------------------------------------------------------------------
+
+IOReturn
+DldUserClientSelectorPolicy::Check(
+    __in const IOUserClient* client,
+    __in DldSelectorPolicyKind kind,
+    __in UInt32 selector
+    )
+{
+    const DldSelectorPolicy*       policy;
+    const DldSelectorPolicyClass*  classEntry;
+    DldSelectorPolicyReaderCpu*    readerCpu;
+    boolean_t                      interruptsState;
+    unsigned int                   cpu;
+    bool                           allow = true;
+
+    assert( client );
+    assert( kind < DldSelectorPolicyKindMaximum );
+
+    //
+    // avoid entering the section if there is no policy
+    //
+    if( NULL == DldUserClientSelectorPolicy::sPolicy )
+        return kIOReturnSuccess;
+
+    //
+    // the interrupts are disabled so the CPU's state is changed only by this reader
+    //
+    interruptsState = ml_set_interrupts_enabled( FALSE );
+    {// start of the reader's section
+
+        cpu = cpu_number();
+        assert( cpu < DldUserClientSelectorPolicy::sCpusNumber );
+
+        readerCpu = &DldUserClientSelectorPolicy::sReaderCpus[ cpu ];
+
+        //
+        // enter the section before loading the pointer, see WaitForReaders()
+        //
+        readerCpu->Sequence = readerCpu->Sequence + 0x1;
+        DldMemoryBarrier();
+
+        policy = DldUserClientSelectorPolicy::sPolicy;
+        if( policy ){
+
+            classEntry = DldUserClientSelectorPolicy::FindClass( policy, client->getMetaClass() );
+            if( classEntry )
+                allow = DldSelectorPolicyIsAllowed( classEntry, kind, selector );
+
+        }// end if( policy )
+
+        //
+        // the policy must be read before the section is left
+        //
+        DldCompilerBarrier();
+        readerCpu->Sequence = readerCpu->Sequence + 0x1;
+
+    }// end of the reader's section
+    ml_set_interrupts_enabled( interruptsState );
+
+    return allow ? kIOReturnSuccess : kIOReturnNotPermitted;
+}
+
+//--------------------------------------------------------------------
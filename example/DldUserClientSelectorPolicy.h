@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#ifndef _DLDUSERCLIENTSELECTORPOLICY_H
+#define _DLDUSERCLIENTSELECTORPOLICY_H
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOUserClient.h>
+#include <IOKit/assert.h>
+#include "DldCommon.h"
+#include "DldSelectorPolicyCompiler.h"
+
+//--------------------------------------------------------------------
+
+//
+// a CPU's reader state, the Sequence is odd while the CPU is checking
+// a call against the policy, see DldUserClientSelectorPolicy::Check()
+//
+typedef struct _DldSelectorPolicyReaderCpu{
+
+    volatile UInt32  Sequence;
+
+} __attribute__((aligned(64))) DldSelectorPolicyReaderCpu;
+
+//--------------------------------------------------------------------
+
+class DldUserClientSelectorPolicy{
+
+private:
+
+    //
+    // the current policy, NULL if there is no policy and all calls are allowed
+    //
+    static DldSelectorPolicy* volatile   sPolicy;
+
+    //
+    // the readers check a call with the interrupts disabled in a per CPU read
+    // section, a writer publishes a new policy and then waits for the CPUs
+    // which were in the section before freeing the old policy, the readers
+    // never wait and never write a shared cache line
+    //
+    static DldSelectorPolicyReaderCpu*   sReaderCpus;
+    static unsigned int                  sCpusNumber;
+
+    //
+    // serializes writers
+    //
+    static IOLock*                       sWriterLock;
+
+    static const DldSelectorPolicyClass* FindClass( __in const DldSelectorPolicy* policy,
+                                                    __in const OSMetaClass* metaClass );
+
+    static IOReturn Check( __in const IOUserClient* client,
+                           __in DldSelectorPolicyKind kind,
+                           __in UInt32 selector );
+
+    static void WaitForReaders();
+
+    static const OSMetaClass* FindLoadedClass( __in const char* name );
+    static unsigned int BindClasses( __inout DldSelectorPolicy* policy );
+    static void PublishWoLock( __in_opt DldSelectorPolicy* newPolicy );
+
+public:
+
+    //
+    // must be called before the policy is loaded, the counterpart is Free()
+    //
+    static bool Initialize();
+
+    //
+    // removes and frees the policy, can be called while the hooks are being called,
+    // the readers' states outlive the call and are reused by Initialize()
+    //
+    static void Free();
+
+    //
+    // the compiler, the classes are looked up by the names, the returned policy
+    // must be freed by FreePolicy() if it has not been published
+    //
+    static IOReturn Compile( __in_opt const DldSelectorPolicyRule* rules,
+                             __in unsigned int rulesCount,
+                             __out DldSelectorPolicy** compiledPolicy );
+
+    static void FreePolicy( __in DldSelectorPolicy* policy );
+
+    //
+    // binds the classes which were not loaded when the policy was loaded and
+    // replaces the policy if any of them has been loaded, called when a kext
+    // might have been loaded, e.g. by a service's publish notification
+    //
+    static void BindPendingClasses();
+
+    //
+    // compiles and atomically replaces the current policy, zero rules remove the policy,
+    // the concurrent calls are serialized
+    //
+    static IOReturn LoadRules( __in_opt const DldSelectorPolicyRule* rules,
+                               __in unsigned int rulesCount );
+
+    //
+    // the checks, return kIOReturnSuccess if a call is allowed and kIOReturnNotPermitted otherwise
+    //
+    static IOReturn CheckExternalMethod( __in const IOUserClient* client, __in uint32_t selector )
+    { return DldUserClientSelectorPolicy::Check( client, DldSelectorPolicyKindExternalMethod, selector ); };
+
+    static IOReturn CheckMethodIndex( __in const IOUserClient* client, __in UInt32 index )
+    { return DldUserClientSelectorPolicy::Check( client, DldSelectorPolicyKindMethodIndex, index ); };
+
+    static IOReturn CheckMemoryType( __in const IOUserClient* client, __in UInt32 type )
+    { return DldUserClientSelectorPolicy::Check( client, DldSelectorPolicyKindMemoryType, type ); };
+};
+
+//--------------------------------------------------------------------
+
+#endif//_DLDUSERCLIENTSELECTORPOLICY_H
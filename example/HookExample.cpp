@@ -8,6 +8,65 @@
 
 #include "HookExample.h"
 #include "DldIOKitHookEngine.h"
+#include "DldAuditEventQueue.h"
+#include "DldEventRing.h"
+#include "DldEventDataQueue.h"
+#include "DldUserClientSelectorPolicy.h"
+#include "DldEventChannels.h"
+
+//--------------------------------------------------------------------
+
+static
+void
+DldAuditLogConsumer(
+    __in void* context,
+    __in const DldAuditEvent* events,
+    __in unsigned int count
+    )
+{
+    for( unsigned int i = 0x0; i < count; ++i ){
+        
+        DBG_PRINT( ( "audit: pid=%d class=%s client=0x%p operation=%u selector=%u result=0x%X\n",
+                     (int)events[ i ].Pid,
+                     events[ i ].ClientClassName,
+                     events[ i ].Client,
+                     (unsigned int)events[ i ].Operation,
+                     (unsigned int)events[ i ].Selector,
+                     (unsigned int)events[ i ].Result ) );
+    }// end for
+}
+
+//--------------------------------------------------------------------
+
+//
+// a service's publish notification, a kext which has been loaded publishes
+// its services, so the selector policy's classes which were not loaded are
+// bound then and not matched by their names when their calls are checked
+//
+static IONotifier*  gServicePublishNotifier = NULL;
+
+#ifdef DLD_MACOSX_10_5
+static
+bool
+DldServicePublishCallback(
+    __in    void* target,
+    __in    void* refCon,
+    __inout IOService* newService
+    )
+#else
+static
+bool
+DldServicePublishCallback(
+    __in    void* target,
+    __in    void* refCon,
+    __inout IOService* newService,
+    __in    IONotifier* notifier
+    )
+#endif
+{
+    DldUserClientSelectorPolicy::BindPendingClasses();
+    return true;
+}
 
 //--------------------------------------------------------------------
 
@@ -25,6 +84,72 @@ HookExample()
         return false;
     }
     
+    //
+    // the selector policy's readers state, there is no policy till LoadRules() is called
+    //
+    if( !DldUserClientSelectorPolicy::Initialize() ){
+        
+        DBG_PRINT_ERROR( ( "DldUserClientSelectorPolicy::Initialize() failed\n" ) );
+        return false;
+    }
+    
+#ifdef DLD_MACOSX_10_5
+    gServicePublishNotifier = IOService::addNotification( gIOFirstPublishNotification,
+                                                          IOService::serviceMatching( "IOService" ),
+                                                          DldServicePublishCallback,
+                                                          NULL );
+#else
+    gServicePublishNotifier = IOService::addMatchingNotification( gIOFirstPublishNotification,
+                                                                  IOService::serviceMatching( "IOService" ),
+                                                                  DldServicePublishCallback,
+                                                                  NULL );
+#endif
+    assert( NULL != gServicePublishNotifier );
+    if( NULL == gServicePublishNotifier ){
+        
+        DBG_PRINT_ERROR( ( "IOService::addMatchingNotification( gIOFirstPublishNotification ) failed\n" ) );
+        return false;
+    }
+    
+    //
+    // the channels' readers state, the hooks use the channels in its read section
+    //
+    if( !DldEventChannels::Initialize() ){
+        
+        DBG_PRINT_ERROR( ( "DldEventChannels::Initialize() failed\n" ) );
+        return false;
+    }
+    
+    //
+    // the audit queue is optional, the hooks skip auditing if there is no queue
+    //
+    gAuditEventQueue = DldAuditEventQueue::withCapacity( 4096, DldAuditLogConsumer, NULL );
+    assert( NULL != gAuditEventQueue );
+    if( NULL == gAuditEventQueue ) {
+        
+        DBG_PRINT_ERROR( ( "DldAuditEventQueue::withCapacity() failed\n" ) );
+    }
+    
+    //
+    // the event ring is optional, it is mapped by a reader through DldEventRingUserClient
+    //
+    gEventRing = DldEventRing::withRecordsPerCpu( 1024 );
+    assert( NULL != gEventRing );
+    if( NULL == gEventRing ) {
+        
+        DBG_PRINT_ERROR( ( "DldEventRing::withRecordsPerCpu() failed\n" ) );
+    }
+    
+    //
+    // the data queue is optional, a consumer is notified when 16KB are queued or after 1 ms
+    //
+    gEventDataQueue = DldEventDataQueue::withCapacity( 64*1024, 16*1024, 1000 );
+    assert( NULL != gEventDataQueue );
+    if( NULL == gEventDataQueue ) {
+        
+        DBG_PRINT_ERROR( ( "DldEventDataQueue::withCapacity() failed\n" ) );
+    }
+    
     //
     // start IOUserClient class derived objects hooking, the hooks might be called before this function returns!
     //
@@ -38,3 +163,44 @@ HookExample()
 }
 
 //--------------------------------------------------------------------
+
+void
+HookExampleStop()
+{
+    DldAuditEventQueue*  auditEventQueue = gAuditEventQueue;
+    DldEventRing*        eventRing = gEventRing;
+    DldEventDataQueue*   eventDataQueue = gEventDataQueue;
+    
+    //
+    // the hooks are not removed so the channels are unpublished first and released
+    // when the hooks which might have loaded the pointers have left the section,
+    // the user clients hold their own references to the ring and the data queue
+    //
+    gAuditEventQueue = NULL;
+    gEventRing = NULL;
+    gEventDataQueue = NULL;
+    
+    DldEventChannels::WaitForReaders();
+    
+    if( auditEventQueue )
+        auditEventQueue->release();
+    
+    if( eventRing )
+        eventRing->release();
+    
+    if( eventDataQueue )
+        eventDataQueue->release();
+    
+    //
+    // remove() waits for the running callbacks
+    //
+    if( gServicePublishNotifier ){
+        
+        gServicePublishNotifier->remove();
+        gServicePublishNotifier = NULL;
+    }
+    
+    DldUserClientSelectorPolicy::Free();
+}
+
+//--------------------------------------------------------------------
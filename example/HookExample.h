@@ -9,6 +9,17 @@
 #ifndef __IOKitHooker__HookExample__
 #define __IOKitHooker__HookExample__
 
+//
+// creates the hook engine and the event channels and starts hooking,
+// called by DldHookExampleService::start()
+//
+bool HookExample();
 
+//
+// releases the event channels and frees the selector policy, the engine
+// can't remove the hooks so they are still called after this returns and
+// find no channels, called by DldHookExampleService::stop()
+//
+void HookExampleStop();
 
 #endif /* defined(__IOKitHooker__HookExample__) */
@@ -9,6 +9,12 @@
 #include "DldCommon.h"
 #include "DldHookerCommonClass.h"
 #include "DldHookerCommonClass2.h"
+#include "DldUserClientAccessCache.h"
+#include "DldUserClientSelectorPolicy.h"
+#include "DldAuditEventQueue.h"
+#include "DldEventRing.h"
+#include "DldEventDataQueue.h"
+#include "DldEventChannels.h"
 
 
 template<DldInheritanceDepth Depth>
@@ -32,6 +38,8 @@ public:
         kDld_registerNotificationPort1_hook,//(mach_port_t port, UInt32 type, io_user_reference_t refCon)
         kDld_registerNotificationPort2_hook,//(mach_port_t port, UInt32 type, UInt32 refCon )
         kDld_getNotificationSemaphore_hook,
+        kDld_clientClose_hook,
+        kDld_clientDied_hook,
         kDld_NumberOfAddedHooks
     };
     
@@ -51,6 +59,14 @@ protected:
     virtual bool init();
     virtual void free();
     
+public:
+    
+    //
+    // the cached access decisions for the client are invalidated
+    //
+    virtual void fObjectTerminated( __in OSObject* object );
+    virtual void fObjectUnHooked( __in OSObject* object );
+    
     /////////////////////////////////////////////
     //
     // end of the required declarations
@@ -94,6 +110,10 @@ protected:
     virtual IOReturn getNotificationSemaphore_hook( UInt32 notification_type,
                                                     semaphore_t * semaphore );
     
+    virtual IOReturn clientClose_hook( void );
+    
+    virtual IOReturn clientDied_hook( void );
+    
     ////////////////////////////////////////////////////////
     //
     // end of hooking functions declaration
@@ -103,6 +123,11 @@ protected:
 private:
     IOReturn  checkAndLogUserClientAccess( __in DldHookerCommonClass2<IOUserClientDldHook<Depth>,IOUserClient>*  commonHooker2 );
     
+    //
+    // posts an audit record to the asynchronous queue, never blocks
+    //
+    void      auditUserClientAccess( __in DldAuditOperation operation, __in UInt32 selector, __in IOReturn result );
+    
 };
 
 //--------------------------------------------------------------------
@@ -219,6 +244,16 @@ IOUserClientDldHook<Depth>::init()
                                                           DldConvertFunctionToVtableIndex( (void (OSMetaClassBase::*)(void)) &IOUserClient::getNotificationSemaphore ),
                                                           DldHookerCommonClass2<IOUserClientDldHook<Depth>,IOUserClient>::_ptmf2ptf( this, (void (DldHookerBaseInterface::*)(void)) &IOUserClientDldHook<Depth>::getNotificationSemaphore_hook ) );
         
+        this->mHookerCommon2->fAddHookingFunctionExternal(
+                                                          IOUserClientDldHook<Depth>::kDld_clientClose_hook,
+                                                          DldConvertFunctionToVtableIndex( (void (OSMetaClassBase::*)(void)) &IOUserClient::clientClose ),
+                                                          DldHookerCommonClass2<IOUserClientDldHook<Depth>,IOUserClient>::_ptmf2ptf( this, (void (DldHookerBaseInterface::*)(void)) &IOUserClientDldHook<Depth>::clientClose_hook ) );
+        
+        this->mHookerCommon2->fAddHookingFunctionExternal(
+                                                          IOUserClientDldHook<Depth>::kDld_clientDied_hook,
+                                                          DldConvertFunctionToVtableIndex( (void (OSMetaClassBase::*)(void)) &IOUserClient::clientDied ),
+                                                          DldHookerCommonClass2<IOUserClientDldHook<Depth>,IOUserClient>::_ptmf2ptf( this, (void (DldHookerBaseInterface::*)(void)) &IOUserClientDldHook<Depth>::clientDied_hook ) );
+        
     } else {
         
         DBG_PRINT_ERROR(("this->mHookerCommon2.init( this ) failed\n"));
@@ -241,12 +276,54 @@ IOUserClientDldHook<Depth>::free()
 
 //--------------------------------------------------------------------
 
+template<DldInheritanceDepth Depth>
+void
+IOUserClientDldHook<Depth>::fObjectTerminated(
+    __in OSObject* object
+    )
+{
+    DldUserClientAccessCache::InvalidateClient( reinterpret_cast<IOUserClient*>(object) );
+}
+
+//--------------------------------------------------------------------
+
+template<DldInheritanceDepth Depth>
+void
+IOUserClientDldHook<Depth>::fObjectUnHooked(
+    __in OSObject* object
+    )
+{
+    DldUserClientAccessCache::InvalidateClient( reinterpret_cast<IOUserClient*>(object) );
+}
+
 template<DldInheritanceDepth Depth>
 IOReturn
 IOUserClientDldHook<Depth>::checkAndLogUserClientAccess(
     __in DldHookerCommonClass2<IOUserClientDldHook<Depth>,IOUserClient>*  commonHooker2
     )
 {
+    IOUserClient*  client = reinterpret_cast<IOUserClient*>(this);
+    task_t         task = current_task();
+    UInt32         generation;
+    UInt32         clientGeneration;
+    IOReturn       decision;
+    
+    //
+    // a repeated call from the same task is resolved by the cache without
+    // touching the registry, the generations must be read before the decision
+    // is made so the decision made for the old policy or for the client that
+    // has been closed concurrently is never saved as valid
+    //
+    if( DldUserClientAccessCache::LookupDecision( client, task, &decision ) )
+        return decision;
+    
+    generation = DldUserClientAccessCache::GetPolicyGeneration();
+    clientGeneration = DldUserClientAccessCache::GetClientGeneration( client );
+    
+    //
+    // allow access by default
+    //
+    decision = kIOReturnSuccess;
     
     //
     // get the parent in the IOService tree, it happened that there might be orphan client objects in the system
@@ -258,18 +335,60 @@ IOUserClientDldHook<Depth>::checkAndLogUserClientAccess(
         
         assert( OSDynamicCast( IOService, parent ) );
         if( NULL == OSDynamicCast( IOService, parent ) )
-            return kIOReturnNotPermitted;
+            decision = kIOReturnNotPermitted;
         
     }// end if( parent )
     
     //
     // !!!!!Add code here to check for access or something !!!!
+    // call DldUserClientAccessCache::PolicyChanged() when the policy changes
     //
     
+    DldUserClientAccessCache::SaveDecision( client, task, generation, clientGeneration, decision );
+    
+    return decision;
+}
+
+//--------------------------------------------------------------------
+
+template<DldInheritanceDepth Depth>
+void
+IOUserClientDldHook<Depth>::auditUserClientAccess(
+    __in DldAuditOperation operation,
+    __in UInt32 selector,
+    __in IOReturn result
+    )
+{
+    DldAuditEvent         event;
+    DldAuditEventQueue*   queue;
+    boolean_t             interruptsState;
+    
+    if( NULL == gAuditEventQueue )
+        return;
+    
     //
-    // allow access
+    // this is called in the caller's Mach message path, so only a slot reservation
+    // and a copy are done here, the processing is done by the queue's thread
     //
-    return kIOReturnSuccess;
+    clock_get_uptime( &event.Timestamp );
+    strlcpy( event.ClientClassName,
+             reinterpret_cast<OSObject*>(this)->getMetaClass()->getClassName(),
+             sizeof( event.ClientClassName ) );
+    event.Client = (const void*)this;
+    event.Pid = proc_selfpid();
+    event.Operation = operation;
+    event.Selector = selector;
+    event.Result = result;
+    
+    interruptsState = DldEventChannels::ReadBegin();
+    {// start of the channels' section
+        
+        queue = gAuditEventQueue;
+        if( queue )
+            queue->enqueue( &event );
+        
+    }// end of the channels' section
+    DldEventChannels::ReadEnd( interruptsState );
 }
 
 //--------------------------------------------------------------------
@@ -334,7 +453,15 @@ IOUserClientDldHook<Depth>::getTargetAndMethodForIndex_hook( IOService ** target
     if( NULL == OSDynamicCast( IOUserClient, reinterpret_cast<IOService*>(this) ) )
         return NULL;
     
-    if( kIOReturnSuccess != this->IOUserClientDldHook<Depth>::checkAndLogUserClientAccess(commonHooker2) )
+    IOReturn  access;
+    
+    access = this->IOUserClientDldHook<Depth>::checkAndLogUserClientAccess(commonHooker2);
+    if( kIOReturnSuccess == access )
+        access = DldUserClientSelectorPolicy::CheckMethodIndex( reinterpret_cast<IOUserClient*>(this), index );
+    
+    this->IOUserClientDldHook<Depth>::auditUserClientAccess( DldAuditOperationMethodIndex, index, access );
+    
+    if( kIOReturnSuccess != access )
         return NULL;
     
     typedef IOExternalMethod* (*getTargetAndMethodForIndexFunc)( IOUserClient*, IOService ** targetP, UInt32 index );
@@ -497,7 +624,15 @@ IOUserClientDldHook<Depth>::externalMethod_hook( uint32_t selector, IOExternalMe
     if( NULL == OSDynamicCast( IOUserClient, reinterpret_cast<IOService*>(this) ) )
         return kIOReturnUnsupported;
     
-    if( kIOReturnSuccess != this->IOUserClientDldHook<Depth>::checkAndLogUserClientAccess(commonHooker2) )
+    IOReturn  access;
+    
+    access = this->IOUserClientDldHook<Depth>::checkAndLogUserClientAccess(commonHooker2);
+    if( kIOReturnSuccess == access )
+        access = DldUserClientSelectorPolicy::CheckExternalMethod( reinterpret_cast<IOUserClient*>(this), selector );
+    
+    this->IOUserClientDldHook<Depth>::auditUserClientAccess( DldAuditOperationExternalMethod, selector, access );
+    
+    if( kIOReturnSuccess != access )
         return kIOReturnNotPermitted;
     
     typedef IOReturn (*externalMethodFunc)( IOUserClient*, uint32_t selector, IOExternalMethodArguments * arguments,
@@ -510,7 +645,75 @@ IOUserClientDldHook<Depth>::externalMethod_hook( uint32_t selector, IOExternalMe
     if( !Original )
         return kIOReturnUnsupported;
     
-    return Original( reinterpret_cast<IOUserClient*>(this), selector, arguments, dispatch, target, reference );
+    if( NULL == gEventRing && NULL == gEventDataQueue )
+        return Original( reinterpret_cast<IOUserClient*>(this), selector, arguments, dispatch, target, reference );
+    
+    //
+    // export the call to the user space reader through the shared ring and the data queue
+    //
+    DldEventRecord      record;
+    DldEventRing*       ring;
+    DldEventDataQueue*  dataQueue;
+    UInt64              endTime;
+    IOReturn            RC;
+    boolean_t           interruptsState;
+    
+    clock_get_uptime( &record.Timestamp );
+    
+    RC = Original( reinterpret_cast<IOUserClient*>(this), selector, arguments, dispatch, target, reference );
+    
+    clock_get_uptime( &endTime );
+    
+    record.Duration = endTime - record.Timestamp;
+    record.Type = DLD_EVENT_TYPE_EXTERNAL_METHOD;
+    record.Hooker = 0x0;
+    record.HookIndex = IOUserClientDldHook<Depth>::kDld_externalMethod_hook;
+    record.Selector = selector;
+    record.Result = RC;
+    record.Pid = proc_selfpid();
+    
+    //
+    // the channels are loaded after the original call as the section must not block,
+    // the data queue's notification might block so the queue is referenced in the
+    // section and the record is enqueued after the section has been left
+    //
+    interruptsState = DldEventChannels::ReadBegin();
+    {// start of the channels' section
+        
+        ring = gEventRing;
+        dataQueue = gEventDataQueue;
+        
+        //
+        // the ring's identifiers are used for both channels if the ring exists
+        //
+        if( ring ){
+            
+            record.Object = ring->getObjectId( this );
+            record.MetaClass = ring->getObjectId( reinterpret_cast<IOUserClient*>(this)->getMetaClass() );
+            record.Thread = ring->getObjectId( current_thread() );
+            
+            ring->write( &record );
+            
+        } else if( dataQueue ){
+            
+            record.Object = dataQueue->getObjectId( this );
+            record.MetaClass = dataQueue->getObjectId( reinterpret_cast<IOUserClient*>(this)->getMetaClass() );
+            record.Thread = dataQueue->getObjectId( current_thread() );
+        }
+        
+        if( dataQueue )
+            dataQueue->retain();
+        
+    }// end of the channels' section
+    DldEventChannels::ReadEnd( interruptsState );
+    
+    if( dataQueue ){
+        
+        dataQueue->enqueue( &record, sizeof( record ) );
+        dataQueue->release();
+    }
+    
+    return RC;
 }
 
 //--------------------------------------------------------------------
@@ -596,7 +799,15 @@ IOUserClientDldHook<Depth>::clientMemoryForType_hook( UInt32 type,
     if( NULL == OSDynamicCast( IOUserClient, reinterpret_cast<IOService*>(this) ) )
         return kIOReturnUnsupported;
     
-    if( kIOReturnSuccess != this->IOUserClientDldHook<Depth>::checkAndLogUserClientAccess(commonHooker2) )
+    IOReturn  access;
+    
+    access = this->IOUserClientDldHook<Depth>::checkAndLogUserClientAccess(commonHooker2);
+    if( kIOReturnSuccess == access )
+        access = DldUserClientSelectorPolicy::CheckMemoryType( reinterpret_cast<IOUserClient*>(this), type );
+    
+    this->IOUserClientDldHook<Depth>::auditUserClientAccess( DldAuditOperationMemoryType, type, access );
+    
+    if( kIOReturnSuccess != access )
         return kIOReturnNotPermitted;
     
     typedef IOReturn (*clientMemoryForTypeFunc)( IOUserClient*, UInt32 type,
@@ -649,4 +860,70 @@ IOUserClientDldHook<Depth>::getNotificationSemaphore_hook( UInt32 notification_t
 
 //--------------------------------------------------------------------
 
+//
+// a user client is closed by a user or the owning task died, the cached
+// decisions are invalidated after the original function returns as the client
+// has been detached by then, the client's address might be reused only after
+// the client has been freed, see fObjectUnHooked()
+//
+template<DldInheritanceDepth Depth>
+IOReturn
+IOUserClientDldHook<Depth>::clientClose_hook( void )
+{
+    DldHookerCommonClass2<IOUserClientDldHook<Depth>,IOUserClient>*  commonHooker2;
+    IOReturn                                                        RC;
+    
+    commonHooker2 = DldHookerCommonClass2<IOUserClientDldHook<Depth>,IOUserClient>::fCommonHooker2();
+    assert( commonHooker2 );
+    if( NULL == commonHooker2 )
+        return kIOReturnUnsupported;
+    
+    typedef IOReturn (*clientCloseFunc)( IOUserClient* );
+    
+    clientCloseFunc Original = (clientCloseFunc)commonHooker2->fGetOriginalFunctionExternal(
+       (OSObject*)this,
+       IOUserClientDldHook<Depth>::kDld_clientClose_hook );
+    assert( Original );
+    if( !Original )
+        return kIOReturnUnsupported;
+    
+    RC = Original( reinterpret_cast<IOUserClient*>(this) );
+    
+    DldUserClientAccessCache::InvalidateClient( reinterpret_cast<IOUserClient*>(this) );
+    
+    return RC;
+}
+
+//--------------------------------------------------------------------
+
+template<DldInheritanceDepth Depth>
+IOReturn
+IOUserClientDldHook<Depth>::clientDied_hook( void )
+{
+    DldHookerCommonClass2<IOUserClientDldHook<Depth>,IOUserClient>*  commonHooker2;
+    IOReturn                                                        RC;
+    
+    commonHooker2 = DldHookerCommonClass2<IOUserClientDldHook<Depth>,IOUserClient>::fCommonHooker2();
+    assert( commonHooker2 );
+    if( NULL == commonHooker2 )
+        return kIOReturnUnsupported;
+    
+    typedef IOReturn (*clientDiedFunc)( IOUserClient* );
+    
+    clientDiedFunc Original = (clientDiedFunc)commonHooker2->fGetOriginalFunctionExternal(
+       (OSObject*)this,
+       IOUserClientDldHook<Depth>::kDld_clientDied_hook );
+    assert( Original );
+    if( !Original )
+        return kIOReturnUnsupported;
+    
+    RC = Original( reinterpret_cast<IOUserClient*>(this) );
+    
+    DldUserClientAccessCache::InvalidateClient( reinterpret_cast<IOUserClient*>(this) );
+    
+    return RC;
+}
+
+//--------------------------------------------------------------------
+
 #endif//IOUSERCLIENTDLDHOOK_H
\ No newline at end of file
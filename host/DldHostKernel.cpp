@@ -0,0 +1,1239 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include "DldCommon.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+//
+// the kernel's interfaces implementation for the host build, see DldHostKernel.h
+//
+
+//--------------------------------------------------------------------
+
+void
+DldHostAssertionFailed(
+    __in const char* expression,
+    __in const char* file,
+    __in int line
+    )
+{
+    fprintf( stderr, "assertion \"%s\" failed at %s:%d\n", expression, file, line );
+    fflush( stderr );
+    abort();
+}
+
+//--------------------------------------------------------------------
+
+void
+panic(
+    __in const char* format,
+    ...
+    )
+{
+    va_list  args;
+
+    va_start( args, format );
+    fprintf( stderr, "panic: " );
+    vfprintf( stderr, format, args );
+    fprintf( stderr, "\n" );
+    va_end( args );
+
+    fflush( stderr );
+    abort();
+}
+
+//--------------------------------------------------------------------
+
+void
+IOLog(
+    __in const char* format,
+    ...
+    )
+{
+    va_list  args;
+
+    va_start( args, format );
+    vfprintf( stderr, format, args );
+    va_end( args );
+}
+
+//--------------------------------------------------------------------
+
+void
+IOSleep(
+    __in unsigned int milliseconds
+    )
+{
+    usleep( (useconds_t)milliseconds*1000 );
+}
+
+void
+IODelay(
+    __in unsigned int microseconds
+    )
+{
+    usleep( (useconds_t)microseconds );
+}
+
+//--------------------------------------------------------------------
+
+void*
+IOMalloc(
+    __in vm_size_t size
+    )
+{
+    return malloc( size );
+}
+
+void
+IOFree(
+    __in void* address,
+    __in vm_size_t size
+    )
+{
+    free( address );
+}
+
+void*
+IOMallocAligned(
+    __in vm_size_t size,
+    __in vm_size_t alignment
+    )
+{
+    void*  address;
+
+    if( alignment < sizeof( void* ) )
+        alignment = sizeof( void* );
+
+    if( 0x0 != posix_memalign( &address, alignment, size ) )
+        return NULL;
+
+    return address;
+}
+
+void
+IOFreeAligned(
+    __in void* address,
+    __in vm_size_t size
+    )
+{
+    free( address );
+}
+
+void*
+mac_kalloc(
+    __in vm_size_t size,
+    __in int how
+    )
+{
+    return malloc( size );
+}
+
+void
+mac_kfree(
+    __in void* data,
+    __in vm_size_t size
+    )
+{
+    free( data );
+}
+
+//--------------------------------------------------------------------
+
+struct _IORWLock{
+    pthread_rwlock_t  Lock;
+};
+
+struct _IOLock{
+    pthread_mutex_t   Lock;
+};
+
+struct _IOSimpleLock{
+    pthread_mutex_t   Lock;
+};
+
+IORWLock*
+IORWLockAlloc( void )
+{
+    IORWLock*  lock = (IORWLock*)malloc( sizeof( *lock ) );
+
+    if( NULL != lock )
+        pthread_rwlock_init( &lock->Lock, NULL );
+
+    return lock;
+}
+
+void IORWLockFree( IORWLock* lock ){ pthread_rwlock_destroy( &lock->Lock ); free( lock ); }
+void IORWLockRead( IORWLock* lock ){ pthread_rwlock_rdlock( &lock->Lock ); }
+void IORWLockWrite( IORWLock* lock ){ pthread_rwlock_wrlock( &lock->Lock ); }
+void IORWLockUnlock( IORWLock* lock ){ pthread_rwlock_unlock( &lock->Lock ); }
+
+IOLock*
+IOLockAlloc( void )
+{
+    IOLock*  lock = (IOLock*)malloc( sizeof( *lock ) );
+
+    if( NULL != lock )
+        pthread_mutex_init( &lock->Lock, NULL );
+
+    return lock;
+}
+
+void IOLockFree( IOLock* lock ){ pthread_mutex_destroy( &lock->Lock ); free( lock ); }
+void IOLockLock( IOLock* lock ){ pthread_mutex_lock( &lock->Lock ); }
+void IOLockUnlock( IOLock* lock ){ pthread_mutex_unlock( &lock->Lock ); }
+
+IOSimpleLock*
+IOSimpleLockAlloc( void )
+{
+    IOSimpleLock*  lock = (IOSimpleLock*)malloc( sizeof( *lock ) );
+
+    if( NULL != lock )
+        pthread_mutex_init( &lock->Lock, NULL );
+
+    return lock;
+}
+
+void IOSimpleLockFree( IOSimpleLock* lock ){ pthread_mutex_destroy( &lock->Lock ); free( lock ); }
+void IOSimpleLockLock( IOSimpleLock* lock ){ pthread_mutex_lock( &lock->Lock ); }
+void IOSimpleLockUnlock( IOSimpleLock* lock ){ pthread_mutex_unlock( &lock->Lock ); }
+
+IOInterruptState
+IOSimpleLockLockDisableInterrupt(
+    __in IOSimpleLock* lock
+    )
+{
+    IOInterruptState  state = ml_set_interrupts_enabled( FALSE );
+
+    pthread_mutex_lock( &lock->Lock );
+    return state;
+}
+
+void
+IOSimpleLockUnlockEnableInterrupt(
+    __in IOSimpleLock* lock,
+    __in IOInterruptState state
+    )
+{
+    pthread_mutex_unlock( &lock->Lock );
+    ml_set_interrupts_enabled( state );
+}
+
+//--------------------------------------------------------------------
+
+//
+// a thread is a CPU, the slot is returned to the pool on the thread's exit
+//
+static pthread_mutex_t  gCpusLock = PTHREAD_MUTEX_INITIALIZER;
+static bool             gCpusUsed[ DLD_HOST_MAX_CPUS ];
+static pthread_key_t    gCpuKey;
+static pthread_once_t   gCpuKeyOnce = PTHREAD_ONCE_INIT;
+
+static __thread int           tCpu = (-1);
+static __thread boolean_t     tInterruptsDisabled = FALSE;
+static __thread unsigned int  tPreemptionLevel = 0x0;
+static __thread char          tThreadId;
+
+static
+void
+DldHostReleaseCpu(
+    __in void* value
+    )
+{
+    int  cpu = (int)( (uintptr_t)value - 0x1 );
+
+    pthread_mutex_lock( &gCpusLock );
+    {// start of the lock
+        gCpusUsed[ cpu ] = false;
+    }// end of the lock
+    pthread_mutex_unlock( &gCpusLock );
+}
+
+static
+void
+DldHostCreateCpuKey( void )
+{
+    pthread_key_create( &gCpuKey, DldHostReleaseCpu );
+}
+
+int
+cpu_number( void )
+{
+    if( tCpu >= 0x0 )
+        return tCpu;
+
+    pthread_once( &gCpuKeyOnce, DldHostCreateCpuKey );
+
+    pthread_mutex_lock( &gCpusLock );
+    {// start of the lock
+        for( int cpu = 0x0; cpu < DLD_HOST_MAX_CPUS && tCpu < 0x0; ++cpu ){
+
+            if( !gCpusUsed[ cpu ] ){
+
+                gCpusUsed[ cpu ] = true;
+                tCpu = cpu;
+            }
+        }// end for
+    }// end of the lock
+    pthread_mutex_unlock( &gCpusLock );
+
+    if( tCpu < 0x0 )
+        panic( "more than %u threads use the CPU slots", (unsigned int)DLD_HOST_MAX_CPUS );
+
+    pthread_setspecific( gCpuKey, (void*)( (uintptr_t)tCpu + 0x1 ) );
+
+    return tCpu;
+}
+
+int
+ml_get_max_cpus( void )
+{
+    return DLD_HOST_MAX_CPUS;
+}
+
+boolean_t
+ml_set_interrupts_enabled(
+    __in boolean_t enable
+    )
+{
+    boolean_t  wasEnabled = !tInterruptsDisabled;
+
+    tInterruptsDisabled = !enable;
+    return wasEnabled;
+}
+
+int
+preemption_enabled( void )
+{
+    return ( !tInterruptsDisabled && 0x0 == tPreemptionLevel );
+}
+
+void disable_preemption( void ){ ++tPreemptionLevel; }
+void enable_preemption( void ){ assert( tPreemptionLevel > 0x0 ); --tPreemptionLevel; }
+
+thread_t current_thread( void ){ return (thread_t)&tThreadId; }
+task_t current_task( void ){ return (task_t)&gCpusLock; }
+int proc_selfpid( void ){ return (int)getpid(); }
+
+void
+proc_selfname(
+    __out char* buffer,
+    __in int size
+    )
+{
+    snprintf( buffer, size, "%s", "dldhost" );
+}
+
+//--------------------------------------------------------------------
+
+//
+// see DldHostClockSimulate()
+//
+static volatile bool      gClockSimulated = false;
+static volatile uint64_t  gSimulatedTime = 0x0;
+
+uint64_t
+mach_absolute_time( void )
+{
+    struct timespec  now;
+
+    if( __atomic_load_n( &gClockSimulated, __ATOMIC_ACQUIRE ) )
+        return __atomic_load_n( &gSimulatedTime, __ATOMIC_ACQUIRE );
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (uint64_t)now.tv_sec*1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+void clock_get_uptime( uint64_t* result ){ *result = mach_absolute_time(); }
+void absolutetime_to_nanoseconds( uint64_t abstime, uint64_t* result ){ *result = abstime; }
+void nanoseconds_to_absolutetime( uint64_t nanoseconds, uint64_t* result ){ *result = nanoseconds; }
+
+void
+clock_interval_to_deadline(
+    __in UInt32 interval,
+    __in UInt32 scaleFactor,
+    __out uint64_t* result
+    )
+{
+    *result = mach_absolute_time() + (uint64_t)interval*scaleFactor;
+}
+
+//--------------------------------------------------------------------
+
+//
+// a thread call is pending while its deadline is set, there are a few
+// thread calls so the list is searched for the earliest deadline
+//
+struct _thread_call{
+    thread_call_t        Next;
+    thread_call_func_t   Func;
+    thread_call_param_t  Param0;
+    uint64_t             Deadline;
+    bool                 Pending;
+};
+
+static pthread_mutex_t  gThreadCallsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   gThreadCallsEvent;
+static pthread_once_t   gThreadCallsOnce = PTHREAD_ONCE_INIT;
+static thread_call_t    gThreadCalls = NULL;
+
+//
+// must be called with gThreadCallsLock held
+//
+static
+thread_call_t
+DldHostEarliestThreadCall( void )
+{
+    thread_call_t  earliest = NULL;
+
+    for( thread_call_t call = gThreadCalls; NULL != call; call = call->Next ){
+
+        if( call->Pending && ( NULL == earliest || call->Deadline < earliest->Deadline ) )
+            earliest = call;
+    }// end for
+
+    return earliest;
+}
+
+//--------------------------------------------------------------------
+
+//
+// a thread call is run with gThreadCallsLock held on entry and on exit,
+// the lock is released for the call as the routine can enter the call
+// again or free it, the call is not touched after the routine returns
+//
+static
+void
+DldHostRunThreadCall(
+    __in thread_call_t call
+    )
+{
+    thread_call_func_t   func = call->Func;
+    thread_call_param_t  param0 = call->Param0;
+
+    call->Pending = false;
+
+    pthread_mutex_unlock( &gThreadCallsLock );
+    func( param0, NULL );
+    pthread_mutex_lock( &gThreadCallsLock );
+}
+
+//--------------------------------------------------------------------
+
+static
+void*
+DldHostThreadCallsThread(
+    __in void* context
+    )
+{
+    pthread_mutex_lock( &gThreadCallsLock );
+
+    while( true ){
+
+        //
+        // the simulated clock's calls are run by DldHostClockAdvance()
+        //
+        thread_call_t  call = gClockSimulated ? NULL : DldHostEarliestThreadCall();
+
+        if( NULL == call ){
+
+            pthread_cond_wait( &gThreadCallsEvent, &gThreadCallsLock );
+
+        } else if( call->Deadline > mach_absolute_time() ){
+
+            struct timespec  deadline;
+
+            deadline.tv_sec = (time_t)( call->Deadline / 1000000000ull );
+            deadline.tv_nsec = (long)( call->Deadline % 1000000000ull );
+
+            pthread_cond_timedwait( &gThreadCallsEvent, &gThreadCallsLock, &deadline );
+
+        } else {
+
+            DldHostRunThreadCall( call );
+        }
+    }// end while
+
+    return NULL;
+}
+
+//--------------------------------------------------------------------
+
+static
+void
+DldHostThreadCallsInit( void )
+{
+    pthread_condattr_t  attributes;
+    pthread_t           thread;
+
+    //
+    // the deadlines are in the mach_absolute_time() units
+    //
+    pthread_condattr_init( &attributes );
+    pthread_condattr_setclock( &attributes, CLOCK_MONOTONIC );
+    pthread_cond_init( &gThreadCallsEvent, &attributes );
+    pthread_condattr_destroy( &attributes );
+
+    if( 0x0 != pthread_create( &thread, NULL, DldHostThreadCallsThread, NULL ) )
+        panic( "the thread calls' thread can't be created" );
+
+    pthread_detach( thread );
+}
+
+//--------------------------------------------------------------------
+
+thread_call_t
+thread_call_allocate(
+    __in thread_call_func_t func,
+    __in thread_call_param_t param0
+    )
+{
+    thread_call_t  call;
+
+    pthread_once( &gThreadCallsOnce, DldHostThreadCallsInit );
+
+    call = (thread_call_t)calloc( 0x1, sizeof( *call ) );
+    if( NULL == call )
+        return NULL;
+
+    call->Func = func;
+    call->Param0 = param0;
+
+    pthread_mutex_lock( &gThreadCallsLock );
+    {// start of the lock
+
+        call->Next = gThreadCalls;
+        gThreadCalls = call;
+
+    }// end of the lock
+    pthread_mutex_unlock( &gThreadCallsLock );
+
+    return call;
+}
+
+//--------------------------------------------------------------------
+
+boolean_t
+thread_call_free(
+    __in thread_call_t call
+    )
+{
+    pthread_mutex_lock( &gThreadCallsLock );
+    {// start of the lock
+
+        //
+        // as the kernel, a pending call is not freed
+        //
+        if( call->Pending ){
+
+            pthread_mutex_unlock( &gThreadCallsLock );
+            return FALSE;
+        }
+
+        for( thread_call_t* link = &gThreadCalls; NULL != *link; link = &(*link)->Next ){
+
+            if( *link == call ){
+
+                *link = call->Next;
+                break;
+            }
+        }// end for
+
+    }// end of the lock
+    pthread_mutex_unlock( &gThreadCallsLock );
+
+    free( call );
+    return TRUE;
+}
+
+//--------------------------------------------------------------------
+
+boolean_t
+thread_call_enter_delayed(
+    __in thread_call_t call,
+    __in uint64_t deadline
+    )
+{
+    boolean_t  pending;
+
+    pthread_mutex_lock( &gThreadCallsLock );
+    {// start of the lock
+
+        pending = call->Pending ? TRUE : FALSE;
+
+        call->Deadline = deadline;
+        call->Pending = true;
+
+        pthread_cond_signal( &gThreadCallsEvent );
+
+    }// end of the lock
+    pthread_mutex_unlock( &gThreadCallsLock );
+
+    return pending;
+}
+
+//--------------------------------------------------------------------
+
+boolean_t
+thread_call_cancel(
+    __in thread_call_t call
+    )
+{
+    boolean_t  pending;
+
+    pthread_mutex_lock( &gThreadCallsLock );
+    {// start of the lock
+
+        pending = call->Pending ? TRUE : FALSE;
+        call->Pending = false;
+
+    }// end of the lock
+    pthread_mutex_unlock( &gThreadCallsLock );
+
+    return pending;
+}
+
+//--------------------------------------------------------------------
+
+void
+DldHostClockSimulate(
+    __in uint64_t startTime
+    )
+{
+    pthread_mutex_lock( &gThreadCallsLock );
+    {// start of the lock
+
+        __atomic_store_n( &gSimulatedTime, startTime, __ATOMIC_RELEASE );
+        __atomic_store_n( &gClockSimulated, true, __ATOMIC_RELEASE );
+
+    }// end of the lock
+    pthread_mutex_unlock( &gThreadCallsLock );
+}
+
+//--------------------------------------------------------------------
+
+void
+DldHostClockAdvance(
+    __in uint64_t nanoseconds
+    )
+{
+    uint64_t       time;
+    thread_call_t  call;
+
+    assert( gClockSimulated );
+
+    pthread_mutex_lock( &gThreadCallsLock );
+    {// start of the lock
+
+        time = gSimulatedTime + nanoseconds;
+
+        //
+        // a call can enter itself or another call with a deadline before
+        // the time so the earliest call is searched for after each call
+        //
+        for( call = DldHostEarliestThreadCall(); NULL != call && call->Deadline <= time; call = DldHostEarliestThreadCall() ){
+
+            //
+            // the clock is not moved back for a call entered with a passed deadline
+            //
+            if( call->Deadline > gSimulatedTime )
+                __atomic_store_n( &gSimulatedTime, call->Deadline, __ATOMIC_RELEASE );
+
+            DldHostRunThreadCall( call );
+        }// end for
+
+        __atomic_store_n( &gSimulatedTime, time, __ATOMIC_RELEASE );
+
+    }// end of the lock
+    pthread_mutex_unlock( &gThreadCallsLock );
+}
+
+//--------------------------------------------------------------------
+
+bool
+DldHostIsAddressMapped(
+    __in vm_offset_t address
+    )
+{
+    //
+    // msync() fails with ENOMEM for an unmapped page
+    //
+    return !( 0x0 != msync( (void*)( address & ~(vm_offset_t)PAGE_MASK ), PAGE_SIZE, MS_ASYNC ) && ENOMEM == errno );
+}
+
+//--------------------------------------------------------------------
+
+//
+// the writable ranges found or made by DldHostWriteProtectedMemory(), the vtables
+// are written on every hook and unhook so the mappings are not parsed every time
+//
+#define DLD_HOST_WRITABLE_RANGES    (32)
+
+static pthread_mutex_t  gWritableLock = PTHREAD_MUTEX_INITIALIZER;
+static vm_offset_t      gWritableRanges[ DLD_HOST_WRITABLE_RANGES ][ 2 ];
+static unsigned int     gWritableRangesNumber = 0x0;
+
+static
+bool
+DldHostMakePageWritable(
+    __in vm_offset_t page
+    )
+/*
+ called with gWritableLock held, the vtables are in the read only data,
+ the page is left writable
+ */
+{
+    vm_offset_t  start = page;
+    vm_offset_t  end = page + PAGE_SIZE;
+    int          protection = PROT_READ;
+    
+    for( unsigned int i = 0x0; i < gWritableRangesNumber; ++i ){
+        
+        if( page >= gWritableRanges[ i ][ 0 ] && page < gWritableRanges[ i ][ 1 ] )
+            return true;
+    }// end for
+    
+#if defined(__linux__)
+    {
+        FILE*  maps;
+        char   line[ 512 ];
+        
+        maps = fopen( "/proc/self/maps", "r" );
+        if( NULL != maps ){
+            
+            while( fgets( line, sizeof( line ), maps ) ){
+                
+                unsigned long  mapStart;
+                unsigned long  mapEnd;
+                char           permissions[ 5 ];
+                
+                if( 0x3 == sscanf( line, "%lx-%lx %4s", &mapStart, &mapEnd, permissions ) &&
+                    page >= mapStart && page < mapEnd ){
+                    
+                    protection = ( 'r' == permissions[ 0 ] ? PROT_READ : 0x0 ) |
+                                 ( 'w' == permissions[ 1 ] ? PROT_WRITE : 0x0 ) |
+                                 ( 'x' == permissions[ 2 ] ? PROT_EXEC : 0x0 );
+                    
+                    if( protection & PROT_WRITE ){
+                        
+                        start = mapStart;
+                        end = mapEnd;
+                    }
+                    break;
+                }
+            }// end while
+            
+            fclose( maps );
+        }
+    }
+#endif//__linux__
+    
+    if( 0x0 == ( protection & PROT_WRITE ) &&
+        0x0 != mprotect( (void*)page, PAGE_SIZE, protection | PROT_WRITE ) )
+        return false;
+    
+    if( gWritableRangesNumber == DLD_HOST_WRITABLE_RANGES )
+        gWritableRangesNumber = 0x0;
+    
+    gWritableRanges[ gWritableRangesNumber ][ 0 ] = start;
+    gWritableRanges[ gWritableRangesNumber ][ 1 ] = end;
+    ++gWritableRangesNumber;
+    
+    return true;
+}
+
+bool
+DldHostWriteProtectedMemory(
+    __in vm_offset_t dst,
+    __in vm_offset_t src,
+    __in vm_size_t length
+    )
+/*
+ the kernel writes the vtables through the physical memory mapping,
+ the user space makes the pages writable
+ */
+{
+    bool  writable = true;
+    
+    pthread_mutex_lock( &gWritableLock );
+    {// start of the lock
+        for( vm_offset_t page = dst & ~(vm_offset_t)PAGE_MASK; page < dst + length && writable; page += PAGE_SIZE )
+            writable = DldHostMakePageWritable( page );
+    }// end of the lock
+    pthread_mutex_unlock( &gWritableLock );
+    
+    if( !writable )
+        return false;
+    
+    memcpy( (void*)dst, (const void*)src, length );
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+//
+// the classes' list, the head is zero initialized before the constructors are called
+//
+static const OSMetaClass*  gClasses = NULL;
+
+OSMetaClass::OSMetaClass(
+    __in const char* className,
+    __in const OSMetaClass* superClass,
+    __in unsigned int classSize
+    ) : ClassName( className ), SuperClass( superClass ), ClassSize( classSize ), InstanceCount( 0x0 )
+{
+    this->Next = gClasses;
+    gClasses = this;
+}
+
+void
+OSMetaClass::instanceConstructed() const
+{
+    OSIncrementAtomic( &const_cast<OSMetaClass*>( this )->InstanceCount );
+}
+
+void
+OSMetaClass::instanceDestructed() const
+{
+    OSDecrementAtomic( &const_cast<OSMetaClass*>( this )->InstanceCount );
+}
+
+const OSMetaClassBase*
+OSMetaClass::checkMetaCast(
+    __in const OSMetaClassBase* object
+    ) const
+{
+    return OSMetaClassBase::safeMetaCast( object, this );
+}
+
+const OSMetaClass*
+OSMetaClass::getMetaClassWithName(
+    __in const char* name
+    )
+{
+    for( const OSMetaClass* metaClass = gClasses; NULL != metaClass; metaClass = metaClass->Next ){
+
+        if( 0x0 == strcmp( metaClass->ClassName, name ) )
+            return metaClass;
+    }// end for
+
+    return NULL;
+}
+
+const OSMetaClass*
+OSMetaClass::getMetaClassWithName(
+    __in const OSSymbol* name
+    )
+{
+    return ( NULL == name ) ? NULL : OSMetaClass::getMetaClassWithName( name->getCStringNoCopy() );
+}
+
+OSMetaClassBase*
+OSMetaClass::checkMetaCastWithName(
+    __in const char* name,
+    __in const OSMetaClassBase* object
+    )
+{
+    return OSMetaClassBase::safeMetaCast( object, OSMetaClass::getMetaClassWithName( name ) );
+}
+
+//--------------------------------------------------------------------
+
+bool
+OSMetaClassBase::isEqualTo(
+    __in const OSMetaClassBase* object
+    ) const
+{
+    return ( this == object );
+}
+
+OSMetaClassBase*
+OSMetaClassBase::safeMetaCast(
+    __in const OSMetaClassBase* object,
+    __in const OSMetaClass* toType
+    )
+{
+    if( NULL == object || NULL == toType )
+        return NULL;
+
+    for( const OSMetaClass* metaClass = object->getMetaClass(); NULL != metaClass; metaClass = metaClass->getSuperClass() ){
+
+        if( metaClass == toType )
+            return const_cast<OSMetaClassBase*>( object );
+    }// end for
+
+    return NULL;
+}
+
+//--------------------------------------------------------------------
+
+const OSMetaClass         OSObject::gMetaClass( "OSObject", NULL, sizeof( OSObject ) );
+const OSMetaClass* const  OSObject::metaClass = &OSObject::gMetaClass;
+
+OSObject::OSObject() : RetainCount( 0x1 )
+{
+    OSObject::gMetaClass.instanceConstructed();
+}
+
+OSObject::~OSObject()
+{
+    OSObject::gMetaClass.instanceDestructed();
+}
+
+const OSMetaClass* OSObject::getMetaClass() const { return &OSObject::gMetaClass; }
+int  OSObject::getRetainCount() const { return (int)this->RetainCount; }
+void OSObject::retain() const { OSIncrementAtomic( &this->RetainCount ); }
+bool OSObject::init(){ return true; }
+void OSObject::free(){ delete this; }
+
+void
+OSObject::release() const
+{
+    assert( this->RetainCount > 0x0 );
+
+    if( 0x1 == OSDecrementAtomic( &this->RetainCount ) )
+        const_cast<OSObject*>( this )->free();
+}
+
+void*
+OSObject::operator new(
+    __in size_t size
+    )
+{
+    //
+    // the kernel zeroes the OSObject's memory
+    //
+    return calloc( 0x1, size );
+}
+
+void
+OSObject::operator delete(
+    __in void* memory,
+    __in size_t size
+    )
+{
+    ::free( memory );
+}
+
+//
+// libkern's operator new allocates with kern_os_malloc() which zeroes the memory,
+// the hooker's classes which are not OSObjects rely on this, e.g. the hooked
+// functions array of DldHookerCommonClass2 which is checked to be empty before
+// a hooking function is added
+//
+void*
+operator new(
+    __in size_t size
+    )
+{
+    void*  memory = calloc( 0x1, size ? size : 0x1 );
+
+    if( NULL == memory )
+        abort();
+
+    return memory;
+}
+
+void*
+operator new[](
+    __in size_t size
+    )
+{
+    return ::operator new( size );
+}
+
+void
+operator delete(
+    __in void* memory
+    ) noexcept
+{
+    ::free( memory );
+}
+
+void
+operator delete[](
+    __in void* memory
+    ) noexcept
+{
+    ::free( memory );
+}
+
+void
+operator delete(
+    __in void* memory,
+    __in size_t size
+    ) noexcept
+{
+    ::free( memory );
+}
+
+void
+operator delete[](
+    __in void* memory,
+    __in size_t size
+    ) noexcept
+{
+    ::free( memory );
+}
+
+//--------------------------------------------------------------------
+
+OSDefineMetaClassAndStructors( OSString, OSObject )
+
+OSString*
+OSString::withCString(
+    __in const char* cString
+    )
+{
+    OSString*  string = new OSString;
+
+    if( NULL != string && !string->init( cString ) ){
+
+        string->release();
+        return NULL;
+    }
+
+    return string;
+}
+
+bool
+OSString::init(
+    __in const char* cString
+    )
+{
+    if( !OSObject::init() )
+        return false;
+
+    this->Length = (unsigned int)strlen( cString );
+    this->String = (char*)IOMalloc( this->Length + 0x1 );
+    if( NULL == this->String )
+        return false;
+
+    memcpy( this->String, cString, this->Length + 0x1 );
+    return true;
+}
+
+void
+OSString::free()
+{
+    if( NULL != this->String )
+        IOFree( this->String, this->Length + 0x1 );
+
+    OSObject::free();
+}
+
+bool
+OSString::isEqualTo(
+    __in const char* cString
+    ) const
+{
+    return ( NULL != this->String && 0x0 == strcmp( this->String, cString ) );
+}
+
+bool
+OSString::isEqualTo(
+    __in const OSMetaClassBase* object
+    ) const
+{
+    const OSString*  string = OSDynamicCast( OSString, object );
+
+    return ( NULL != string && this->isEqualTo( string->getCStringNoCopy() ) );
+}
+
+OSDefineMetaClassAndStructors( OSSymbol, OSString )
+
+const OSSymbol*
+OSSymbol::withCString(
+    __in const char* cString
+    )
+{
+    OSSymbol*  symbol = new OSSymbol;
+
+    if( NULL != symbol && !symbol->init( cString ) ){
+
+        symbol->release();
+        return NULL;
+    }
+
+    return symbol;
+}
+
+//--------------------------------------------------------------------
+
+OSDefineMetaClassAndStructors( IORegistryPlane, OSObject )
+OSDefineMetaClassAndStructors( IORegistryEntry, OSObject )
+OSDefineMetaClassAndStructors( IOService, IORegistryEntry )
+OSDefineMetaClassAndAbstractStructors( IOUserClient, IOService )
+
+const IORegistryPlane*  gIOServicePlane = new IORegistryPlane;
+
+bool IORegistryEntry::attachToChild( IORegistryEntry* child, const IORegistryPlane* plane ){ return true; }
+void IORegistryEntry::setPropertyTable( OSDictionary* dict ){}
+bool IORegistryEntry::setProperty( const OSSymbol* aKey, OSObject* anObject ){ return true; }
+bool IORegistryEntry::setProperty( const OSString* aKey, OSObject* anObject ){ return true; }
+bool IORegistryEntry::setProperty( const char* aKey, OSObject* anObject ){ return true; }
+bool IORegistryEntry::setProperty( const char* aKey, const char* aString ){ return true; }
+bool IORegistryEntry::setProperty( const char* aKey, bool aBoolean ){ return true; }
+bool IORegistryEntry::setProperty( const char* aKey, unsigned long long aValue, unsigned int aNumberOfBits ){ return true; }
+bool IORegistryEntry::setProperty( const char* aKey, void* bytes, unsigned int length ){ return true; }
+void IORegistryEntry::removeProperty( const OSSymbol* aKey ){}
+void IORegistryEntry::removeProperty( const OSString* aKey ){}
+void IORegistryEntry::removeProperty( const char* aKey ){}
+OSObject* IORegistryEntry::getProperty( const char* aKey ) const { return NULL; }
+const char* IORegistryEntry::getName( const IORegistryPlane* plane ) const { return this->getMetaClass()->getClassName(); }
+
+bool IOService::start( IOService* provider ){ return true; }
+void IOService::stop( IOService* provider ){}
+bool IOService::open( IOService* forClient, IOOptionBits options, void* arg ){ return true; }
+void IOService::close( IOService* forClient, IOOptionBits options ){}
+bool IOService::requestTerminate( IOService* provider, IOOptionBits options ){ return true; }
+bool IOService::willTerminate( IOService* provider, IOOptionBits options ){ return true; }
+bool IOService::didTerminate( IOService* provider, IOOptionBits options, bool* defer ){ return true; }
+bool IOService::terminate( IOOptionBits options ){ return true; }
+bool IOService::terminateClient( IOService* client, IOOptionBits options ){ return true; }
+bool IOService::finalize( IOOptionBits options ){ return true; }
+bool IOService::attach( IOService* provider ){ this->Provider = provider; return true; }
+void IOService::detach( IOService* provider ){ this->Provider = NULL; }
+IOService* IOService::getProvider() const { return this->Provider; }
+
+IOReturn
+IOService::newUserClient( task_t owningTask, void* securityID, UInt32 type, OSDictionary* properties, IOUserClient** handler )
+{
+    return kIOReturnUnsupported;
+}
+
+IOReturn
+IOService::newUserClient( task_t owningTask, void* securityID, UInt32 type, IOUserClient** handler )
+{
+    return kIOReturnUnsupported;
+}
+
+IOReturn IOUserClient::clientClose(){ return kIOReturnUnsupported; }
+IOReturn IOUserClient::clientDied(){ return this->clientClose(); }
+IOExternalMethod* IOUserClient::getExternalMethodForIndex( UInt32 index ){ return NULL; }
+IOExternalAsyncMethod* IOUserClient::getExternalAsyncMethodForIndex( UInt32 index ){ return NULL; }
+IOExternalMethod* IOUserClient::getTargetAndMethodForIndex( IOService** targetP, UInt32 index ){ return NULL; }
+IOExternalAsyncMethod* IOUserClient::getAsyncTargetAndMethodForIndex( IOService** targetP, UInt32 index ){ return NULL; }
+IOExternalTrap* IOUserClient::getExternalTrapForIndex( UInt32 index ){ return NULL; }
+IOExternalTrap* IOUserClient::getTargetAndTrapForIndex( IOService** targetP, UInt32 index ){ return NULL; }
+
+IOReturn
+IOUserClient::externalMethod( uint32_t selector, IOExternalMethodArguments* arguments,
+                              IOExternalMethodDispatch* dispatch, OSObject* target, void* reference )
+{
+    return kIOReturnUnsupported;
+}
+
+IOReturn IOUserClient::registerNotificationPort( mach_port_t port, UInt32 type, io_user_reference_t refCon ){ return kIOReturnUnsupported; }
+IOReturn IOUserClient::registerNotificationPort( mach_port_t port, UInt32 type, UInt32 refCon ){ return kIOReturnUnsupported; }
+IOReturn IOUserClient::clientMemoryForType( UInt32 type, IOOptionBits* options, IOMemoryDescriptor** memory ){ return kIOReturnUnsupported; }
+IOReturn IOUserClient::getNotificationSemaphore( UInt32 notification_type, semaphore_t* semaphore ){ return kIOReturnUnsupported; }
+
+//--------------------------------------------------------------------
+
+OSDefineMetaClassAndAbstractStructors( IOMemoryDescriptor, OSObject )
+OSDefineMetaClassAndStructors( IOBufferMemoryDescriptor, IOMemoryDescriptor )
+
+IOBufferMemoryDescriptor*
+IOBufferMemoryDescriptor::withOptions(
+    __in IOOptionBits options,
+    __in vm_size_t capacity,
+    __in vm_offset_t alignment
+    )
+{
+    IOBufferMemoryDescriptor*  descriptor;
+    void*                      buffer;
+
+    //
+    // the mapping is page aligned
+    //
+    if( 0x0 == capacity || alignment > PAGE_SIZE )
+        return NULL;
+
+    buffer = mmap( NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    if( MAP_FAILED == buffer )
+        return NULL;
+
+    descriptor = new IOBufferMemoryDescriptor;
+    descriptor->Buffer = buffer;
+    descriptor->Capacity = capacity;
+
+    return descriptor;
+}
+
+void
+IOBufferMemoryDescriptor::free()
+{
+    if( this->Buffer )
+        munmap( this->Buffer, this->Capacity );
+
+    IOMemoryDescriptor::free();
+}
+
+//--------------------------------------------------------------------
+
+OSDefineMetaClassAndStructors( IODataQueue, OSObject )
+
+Boolean
+IODataQueue::initWithCapacity(
+    __in UInt32 size
+    )
+{
+    vm_size_t  allocSize;
+
+    if( !OSObject::init() )
+        return false;
+
+    if( size > UINT32_MAX - DATA_QUEUE_MEMORY_HEADER_SIZE )
+        return false;
+
+    allocSize = ( size + DATA_QUEUE_MEMORY_HEADER_SIZE + PAGE_MASK ) & ~(vm_size_t)PAGE_MASK;
+
+    this->dataQueue = (IODataQueueMemory*)IOMallocAligned( allocSize, PAGE_SIZE );
+    if( NULL == this->dataQueue )
+        return false;
+
+    bzero( this->dataQueue, allocSize );
+    this->dataQueue->queueSize = size;
+
+    return true;
+}
+
+void
+IODataQueue::free()
+{
+    if( this->dataQueue ){
+
+        vm_size_t  allocSize = ( this->dataQueue->queueSize + DATA_QUEUE_MEMORY_HEADER_SIZE + PAGE_MASK ) & ~(vm_size_t)PAGE_MASK;
+
+        IOFreeAligned( this->dataQueue, allocSize );
+    }
+
+    OSObject::free();
+}
+
+void
+IODataQueue::sendDataAvailableNotification()
+{
+    if( this->notifyRoutine )
+        this->notifyRoutine( this, this->notifyContext );
+}
+
+void
+IODataQueue::setNotificationRoutine(
+    __in NotificationRoutine routine,
+    __in void* context
+    )
+{
+    this->notifyContext = context;
+    this->notifyRoutine = routine;
+}
+
+//--------------------------------------------------------------------
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include "DldCommonHashTable.h"
+#include "DldHostBenchmark.h"
+
+//
+// ght_get_ro() for every key against ght_get_many() for the same keys,
+// the keys are 8 bytes as the object keys of the hooked objects table,
+// half of the lookups miss as for HookObjects() which skips the hooked
+// objects, the small table fits the caches, the large table has as many
+// keys as the iterations, the default 4M keys take about 300 MB which
+// is more than the last level cache of the machines measured, the
+// table_bytes field tells whether it is so for a run
+//
+
+#define DLD_LOOKUP_SMALL_KEYS   (0x4000)
+
+//
+// ght_get_many() is called for this number of keys as HookObjects() does
+// for a bulk call
+//
+#define DLD_LOOKUP_CALL_KEYS    (0x100)
+
+typedef enum _DldLookupScenario{
+    DldLookupScenarioSequential = 0x0,
+    DldLookupScenarioBatched,
+    DldLookupScenarioMaximum
+} DldLookupScenario;
+
+static const char*  gLookupScenarioNames[ 0x2 ][ DldLookupScenarioMaximum ] = {
+    { "small_sequential", "small_batched" },
+    { "large_sequential", "large_batched" }
+};
+
+//--------------------------------------------------------------------
+
+static
+UInt64
+DldLookupRandom(
+    __inout UInt64* state
+    )
+{
+    //
+    // xorshift64*, the keys must not be clustered in the table's memory
+    //
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+//--------------------------------------------------------------------
+
+static
+void
+DldLookupRun(
+    __in unsigned int table,
+    __in unsigned long keysNumber,
+    __in unsigned long lookups
+    )
+{
+    ght_hash_table_t*  hashTable;
+    UInt64*            keys;
+    UInt64*            lookupKeys;
+    const void**       lookupKeysPtrs;
+    void**             found;
+    vm_size_t          tableBytes;
+    vm_size_t          entriesBytes;
+    UInt64             state = 0x9E3779B97F4A7C15ULL + keysNumber;
+    double             sequentialNs = 0.0;
+
+    hashTable = ght_create( (unsigned int)keysNumber, false, GHT_FLAGS_NONE );
+    keys = (UInt64*)malloc( keysNumber*sizeof( keys[ 0 ] ) );
+    lookupKeys = (UInt64*)malloc( lookups*sizeof( lookupKeys[ 0 ] ) );
+    lookupKeysPtrs = (const void**)malloc( lookups*sizeof( lookupKeysPtrs[ 0 ] ) );
+    found = (void**)malloc( DLD_LOOKUP_CALL_KEYS*sizeof( found[ 0 ] ) );
+    if( NULL == hashTable || NULL == keys || NULL == lookupKeys || NULL == lookupKeysPtrs || NULL == found ){
+
+        fprintf( stderr, "an allocation failed\n" );
+        exit( 1 );
+    }
+
+    for( unsigned long i = 0x0; i < keysNumber; ++i ){
+
+        keys[ i ] = DldLookupRandom( &state );
+
+        if( 0x0 != ght_insert( hashTable, (void*)&keys[ i ], sizeof( keys[ i ] ), &keys[ i ] ) ){
+
+            fprintf( stderr, "ght_insert failed\n" );
+            exit( 1 );
+        }
+    }// end for
+
+    //
+    // the odd lookups are for the keys which are not in the table
+    //
+    for( unsigned long i = 0x0; i < lookups; ++i ){
+
+        if( i & 0x1 )
+            lookupKeys[ i ] = DldLookupRandom( &state );
+        else
+            lookupKeys[ i ] = keys[ DldLookupRandom( &state ) % keysNumber ];
+
+        lookupKeysPtrs[ i ] = &lookupKeys[ i ];
+    }// end for
+
+    ght_memory_usage( hashTable, &tableBytes, &entriesBytes );
+
+    for( unsigned int scenario = 0x0; scenario < DldLookupScenarioMaximum; ++scenario ){
+
+        uint64_t  startTime;
+        uint64_t  elapsedNs;
+        uint64_t  hits = 0x0;
+        double    nsPerLookup;
+
+        startTime = DldBenchmarkNanoseconds();
+
+        if( DldLookupScenarioSequential == scenario ){
+
+            for( unsigned long i = 0x0; i < lookups; ++i )
+                hits += ( NULL != ght_get_ro( hashTable, sizeof( lookupKeys[ i ] ), &lookupKeys[ i ] ) ) ? 0x1 : 0x0;
+
+        } else {
+
+            for( unsigned long i = 0x0; i < lookups; i += DLD_LOOKUP_CALL_KEYS ){
+
+                unsigned int  count = ( lookups - i < DLD_LOOKUP_CALL_KEYS ) ? (unsigned int)( lookups - i ) : DLD_LOOKUP_CALL_KEYS;
+
+                ght_get_many( hashTable, sizeof( lookupKeys[ 0 ] ), &lookupKeysPtrs[ i ], count, found );
+
+                for( unsigned int j = 0x0; j < count; ++j )
+                    hits += ( NULL != found[ j ] ) ? 0x1 : 0x0;
+            }// end for
+        }
+
+        elapsedNs = DldBenchmarkNanoseconds() - startTime;
+        nsPerLookup = (double)elapsedNs/(double)( lookups ? lookups : 0x1 );
+
+        if( DldLookupScenarioSequential == scenario )
+            sequentialNs = nsPerLookup;
+
+        DldBenchmarkResultBegin( gLookupScenarioNames[ table ][ scenario ], 0x1 );
+        DldBenchmarkFieldUInt( "table_keys", keysNumber );
+        DldBenchmarkFieldUInt( "table_bytes", (uint64_t)( tableBytes + entriesBytes ) );
+        DldBenchmarkFieldUInt( "lookups", lookups );
+        DldBenchmarkFieldUInt( "found", hits );
+        DldBenchmarkFieldUInt( "elapsed_ns", elapsedNs );
+        DldBenchmarkFieldDouble( "ns_per_lookup", nsPerLookup );
+        DldBenchmarkFieldDouble( "speedup", sequentialNs/( nsPerLookup > 0.0 ? nsPerLookup : 1.0 ) );
+        DldBenchmarkResultEnd();
+
+    }// end for
+
+    free( found );
+    free( lookupKeysPtrs );
+    free( lookupKeys );
+    free( keys );
+    ght_finalize( hashTable );
+}
+
+//--------------------------------------------------------------------
+
+int
+main( int argc, char* argv[] )
+{
+    DldBenchmarkArguments  arguments;
+
+    DldBenchmarkParseArguments( argc, argv, 0x400000, &arguments );
+
+    DldBenchmarkBegin( "DldBatchedLookupBenchmark", &arguments );
+
+    DldLookupRun( 0x0, DLD_LOOKUP_SMALL_KEYS, arguments.Iterations );
+    DldLookupRun( 0x1, arguments.Iterations, arguments.Iterations );
+
+    DldBenchmarkEnd();
+
+    return 0;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include "DldHostTestClasses.h"
+#include "DldHostBenchmark.h"
+
+//
+// hooking and unhooking the objects of a class one by one against
+// HookObjects() and UnHookObjects() for all of them, for the object
+// hooks and for the vtable hooks which add an entry per object unless
+// the build has DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES, the objects number
+// is the iterations number, the time is per object
+//
+
+typedef DldHookerCommonClass2< DldTestServiceDldHook<DldInheritanceDepth_0,0>, DldTestService >  DldBulkObjectHooker;
+typedef DldHookerCommonClass2< DldTestServiceDldHook<DldInheritanceDepth_0,1>, DldTestService >  DldBulkVtableHooker;
+
+typedef enum _DldBulkScenario{
+    DldBulkScenarioObjectOneByOne = 0x0,
+    DldBulkScenarioObjectBulk,
+    DldBulkScenarioVtableOneByOne,
+    DldBulkScenarioVtableBulk,
+    DldBulkScenarioMaximum
+} DldBulkScenario;
+
+static const char*  gBulkScenarioNames[ DldBulkScenarioMaximum ] = {
+    "object_one_by_one",
+    "object_bulk",
+    "vtable_one_by_one",
+    "vtable_bulk"
+};
+
+//--------------------------------------------------------------------
+
+static
+IOReturn
+DldBulkHook(
+    __in DldBulkScenario scenario,
+    __inout OSObject** objects,
+    __in unsigned long count
+    )
+{
+    IOReturn  RC = kIOReturnSuccess;
+
+    switch( scenario ){
+
+        case DldBulkScenarioObjectOneByOne:
+            for( unsigned long i = 0x0; i < count && kIOReturnSuccess == RC; ++i )
+                RC = DldBulkObjectHooker::fHookObject( objects[ i ], DldHookTypeObject );
+            break;
+
+        case DldBulkScenarioObjectBulk:
+            RC = DldBulkObjectHooker::fHookObjects( objects, (unsigned int)count, DldHookTypeObject );
+            break;
+
+        case DldBulkScenarioVtableOneByOne:
+            for( unsigned long i = 0x0; i < count && kIOReturnSuccess == RC; ++i )
+                RC = DldBulkVtableHooker::fHookObject( objects[ i ], DldHookTypeVtable );
+            break;
+
+        default:
+            RC = DldBulkVtableHooker::fHookObjects( objects, (unsigned int)count, DldHookTypeVtable );
+            break;
+    }// end switch
+
+    return RC;
+}
+
+static
+IOReturn
+DldBulkUnHook(
+    __in DldBulkScenario scenario,
+    __inout OSObject** objects,
+    __in unsigned long count
+    )
+{
+    IOReturn  RC = kIOReturnSuccess;
+
+    switch( scenario ){
+
+        case DldBulkScenarioObjectOneByOne:
+            for( unsigned long i = 0x0; i < count && kIOReturnSuccess == RC; ++i )
+                RC = DldBulkObjectHooker::fUnHookObject( objects[ i ], DldHookTypeObject, DldInheritanceDepth_0 );
+            break;
+
+        case DldBulkScenarioObjectBulk:
+            RC = DldBulkObjectHooker::fUnHookObjects( objects, (unsigned int)count );
+            break;
+
+        case DldBulkScenarioVtableOneByOne:
+            for( unsigned long i = 0x0; i < count && kIOReturnSuccess == RC; ++i )
+                RC = DldBulkVtableHooker::fUnHookObject( objects[ i ], DldHookTypeVtable, DldInheritanceDepth_0 );
+            break;
+
+        default:
+            RC = DldBulkVtableHooker::fUnHookObjects( objects, (unsigned int)count );
+            break;
+    }// end switch
+
+    return RC;
+}
+
+//--------------------------------------------------------------------
+
+int
+main( int argc, char* argv[] )
+{
+    DldBenchmarkArguments  arguments;
+    OSObject**             objects;
+
+    DldBenchmarkParseArguments( argc, argv, 100000, &arguments );
+
+    if( !DldHookedObjectsHashTable::CreateStaticTableWithSize( 0x100, false ) ){
+
+        fprintf( stderr, "CreateStaticTableWithSize failed\n" );
+        return 1;
+    }
+
+    objects = (OSObject**)calloc( arguments.Iterations, sizeof( objects[ 0 ] ) );
+    if( NULL == objects )
+        return 1;
+
+    for( unsigned long i = 0x0; i < arguments.Iterations; ++i )
+        objects[ i ] = new DldTestService;
+
+    DldBenchmarkBegin( "DldBulkHookBenchmark", &arguments );
+
+    for( unsigned int scenario = 0x0; scenario < DldBulkScenarioMaximum; ++scenario ){
+
+        uint64_t  startTime;
+        uint64_t  hookNs;
+        uint64_t  unHookNs;
+        UInt32    hookedCalls;
+
+        startTime = DldBenchmarkNanoseconds();
+        if( kIOReturnSuccess != DldBulkHook( (DldBulkScenario)scenario, objects, arguments.Iterations ) ){
+
+            fprintf( stderr, "hooking failed\n" );
+            return 1;
+        }
+        hookNs = DldBenchmarkNanoseconds() - startTime;
+
+        //
+        // the objects are hooked, the last one is checked as a sample
+        //
+        hookedCalls = ( (DldTestService*)objects[ arguments.Iterations - 0x1 ] )->testMethod( 0x1 );
+
+        startTime = DldBenchmarkNanoseconds();
+        if( kIOReturnSuccess != DldBulkUnHook( (DldBulkScenario)scenario, objects, arguments.Iterations ) ){
+
+            fprintf( stderr, "unhooking failed\n" );
+            return 1;
+        }
+        unHookNs = DldBenchmarkNanoseconds() - startTime;
+
+        if( 0x2 + DLD_TEST_HOOK_INCREMENT != hookedCalls ){
+
+            fprintf( stderr, "an object has not been hooked\n" );
+            return 1;
+        }
+
+        DldBenchmarkResultBegin( gBulkScenarioNames[ scenario ], 0x1 );
+        DldBenchmarkFieldUInt( "objects", arguments.Iterations );
+        DldBenchmarkFieldUInt( "hook_ns", hookNs );
+        DldBenchmarkFieldUInt( "unhook_ns", unHookNs );
+        DldBenchmarkFieldDouble( "hook_ns_per_object", (double)hookNs/(double)arguments.Iterations );
+        DldBenchmarkFieldDouble( "unhook_ns_per_object", (double)unHookNs/(double)arguments.Iterations );
+        DldBenchmarkResultEnd();
+
+    }// end for
+
+    DldBenchmarkEnd();
+
+    for( unsigned long i = 0x0; i < arguments.Iterations; ++i )
+        objects[ i ]->release();
+
+    free( objects );
+
+    return 0;
+}
@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include "DldHostTestClasses.h"
+#include "DldHostBenchmark.h"
+
+//
+// the hooker's call cache for the direct vtable hooks, see DldCallCacheEntry,
+// a depth 1 vtable hooker hooks the vtables of the DLD_TEST_SIBLING_CLASSES
+// classes and every thread calls the objects in turn
+//   monomorphic  - the call site sees a single vtable
+//   polymorphic  - the call site sees DLD_CALL_CACHE_WAYS vtables
+//   megamorphic  - the call site sees DLD_TEST_SIBLING_CLASSES vtables
+//                  which is more than the cache ways
+// a build with DLD_HOOK_STATS reports the cache hits and misses
+//
+
+typedef DldHookerCommonClass2< DldTestServiceDldHook<DldInheritanceDepth_1,0>, DldTestService >  DldCacheVtableHooker;
+
+typedef enum _DldCacheScenario{
+    DldCacheScenarioMonomorphic = 0x0,
+    DldCacheScenarioPolymorphic,
+    DldCacheScenarioMegamorphic,
+    DldCacheScenarioMaximum
+} DldCacheScenario;
+
+static const char*  gCacheScenarioNames[ DldCacheScenarioMaximum ] = {
+    "monomorphic",
+    "polymorphic",
+    "megamorphic"
+};
+
+static const unsigned int  gCacheScenarioClasses[ DldCacheScenarioMaximum ] = {
+    0x1,
+    DLD_CALL_CACHE_WAYS,
+    DLD_TEST_SIBLING_CLASSES
+};
+
+typedef struct _DldCacheContext{
+
+    DldTestService*   Objects[ DLD_TEST_SIBLING_CLASSES ];
+    unsigned int      Classes;
+    unsigned long     Iterations;
+    volatile UInt32   Sink;
+
+} DldCacheContext;
+
+//--------------------------------------------------------------------
+
+static
+void
+DldCacheThreadRoutine(
+    __in unsigned int thread,
+    __in void* context
+    )
+{
+    DldCacheContext*  cacheContext = (DldCacheContext*)context;
+    UInt32            sum = 0x0;
+    unsigned int      current = thread % cacheContext->Classes;
+
+    for( unsigned long i = 0x0; i < cacheContext->Iterations; ++i ){
+
+        sum += cacheContext->Objects[ current ]->testMethod( (UInt32)i );
+
+        if( ++current == cacheContext->Classes )
+            current = 0x0;
+    }// end for
+
+    cacheContext->Sink += sum;
+}
+
+//--------------------------------------------------------------------
+
+int
+main( int argc, char* argv[] )
+{
+    DldBenchmarkArguments  arguments;
+    DldCacheContext        context;
+
+    DldBenchmarkParseArguments( argc, argv, 1000000, &arguments );
+
+    if( !DldHookedObjectsHashTable::CreateStaticTableWithSize( 0x100, false ) ){
+
+        fprintf( stderr, "CreateStaticTableWithSize failed\n" );
+        return 1;
+    }
+
+    bzero( &context, sizeof( context ) );
+    context.Iterations = arguments.Iterations;
+
+    for( unsigned int i = 0x0; i < DLD_TEST_SIBLING_CLASSES; ++i ){
+
+        context.Objects[ i ] = DldTestNewSibling( i );
+
+        if( kIOReturnSuccess != DldCacheVtableHooker::fHookObject( context.Objects[ i ], DldHookTypeVtable ) ){
+
+            fprintf( stderr, "hooking failed\n" );
+            return 1;
+        }
+
+        if( 0x3 + DLD_TEST_HOOK_INCREMENT != context.Objects[ i ]->testMethod( 0x1 ) ){
+
+            fprintf( stderr, "a call has not been hooked\n" );
+            return 1;
+        }
+    }// end for
+
+    DldBenchmarkBegin( "DldCallCacheBenchmark", &arguments );
+
+    for( unsigned int scenario = 0x0; scenario < DldCacheScenarioMaximum; ++scenario ){
+
+        context.Classes = gCacheScenarioClasses[ scenario ];
+
+        for( unsigned int threads = 0x1; threads <= arguments.MaxThreads; threads *= 0x2 ){
+
+            uint64_t  elapsedNs;
+            uint64_t  calls = (uint64_t)threads*context.Iterations;
+
+#if defined(DLD_HOOK_STATS)
+            DldHookerCallStatistics  before;
+            DldHookerCallStatistics  after;
+
+            DldCacheVtableHooker::fCommonHooker2()->fGetCallStatistics( &before );
+#endif//DLD_HOOK_STATS
+
+            elapsedNs = DldBenchmarkRunThreads( threads, DldCacheThreadRoutine, &context );
+
+            DldBenchmarkResultBegin( gCacheScenarioNames[ scenario ], threads );
+            DldBenchmarkFieldUInt( "classes", context.Classes );
+            DldBenchmarkFieldUInt( "calls", calls );
+            DldBenchmarkFieldUInt( "elapsed_ns", elapsedNs );
+            DldBenchmarkFieldDouble( "ns_per_call", (double)elapsedNs*threads/(double)( calls ? calls : 0x1 ) );
+
+#if defined(DLD_HOOK_STATS)
+            DldCacheVtableHooker::fCommonHooker2()->fGetCallStatistics( &after );
+
+            DldBenchmarkFieldUInt( "cache_hits", (uint64_t)( after.CallCacheHits - before.CallCacheHits ) );
+            DldBenchmarkFieldUInt( "cache_misses", (uint64_t)( after.CallCacheMisses - before.CallCacheMisses ) );
+#endif//DLD_HOOK_STATS
+
+            DldBenchmarkResultEnd();
+
+        }// end for
+    }// end for
+
+    DldBenchmarkEnd();
+
+    for( unsigned int i = 0x0; i < DLD_TEST_SIBLING_CLASSES; ++i ){
+
+        DldCacheVtableHooker::fUnHookObject( context.Objects[ i ], DldHookTypeVtable, DldInheritanceDepth_1 );
+        context.Objects[ i ]->release();
+    }// end for
+
+    return 0;
+}
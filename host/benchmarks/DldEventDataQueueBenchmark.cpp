@@ -0,0 +1,291 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include <math.h>
+#include "DldEventDataQueue.h"
+#include "DldHostBenchmark.h"
+
+//
+// a simulation of DldEventDataQueue's coalesced notifications, the clock
+// is simulated, see DldHostClockSimulate(), so the latency timer and
+// the consumer's wakeups run at their deadlines whatever the host's load,
+// the events arrive as a Poisson process at a rate, the number of events
+// for a run is the iterations number, a notification wakes the consumer
+// after DLD_DQ_WAKEUP_LATENCY, the notifications received before
+// the wakeup are merged as the Mach port's queue holds one message,
+// the consumer drains the queue as IODataQueueDequeue() does and an event's
+// delivery latency is the time from its enqueueing till its dequeueing,
+// the consumer's time is modelled as DLD_DQ_WAKEUP_COST for a wakeup
+// and DLD_DQ_EVENT_COST for an event, the throughput is the events rate
+// the consumer can keep up with, the runs sweep the rates, the watermarks
+// and the maximum latencies, the watermark of one entry is the native
+// IODataQueue's wakeup for each event
+//
+
+#define DLD_DQ_QUEUE_SIZE       (64*1024)
+#define DLD_DQ_ENTRY_SIZE       ( sizeof( DldEventRecord ) + DATA_QUEUE_ENTRY_HEADER_SIZE )
+
+#define DLD_DQ_WAKEUP_LATENCY   (20*1000)
+#define DLD_DQ_WAKEUP_COST      (5*1000)
+#define DLD_DQ_EVENT_COST       (100)
+
+static const UInt32  gDqRates[] = { 10000, 100000, 1000000 };
+
+static const UInt32  gDqWatermarks[] = { DLD_DQ_ENTRY_SIZE, 1024, 4*1024, 16*1024, 32*1024 };
+
+static const UInt32  gDqMaxLatenciesUs[] = { 100, 1000, 10000 };
+
+#define DLD_DQ_ARRAY_SIZE( _A_ )    ( sizeof( _A_ )/sizeof( _A_[ 0 ] ) )
+
+typedef struct _DldDqConsumer{
+
+    DldEventDataQueue*     Queue;
+    thread_call_t          Wakeup;
+    bool                   WakeupPending;
+
+    uint64_t               Notifications;
+    uint64_t               Wakeups;
+    uint64_t               LatencySum;
+    DldBenchmarkHistogram  Latency;
+
+} DldDqConsumer;
+
+//--------------------------------------------------------------------
+
+static
+UInt64
+DldDqRandom(
+    __inout UInt64* state
+    )
+{
+    //
+    // xorshift64*
+    //
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+//--------------------------------------------------------------------
+
+static
+uint64_t
+DldDqInterarrival(
+    __inout UInt64* state,
+    __in UInt32 rate
+    )
+{
+    //
+    // an exponential distribution, the uniform value is in (0, 1]
+    //
+    double  uniform = (double)( ( DldDqRandom( state ) >> 11 ) + 0x1 ) / 9007199254740992.0;
+
+    return (uint64_t)( -log( uniform ) * 1000000000.0 / (double)rate );
+}
+
+//--------------------------------------------------------------------
+
+static
+void
+DldDqNotification(
+    __in IODataQueue* queue,
+    __in void* context
+    )
+{
+    DldDqConsumer*  consumer = (DldDqConsumer*)context;
+
+    consumer->Notifications += 0x1;
+
+    if( !consumer->WakeupPending ){
+
+        consumer->WakeupPending = true;
+        thread_call_enter_delayed( consumer->Wakeup, mach_absolute_time() + DLD_DQ_WAKEUP_LATENCY );
+    }
+}
+
+//--------------------------------------------------------------------
+
+//
+// drains the queue as IODataQueueDequeue() does
+//
+static
+void
+DldDqConsumerWakeup(
+    __in thread_call_param_t param0,
+    __in thread_call_param_t param1
+    )
+{
+    DldDqConsumer*      consumer = (DldDqConsumer*)param0;
+    IODataQueueMemory*  dataQueue = consumer->Queue->getDataQueueMemory();
+    uint64_t            now = mach_absolute_time();
+
+    consumer->WakeupPending = false;
+    consumer->Wakeups += 0x1;
+
+    while( dataQueue->head != dataQueue->tail ){
+
+        IODataQueueEntry*  entry = (IODataQueueEntry*)( (UInt8*)dataQueue->queue + dataQueue->head );
+        UInt32             newHead;
+        DldEventRecord     record;
+        uint64_t           latency;
+
+        //
+        // the producer wrapped around if there is no room for the header or for the data
+        //
+        if( dataQueue->head + DATA_QUEUE_ENTRY_HEADER_SIZE > dataQueue->queueSize ||
+            dataQueue->head + entry->size + DATA_QUEUE_ENTRY_HEADER_SIZE > dataQueue->queueSize ){
+
+            entry = dataQueue->queue;
+            newHead = entry->size + DATA_QUEUE_ENTRY_HEADER_SIZE;
+
+        } else {
+
+            newHead = dataQueue->head + entry->size + DATA_QUEUE_ENTRY_HEADER_SIZE;
+        }
+
+        memcpy( &record, entry->data, sizeof( record ) );
+        dataQueue->head = newHead;
+
+        latency = now - record.Timestamp;
+
+        consumer->LatencySum += latency;
+        DldBenchmarkHistogramAdd( &consumer->Latency, latency );
+
+    }// end while
+}
+
+//--------------------------------------------------------------------
+
+static
+bool
+DldDqRun(
+    __in UInt32 rate,
+    __in UInt32 watermark,
+    __in UInt32 maxLatencyUs,
+    __in unsigned long events
+    )
+{
+    DldDqConsumer*  consumer;
+    DldEventRecord  record;
+    UInt64          state = 0x9E3779B97F4A7C15ULL;
+    uint64_t        startTime;
+    uint64_t        duration;
+    uint64_t        consumerTime;
+    SInt32          enqueued;
+    SInt32          dropped;
+    SInt32          watermarkNotifications;
+    SInt32          timerNotifications;
+    uint64_t        delivered;
+
+    consumer = (DldDqConsumer*)calloc( 0x1, sizeof( *consumer ) );
+    if( NULL == consumer ){
+
+        fprintf( stderr, "an allocation failed\n" );
+        return false;
+    }
+
+    consumer->Queue = DldEventDataQueue::withCapacity( DLD_DQ_QUEUE_SIZE, watermark, maxLatencyUs );
+    consumer->Wakeup = thread_call_allocate( DldDqConsumerWakeup, (thread_call_param_t)consumer );
+    if( NULL == consumer->Queue || NULL == consumer->Wakeup ){
+
+        fprintf( stderr, "the queue or the consumer can't be created\n" );
+        return false;
+    }
+
+    consumer->Queue->setNotificationRoutine( DldDqNotification, consumer );
+
+    bzero( &record, sizeof( record ) );
+    record.Type = DLD_EVENT_TYPE_CALL;
+
+    startTime = mach_absolute_time();
+
+    for( unsigned long i = 0x0; i < events; ++i ){
+
+        DldHostClockAdvance( DldDqInterarrival( &state, rate ) );
+
+        record.Timestamp = mach_absolute_time();
+        record.Selector = (uint32_t)i;
+
+        consumer->Queue->enqueue( &record, sizeof( record ) );
+
+    }// end for
+
+    duration = mach_absolute_time() - startTime;
+
+    //
+    // the last events are delivered by the timer
+    //
+    DldHostClockAdvance( (uint64_t)maxLatencyUs*kMicrosecondScale + 0x2*DLD_DQ_WAKEUP_LATENCY );
+
+    consumer->Queue->getStatistics( &enqueued, &dropped, &watermarkNotifications, &timerNotifications );
+    delivered = consumer->Latency.Count;
+
+    if( (uint64_t)enqueued != delivered || (unsigned long)( enqueued + dropped ) != events ){
+
+        fprintf( stderr, "enqueued %d, dropped %d, delivered %llu of %lu events\n",
+                 (int)enqueued, (int)dropped, (unsigned long long)delivered, events );
+        return false;
+    }
+
+    consumerTime = consumer->Wakeups*DLD_DQ_WAKEUP_COST + delivered*DLD_DQ_EVENT_COST;
+
+    DldBenchmarkResultBegin( ( DLD_DQ_ENTRY_SIZE == watermark ) ? "per_event" : "coalesced", 0x1 );
+    DldBenchmarkFieldUInt( "rate", rate );
+    DldBenchmarkFieldUInt( "watermark_bytes", watermark );
+    DldBenchmarkFieldUInt( "max_latency_us", maxLatencyUs );
+    DldBenchmarkFieldUInt( "enqueued", (uint64_t)enqueued );
+    DldBenchmarkFieldUInt( "dropped", (uint64_t)dropped );
+    DldBenchmarkFieldUInt( "watermark_notifications", (uint64_t)watermarkNotifications );
+    DldBenchmarkFieldUInt( "timer_notifications", (uint64_t)timerNotifications );
+    DldBenchmarkFieldUInt( "notifications", consumer->Notifications );
+    DldBenchmarkFieldUInt( "wakeups", consumer->Wakeups );
+    DldBenchmarkFieldDouble( "wakeups_per_ms", (double)consumer->Wakeups*1000000.0/(double)duration );
+    DldBenchmarkFieldDouble( "events_per_wakeup", (double)delivered/(double)consumer->Wakeups );
+    DldBenchmarkFieldDouble( "consumer_cpu_percent", (double)consumerTime*100.0/(double)duration );
+    DldBenchmarkFieldDouble( "throughput_events_per_sec", (double)delivered*1000000000.0/(double)consumerTime );
+    DldBenchmarkFieldDouble( "latency_mean_ns", (double)consumer->LatencySum/(double)delivered );
+    DldBenchmarkFieldPercentiles( "latency", &consumer->Latency );
+    DldBenchmarkResultEnd();
+
+    //
+    // the latency timer is not armed as the queue is empty
+    //
+    consumer->Queue->release();
+    thread_call_free( consumer->Wakeup );
+    free( consumer );
+
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+int
+main( int argc, char* argv[] )
+{
+    DldBenchmarkArguments  arguments;
+
+    DldBenchmarkParseArguments( argc, argv, 0x10000, &arguments );
+
+    DldHostClockSimulate( kSecondScale );
+
+    DldBenchmarkBegin( "DldEventDataQueueBenchmark", &arguments );
+
+    for( unsigned int r = 0x0; r < DLD_DQ_ARRAY_SIZE( gDqRates ); ++r ){
+
+        for( unsigned int w = 0x0; w < DLD_DQ_ARRAY_SIZE( gDqWatermarks ); ++w ){
+
+            for( unsigned int l = 0x0; l < DLD_DQ_ARRAY_SIZE( gDqMaxLatenciesUs ); ++l ){
+
+                if( !DldDqRun( gDqRates[ r ], gDqWatermarks[ w ], gDqMaxLatenciesUs[ l ], arguments.Iterations ) )
+                    return 1;
+
+            }// end for
+        }// end for
+    }// end for
+
+    DldBenchmarkEnd();
+
+    return 0;
+}
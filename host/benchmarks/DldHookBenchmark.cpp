@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include "DldHostTestClasses.h"
+#include "DldHostBenchmark.h"
+
+//
+// the hooked call cost for the object and vtable hooks at the depth 0,
+// for a vtable hook at the depth 2 where the derived class's function
+// calls the super classes' implementations, and for a vtable hook chained
+// with an object hook, every thread calls its own object
+//
+
+typedef DldHookerCommonClass2< DldTestServiceDldHook<DldInheritanceDepth_0,0>, DldTestService >  DldBenchHooker0;
+typedef DldHookerCommonClass2< DldTestServiceDldHook<DldInheritanceDepth_0,1>, DldTestService >  DldBenchHooker0Vtable;
+typedef DldHookerCommonClass2< DldTestServiceDldHook<DldInheritanceDepth_2,0>, DldTestService >  DldBenchHooker2;
+
+typedef enum _DldBenchScenario{
+    DldBenchScenarioNotHooked = 0x0,
+    DldBenchScenarioObjectDepth0,
+    DldBenchScenarioVtableDepth0,
+    DldBenchScenarioVtableDepth2Super,
+    DldBenchScenarioChained,
+    DldBenchScenarioMaximum
+} DldBenchScenario;
+
+static const char*  gScenarioNames[ DldBenchScenarioMaximum ] = {
+    "not_hooked",
+    "object_depth0",
+    "vtable_depth0",
+    "vtable_depth2_super",
+    "chained_vtable_object"
+};
+
+typedef struct _DldBenchContext{
+
+    DldTestService*   Objects[ DLD_BENCHMARK_MAX_THREADS ];
+    unsigned long     Iterations;
+    volatile UInt32   Sink;
+
+} DldBenchContext;
+
+//--------------------------------------------------------------------
+
+static
+void
+DldBenchCallRoutine(
+    __in unsigned int thread,
+    __in void* context
+    )
+{
+    DldBenchContext*  benchContext = (DldBenchContext*)context;
+    DldTestService*   object = benchContext->Objects[ thread ];
+    UInt32            sum = 0x0;
+
+    for( unsigned long i = 0x0; i < benchContext->Iterations; ++i )
+        sum += object->testMethod( (UInt32)i );
+
+    benchContext->Sink += sum;
+}
+
+//--------------------------------------------------------------------
+
+static
+IOReturn
+DldBenchHook(
+    __in DldBenchScenario scenario,
+    __in DldTestService* object
+    )
+{
+    IOReturn  RC = kIOReturnSuccess;
+
+    switch( scenario ){
+
+        case DldBenchScenarioObjectDepth0:
+            RC = DldBenchHooker0::fHookObject( object, DldHookTypeObject );
+            break;
+
+        case DldBenchScenarioVtableDepth0:
+            RC = DldBenchHooker0Vtable::fHookObject( object, DldHookTypeVtable );
+            break;
+
+        case DldBenchScenarioVtableDepth2Super:
+            RC = DldBenchHooker2::fHookObject( object, DldHookTypeVtable );
+            break;
+
+        case DldBenchScenarioChained:
+            RC = DldBenchHooker0Vtable::fHookObject( object, DldHookTypeVtable );
+            if( kIOReturnSuccess == RC )
+                RC = DldBenchHooker0::fHookObject( object, DldHookTypeObject );
+            break;
+
+        default:
+            break;
+    }
+
+    return RC;
+}
+
+//--------------------------------------------------------------------
+
+static
+void
+DldBenchUnHook(
+    __in DldBenchScenario scenario,
+    __in DldTestService* object
+    )
+{
+    switch( scenario ){
+
+        case DldBenchScenarioObjectDepth0:
+            DldBenchHooker0::fUnHookObject( object, DldHookTypeObject, DldInheritanceDepth_0 );
+            break;
+
+        case DldBenchScenarioVtableDepth0:
+            DldBenchHooker0Vtable::fUnHookObject( object, DldHookTypeVtable, DldInheritanceDepth_0 );
+            break;
+
+        case DldBenchScenarioVtableDepth2Super:
+            DldBenchHooker2::fUnHookObject( object, DldHookTypeVtable, DldInheritanceDepth_2 );
+            break;
+
+        case DldBenchScenarioChained:
+            DldBenchHooker0::fUnHookObject( object, DldHookTypeObject, DldInheritanceDepth_0 );
+            DldBenchHooker0Vtable::fUnHookObject( object, DldHookTypeVtable, DldInheritanceDepth_0 );
+            break;
+
+        default:
+            break;
+    }
+}
+
+//--------------------------------------------------------------------
+
+int
+main( int argc, char* argv[] )
+{
+    DldBenchmarkArguments  arguments;
+    DldBenchContext        context;
+
+    DldBenchmarkParseArguments( argc, argv, 1000000, &arguments );
+
+    if( !DldHookedObjectsHashTable::CreateStaticTableWithSize( 0x100, false ) ){
+
+        fprintf( stderr, "CreateStaticTableWithSize failed\n" );
+        return 1;
+    }
+
+    context.Iterations = arguments.Iterations;
+    context.Sink = 0x0;
+
+    DldBenchmarkBegin( "DldHookBenchmark", &arguments );
+
+    for( int scenario = DldBenchScenarioNotHooked; scenario < DldBenchScenarioMaximum; ++scenario ){
+
+        for( unsigned int i = 0x0; i < arguments.MaxThreads; ++i ){
+
+            if( DldBenchScenarioVtableDepth2Super == scenario )
+                context.Objects[ i ] = new DldTestServiceLevel2;
+            else
+                context.Objects[ i ] = new DldTestService;
+
+            if( kIOReturnSuccess != DldBenchHook( (DldBenchScenario)scenario, context.Objects[ i ] ) ){
+
+                fprintf( stderr, "%s: hooking failed\n", gScenarioNames[ scenario ] );
+                return 1;
+            }
+        }// end for
+
+        for( unsigned int threads = 0x1; threads <= arguments.MaxThreads; threads *= 0x2 ){
+
+            uint64_t  elapsedNs;
+
+            elapsedNs = DldBenchmarkRunThreads( threads, DldBenchCallRoutine, &context );
+            DldBenchmarkCallsResult( gScenarioNames[ scenario ], threads, (uint64_t)threads*arguments.Iterations, elapsedNs );
+
+        }// end for
+
+        for( unsigned int i = 0x0; i < arguments.MaxThreads; ++i ){
+
+            DldBenchUnHook( (DldBenchScenario)scenario, context.Objects[ i ] );
+            context.Objects[ i ]->release();
+
+        }// end for
+
+    }// end for
+
+    DldBenchmarkEnd();
+
+    return 0;
+}
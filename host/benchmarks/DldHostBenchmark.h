@@ -0,0 +1,351 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#ifndef _DLDHOSTBENCHMARK_H
+#define _DLDHOSTBENCHMARK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include "DldCommon.h"
+
+//
+// the host benchmarks' common code, a benchmark accepts
+//   -i <iterations>  the iterations made by a thread
+//   -t <threads>     the maximum number of threads, the runs are made
+//                    for 1, 2, 4 ... threads up to this number
+// and prints the results as a JSON object to stdout, e.g.
+//   { "benchmark": "DldHookBenchmark", "iterations": 100000, "results": [
+//     { "scenario": "object_depth0", "threads": 1, ... } ] }
+//
+
+#define DLD_BENCHMARK_MAX_THREADS    (64)
+
+typedef struct _DldBenchmarkArguments{
+
+    unsigned long   Iterations;
+    unsigned int    MaxThreads;
+
+} DldBenchmarkArguments;
+
+//--------------------------------------------------------------------
+
+inline
+void
+DldBenchmarkParseArguments(
+    __in int argc,
+    __in char* argv[],
+    __in unsigned long defaultIterations,
+    __out DldBenchmarkArguments* arguments
+    )
+{
+    arguments->Iterations = defaultIterations;
+    arguments->MaxThreads = DLD_BENCHMARK_MAX_THREADS;
+
+    for( int i = 0x1; i + 0x1 < argc; i += 0x2 ){
+
+        if( 0x0 == strcmp( argv[ i ], "-i" ) )
+            arguments->Iterations = strtoul( argv[ i + 0x1 ], NULL, 0x0 );
+        else if( 0x0 == strcmp( argv[ i ], "-t" ) )
+            arguments->MaxThreads = (unsigned int)strtoul( argv[ i + 0x1 ], NULL, 0x0 );
+
+    }// end for
+
+    if( 0x0 == arguments->Iterations )
+        arguments->Iterations = 0x1;
+
+    if( 0x0 == arguments->MaxThreads )
+        arguments->MaxThreads = 0x1;
+
+    if( arguments->MaxThreads > DLD_BENCHMARK_MAX_THREADS )
+        arguments->MaxThreads = DLD_BENCHMARK_MAX_THREADS;
+}
+
+//--------------------------------------------------------------------
+
+inline
+uint64_t
+DldBenchmarkNanoseconds()
+{
+    struct timespec  ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (uint64_t)ts.tv_sec*1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+//--------------------------------------------------------------------
+
+//
+// a thread's body, thread is in the [0, threads) range
+//
+typedef void (*DldBenchmarkThreadRoutine)( __in unsigned int thread, __in void* context );
+
+typedef struct _DldBenchmarkThread{
+
+    pthread_t                   Thread;
+    unsigned int                Index;
+    DldBenchmarkThreadRoutine   Routine;
+    void*                       Context;
+    volatile bool*              Start;
+
+} DldBenchmarkThread;
+
+inline
+void*
+DldBenchmarkThreadEntry(
+    __in void* parameter
+    )
+{
+    DldBenchmarkThread*  thread = (DldBenchmarkThread*)parameter;
+
+    while( !*thread->Start )
+        sched_yield();
+
+    thread->Routine( thread->Index, thread->Context );
+    return NULL;
+}
+
+//
+// runs the routine in the threads which are started at the same time,
+// returns the wall time in nanoseconds
+//
+inline
+uint64_t
+DldBenchmarkRunThreads(
+    __in unsigned int threadsNumber,
+    __in DldBenchmarkThreadRoutine routine,
+    __in void* context
+    )
+{
+    DldBenchmarkThread  threads[ DLD_BENCHMARK_MAX_THREADS ];
+    volatile bool       start = false;
+    uint64_t            startTime;
+
+    if( threadsNumber > DLD_BENCHMARK_MAX_THREADS )
+        threadsNumber = DLD_BENCHMARK_MAX_THREADS;
+
+    for( unsigned int i = 0x0; i < threadsNumber; ++i ){
+
+        threads[ i ].Index = i;
+        threads[ i ].Routine = routine;
+        threads[ i ].Context = context;
+        threads[ i ].Start = &start;
+
+        if( 0x0 != pthread_create( &threads[ i ].Thread, NULL, DldBenchmarkThreadEntry, &threads[ i ] ) ){
+
+            fprintf( stderr, "pthread_create failed\n" );
+            exit( 1 );
+        }
+    }// end for
+
+    startTime = DldBenchmarkNanoseconds();
+    __atomic_store_n( &start, true, __ATOMIC_RELEASE );
+
+    for( unsigned int i = 0x0; i < threadsNumber; ++i )
+        pthread_join( threads[ i ].Thread, NULL );
+
+    return DldBenchmarkNanoseconds() - startTime;
+}
+
+//--------------------------------------------------------------------
+
+//
+// a latency histogram, a bucket N counts the values in the [2^N, 2^(N+1))
+// nanoseconds range, a histogram is updated by a single thread and merged
+//
+#define DLD_BENCHMARK_HISTOGRAM_BUCKETS    (48)
+
+typedef struct _DldBenchmarkHistogram{
+
+    uint64_t   Buckets[ DLD_BENCHMARK_HISTOGRAM_BUCKETS ];
+    uint64_t   Count;
+    uint64_t   Max;
+
+} DldBenchmarkHistogram;
+
+inline
+void
+DldBenchmarkHistogramAdd(
+    __inout DldBenchmarkHistogram* histogram,
+    __in uint64_t valueNs
+    )
+{
+    unsigned int  bucket = 0x0;
+
+    while( ( valueNs >> ( bucket + 0x1 ) ) && bucket < ( DLD_BENCHMARK_HISTOGRAM_BUCKETS - 0x1 ) )
+        ++bucket;
+
+    histogram->Buckets[ bucket ] += 0x1;
+    histogram->Count += 0x1;
+    if( valueNs > histogram->Max )
+        histogram->Max = valueNs;
+}
+
+inline
+void
+DldBenchmarkHistogramMerge(
+    __inout DldBenchmarkHistogram* histogram,
+    __in const DldBenchmarkHistogram* source
+    )
+{
+    for( unsigned int i = 0x0; i < DLD_BENCHMARK_HISTOGRAM_BUCKETS; ++i )
+        histogram->Buckets[ i ] += source->Buckets[ i ];
+
+    histogram->Count += source->Count;
+    if( source->Max > histogram->Max )
+        histogram->Max = source->Max;
+}
+
+//
+// returns the upper bound of the bucket containing the percentile, e.g. 99.9
+//
+inline
+uint64_t
+DldBenchmarkHistogramPercentile(
+    __in const DldBenchmarkHistogram* histogram,
+    __in double percentile
+    )
+{
+    uint64_t  threshold;
+    uint64_t  count = 0x0;
+
+    if( 0x0 == histogram->Count )
+        return 0x0;
+
+    threshold = (uint64_t)( (double)histogram->Count*percentile/100.0 );
+    if( 0x0 == threshold )
+        threshold = 0x1;
+
+    for( unsigned int i = 0x0; i < DLD_BENCHMARK_HISTOGRAM_BUCKETS; ++i ){
+
+        count += histogram->Buckets[ i ];
+        if( count >= threshold )
+            return ( ( 0x1ull << ( i + 0x1 ) ) < histogram->Max ) ? ( 0x1ull << ( i + 0x1 ) ) : histogram->Max;
+    }// end for
+
+    return histogram->Max;
+}
+
+//--------------------------------------------------------------------
+
+//
+// the JSON output, DldBenchmarkBegin() and DldBenchmarkEnd() enclose the results
+//
+inline
+bool*
+DldBenchmarkFirstResult()
+{
+    static bool  first = true;
+    return &first;
+}
+
+inline
+void
+DldBenchmarkBegin(
+    __in const char* name,
+    __in const DldBenchmarkArguments* arguments
+    )
+{
+    printf( "{\n  \"benchmark\": \"%s\",\n  \"iterations\": %lu,\n  \"max_threads\": %u,\n  \"results\": [",
+            name, arguments->Iterations, arguments->MaxThreads );
+    *DldBenchmarkFirstResult() = true;
+}
+
+//
+// starts a result object, the fields are added by DldBenchmarkField*(),
+// the result is closed by DldBenchmarkResultEnd()
+//
+inline
+void
+DldBenchmarkResultBegin(
+    __in const char* scenario,
+    __in unsigned int threads
+    )
+{
+    printf( "%s\n    { \"scenario\": \"%s\", \"threads\": %u", *DldBenchmarkFirstResult() ? "" : ",", scenario, threads );
+    *DldBenchmarkFirstResult() = false;
+}
+
+inline
+void
+DldBenchmarkFieldUInt(
+    __in const char* name,
+    __in uint64_t value
+    )
+{
+    printf( ", \"%s\": %llu", name, (unsigned long long)value );
+}
+
+inline
+void
+DldBenchmarkFieldDouble(
+    __in const char* name,
+    __in double value
+    )
+{
+    printf( ", \"%s\": %.3f", name, value );
+}
+
+//
+// adds the <name>_p50_ns, <name>_p99_ns, <name>_p999_ns and <name>_max_ns fields
+//
+inline
+void
+DldBenchmarkFieldPercentiles(
+    __in const char* name,
+    __in const DldBenchmarkHistogram* histogram
+    )
+{
+    printf( ", \"%s_p50_ns\": %llu, \"%s_p99_ns\": %llu, \"%s_p999_ns\": %llu, \"%s_max_ns\": %llu",
+            name, (unsigned long long)DldBenchmarkHistogramPercentile( histogram, 50.0 ),
+            name, (unsigned long long)DldBenchmarkHistogramPercentile( histogram, 99.0 ),
+            name, (unsigned long long)DldBenchmarkHistogramPercentile( histogram, 99.9 ),
+            name, (unsigned long long)histogram->Max );
+}
+
+inline
+void
+DldBenchmarkResultEnd()
+{
+    printf( " }" );
+}
+
+//
+// a result of calls made by the threads in the elapsed time
+//
+inline
+void
+DldBenchmarkCallsResult(
+    __in const char* scenario,
+    __in unsigned int threads,
+    __in uint64_t calls,
+    __in uint64_t elapsedNs
+    )
+{
+    DldBenchmarkResultBegin( scenario, threads );
+    DldBenchmarkFieldUInt( "calls", calls );
+    DldBenchmarkFieldUInt( "elapsed_ns", elapsedNs );
+
+    //
+    // the per call time is the wall time of a thread, i.e. it
+    // includes the time the thread waited for a CPU
+    //
+    DldBenchmarkFieldDouble( "ns_per_call", (double)elapsedNs*threads/(double)( calls ? calls : 0x1 ) );
+    DldBenchmarkFieldDouble( "calls_per_second", (double)calls*1e9/(double)( elapsedNs ? elapsedNs : 0x1 ) );
+    DldBenchmarkResultEnd();
+}
+
+inline
+void
+DldBenchmarkEnd()
+{
+    printf( "\n  ]\n}\n" );
+    fflush( stdout );
+}
+
+#endif//_DLDHOSTBENCHMARK_H
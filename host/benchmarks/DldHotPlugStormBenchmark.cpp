@@ -0,0 +1,322 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include <sys/resource.h>
+#include "DldHostTestClasses.h"
+#include "DldHostBenchmark.h"
+
+//
+// a hot-plug storm, a thread creates, hooks, unhooks and releases objects
+// as a driver does when devices come and go, while the reader threads call
+// the vtable hooked objects, the storm keeps a window of live objects so
+// the table has a steady population, the results are the hook and unhook
+// latency percentiles, the readers' call latency percentiles, i.e. the reader
+// stalls caused by the storm, and the peak memory used by the hooker,
+// a build with DLD_HOOK_STATS also reports the table's lock statistics
+//
+
+typedef DldHookerCommonClass2< DldTestServiceDldHook<DldInheritanceDepth_0,0>, DldTestService >  DldStormObjectHooker;
+typedef DldHookerCommonClass2< DldTestServiceDldHook<DldInheritanceDepth_0,1>, DldTestService >  DldStormVtableHooker;
+typedef DldHookerCommonClass2< DldTestServiceDldHook<DldInheritanceDepth_2,0>, DldTestService >  DldStormVtableHooker2;
+
+//
+// the number of objects alive at any time, a power of two
+//
+#define DLD_STORM_WINDOW            (0x100)
+
+//
+// the memory usage is sampled every this number of the hot-plug events
+//
+#define DLD_STORM_MEMORY_SAMPLING   (0x40)
+
+typedef struct _DldStormReader{
+
+    DldTestService*         Object;
+    DldTestService*         DerivedObject;
+    DldBenchmarkHistogram   Calls;
+
+} __attribute__((aligned(64))) DldStormReader;
+
+typedef struct _DldStormContext{
+
+    unsigned int            ReadersNumber;
+    unsigned long           Events;
+    volatile bool           StormDone;
+
+    DldStormReader          Readers[ DLD_BENCHMARK_MAX_THREADS ];
+    DldTestService*         Window[ DLD_STORM_WINDOW ];
+
+    DldBenchmarkHistogram   Hooks;
+    DldBenchmarkHistogram   UnHooks;
+    uint64_t                PeakBytes;
+
+    volatile UInt32         Sink;
+
+} DldStormContext;
+
+//--------------------------------------------------------------------
+
+static
+uint64_t
+DldStormMemoryUsage()
+{
+    DldHashTableMemoryUsage  tableUsage;
+    DldHookerMemoryUsage     hookerUsage;
+    uint64_t                 bytes;
+
+    DldHookedObjectsHashTable::sHashTable->GetMemoryUsage( &tableUsage );
+    bytes = tableUsage.TableBytes + tableUsage.EntriesBytes;
+
+    if( DldStormObjectHooker::fGetMemoryUsage( &hookerUsage ) )
+        bytes += hookerUsage.EntriesBytes + hookerUsage.VtableFunctionsInfoBytes + hookerUsage.VtableBufferBytes;
+
+    return bytes;
+}
+
+//--------------------------------------------------------------------
+
+static
+void
+DldStormUnHookWindowObject(
+    __inout DldStormContext* context,
+    __in unsigned int slot
+    )
+{
+    uint64_t  startTime;
+
+    if( NULL == context->Window[ slot ] )
+        return;
+
+    startTime = DldBenchmarkNanoseconds();
+    DldStormObjectHooker::fUnHookObject( context->Window[ slot ], DldHookTypeObject, DldInheritanceDepth_0 );
+    DldBenchmarkHistogramAdd( &context->UnHooks, DldBenchmarkNanoseconds() - startTime );
+
+    context->Window[ slot ]->release();
+    context->Window[ slot ] = NULL;
+}
+
+//--------------------------------------------------------------------
+
+static
+void
+DldStormRoutine(
+    __inout DldStormContext* context
+    )
+{
+    for( unsigned long event = 0x0; event < context->Events; ++event ){
+
+        unsigned int     slot = (unsigned int)( event & ( DLD_STORM_WINDOW - 0x1 ) );
+        DldTestService*  object;
+        uint64_t         startTime;
+
+        //
+        // the device which was plugged DLD_STORM_WINDOW events ago is removed
+        //
+        DldStormUnHookWindowObject( context, slot );
+
+        object = new DldTestService;
+
+        startTime = DldBenchmarkNanoseconds();
+        if( kIOReturnSuccess != DldStormObjectHooker::fHookObject( object, DldHookTypeObject ) ){
+
+            fprintf( stderr, "hooking failed\n" );
+            exit( 1 );
+        }
+        DldBenchmarkHistogramAdd( &context->Hooks, DldBenchmarkNanoseconds() - startTime );
+
+        context->Window[ slot ] = object;
+
+        if( 0x0 == ( event % DLD_STORM_MEMORY_SAMPLING ) ){
+
+            uint64_t  bytes = DldStormMemoryUsage();
+
+            if( bytes > context->PeakBytes )
+                context->PeakBytes = bytes;
+        }
+    }// end for
+
+    __atomic_store_n( &context->StormDone, true, __ATOMIC_RELEASE );
+}
+
+//--------------------------------------------------------------------
+
+static
+void
+DldStormReaderRoutine(
+    __inout DldStormReader* reader,
+    __in DldStormContext* context
+    )
+{
+    UInt32  sum = 0x0;
+
+    while( !__atomic_load_n( &context->StormDone, __ATOMIC_ACQUIRE ) ){
+
+        uint64_t  startTime;
+
+        startTime = DldBenchmarkNanoseconds();
+        sum += reader->Object->testMethod( sum );
+        DldBenchmarkHistogramAdd( &reader->Calls, DldBenchmarkNanoseconds() - startTime );
+
+        startTime = DldBenchmarkNanoseconds();
+        sum += reader->DerivedObject->testMethod( sum );
+        DldBenchmarkHistogramAdd( &reader->Calls, DldBenchmarkNanoseconds() - startTime );
+
+    }// end while
+
+    context->Sink += sum;
+}
+
+//--------------------------------------------------------------------
+
+static
+void
+DldStormThreadRoutine(
+    __in unsigned int thread,
+    __in void* context
+    )
+{
+    DldStormContext*  stormContext = (DldStormContext*)context;
+
+    if( thread == stormContext->ReadersNumber )
+        DldStormRoutine( stormContext );
+    else
+        DldStormReaderRoutine( &stormContext->Readers[ thread ], stormContext );
+}
+
+//--------------------------------------------------------------------
+
+#if defined(DLD_HOOK_STATS)
+
+static
+void
+DldStormTableStatistics()
+{
+    DldHashTableStatistics  statistics;
+    DldBenchmarkHistogram   holdTimes;
+
+    DldHookedObjectsHashTable::sHashTable->GetStatistics( &statistics );
+
+    //
+    // the table's histogram has the same buckets
+    //
+    bzero( &holdTimes, sizeof( holdTimes ) );
+    for( unsigned int i = 0x0; i < DLD_LOCK_HISTOGRAM_BUCKETS; ++i ){
+
+        holdTimes.Buckets[ i ] = (uint64_t)statistics.ExclusiveHoldTimeHistogram[ i ];
+        holdTimes.Count += (uint64_t)statistics.ExclusiveHoldTimeHistogram[ i ];
+    }// end for
+    holdTimes.Max = (uint64_t)statistics.MaxExclusiveHoldTime;
+
+    DldBenchmarkResultBegin( "table_statistics", 0x0 );
+    DldBenchmarkFieldUInt( "exclusive_locks", (uint64_t)statistics.ExclusiveLocks );
+    DldBenchmarkFieldUInt( "exclusive_wait_ns", (uint64_t)statistics.ExclusiveWaitTime );
+    DldBenchmarkFieldPercentiles( "exclusive_hold", &holdTimes );
+    DldBenchmarkFieldUInt( "shared_locks", (uint64_t)statistics.SharedLocks );
+    DldBenchmarkFieldUInt( "max_shared_wait_ns", (uint64_t)statistics.MaxSharedWaitTime );
+    DldBenchmarkFieldUInt( "lock_free_reads", (uint64_t)statistics.LockFreeReads );
+    DldBenchmarkFieldUInt( "lock_free_reads_failed", (uint64_t)statistics.LockFreeReadsFailed );
+    DldBenchmarkFieldUInt( "peak_entries", (uint64_t)statistics.PeakEntries );
+    DldBenchmarkResultEnd();
+}
+
+#endif//DLD_HOOK_STATS
+
+//--------------------------------------------------------------------
+
+int
+main( int argc, char* argv[] )
+{
+    DldBenchmarkArguments  arguments;
+    DldStormContext*       context;
+
+    DldBenchmarkParseArguments( argc, argv, 20000, &arguments );
+
+    if( !DldHookedObjectsHashTable::CreateStaticTableWithSize( 0x100, false ) ){
+
+        fprintf( stderr, "CreateStaticTableWithSize failed\n" );
+        return 1;
+    }
+
+    context = (DldStormContext*)calloc( 0x1, sizeof( *context ) );
+    if( NULL == context )
+        return 1;
+
+    for( unsigned int i = 0x0; i < arguments.MaxThreads; ++i ){
+
+        context->Readers[ i ].Object = new DldTestService;
+        context->Readers[ i ].DerivedObject = new DldTestServiceLevel2;
+
+        if( kIOReturnSuccess != DldStormVtableHooker::fHookObject( context->Readers[ i ].Object, DldHookTypeVtable ) ||
+            kIOReturnSuccess != DldStormVtableHooker2::fHookObject( context->Readers[ i ].DerivedObject, DldHookTypeVtable ) ){
+
+            fprintf( stderr, "hooking failed\n" );
+            return 1;
+        }
+    }// end for
+
+    DldBenchmarkBegin( "DldHotPlugStormBenchmark", &arguments );
+
+    for( unsigned int readers = 0x1; readers <= arguments.MaxThreads; readers *= 0x2 ){
+
+        DldBenchmarkHistogram  calls;
+        struct rusage          usage;
+        uint64_t               elapsedNs;
+
+        context->ReadersNumber = readers;
+        context->Events = arguments.Iterations;
+        context->StormDone = false;
+        context->PeakBytes = 0x0;
+        bzero( &context->Hooks, sizeof( context->Hooks ) );
+        bzero( &context->UnHooks, sizeof( context->UnHooks ) );
+
+        for( unsigned int i = 0x0; i < readers; ++i )
+            bzero( &context->Readers[ i ].Calls, sizeof( context->Readers[ i ].Calls ) );
+
+        elapsedNs = DldBenchmarkRunThreads( readers + 0x1, DldStormThreadRoutine, context );
+
+        bzero( &calls, sizeof( calls ) );
+        for( unsigned int i = 0x0; i < readers; ++i )
+            DldBenchmarkHistogramMerge( &calls, &context->Readers[ i ].Calls );
+
+        getrusage( RUSAGE_SELF, &usage );
+
+        DldBenchmarkResultBegin( "hot_plug_storm", readers );
+        DldBenchmarkFieldUInt( "events", context->Events );
+        DldBenchmarkFieldUInt( "elapsed_ns", elapsedNs );
+        DldBenchmarkFieldPercentiles( "hook", &context->Hooks );
+        DldBenchmarkFieldPercentiles( "unhook", &context->UnHooks );
+        DldBenchmarkFieldUInt( "reader_calls", calls.Count );
+        DldBenchmarkFieldPercentiles( "reader_call", &calls );
+        DldBenchmarkFieldUInt( "peak_hooker_bytes", context->PeakBytes );
+        DldBenchmarkFieldUInt( "peak_rss_kb", (uint64_t)usage.ru_maxrss );
+        DldBenchmarkResultEnd();
+
+        //
+        // the window is emptied so every run starts with the same table
+        //
+        for( unsigned int slot = 0x0; slot < DLD_STORM_WINDOW; ++slot )
+            DldStormUnHookWindowObject( context, slot );
+
+    }// end for
+
+#if defined(DLD_HOOK_STATS)
+    DldStormTableStatistics();
+#endif//DLD_HOOK_STATS
+
+    DldBenchmarkEnd();
+
+    for( unsigned int i = 0x0; i < arguments.MaxThreads; ++i ){
+
+        DldStormVtableHooker::fUnHookObject( context->Readers[ i ].Object, DldHookTypeVtable, DldInheritanceDepth_0 );
+        DldStormVtableHooker2::fUnHookObject( context->Readers[ i ].DerivedObject, DldHookTypeVtable, DldInheritanceDepth_2 );
+
+        context->Readers[ i ].Object->release();
+        context->Readers[ i ].DerivedObject->release();
+
+    }// end for
+
+    free( context );
+
+    return 0;
+}
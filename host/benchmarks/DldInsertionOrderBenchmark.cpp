@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include "DldCommonHashTable.h"
+#include "DldHostBenchmark.h"
+
+//
+// a table which links its entries in the insertion order against a table
+// created with GHT_NO_INSERTION_ORDER, the keys are 8 bytes as the object
+// keys of the hooked objects table, the number of keys is the iterations
+// number, the keys are inserted, iterated over with ght_first() and
+// ght_next() and removed in a different order, the times are per key
+// and are the best of DLD_ORDER_ROUNDS rounds, the memory is taken after
+// the keys have been inserted
+//
+
+typedef enum _DldOrderScenario{
+    DldOrderScenarioOrdered = 0x0,
+    DldOrderScenarioUnordered,
+    DldOrderScenarioMaximum
+} DldOrderScenario;
+
+static const char*  gOrderScenarioNames[ DldOrderScenarioMaximum ] = {
+    "insertion_order",
+    "no_insertion_order"
+};
+
+static const unsigned int  gOrderScenarioFlags[ DldOrderScenarioMaximum ] = {
+    GHT_FLAGS_NONE,
+    GHT_NO_INSERTION_ORDER
+};
+
+#define DLD_ORDER_ROUNDS    (0x3)
+
+typedef struct _DldOrderResult{
+
+    uint64_t    InsertNs;
+    uint64_t    IterateNs;
+    uint64_t    RemoveNs;
+    vm_size_t   TableBytes;
+    vm_size_t   EntriesBytes;
+
+} DldOrderResult;
+
+//--------------------------------------------------------------------
+
+static
+UInt64
+DldOrderRandom(
+    __inout UInt64* state
+    )
+{
+    //
+    // xorshift64*
+    //
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+//--------------------------------------------------------------------
+
+static
+bool
+DldOrderRun(
+    __in DldOrderScenario scenario,
+    __in UInt64* keys,
+    __in unsigned long* removeOrder,
+    __in unsigned long keysNumber,
+    __out DldOrderResult* result
+    )
+{
+    ght_hash_table_t*  hashTable;
+    ght_iterator_t     iterator;
+    const void*        key;
+    uint64_t           startTime;
+    uint64_t           iterated = 0x0;
+    uint64_t           removed = 0x0;
+
+    hashTable = ght_create( (unsigned int)keysNumber, false, gOrderScenarioFlags[ scenario ] );
+    if( NULL == hashTable ){
+
+        fprintf( stderr, "ght_create failed\n" );
+        return false;
+    }
+
+    startTime = DldBenchmarkNanoseconds();
+    for( unsigned long i = 0x0; i < keysNumber; ++i ){
+
+        if( 0x0 != ght_insert( hashTable, (void*)&keys[ i ], sizeof( keys[ i ] ), &keys[ i ] ) ){
+
+            fprintf( stderr, "ght_insert failed\n" );
+            ght_finalize( hashTable );
+            return false;
+        }
+    }// end for
+    result->InsertNs = DldBenchmarkNanoseconds() - startTime;
+
+    ght_memory_usage( hashTable, &result->TableBytes, &result->EntriesBytes );
+
+    startTime = DldBenchmarkNanoseconds();
+    for( void* data = ght_first( hashTable, &iterator, &key ); data; data = ght_next( hashTable, &iterator, &key ) )
+        iterated += ( *(UInt64*)data == *(const UInt64*)key ) ? 0x1 : 0x0;
+    result->IterateNs = DldBenchmarkNanoseconds() - startTime;
+
+    startTime = DldBenchmarkNanoseconds();
+    for( unsigned long i = 0x0; i < keysNumber; ++i )
+        removed += ( NULL != ght_remove( hashTable, sizeof( keys[ 0 ] ), &keys[ removeOrder[ i ] ] ) ) ? 0x1 : 0x0;
+    result->RemoveNs = DldBenchmarkNanoseconds() - startTime;
+
+    ght_finalize( hashTable );
+
+    if( iterated != keysNumber || removed != keysNumber ){
+
+        fprintf( stderr, "iterated %llu, removed %llu of %lu keys\n",
+                 (unsigned long long)iterated, (unsigned long long)removed, keysNumber );
+        return false;
+    }
+
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+int
+main( int argc, char* argv[] )
+{
+    DldBenchmarkArguments  arguments;
+    UInt64*                keys;
+    unsigned long*         removeOrder;
+    UInt64                 state = 0x9E3779B97F4A7C15ULL;
+    DldOrderResult         results[ DldOrderScenarioMaximum ];
+
+    DldBenchmarkParseArguments( argc, argv, 0x100000, &arguments );
+
+    keys = (UInt64*)malloc( arguments.Iterations*sizeof( keys[ 0 ] ) );
+    removeOrder = (unsigned long*)malloc( arguments.Iterations*sizeof( removeOrder[ 0 ] ) );
+    if( NULL == keys || NULL == removeOrder ){
+
+        fprintf( stderr, "an allocation failed\n" );
+        return 1;
+    }
+
+    //
+    // the keys are unique as xorshift64* doesn't repeat a state in its period,
+    // the removal order is a random permutation
+    //
+    for( unsigned long i = 0x0; i < arguments.Iterations; ++i ){
+
+        keys[ i ] = DldOrderRandom( &state );
+        removeOrder[ i ] = i;
+    }// end for
+
+    for( unsigned long i = arguments.Iterations - 0x1; i > 0x0; --i ){
+
+        unsigned long  j = (unsigned long)( DldOrderRandom( &state ) % ( i + 0x1 ) );
+        unsigned long  swap = removeOrder[ i ];
+
+        removeOrder[ i ] = removeOrder[ j ];
+        removeOrder[ j ] = swap;
+    }// end for
+
+    DldBenchmarkBegin( "DldInsertionOrderBenchmark", &arguments );
+
+    bzero( results, sizeof( results ) );
+
+    //
+    // the scenarios alternate and the best time of the rounds is reported
+    // so the first scenario doesn't pay alone for the allocator's growth
+    //
+    for( unsigned int round = 0x0; round < DLD_ORDER_ROUNDS; ++round ){
+
+        for( unsigned int scenario = 0x0; scenario < DldOrderScenarioMaximum; ++scenario ){
+
+            DldOrderResult  result;
+
+            if( !DldOrderRun( (DldOrderScenario)scenario, keys, removeOrder, arguments.Iterations, &result ) )
+                return 1;
+
+            if( 0x0 == round || result.InsertNs < results[ scenario ].InsertNs )
+                results[ scenario ].InsertNs = result.InsertNs;
+
+            if( 0x0 == round || result.IterateNs < results[ scenario ].IterateNs )
+                results[ scenario ].IterateNs = result.IterateNs;
+
+            if( 0x0 == round || result.RemoveNs < results[ scenario ].RemoveNs )
+                results[ scenario ].RemoveNs = result.RemoveNs;
+
+            results[ scenario ].TableBytes = result.TableBytes;
+            results[ scenario ].EntriesBytes = result.EntriesBytes;
+
+        }// end for
+    }// end for
+
+    for( unsigned int scenario = 0x0; scenario < DldOrderScenarioMaximum; ++scenario ){
+
+        DldOrderResult*  result = &results[ scenario ];
+        vm_size_t        orderedBytes = results[ DldOrderScenarioOrdered ].TableBytes + results[ DldOrderScenarioOrdered ].EntriesBytes;
+        double           keysNumber = (double)arguments.Iterations;
+
+        DldBenchmarkResultBegin( gOrderScenarioNames[ scenario ], 0x1 );
+        DldBenchmarkFieldUInt( "keys", arguments.Iterations );
+        DldBenchmarkFieldDouble( "insert_ns_per_key", (double)result->InsertNs/keysNumber );
+        DldBenchmarkFieldDouble( "iterate_ns_per_key", (double)result->IterateNs/keysNumber );
+        DldBenchmarkFieldDouble( "remove_ns_per_key", (double)result->RemoveNs/keysNumber );
+        DldBenchmarkFieldUInt( "table_bytes", (uint64_t)result->TableBytes );
+        DldBenchmarkFieldUInt( "entries_bytes", (uint64_t)result->EntriesBytes );
+        DldBenchmarkFieldDouble( "bytes_per_key", (double)( result->TableBytes + result->EntriesBytes )/keysNumber );
+        DldBenchmarkFieldUInt( "saved_bytes", (uint64_t)( orderedBytes - ( result->TableBytes + result->EntriesBytes ) ) );
+        DldBenchmarkResultEnd();
+
+    }// end for
+
+    DldBenchmarkEnd();
+
+    free( removeOrder );
+    free( keys );
+
+    return 0;
+}
@@ -0,0 +1,359 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include "DldHostTestClasses.h"
+#include "DldHostBenchmark.h"
+
+//
+// the read side scalability, every thread resolves vtable keys with
+//   shared_lock      - the hash table lookup under the shared lock
+//   read_section     - the hash table lookup in the lock free read section
+//   replica          - the replica lookup in the lock free read section,
+//                      only in a build with DLD_HOOK_REPLICAS
+//   hooked_call      - a call of a vtable hooked object, the original
+//                      function is resolved by the hooker's call cache
+// the table has DLD_SCALING_KEYS vtable entries which original functions
+// arrays are fake so a lookup misses the hooker's call cache, the scaling
+// field is the throughput divided by the number of threads and the single
+// thread throughput, it is 1.0 for a linear scaling
+//
+
+typedef DldHookerCommonClass2< DldTestServiceDldHook<DldInheritanceDepth_0,1>, DldTestService >  DldScalingVtableHooker;
+
+#define DLD_SCALING_KEYS    (0x100)
+
+typedef enum _DldScalingScenario{
+    DldScalingScenarioSharedLock = 0x0,
+    DldScalingScenarioReadSection,
+#if defined(DLD_HOOK_REPLICAS)
+    DldScalingScenarioReplica,
+#endif//DLD_HOOK_REPLICAS
+    DldScalingScenarioHookedCall,
+    DldScalingScenarioMaximum
+} DldScalingScenario;
+
+static const char*  gScalingScenarioNames[ DldScalingScenarioMaximum ] = {
+    "shared_lock",
+    "read_section",
+#if defined(DLD_HOOK_REPLICAS)
+    "replica",
+#endif//DLD_HOOK_REPLICAS
+    "hooked_call"
+};
+
+typedef struct _DldScalingThread{
+
+    UInt64      Found;
+    UInt64      Retries;
+
+} __attribute__((aligned(64))) DldScalingThread;
+
+typedef struct _DldScalingContext{
+
+    DldScalingScenario          Scenario;
+    unsigned long               Iterations;
+
+    OSMetaClassBase::_ptf_t     Vtables[ DLD_SCALING_KEYS ][ 0x2 ];
+    UInt64                      MetaClass;
+
+    DldTestService*             Objects[ DLD_BENCHMARK_MAX_THREADS ];
+    DldScalingThread            Threads[ DLD_BENCHMARK_MAX_THREADS ];
+
+    volatile UInt32             Sink;
+
+} DldScalingContext;
+
+//--------------------------------------------------------------------
+
+static
+void
+DldScalingKey(
+    __in DldScalingContext* context,
+    __in unsigned int slot,
+    __out DldHookTypeVtableKey* key
+    )
+{
+    //
+    // the key is compared as a byte array so the padding is zeroed
+    //
+    bzero( key, sizeof( *key ) );
+    key->Vtable = context->Vtables[ slot ];
+    key->metaClass = (const OSMetaClass*)&context->MetaClass;
+    key->InheritanceDepth = DldInheritanceDepth_0;
+}
+
+//--------------------------------------------------------------------
+
+static
+bool
+DldScalingAddEntry(
+    __in DldScalingContext* context,
+    __in unsigned int slot
+    )
+{
+    DldHookTypeVtableKey    key;
+    DldHookedObjectEntry*   entry;
+    DldHookedFunctionInfo*  functionsInfo;
+    bool                    added;
+
+    entry = DldHookedObjectEntry::allocateNew();
+    functionsInfo = (DldHookedFunctionInfo*)IOMalloc( 0x2*sizeof( DldHookedFunctionInfo ) );
+    if( NULL == entry || NULL == functionsInfo )
+        return false;
+
+    functionsInfo[ 0 ].VtableIndex = slot;
+    functionsInfo[ 0 ].OriginalFunction = (DldVtableFunctionPtr)context->Vtables[ slot ];
+    functionsInfo[ 0 ].HookingFunction = NULL;
+    functionsInfo[ 1 ].VtableIndex = (unsigned int)(-1);
+    functionsInfo[ 1 ].OriginalFunction = NULL;
+    functionsInfo[ 1 ].HookingFunction = NULL;
+
+    DldScalingKey( context, slot, &key );
+
+    entry->Type = DldHookedObjectEntry::DldHookEntryTypeVtable;
+    entry->InheritanceDepth = DldInheritanceDepth_0;
+    entry->Key.VtableHookVtable = key;
+    entry->Parameters.Common.HookedVtableFunctionsInfo = functionsInfo;
+    entry->Parameters.TypeVtable.HookedVtableFunctionsInfoEntriesNumber = 0x2;
+    entry->Parameters.TypeVtable.ReferenceCount = 0x1;
+
+    DldHookedObjectsHashTable::sHashTable->LockExclusive();
+    {// start of the lock
+
+        added = DldHookedObjectsHashTable::sHashTable->AddObject( &key, entry );
+
+    }// end of the lock
+    DldHookedObjectsHashTable::sHashTable->UnLockExclusive();
+
+    entry->release();
+
+    return added;
+}
+
+static
+void
+DldScalingRemoveEntry(
+    __in DldScalingContext* context,
+    __in unsigned int slot
+    )
+{
+    DldHookTypeVtableKey    key;
+    DldHookedObjectEntry*   entry;
+
+    DldScalingKey( context, slot, &key );
+
+    DldHookedObjectsHashTable::sHashTable->LockExclusive();
+    {// start of the lock
+
+        entry = DldHookedObjectsHashTable::sHashTable->RemoveObject( &key );
+
+    }// end of the lock
+    DldHookedObjectsHashTable::sHashTable->UnLockExclusive();
+
+    if( entry )
+        entry->release();
+}
+
+//--------------------------------------------------------------------
+
+static
+void
+DldScalingThreadRoutine(
+    __in unsigned int thread,
+    __in void* context
+    )
+{
+    DldScalingContext*  scalingContext = (DldScalingContext*)context;
+    DldScalingThread*   threadState = &scalingContext->Threads[ thread ];
+    DldTestService*     object = scalingContext->Objects[ thread ];
+    UInt32              sum = 0x0;
+    unsigned int        slot = thread;
+
+    for( unsigned long i = 0x0; i < scalingContext->Iterations; ++i ){
+
+        DldHookTypeVtableKey    key;
+        DldHashTableReadState   state;
+        DldHookedObjectEntry*   entry;
+
+        slot = ( slot*0x5 + 0x3 ) % DLD_SCALING_KEYS;
+
+        switch( scalingContext->Scenario ){
+
+            case DldScalingScenarioSharedLock:
+
+                DldScalingKey( scalingContext, slot, &key );
+
+                DldHookedObjectsHashTable::sHashTable->LockShared();
+                {// start of the lock
+
+                    entry = DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &key, false );
+                    if( entry )
+                        sum += (UInt32)(uintptr_t)entry->Parameters.Common.HookedVtableFunctionsInfo[ 0 ].OriginalFunction;
+
+                }// end of the lock
+                DldHookedObjectsHashTable::sHashTable->UnLockShared();
+
+                threadState->Found += ( NULL != entry ) ? 0x1 : 0x0;
+                break;
+
+            case DldScalingScenarioReadSection:
+
+                DldScalingKey( scalingContext, slot, &key );
+
+                entry = NULL;
+                if( DldHookedObjectsHashTable::sHashTable->ReadBegin( &state ) ){
+
+                    entry = DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &key, false );
+                    if( entry )
+                        sum += (UInt32)(uintptr_t)entry->Parameters.Common.HookedVtableFunctionsInfo[ 0 ].OriginalFunction;
+
+                    if( !DldHookedObjectsHashTable::sHashTable->ReadEnd( &state ) )
+                        threadState->Retries += 0x1;
+
+                } else {
+
+                    threadState->Retries += 0x1;
+                }
+
+                threadState->Found += ( NULL != entry ) ? 0x1 : 0x0;
+                break;
+
+#if defined(DLD_HOOK_REPLICAS)
+            case DldScalingScenarioReplica:
+                {
+                    DldHookedFunctionInfo*  functionsInfo = NULL;
+
+                    DldScalingKey( scalingContext, slot, &key );
+
+                    if( DldHookedObjectsHashTable::sHashTable->ReadBegin( &state ) ){
+
+                        functionsInfo = DldHookedObjectsHashTable::sHashTable->RetrieveReplicaFunctionsInfo( &state, &key );
+                        if( functionsInfo )
+                            sum += (UInt32)(uintptr_t)functionsInfo[ 0 ].OriginalFunction;
+
+                        if( !DldHookedObjectsHashTable::sHashTable->ReadEnd( &state ) )
+                            threadState->Retries += 0x1;
+
+                    } else {
+
+                        threadState->Retries += 0x1;
+                    }
+
+                    threadState->Found += ( NULL != functionsInfo ) ? 0x1 : 0x0;
+                }
+                break;
+#endif//DLD_HOOK_REPLICAS
+
+            default:
+
+                sum += object->testMethod( (UInt32)i );
+                threadState->Found += 0x1;
+                break;
+        }// end switch
+
+    }// end for
+
+    scalingContext->Sink += sum;
+}
+
+//--------------------------------------------------------------------
+
+int
+main( int argc, char* argv[] )
+{
+    DldBenchmarkArguments  arguments;
+    DldScalingContext*     context;
+
+    DldBenchmarkParseArguments( argc, argv, 1000000, &arguments );
+
+    if( !DldHookedObjectsHashTable::CreateStaticTableWithSize( 0x100, false ) ){
+
+        fprintf( stderr, "CreateStaticTableWithSize failed\n" );
+        return 1;
+    }
+
+    context = (DldScalingContext*)calloc( 0x1, sizeof( *context ) );
+    if( NULL == context )
+        return 1;
+
+    for( unsigned int slot = 0x0; slot < DLD_SCALING_KEYS; ++slot ){
+
+        if( !DldScalingAddEntry( context, slot ) ){
+
+            fprintf( stderr, "adding a vtable entry failed\n" );
+            return 1;
+        }
+    }// end for
+
+    for( unsigned int i = 0x0; i < arguments.MaxThreads; ++i ){
+
+        context->Objects[ i ] = new DldTestService;
+
+        if( kIOReturnSuccess != DldScalingVtableHooker::fHookObject( context->Objects[ i ], DldHookTypeVtable ) ){
+
+            fprintf( stderr, "hooking failed\n" );
+            return 1;
+        }
+    }// end for
+
+    context->Iterations = arguments.Iterations;
+
+    DldBenchmarkBegin( "DldReplicaScalingBenchmark", &arguments );
+
+    for( unsigned int scenario = 0x0; scenario < DldScalingScenarioMaximum; ++scenario ){
+
+        double  singleThreadRate = 0.0;
+
+        context->Scenario = (DldScalingScenario)scenario;
+
+        for( unsigned int threads = 0x1; threads <= arguments.MaxThreads; threads *= 0x2 ){
+
+            uint64_t  elapsedNs;
+            uint64_t  calls = (uint64_t)threads*context->Iterations;
+            uint64_t  found = 0x0;
+            uint64_t  retries = 0x0;
+            double    rate;
+
+            bzero( context->Threads, sizeof( context->Threads ) );
+
+            elapsedNs = DldBenchmarkRunThreads( threads, DldScalingThreadRoutine, context );
+
+            for( unsigned int i = 0x0; i < threads; ++i ){
+
+                found += context->Threads[ i ].Found;
+                retries += context->Threads[ i ].Retries;
+            }// end for
+
+            rate = (double)calls*1e9/(double)( elapsedNs ? elapsedNs : 0x1 );
+            if( 0x1 == threads )
+                singleThreadRate = rate;
+
+            DldBenchmarkResultBegin( gScalingScenarioNames[ scenario ], threads );
+            DldBenchmarkFieldUInt( "calls", calls );
+            DldBenchmarkFieldUInt( "elapsed_ns", elapsedNs );
+            DldBenchmarkFieldUInt( "found", found );
+            DldBenchmarkFieldUInt( "retries", retries );
+            DldBenchmarkFieldDouble( "ns_per_call", (double)elapsedNs*threads/(double)( calls ? calls : 0x1 ) );
+            DldBenchmarkFieldDouble( "calls_per_second", rate );
+            DldBenchmarkFieldDouble( "scaling", rate/( singleThreadRate*threads ) );
+            DldBenchmarkResultEnd();
+
+        }// end for
+    }// end for
+
+    DldBenchmarkEnd();
+
+    for( unsigned int i = 0x0; i < arguments.MaxThreads; ++i ){
+
+        DldScalingVtableHooker::fUnHookObject( context->Objects[ i ], DldHookTypeVtable, DldInheritanceDepth_0 );
+        context->Objects[ i ]->release();
+    }// end for
+
+    for( unsigned int slot = 0x0; slot < DLD_SCALING_KEYS; ++slot )
+        DldScalingRemoveEntry( context, slot );
+
+    free( context );
+
+    return 0;
+}
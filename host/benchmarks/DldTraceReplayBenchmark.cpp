@@ -0,0 +1,1071 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include <unistd.h>
+#include "DldHostTestClasses.h"
+#include "DldHostBenchmark.h"
+#include "DldEventRingShared.h"
+
+//
+// replays a hook trace, i.e. the DLD_EVENT_TYPE_HOOK, DLD_EVENT_TYPE_UNHOOK
+// and DLD_EVENT_TYPE_CALL records captured by DLD_EVENT_RING_METHOD_SET_HOOK_TRACE
+// and saved as an array of DldEventRecord structures, against the synthetic
+// objects, the benchmark accepts
+//   -r <file>   replays the trace from the file
+//   -w <file>   saves the generated trace to the file
+// without -r a trace is generated by a synthetic workload recorded through
+// gHookTraceCallback in the same format as DldEventRing records it,
+//
+// the replay maps
+//   - a traced object to a DldTestService object, the class is
+//     DldTestServiceLevel<N> if the first hook of the object is at the depth N,
+//     the depths above 2 are replayed at the depth 2
+//   - a traced hooker to a hooker from the pool, the object hookers and
+//     the vtable hookers are assigned round robin to DLD_REPLAY_CHAINS hookers
+//     of their type, a hooker which has no hook records in the trace, i.e.
+//     it hooked before the trace was started, is replayed as an object hooker
+//     and the objects it called are hooked before the replay starts
+//   - a traced thread to a replay thread, the traced threads are assigned
+//     round robin to the replay threads
+// a call through N chained hooks is recorded N times, the records of the
+// same thread for the same object made by different hookers are replayed as
+// a single call, the hook and unhook records are replayed in the trace order
+// by the main thread while the replay threads wait, the calls between them
+// are replayed by the replay threads concurrently, the hook records for an
+// already hooked object and the unhook records for an object which is not
+// hooked by the replay hooker are skipped
+//
+
+#define DLD_REPLAY_CHAINS           (0x2)
+#define DLD_REPLAY_DEPTHS           (0x3)
+
+//
+// the maximum number of the hookers a single call passes through
+//
+#define DLD_REPLAY_CALL_HOOKERS     (0x8)
+
+typedef IOReturn (*DldReplayHookRoutine)( __in OSObject* object );
+
+typedef struct _DldReplayHookerRoutines{
+
+    DldReplayHookRoutine    Hook;
+    DldReplayHookRoutine    UnHook;
+
+} DldReplayHookerRoutines;
+
+//
+// the chains [ 0, DLD_REPLAY_CHAINS ) are the object hookers,
+// the chains [ DLD_REPLAY_CHAINS, 2*DLD_REPLAY_CHAINS ) are the vtable hookers
+//
+template<DldInheritanceDepth Depth, int Chain>
+IOReturn
+DldReplayHook( __in OSObject* object )
+{
+    return DldHookerCommonClass2< DldTestServiceDldHook<Depth,Chain>, DldTestService >::fHookObject(
+                object, ( Chain < DLD_REPLAY_CHAINS ) ? DldHookTypeObject : DldHookTypeVtable );
+}
+
+template<DldInheritanceDepth Depth, int Chain>
+IOReturn
+DldReplayUnHook( __in OSObject* object )
+{
+    return DldHookerCommonClass2< DldTestServiceDldHook<Depth,Chain>, DldTestService >::fUnHookObject(
+                object, ( Chain < DLD_REPLAY_CHAINS ) ? DldHookTypeObject : DldHookTypeVtable, Depth );
+}
+
+#define DLD_REPLAY_HOOKER( _DEPTH_, _CHAIN_ ) \
+    { DldReplayHook< _DEPTH_, _CHAIN_ >, DldReplayUnHook< _DEPTH_, _CHAIN_ > }
+
+#define DLD_REPLAY_DEPTH_HOOKERS( _DEPTH_ ) \
+    { DLD_REPLAY_HOOKER( _DEPTH_, 0 ), DLD_REPLAY_HOOKER( _DEPTH_, 1 ), \
+      DLD_REPLAY_HOOKER( _DEPTH_, 2 ), DLD_REPLAY_HOOKER( _DEPTH_, 3 ) }
+
+static const DldReplayHookerRoutines  gReplayHookers[ DLD_REPLAY_DEPTHS ][ 2*DLD_REPLAY_CHAINS ] = {
+    DLD_REPLAY_DEPTH_HOOKERS( DldInheritanceDepth_0 ),
+    DLD_REPLAY_DEPTH_HOOKERS( DldInheritanceDepth_1 ),
+    DLD_REPLAY_DEPTH_HOOKERS( DldInheritanceDepth_2 )
+};
+
+//--------------------------------------------------------------------
+
+//
+// an identifier to an index map, open addressing with linear probing,
+// the indices are assigned in the order of the identifiers' appearance
+//
+typedef struct _DldReplayIdMap{
+
+    uint64_t*       Keys;
+    uint32_t*       Values;
+    uint32_t        Size;// a power of two
+    uint32_t        Count;
+
+} DldReplayIdMap;
+
+static
+uint32_t
+DldReplayIdMapLookup(
+    __inout DldReplayIdMap* map,
+    __in uint64_t key,
+    __out bool* added
+    )
+{
+    uint32_t  slot;
+
+    *added = false;
+
+    if( 2*( map->Count + 0x1 ) > map->Size ){
+
+        DldReplayIdMap  newMap;
+
+        newMap.Size = map->Size ? 2*map->Size : 0x100;
+        newMap.Count = 0x0;
+        newMap.Keys = (uint64_t*)calloc( newMap.Size, sizeof( newMap.Keys[ 0 ] ) );
+        newMap.Values = (uint32_t*)calloc( newMap.Size, sizeof( newMap.Values[ 0 ] ) );
+        if( NULL == newMap.Keys || NULL == newMap.Values ){
+
+            fprintf( stderr, "out of memory\n" );
+            exit( 1 );
+        }
+
+        //
+        // the values are stored with 0x1 added so a zero value is an empty slot
+        //
+        for( uint32_t i = 0x0; i < map->Size; ++i ){
+
+            if( 0x0 != map->Values[ i ] ){
+
+                slot = (uint32_t)( map->Keys[ i ] * 0x9E3779B97F4A7C15ULL >> 32 ) & ( newMap.Size - 0x1 );
+                while( 0x0 != newMap.Values[ slot ] )
+                    slot = ( slot + 0x1 ) & ( newMap.Size - 0x1 );
+
+                newMap.Keys[ slot ] = map->Keys[ i ];
+                newMap.Values[ slot ] = map->Values[ i ];
+            }
+        }// end for
+
+        newMap.Count = map->Count;
+
+        free( map->Keys );
+        free( map->Values );
+        *map = newMap;
+    }
+
+    slot = (uint32_t)( key * 0x9E3779B97F4A7C15ULL >> 32 ) & ( map->Size - 0x1 );
+    while( 0x0 != map->Values[ slot ] ){
+
+        if( key == map->Keys[ slot ] )
+            return map->Values[ slot ] - 0x1;
+
+        slot = ( slot + 0x1 ) & ( map->Size - 0x1 );
+    }// end while
+
+    map->Keys[ slot ] = key;
+    map->Values[ slot ] = ++map->Count;
+    *added = true;
+
+    return map->Count - 0x1;
+}
+
+static
+void
+DldReplayIdMapFree(
+    __inout DldReplayIdMap* map
+    )
+{
+    free( map->Keys );
+    free( map->Values );
+    bzero( map, sizeof( *map ) );
+}
+
+//--------------------------------------------------------------------
+
+//
+// a growing records array, also used by the recording callback
+//
+typedef struct _DldReplayTrace{
+
+    DldEventRecord*     Records;
+    size_t              Count;
+    size_t              Size;
+
+} DldReplayTrace;
+
+static
+void
+DldReplayTraceAdd(
+    __inout DldReplayTrace* trace,
+    __in const DldEventRecord* record
+    )
+{
+    if( trace->Count == trace->Size ){
+
+        trace->Size = trace->Size ? 2*trace->Size : 0x1000;
+        trace->Records = (DldEventRecord*)realloc( trace->Records, trace->Size*sizeof( trace->Records[ 0 ] ) );
+        if( NULL == trace->Records ){
+
+            fprintf( stderr, "out of memory\n" );
+            exit( 1 );
+        }
+    }
+
+    trace->Records[ trace->Count++ ] = *record;
+}
+
+//--------------------------------------------------------------------
+
+//
+// the recording, the records are made as DldEventRing::HookTraceCallback() makes them,
+// the identifiers are the addresses as the recorded process replays its own trace
+//
+
+static DldReplayTrace    gRecordedTrace;
+static pthread_mutex_t   gRecordedTraceMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static
+void
+DldReplayRecordCallback(
+    __in DldHookTraceEvent event,
+    __in DldHookerCommonClass* hooker,
+    __in const OSObject* object,
+    __in unsigned int indx
+    )
+{
+    DldEventRecord  record;
+
+    bzero( &record, sizeof( record ) );
+
+    record.Timestamp = DldBenchmarkNanoseconds();
+    record.Object = (uint64_t)(uintptr_t)object;
+    record.MetaClass = (uint64_t)(uintptr_t)object->getMetaClass();
+    record.Thread = (uint64_t)pthread_self();
+    record.Pid = getpid();
+    record.Hooker = hooker->GetHookerId();
+
+    switch( event ){
+
+        case DldHookTraceEventCall:
+            record.Type = DLD_EVENT_TYPE_CALL;
+            record.HookIndex = indx;
+            break;
+        case DldHookTraceEventHook:
+            record.Type = DLD_EVENT_TYPE_HOOK;
+            record.HookIndex = DLD_EVENT_HOOKER_INFO( hooker->GetHookType(), hooker->GetInheritanceDepth() );
+            break;
+        case DldHookTraceEventUnHook:
+            record.Type = DLD_EVENT_TYPE_UNHOOK;
+            record.HookIndex = DLD_EVENT_HOOKER_INFO( hooker->GetHookType(), hooker->GetInheritanceDepth() );
+            break;
+        default:
+            return;
+    }
+
+    pthread_mutex_lock( &gRecordedTraceMutex );
+    DldReplayTraceAdd( &gRecordedTrace, &record );
+    pthread_mutex_unlock( &gRecordedTraceMutex );
+}
+
+//--------------------------------------------------------------------
+
+//
+// the synthetic workload, the objects are a mix of the object hooked,
+// the vtable hooked at the depth 2 and the vtable and object chained objects,
+// a thread calls its objects, the objects are unhooked and hooked
+// again every round as by a device's removal and arrival
+//
+
+#define DLD_REPLAY_WORKLOAD_OBJECTS     (0x4)// per thread
+#define DLD_REPLAY_WORKLOAD_ROUNDS      (0x4)
+
+typedef struct _DldReplayWorkload{
+
+    DldTestService*     Objects[ DLD_BENCHMARK_MAX_THREADS ][ DLD_REPLAY_WORKLOAD_OBJECTS ];
+    unsigned long       Calls;
+    volatile UInt32     Sink;
+
+} DldReplayWorkload;
+
+static
+void
+DldReplayWorkloadRoutine(
+    __in unsigned int thread,
+    __in void* context
+    )
+{
+    DldReplayWorkload*  workload = (DldReplayWorkload*)context;
+    UInt32              sum = 0x0;
+
+    for( unsigned long i = 0x0; i < workload->Calls; ++i )
+        sum += workload->Objects[ thread ][ i % DLD_REPLAY_WORKLOAD_OBJECTS ]->testMethod( (UInt32)i );
+
+    workload->Sink += sum;
+}
+
+static
+void
+DldReplayGenerateTrace(
+    __in const DldBenchmarkArguments* arguments
+    )
+{
+    DldReplayWorkload*  workload;
+
+    workload = (DldReplayWorkload*)calloc( 0x1, sizeof( *workload ) );
+    if( NULL == workload ){
+
+        fprintf( stderr, "out of memory\n" );
+        exit( 1 );
+    }
+
+    workload->Calls = arguments->Iterations / DLD_REPLAY_WORKLOAD_ROUNDS + 0x1;
+
+    gHookTraceCallback = DldReplayRecordCallback;
+
+    for( unsigned int round = 0x0; round < DLD_REPLAY_WORKLOAD_ROUNDS; ++round ){
+
+        for( unsigned int t = 0x0; t < arguments->MaxThreads; ++t ){
+
+            workload->Objects[ t ][ 0 ] = new DldTestService;
+            workload->Objects[ t ][ 1 ] = new DldTestServiceLevel2;
+            workload->Objects[ t ][ 2 ] = new DldTestService;
+            workload->Objects[ t ][ 3 ] = new DldTestService;
+
+            if( kIOReturnSuccess != gReplayHookers[ 0 ][ 0 ].Hook( workload->Objects[ t ][ 0 ] ) ||
+                kIOReturnSuccess != gReplayHookers[ 2 ][ DLD_REPLAY_CHAINS ].Hook( workload->Objects[ t ][ 1 ] ) ||
+                kIOReturnSuccess != gReplayHookers[ 0 ][ DLD_REPLAY_CHAINS ].Hook( workload->Objects[ t ][ 2 ] ) ||
+                kIOReturnSuccess != gReplayHookers[ 0 ][ 1 ].Hook( workload->Objects[ t ][ 2 ] ) ||
+                kIOReturnSuccess != gReplayHookers[ 0 ][ 1 ].Hook( workload->Objects[ t ][ 3 ] ) ){
+
+                fprintf( stderr, "hooking failed\n" );
+                exit( 1 );
+            }
+        }// end for
+
+        DldBenchmarkRunThreads( arguments->MaxThreads, DldReplayWorkloadRoutine, workload );
+
+        for( unsigned int t = 0x0; t < arguments->MaxThreads; ++t ){
+
+            gReplayHookers[ 0 ][ 0 ].UnHook( workload->Objects[ t ][ 0 ] );
+            gReplayHookers[ 2 ][ DLD_REPLAY_CHAINS ].UnHook( workload->Objects[ t ][ 1 ] );
+            gReplayHookers[ 0 ][ 1 ].UnHook( workload->Objects[ t ][ 2 ] );
+            gReplayHookers[ 0 ][ DLD_REPLAY_CHAINS ].UnHook( workload->Objects[ t ][ 2 ] );
+            gReplayHookers[ 0 ][ 1 ].UnHook( workload->Objects[ t ][ 3 ] );
+
+            for( unsigned int i = 0x0; i < DLD_REPLAY_WORKLOAD_OBJECTS; ++i )
+                workload->Objects[ t ][ i ]->release();
+
+        }// end for
+
+    }// end for
+
+    gHookTraceCallback = NULL;
+
+    free( workload );
+}
+
+//--------------------------------------------------------------------
+
+typedef enum _DldReplayOpType{
+    DldReplayOpCall = 0x0,
+    DldReplayOpHook,
+    DldReplayOpUnHook
+} DldReplayOpType;
+
+typedef struct _DldReplayOp{
+
+    uint8_t     Type;// DldReplayOpType
+    uint8_t     Chain;
+    uint16_t    Thread;// a traced thread's index, for DldReplayOpCall
+    uint32_t    Object;
+
+} DldReplayOp;
+
+typedef struct _DldReplayObject{
+
+    uint32_t            Depth;
+    bool                DepthKnown;
+    DldTestService*     Instance;
+    uint32_t            HookedChains;// a bit per chain
+
+} DldReplayObject;
+
+typedef struct _DldReplayHooker{
+
+    bool        TypeKnown;
+    uint8_t     Chain;
+
+} DldReplayHooker;
+
+//
+// the last call of a traced thread, the next call record of the thread for
+// the same object made by a hooker not in the list is a part of the same call
+//
+typedef struct _DldReplayThreadCall{
+
+    uint32_t    Object;
+    uint32_t    Hookers[ DLD_REPLAY_CALL_HOOKERS ];
+    uint32_t    HookersNumber;
+
+} DldReplayThreadCall;
+
+//
+// a replay program, the segments are the sequences of the calls separated by the hook and unhook ops
+//
+typedef struct _DldReplayProgram{
+
+    DldReplayOp*        Ops;
+    size_t              OpsNumber;
+
+    DldReplayObject*    Objects;
+    uint32_t            ObjectsNumber;
+
+    uint32_t            ThreadsNumber;
+
+    //
+    // the ops to hook the objects called by the hookers hooked before the trace start
+    //
+    DldReplayOp*        InitialHooks;
+    size_t              InitialHooksNumber;
+
+    uint64_t            Records;
+    uint64_t            CallRecords;
+    uint32_t            HookersNumber;
+    uint32_t            UnknownHookers;
+
+} DldReplayProgram;
+
+static
+int
+DldReplayCompareRecords(
+    __in const void* first,
+    __in const void* second
+    )
+{
+    const DldEventRecord*  r1 = (const DldEventRecord*)first;
+    const DldEventRecord*  r2 = (const DldEventRecord*)second;
+
+    if( r1->Timestamp != r2->Timestamp )
+        return ( r1->Timestamp < r2->Timestamp ) ? -1 : 1;
+
+    //
+    // qsort is not stable, the records are saved by the reader in the order
+    // of their appearance in a CPU's ring so the address keeps the order
+    //
+    return ( r1 < r2 ) ? -1 : ( ( r1 > r2 ) ? 1 : 0 );
+}
+
+//
+// returns true for the records replayed by DldReplayCompile(), the other
+// records, e.g. DLD_EVENT_TYPE_EXTERNAL_METHOD, are dropped
+//
+static
+bool
+DldReplayIsHookRecord(
+    __in const DldEventRecord* record
+    )
+{
+    return ( DLD_EVENT_TYPE_CALL == record->Type ||
+             DLD_EVENT_TYPE_HOOK == record->Type ||
+             DLD_EVENT_TYPE_UNHOOK == record->Type );
+}
+
+//
+// grows the array to have at least the index + 0x1 entries, the new entries are zeroed
+//
+static
+void*
+DldReplayGrowArray(
+    __in void* array,
+    __inout uint32_t* size,
+    __in uint32_t indx,
+    __in size_t entrySize
+    )
+{
+    uint32_t  newSize = *size;
+
+    if( indx < *size )
+        return array;
+
+    while( newSize <= indx )
+        newSize = newSize ? 2*newSize : 0x40;
+
+    array = realloc( array, newSize*entrySize );
+    if( NULL == array ){
+
+        fprintf( stderr, "out of memory\n" );
+        exit( 1 );
+    }
+
+    bzero( (uint8_t*)array + (size_t)( *size )*entrySize, (size_t)( newSize - *size )*entrySize );
+    *size = newSize;
+
+    return array;
+}
+
+static
+uint32_t
+DldReplayNewObject(
+    __inout DldReplayProgram* program,
+    __inout uint32_t* objectsSize
+    )
+{
+    program->Objects = (DldReplayObject*)DldReplayGrowArray( program->Objects, objectsSize,
+                                                             program->ObjectsNumber, sizeof( program->Objects[ 0 ] ) );
+    return program->ObjectsNumber++;
+}
+
+static
+void
+DldReplayCompile(
+    __inout DldReplayTrace* trace,
+    __out DldReplayProgram* program
+    )
+{
+    DldReplayIdMap          objectsMap;
+    DldReplayIdMap          threadsMap;
+    DldReplayIdMap          hookersMap;
+    DldReplayHooker*        hookers = NULL;
+    DldReplayThreadCall*    threadCalls = NULL;
+    uint32_t*               currentObjects = NULL;// a traced object's index to the program's object
+    uint32_t                hookersSize = 0x0;
+    uint32_t                threadsSize = 0x0;
+    uint32_t                objectsSize = 0x0;
+    uint32_t                currentObjectsSize = 0x0;
+    uint32_t                nextChain[ 0x2 ] = { 0x0, 0x0 };
+
+    bzero( program, sizeof( *program ) );
+    bzero( &objectsMap, sizeof( objectsMap ) );
+    bzero( &threadsMap, sizeof( threadsMap ) );
+    bzero( &hookersMap, sizeof( hookersMap ) );
+
+    for( size_t i = 0x0; i < trace->Count; ++i ){
+
+        if( DldReplayIsHookRecord( &trace->Records[ i ] ) )
+            trace->Records[ program->Records++ ] = trace->Records[ i ];
+    }// end for
+
+    trace->Count = (size_t)program->Records;
+
+    qsort( trace->Records, trace->Count, sizeof( trace->Records[ 0 ] ), DldReplayCompareRecords );
+
+    program->Ops = (DldReplayOp*)calloc( trace->Count + 0x1, sizeof( program->Ops[ 0 ] ) );
+    program->InitialHooks = (DldReplayOp*)calloc( trace->Count + 0x1, sizeof( program->InitialHooks[ 0 ] ) );
+    if( NULL == program->Ops || NULL == program->InitialHooks ){
+
+        fprintf( stderr, "out of memory\n" );
+        exit( 1 );
+    }
+
+    //
+    // the hookers' types are learned first as a call might be recorded before
+    // the hooker's first hook record
+    //
+    for( size_t i = 0x0; i < trace->Count; ++i ){
+
+        const DldEventRecord*  record = &trace->Records[ i ];
+        uint32_t               hooker;
+        bool                   added;
+
+        hooker = DldReplayIdMapLookup( &hookersMap, record->Hooker, &added );
+        hookers = (DldReplayHooker*)DldReplayGrowArray( hookers, &hookersSize, hooker, sizeof( hookers[ 0 ] ) );
+
+        if( DLD_EVENT_TYPE_CALL != record->Type && !hookers[ hooker ].TypeKnown ){
+
+            unsigned int  vtable = ( DldHookTypeVtable == DLD_EVENT_HOOKER_TYPE( record->HookIndex ) ) ? 0x1 : 0x0;
+
+            hookers[ hooker ].TypeKnown = true;
+            hookers[ hooker ].Chain = (uint8_t)( vtable*DLD_REPLAY_CHAINS + nextChain[ vtable ] );
+            nextChain[ vtable ] = ( nextChain[ vtable ] + 0x1 ) % DLD_REPLAY_CHAINS;
+        }
+    }// end for
+
+    for( uint32_t h = 0x0; h < hookersMap.Count; ++h ){
+
+        if( !hookers[ h ].TypeKnown ){
+
+            hookers[ h ].TypeKnown = true;
+            hookers[ h ].Chain = (uint8_t)nextChain[ 0x0 ];
+            nextChain[ 0x0 ] = ( nextChain[ 0x0 ] + 0x1 ) % DLD_REPLAY_CHAINS;
+            ++program->UnknownHookers;
+        }
+    }// end for
+
+    for( size_t i = 0x0; i < trace->Count; ++i ){
+
+        const DldEventRecord*  record = &trace->Records[ i ];
+        DldReplayObject*       object;
+        DldReplayOp*           op;
+        uint32_t               tracedObject;
+        uint32_t               objectIndex;
+        uint32_t               chainBit;
+        uint32_t               hooker;
+        bool                   added;
+
+        hooker = DldReplayIdMapLookup( &hookersMap, record->Hooker, &added );
+        assert( !added );
+        chainBit = 0x1 << hookers[ hooker ].Chain;
+
+        tracedObject = DldReplayIdMapLookup( &objectsMap, record->Object, &added );
+        currentObjects = (uint32_t*)DldReplayGrowArray( currentObjects, &currentObjectsSize, tracedObject, sizeof( currentObjects[ 0 ] ) );
+
+        if( added )
+            currentObjects[ tracedObject ] = DldReplayNewObject( program, &objectsSize );
+
+        objectIndex = currentObjects[ tracedObject ];
+
+        //
+        // an address is reused by a new object after the old one has been freed, a hook
+        // for an object which has been unhooked by all its hookers starts a new object
+        //
+        if( DLD_EVENT_TYPE_HOOK == record->Type &&
+            program->Objects[ objectIndex ].DepthKnown &&
+            0x0 == program->Objects[ objectIndex ].HookedChains ){
+
+            objectIndex = DldReplayNewObject( program, &objectsSize );
+            currentObjects[ tracedObject ] = objectIndex;
+        }
+
+        object = &program->Objects[ objectIndex ];
+
+        if( DLD_EVENT_TYPE_CALL == record->Type ){
+
+            DldReplayThreadCall*  threadCall;
+            uint32_t              thread;
+            bool                  sameCall = false;
+
+            ++program->CallRecords;
+
+            thread = DldReplayIdMapLookup( &threadsMap, record->Thread, &added );
+            threadCalls = (DldReplayThreadCall*)DldReplayGrowArray( threadCalls, &threadsSize, thread, sizeof( threadCalls[ 0 ] ) );
+            threadCall = &threadCalls[ thread ];
+
+            if( !added && threadCall->Object == objectIndex && threadCall->HookersNumber < DLD_REPLAY_CALL_HOOKERS ){
+
+                sameCall = true;
+                for( uint32_t h = 0x0; h < threadCall->HookersNumber; ++h ){
+
+                    if( threadCall->Hookers[ h ] == hooker )
+                        sameCall = false;
+                }// end for
+            }
+
+            if( !sameCall ){
+
+                threadCall->Object = objectIndex;
+                threadCall->HookersNumber = 0x0;
+
+                op = &program->Ops[ program->OpsNumber++ ];
+                op->Type = DldReplayOpCall;
+                op->Thread = (uint16_t)thread;
+                op->Object = objectIndex;
+            }
+
+            threadCall->Hookers[ threadCall->HookersNumber++ ] = hooker;
+
+            //
+            // a call by a hooker which has not hooked the object means the object
+            // had been hooked before the trace started or a vtable hook made for
+            // another object of the same class, the object is hooked before the replay
+            //
+            if( !( object->HookedChains & chainBit ) ){
+
+                op = &program->InitialHooks[ program->InitialHooksNumber++ ];
+                op->Type = DldReplayOpHook;
+                op->Chain = hookers[ hooker ].Chain;
+                op->Object = objectIndex;
+
+                object->HookedChains |= chainBit;
+            }
+
+        } else {
+
+            if( !object->DepthKnown ){
+
+                object->DepthKnown = true;
+                object->Depth = DLD_EVENT_HOOKER_DEPTH( record->HookIndex );
+                if( object->Depth >= DLD_REPLAY_DEPTHS )
+                    object->Depth = DLD_REPLAY_DEPTHS - 0x1;
+            }
+
+            op = &program->Ops[ program->OpsNumber++ ];
+            op->Type = ( DLD_EVENT_TYPE_HOOK == record->Type ) ? DldReplayOpHook : DldReplayOpUnHook;
+            op->Chain = hookers[ hooker ].Chain;
+            op->Object = objectIndex;
+
+            if( DLD_EVENT_TYPE_HOOK == record->Type )
+                object->HookedChains |= chainBit;
+            else
+                object->HookedChains &= ~chainBit;
+        }
+
+    }// end for
+
+    program->ThreadsNumber = threadsMap.Count;
+    program->HookersNumber = hookersMap.Count;
+
+    //
+    // the field is the replay's state from now on
+    //
+    for( uint32_t i = 0x0; i < program->ObjectsNumber; ++i )
+        program->Objects[ i ].HookedChains = 0x0;
+
+    free( hookers );
+    free( threadCalls );
+    free( currentObjects );
+    DldReplayIdMapFree( &objectsMap );
+    DldReplayIdMapFree( &threadsMap );
+    DldReplayIdMapFree( &hookersMap );
+}
+
+static
+void
+DldReplayFreeProgram(
+    __inout DldReplayProgram* program
+    )
+{
+    free( program->Ops );
+    free( program->InitialHooks );
+    free( program->Objects );
+    bzero( program, sizeof( *program ) );
+}
+
+//--------------------------------------------------------------------
+
+typedef struct _DldReplayWorker{
+
+    DldBenchmarkHistogram   Calls;
+
+} __attribute__((aligned(64))) DldReplayWorker;
+
+typedef struct _DldReplayContext{
+
+    DldReplayProgram*       Program;
+    unsigned int            WorkersNumber;
+    pthread_barrier_t       Barrier;
+
+    DldReplayWorker         Workers[ DLD_BENCHMARK_MAX_THREADS ];// the last one is not used
+
+    DldBenchmarkHistogram   Hooks;
+    DldBenchmarkHistogram   UnHooks;
+    uint64_t                Skipped;
+
+    volatile UInt32         Sink;
+
+} DldReplayContext;
+
+//
+// returns the index of the first op after the segment's calls
+//
+static
+size_t
+DldReplaySegmentEnd(
+    __in const DldReplayProgram* program,
+    __in size_t start
+    )
+{
+    while( start < program->OpsNumber && DldReplayOpCall == program->Ops[ start ].Type )
+        ++start;
+
+    return start;
+}
+
+static
+void
+DldReplayHookOp(
+    __inout DldReplayContext* context,
+    __in const DldReplayOp* op
+    )
+{
+    DldReplayObject*               object = &context->Program->Objects[ op->Object ];
+    const DldReplayHookerRoutines* routines = &gReplayHookers[ object->Depth ][ op->Chain ];
+    uint32_t                       chainBit = 0x1 << op->Chain;
+    uint64_t                       startTime;
+
+    if( ( DldReplayOpHook == op->Type ) == ( 0x0 != ( object->HookedChains & chainBit ) ) ){
+
+        ++context->Skipped;
+        return;
+    }
+
+    startTime = DldBenchmarkNanoseconds();
+
+    if( DldReplayOpHook == op->Type ){
+
+        if( kIOReturnSuccess != routines->Hook( object->Instance ) ){
+
+            fprintf( stderr, "hooking failed\n" );
+            exit( 1 );
+        }
+
+        DldBenchmarkHistogramAdd( &context->Hooks, DldBenchmarkNanoseconds() - startTime );
+        object->HookedChains |= chainBit;
+
+    } else {
+
+        routines->UnHook( object->Instance );
+
+        DldBenchmarkHistogramAdd( &context->UnHooks, DldBenchmarkNanoseconds() - startTime );
+        object->HookedChains &= ~chainBit;
+    }
+}
+
+static
+void
+DldReplayThreadRoutine(
+    __in unsigned int thread,
+    __in void* context
+    )
+{
+    DldReplayContext*  replayContext = (DldReplayContext*)context;
+    DldReplayProgram*  program = replayContext->Program;
+    DldReplayWorker*   worker = &replayContext->Workers[ thread ];
+    size_t             start = 0x0;
+    UInt32             sum = 0x0;
+
+    //
+    // the last thread replays the hook and unhook ops, the others replay
+    // the calls, a segment's calls are started and finished at the barrier
+    //
+    while( start < program->OpsNumber ){
+
+        size_t  end;
+
+        while( start < program->OpsNumber && DldReplayOpCall != program->Ops[ start ].Type ){
+
+            if( thread == replayContext->WorkersNumber )
+                DldReplayHookOp( replayContext, &program->Ops[ start ] );
+
+            ++start;
+        }// end while
+
+        end = DldReplaySegmentEnd( program, start );
+        if( end != start ){
+
+            pthread_barrier_wait( &replayContext->Barrier );
+
+            for( size_t i = start; i < end && thread != replayContext->WorkersNumber; ++i ){
+
+                const DldReplayOp*  op = &program->Ops[ i ];
+                uint64_t            startTime;
+
+                if( op->Thread % replayContext->WorkersNumber == thread ){
+
+                    startTime = DldBenchmarkNanoseconds();
+                    sum += program->Objects[ op->Object ].Instance->testMethod( sum );
+                    DldBenchmarkHistogramAdd( &worker->Calls, DldBenchmarkNanoseconds() - startTime );
+                }
+            }// end for
+
+            pthread_barrier_wait( &replayContext->Barrier );
+        }
+
+        start = end;
+    }// end while
+
+    replayContext->Sink += sum;
+}
+
+static
+void
+DldReplayRun(
+    __inout DldReplayProgram* program,
+    __in unsigned int workersNumber
+    )
+{
+    DldReplayContext*       context;
+    DldBenchmarkHistogram   calls;
+    uint64_t                elapsedNs;
+
+    context = (DldReplayContext*)calloc( 0x1, sizeof( *context ) );
+    if( NULL == context ){
+
+        fprintf( stderr, "out of memory\n" );
+        exit( 1 );
+    }
+
+    context->Program = program;
+    context->WorkersNumber = workersNumber;
+    pthread_barrier_init( &context->Barrier, NULL, workersNumber + 0x1 );
+
+    for( uint32_t i = 0x0; i < program->ObjectsNumber; ++i ){
+
+        DldReplayObject*  object = &program->Objects[ i ];
+
+        switch( object->Depth ){
+
+            case 0x0:
+                object->Instance = new DldTestService;
+                break;
+            case 0x1:
+                object->Instance = new DldTestServiceLevel1;
+                break;
+            default:
+                object->Instance = new DldTestServiceLevel2;
+                break;
+        }
+
+        object->HookedChains = 0x0;
+    }// end for
+
+    for( size_t i = 0x0; i < program->InitialHooksNumber; ++i )
+        DldReplayHookOp( context, &program->InitialHooks[ i ] );
+
+    //
+    // the initial hooks are not a part of the replay
+    //
+    bzero( &context->Hooks, sizeof( context->Hooks ) );
+
+    elapsedNs = DldBenchmarkRunThreads( workersNumber + 0x1, DldReplayThreadRoutine, context );
+
+    bzero( &calls, sizeof( calls ) );
+    for( unsigned int i = 0x0; i < workersNumber; ++i )
+        DldBenchmarkHistogramMerge( &calls, &context->Workers[ i ].Calls );
+
+    DldBenchmarkResultBegin( "replay", workersNumber );
+    DldBenchmarkFieldUInt( "records", program->Records );
+    DldBenchmarkFieldUInt( "call_records", program->CallRecords );
+    DldBenchmarkFieldUInt( "objects", program->ObjectsNumber );
+    DldBenchmarkFieldUInt( "traced_threads", program->ThreadsNumber );
+    DldBenchmarkFieldUInt( "hookers", program->HookersNumber );
+    DldBenchmarkFieldUInt( "hookers_hooked_before_trace", program->UnknownHookers );
+    DldBenchmarkFieldUInt( "skipped", context->Skipped );
+    DldBenchmarkFieldUInt( "elapsed_ns", elapsedNs );
+    DldBenchmarkFieldUInt( "calls", calls.Count );
+    DldBenchmarkFieldPercentiles( "call", &calls );
+    DldBenchmarkFieldUInt( "hooks", context->Hooks.Count );
+    DldBenchmarkFieldPercentiles( "hook", &context->Hooks );
+    DldBenchmarkFieldUInt( "unhooks", context->UnHooks.Count );
+    DldBenchmarkFieldPercentiles( "unhook", &context->UnHooks );
+    DldBenchmarkResultEnd();
+
+    //
+    // the object hooks are removed before the vtable hooks as they might be chained
+    //
+    for( unsigned int chain = 0x0; chain < 2*DLD_REPLAY_CHAINS; ++chain ){
+
+        for( uint32_t i = 0x0; i < program->ObjectsNumber; ++i ){
+
+            DldReplayObject*  object = &program->Objects[ i ];
+
+            if( object->HookedChains & ( 0x1 << chain ) )
+                gReplayHookers[ object->Depth ][ chain ].UnHook( object->Instance );
+        }// end for
+    }// end for
+
+    for( uint32_t i = 0x0; i < program->ObjectsNumber; ++i ){
+
+        program->Objects[ i ].Instance->release();
+        program->Objects[ i ].Instance = NULL;
+        program->Objects[ i ].HookedChains = 0x0;
+    }// end for
+
+    pthread_barrier_destroy( &context->Barrier );
+    free( context );
+}
+
+//--------------------------------------------------------------------
+
+static
+bool
+DldReplayReadTrace(
+    __in const char* path,
+    __out DldReplayTrace* trace
+    )
+{
+    FILE*           file;
+    DldEventRecord  record;
+
+    file = fopen( path, "rb" );
+    if( NULL == file ){
+
+        fprintf( stderr, "can't open %s\n", path );
+        return false;
+    }
+
+    while( 0x1 == fread( &record, sizeof( record ), 0x1, file ) )
+        DldReplayTraceAdd( trace, &record );
+
+    fclose( file );
+
+    return true;
+}
+
+static
+bool
+DldReplayWriteTrace(
+    __in const char* path,
+    __in const DldReplayTrace* trace
+    )
+{
+    FILE*  file;
+    bool   written;
+
+    file = fopen( path, "wb" );
+    if( NULL == file ){
+
+        fprintf( stderr, "can't create %s\n", path );
+        return false;
+    }
+
+    written = ( trace->Count == fwrite( trace->Records, sizeof( trace->Records[ 0 ] ), trace->Count, file ) );
+    written = ( 0x0 == fclose( file ) ) && written;
+
+    return written;
+}
+
+//--------------------------------------------------------------------
+
+int
+main( int argc, char* argv[] )
+{
+    DldBenchmarkArguments  arguments;
+    DldReplayProgram       program;
+    const char*            readPath = NULL;
+    const char*            writePath = NULL;
+
+    DldBenchmarkParseArguments( argc, argv, 20000, &arguments );
+
+    for( int i = 0x1; i + 0x1 < argc; i += 0x2 ){
+
+        if( 0x0 == strcmp( argv[ i ], "-r" ) )
+            readPath = argv[ i + 0x1 ];
+        else if( 0x0 == strcmp( argv[ i ], "-w" ) )
+            writePath = argv[ i + 0x1 ];
+
+    }// end for
+
+    if( !DldHookedObjectsHashTable::CreateStaticTableWithSize( 0x100, false ) ){
+
+        fprintf( stderr, "CreateStaticTableWithSize failed\n" );
+        return 1;
+    }
+
+    if( readPath ){
+
+        if( !DldReplayReadTrace( readPath, &gRecordedTrace ) )
+            return 1;
+
+    } else {
+
+        DldReplayGenerateTrace( &arguments );
+    }
+
+    if( writePath && !DldReplayWriteTrace( writePath, &gRecordedTrace ) )
+        return 1;
+
+    DldReplayCompile( &gRecordedTrace, &program );
+
+    DldBenchmarkBegin( "DldTraceReplayBenchmark", &arguments );
+
+    //
+    // the hook and unhook ops are replayed by an additional thread
+    //
+    for( unsigned int workers = 0x1; workers <= arguments.MaxThreads && workers < DLD_BENCHMARK_MAX_THREADS; workers *= 0x2 )
+        DldReplayRun( &program, workers );
+
+    DldBenchmarkEnd();
+
+    DldReplayFreeProgram( &program );
+    free( gRecordedTrace.Records );
+
+    return 0;
+}
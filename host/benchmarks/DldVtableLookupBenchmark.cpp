@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include "DldHostTestClasses.h"
+#include "DldHostBenchmark.h"
+
+//
+// the original function resolution for a direct vtable hook, a depth 1
+// vtable hooker hooks the vtables of the DLD_TEST_SIBLING_CLASSES classes
+// and the calls are made for their objects in turn
+//   cached_call        - the hooked calls of a single object resolved by
+//                        the hooker's call cache
+//   hooker_table_call  - the hooked calls resolved by the hooker's own
+//                        vtables table, see DldHookerCommonClass::HookedVtables,
+//                        the call cache is invalidated before every call by
+//                        changing the vtable generation
+//   hash_table_call    - the calls resolved as they were before the hooker
+//                        had its vtables table, the meta class walk and the
+//                        hash table lookups in the read section, the benchmark
+//                        calls the original function directly so the scenario
+//                        doesn't include the hooked call's dispatch and is
+//                        a lower bound for the former path
+// the number of the classes which objects are called is changed from 1 to
+// DLD_TEST_SIBLING_CLASSES, the time is per call
+//
+
+typedef DldHookerCommonClass2< DldTestServiceDldHook<DldInheritanceDepth_1,0>, DldTestService >  DldLookupVtableHooker;
+
+typedef UInt32 (*DldLookupTestMethod)( DldTestService* __this, UInt32 value );
+
+//
+// testMethod()'s index in the hooker's functions array which starts
+// with the base hooks, found by the vtable index
+//
+static unsigned int  gLookupTestMethodIndex;
+
+typedef enum _DldLookupScenario{
+    DldLookupScenarioCachedCall = 0x0,
+    DldLookupScenarioHookerTableCall,
+    DldLookupScenarioHashTableCall,
+    DldLookupScenarioMaximum
+} DldLookupScenario;
+
+static const char*  gLookupScenarioNames[ DldLookupScenarioMaximum ] = {
+    "cached_call",
+    "hooker_table_call",
+    "hash_table_call"
+};
+
+//--------------------------------------------------------------------
+
+//
+// the original function for a call through the object's vtable, as
+// GetOriginalFunctionInt() and RetrieveOriginalFunction() found it
+//
+static
+DldLookupTestMethod
+DldLookupRetrieveOriginal(
+    __in DldTestService* object
+    )
+{
+    DldSingleInheritingClassObjectPtr  ObjU;
+    DldHashTableReadState              readState;
+    const OSMetaClass*                 objectMetaClass;
+    const OSMetaClass*                 hookedMetaClass;
+    DldHookedObjectEntry*              entry = NULL;
+    DldLookupTestMethod                original = NULL;
+    bool                               retrieved = false;
+    unsigned int                       depth = 0x0;
+
+    ObjU.fObj = object;
+    objectMetaClass = object->getMetaClass();
+
+    hookedMetaClass = objectMetaClass;
+    while( hookedMetaClass && hookedMetaClass != DldTestService::metaClass ){
+
+        hookedMetaClass = hookedMetaClass->getSuperClass();
+        ++depth;
+    }// end while
+
+    assert( DldInheritanceDepth_1 == depth );
+
+    DldHookTypeVtableKey  VtableHookKey;
+    bzero( &VtableHookKey, sizeof( VtableHookKey ) );
+    VtableHookKey.Vtable = *ObjU.vtablep;
+    VtableHookKey.metaClass = objectMetaClass;
+    VtableHookKey.InheritanceDepth = (DldInheritanceDepth)depth;
+
+#if !defined(DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES)
+    DldHookTypeVtableObjKey  VtableHookObjKey;
+    bzero( &VtableHookObjKey, sizeof( VtableHookObjKey ) );
+    VtableHookObjKey.Object = ObjU.fObj;
+    VtableHookObjKey.metaClass = objectMetaClass;
+    VtableHookObjKey.InheritanceDepth = (DldInheritanceDepth)depth;
+#endif//DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES
+
+    while( !retrieved && DldHookedObjectsHashTable::sHashTable->ReadBegin( &readState ) ){
+
+#if !defined(DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES)
+        entry = DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookObjKey, false );
+        if( NULL == entry )
+            entry = DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookKey, false );
+#else
+        entry = DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookKey, false );
+#endif//DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES
+
+        if( entry )
+            original = (DldLookupTestMethod)entry->Parameters.Common.HookedVtableFunctionsInfo[ gLookupTestMethodIndex ].OriginalFunction;
+
+        retrieved = DldHookedObjectsHashTable::sHashTable->ReadEnd( &readState );
+    }// end while
+
+    return original;
+}
+
+//--------------------------------------------------------------------
+
+static
+bool
+DldLookupFindTestMethodIndex(
+    __in DldTestService* object
+    )
+{
+    DldSingleInheritingClassObjectPtr  ObjU;
+    DldHookedObjectEntry*              entry;
+    DldHookedFunctionInfo*             functionsInfo;
+    unsigned int                       vtableIndex;
+    bool                               found = false;
+
+    ObjU.fObj = object;
+    vtableIndex = DldConvertFunctionToVtableIndex( (void (OSMetaClassBase::*)(void)) &DldTestService::testMethod );
+
+    DldHookTypeVtableKey  VtableHookKey;
+    bzero( &VtableHookKey, sizeof( VtableHookKey ) );
+    VtableHookKey.Vtable = *ObjU.vtablep;
+    VtableHookKey.metaClass = object->getMetaClass();
+    VtableHookKey.InheritanceDepth = DldInheritanceDepth_1;
+
+    DldHookedObjectsHashTable::sHashTable->LockShared();
+    {// start of the lock
+
+        entry = DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookKey, false );
+        functionsInfo = entry ? entry->Parameters.Common.HookedVtableFunctionsInfo : NULL;
+
+        for( unsigned int i = 0x0; functionsInfo && !found && (unsigned int)(-1) != functionsInfo[ i ].VtableIndex; ++i ){
+
+            if( vtableIndex == functionsInfo[ i ].VtableIndex ){
+
+                gLookupTestMethodIndex = i;
+                found = true;
+            }
+        }// end for
+
+    }// end of the lock
+    DldHookedObjectsHashTable::sHashTable->UnLockShared();
+
+    return found;
+}
+
+//--------------------------------------------------------------------
+
+static
+UInt32
+DldLookupCall(
+    __in DldLookupScenario scenario,
+    __in DldTestService* object,
+    __in UInt32 value
+    )
+{
+    DldLookupTestMethod  original;
+
+    if( DldLookupScenarioCachedCall == scenario )
+        return object->testMethod( value );
+
+    //
+    // a single thread changes the generation, the increment is not atomic
+    //
+    DldHookedObjectsHashTable::sVtableGeneration = DldHookedObjectsHashTable::sVtableGeneration + 0x1;
+
+    if( DldLookupScenarioHookerTableCall == scenario )
+        return object->testMethod( value );
+
+    original = DldLookupRetrieveOriginal( object );
+    if( NULL == original )
+        return 0x0;
+
+    return original( object, value ) + DLD_TEST_HOOK_INCREMENT;
+}
+
+//--------------------------------------------------------------------
+
+int
+main( int argc, char* argv[] )
+{
+    DldBenchmarkArguments  arguments;
+    DldTestService*        objects[ DLD_TEST_SIBLING_CLASSES ];
+    volatile UInt32        sink = 0x0;
+
+    DldBenchmarkParseArguments( argc, argv, 1000000, &arguments );
+
+    if( !DldHookedObjectsHashTable::CreateStaticTableWithSize( 0x100, false ) ){
+
+        fprintf( stderr, "CreateStaticTableWithSize failed\n" );
+        return 1;
+    }
+
+    for( unsigned int i = 0x0; i < DLD_TEST_SIBLING_CLASSES; ++i ){
+
+        objects[ i ] = DldTestNewSibling( i );
+
+        if( kIOReturnSuccess != DldLookupVtableHooker::fHookObject( objects[ i ], DldHookTypeVtable ) ){
+
+            fprintf( stderr, "hooking failed\n" );
+            return 1;
+        }
+    }// end for
+
+    if( !DldLookupFindTestMethodIndex( objects[ 0x0 ] ) ){
+
+        fprintf( stderr, "testMethod() has not been found in the vtable entry\n" );
+        return 1;
+    }
+
+    DldBenchmarkBegin( "DldVtableLookupBenchmark", &arguments );
+
+    for( unsigned int scenario = 0x0; scenario < DldLookupScenarioMaximum; ++scenario ){
+
+        for( unsigned int classes = 0x1; classes <= DLD_TEST_SIBLING_CLASSES; classes *= 0x2 ){
+
+            uint64_t      startTime;
+            uint64_t      elapsedNs;
+            UInt32        sum = 0x0;
+            unsigned int  current = 0x0;
+
+            //
+            // the cached call is made for a single object
+            //
+            if( DldLookupScenarioCachedCall == scenario && 0x1 != classes )
+                break;
+
+            //
+            // every class's call is checked before the measurement
+            //
+            for( unsigned int i = 0x0; i < classes; ++i ){
+
+                if( 0x3 + DLD_TEST_HOOK_INCREMENT != DldLookupCall( (DldLookupScenario)scenario, objects[ i ], 0x1 ) ){
+
+                    fprintf( stderr, "a call has not been hooked\n" );
+                    return 1;
+                }
+            }// end for
+
+            startTime = DldBenchmarkNanoseconds();
+
+            for( unsigned long i = 0x0; i < arguments.Iterations; ++i ){
+
+                sum += DldLookupCall( (DldLookupScenario)scenario, objects[ current ], (UInt32)i );
+
+                if( ++current == classes )
+                    current = 0x0;
+            }// end for
+
+            elapsedNs = DldBenchmarkNanoseconds() - startTime;
+            sink += sum;
+
+            DldBenchmarkResultBegin( gLookupScenarioNames[ scenario ], 0x1 );
+            DldBenchmarkFieldUInt( "classes", classes );
+            DldBenchmarkFieldUInt( "calls", arguments.Iterations );
+            DldBenchmarkFieldUInt( "elapsed_ns", elapsedNs );
+            DldBenchmarkFieldDouble( "ns_per_call", (double)elapsedNs/(double)arguments.Iterations );
+            DldBenchmarkResultEnd();
+
+        }// end for
+    }// end for
+
+    DldBenchmarkEnd();
+
+    for( unsigned int i = 0x0; i < DLD_TEST_SIBLING_CLASSES; ++i ){
+
+        DldLookupVtableHooker::fUnHookObject( objects[ i ], DldHookTypeVtable, DldInheritanceDepth_1 );
+        objects[ i ]->release();
+    }// end for
+
+    return 0;
+}
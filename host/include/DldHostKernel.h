@@ -0,0 +1,620 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#ifndef _DLDHOSTKERNEL_H
+#define _DLDHOSTKERNEL_H
+
+//
+// the user space stand-ins for the IOKit, libkern, Mach and BSD kernel
+// interfaces used by the hooker's core, see DLD_HOST_BUILD in DldCommon.h,
+// the kernel headers included by the core are forwarded to this file
+// from the host/include directory,
+// the stand-ins implement the kernel's semantic the hooker relies on
+// and nothing more, e.g. OSMetaClass keeps the class name, the superclass
+// and the instance counter, cpu_number() returns a slot unique for the
+// calling thread as the lock free readers rely on the CPU's exclusive use,
+// the implementation is in host/DldHostKernel.cpp
+//
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <sys/types.h>
+#include <sys/cdefs.h>
+#include <unistd.h>
+
+#if !defined(__cplusplus)
+    #error "the host build is C++ only"
+#endif
+
+//--------------------------------------------------------------------
+
+typedef uint8_t     UInt8;
+typedef uint16_t    UInt16;
+typedef uint32_t    UInt32;
+typedef uint64_t    UInt64;
+typedef int8_t      SInt8;
+typedef int16_t     SInt16;
+typedef int32_t     SInt32;
+typedef int64_t     SInt64;
+typedef unsigned char  Boolean;
+
+typedef int         kern_return_t;
+typedef int         boolean_t;
+typedef kern_return_t  IOReturn;
+typedef UInt32      IOOptionBits;
+typedef UInt64      IOByteCount;
+typedef uintptr_t   vm_offset_t;
+typedef uintptr_t   vm_size_t;
+typedef uintptr_t   vm_address_t;
+typedef uint64_t    addr64_t;
+typedef UInt32      ppnum_t;
+typedef uint64_t    AbsoluteTime;
+typedef uint64_t    io_user_reference_t;
+typedef UInt32      mach_port_t;
+typedef int         wait_result_t;
+
+typedef struct task*       task_t;
+typedef struct thread*     thread_t;
+typedef struct proc*       proc_t;
+typedef struct semaphore*  semaphore_t;
+
+#define KERN_SUCCESS    0
+#define KERN_FAILURE    5
+
+#ifndef TRUE
+    #define TRUE    1
+#endif
+#ifndef FALSE
+    #define FALSE   0
+#endif
+
+#ifndef PAGE_SIZE
+    #define PAGE_SIZE       4096
+#endif
+#ifndef PAGE_MASK
+    #define PAGE_MASK       ( PAGE_SIZE - 1 )
+#endif
+#define I386_PGBYTES        4096
+#define I386_PGSHIFT        12
+
+#define M_WAITOK            0x0000
+#define M_NOWAIT            0x0001
+
+#define kSecondScale        1000000000
+#define kMillisecondScale   1000000
+#define kMicrosecondScale   1000
+#define kNanosecondScale    1
+
+#define MAXCOMLEN           16
+
+//
+// the Itanium C++ ABI as for the x86_64 kexts
+//
+#define APPLE_KEXT_LEGACY_ABI   0
+#define APPLE_KEXT_OVERRIDE     override
+
+//--------------------------------------------------------------------
+
+#define iokit_common_err(return)    ( (IOReturn)( 0xe0000000 | (return) ) )
+
+#define kIOReturnSuccess            KERN_SUCCESS
+#define kIOReturnError              iokit_common_err( 0x2bc )
+#define kIOReturnNoMemory           iokit_common_err( 0x2bd )
+#define kIOReturnNoResources        iokit_common_err( 0x2be )
+#define kIOReturnBadArgument        iokit_common_err( 0x2c2 )
+#define kIOReturnExclusiveAccess    iokit_common_err( 0x2c5 )
+#define kIOReturnUnsupported        iokit_common_err( 0x2c7 )
+#define kIOReturnNoSpace            iokit_common_err( 0x2c9 )
+#define kIOReturnBusy               iokit_common_err( 0x2d5 )
+#define kIOReturnTimeout            iokit_common_err( 0x2d6 )
+#define kIOReturnNotReady           iokit_common_err( 0x2d8 )
+#define kIOReturnNotPermitted       iokit_common_err( 0x2e2 )
+#define kIOReturnUnderrun           iokit_common_err( 0x2e7 )
+#define kIOReturnOverrun            iokit_common_err( 0x2e8 )
+#define kIOReturnNotFound           iokit_common_err( 0x2f0 )
+
+//--------------------------------------------------------------------
+
+//
+// the debug assert as defined by IOKit/assert.h, active for DBG builds
+//
+#undef assert
+#if defined(DBG)
+    #define assert( _EX_ )  do{ if( !(_EX_) ) DldHostAssertionFailed( #_EX_, __FILE__, __LINE__ ); }while(0)
+#else
+    #define assert( _EX_ )  ((void)0)
+#endif//DBG
+
+//--------------------------------------------------------------------
+
+extern "C" {
+
+    void  DldHostAssertionFailed( const char* expression, const char* file, int line ) __attribute__((noreturn));
+
+    void  panic( const char* format, ... ) __attribute__((noreturn, format(printf, 1, 2)));
+    void  IOLog( const char* format, ... ) __attribute__((format(printf, 1, 2)));
+    void  IOSleep( unsigned int milliseconds );
+    void  IODelay( unsigned int microseconds );
+
+    void* IOMalloc( vm_size_t size );
+    void  IOFree( void* address, vm_size_t size );
+    void* IOMallocAligned( vm_size_t size, vm_size_t alignment );
+    void  IOFreeAligned( void* address, vm_size_t size );
+    void* mac_kalloc( vm_size_t size, int how );
+    void  mac_kfree( void* data, vm_size_t size );
+
+    //
+    // the locks are POSIX locks, the simple lock doesn't disable interrupts
+    //
+    typedef struct _IORWLock        IORWLock;
+    typedef struct _IOLock          IOLock;
+    typedef struct _IOSimpleLock    IOSimpleLock;
+    typedef struct _lck_grp         lck_grp_t;
+    typedef int                     IOInterruptState;
+
+    IORWLock*  IORWLockAlloc( void );
+    void       IORWLockFree( IORWLock* lock );
+    void       IORWLockRead( IORWLock* lock );
+    void       IORWLockWrite( IORWLock* lock );
+    void       IORWLockUnlock( IORWLock* lock );
+
+    IOLock*    IOLockAlloc( void );
+    void       IOLockFree( IOLock* lock );
+    void       IOLockLock( IOLock* lock );
+    void       IOLockUnlock( IOLock* lock );
+
+    IOSimpleLock*     IOSimpleLockAlloc( void );
+    void              IOSimpleLockFree( IOSimpleLock* lock );
+    void              IOSimpleLockLock( IOSimpleLock* lock );
+    void              IOSimpleLockUnlock( IOSimpleLock* lock );
+    IOInterruptState  IOSimpleLockLockDisableInterrupt( IOSimpleLock* lock );
+    void              IOSimpleLockUnlockEnableInterrupt( IOSimpleLock* lock, IOInterruptState state );
+
+    //
+    // a thread is given a CPU slot on the first call and returns it on exit,
+    // a thread which disabled the interrupts or the preemption is considered
+    // to be running with the preemption disabled
+    //
+    int        cpu_number( void );
+    int        ml_get_max_cpus( void );
+    boolean_t  ml_set_interrupts_enabled( boolean_t enable );
+    int        preemption_enabled( void );
+    void       disable_preemption( void );
+    void       enable_preemption( void );
+
+    thread_t   current_thread( void );
+    task_t     current_task( void );
+    int        proc_selfpid( void );
+    void       proc_selfname( char* buffer, int size );
+
+    //
+    // the absolute time is in nanoseconds
+    //
+    uint64_t   mach_absolute_time( void );
+    void       clock_get_uptime( uint64_t* result );
+    void       absolutetime_to_nanoseconds( uint64_t abstime, uint64_t* result );
+    void       nanoseconds_to_absolutetime( uint64_t nanoseconds, uint64_t* result );
+    void       clock_interval_to_deadline( UInt32 interval, UInt32 scaleFactor, uint64_t* result );
+
+    //
+    // the simulated clock replaces the monotonic clock for mach_absolute_time()
+    // and the thread calls' deadlines, the clock starts at startTime and is moved
+    // only by DldHostClockAdvance() which runs the thread calls in the caller's
+    // thread in the deadlines' order, the time seen by a thread call is its deadline
+    //
+    void       DldHostClockSimulate( uint64_t startTime );
+    void       DldHostClockAdvance( uint64_t nanoseconds );
+
+    //
+    // the thread calls are run by a host thread at their deadlines,
+    // or by DldHostClockAdvance() if the clock is simulated
+    //
+    typedef struct _thread_call*  thread_call_t;
+    typedef void*                 thread_call_param_t;
+    typedef void (*thread_call_func_t)( thread_call_param_t param0, thread_call_param_t param1 );
+
+    thread_call_t  thread_call_allocate( thread_call_func_t func, thread_call_param_t param0 );
+    boolean_t      thread_call_free( thread_call_t call );
+    boolean_t      thread_call_enter_delayed( thread_call_t call, uint64_t deadline );
+    boolean_t      thread_call_cancel( thread_call_t call );
+
+    //
+    // the vtable writer's support, see DldWriteWiredSrcToWiredDst()
+    //
+    bool       DldHostIsAddressMapped( vm_offset_t address );
+    bool       DldHostWriteProtectedMemory( vm_offset_t dst, vm_offset_t src, vm_size_t length );
+}
+
+//
+// the CPU slots' limit, ml_get_max_cpus() returns it
+//
+#define DLD_HOST_MAX_CPUS   (128)
+
+//--------------------------------------------------------------------
+
+//
+// libkern atomics, the functions return the original value,
+// the macros cast the address as the kernel's __SAFE_CAST_PTR() does
+//
+inline SInt32 OSAddAtomic( SInt32 amount, volatile SInt32* address ){ return __atomic_fetch_add( address, amount, __ATOMIC_SEQ_CST ); }
+inline SInt32 OSIncrementAtomic( volatile SInt32* address ){ return __atomic_fetch_add( address, 1, __ATOMIC_SEQ_CST ); }
+inline SInt32 OSDecrementAtomic( volatile SInt32* address ){ return __atomic_fetch_sub( address, 1, __ATOMIC_SEQ_CST ); }
+inline SInt64 OSAddAtomic64( SInt64 amount, volatile SInt64* address ){ return __atomic_fetch_add( address, amount, __ATOMIC_SEQ_CST ); }
+inline SInt64 OSIncrementAtomic64( volatile SInt64* address ){ return __atomic_fetch_add( address, 1, __ATOMIC_SEQ_CST ); }
+inline SInt64 OSDecrementAtomic64( volatile SInt64* address ){ return __atomic_fetch_sub( address, 1, __ATOMIC_SEQ_CST ); }
+inline long   OSAddAtomicLong( long amount, volatile long* address ){ return __atomic_fetch_add( address, amount, __ATOMIC_SEQ_CST ); }
+inline UInt32 OSBitOrAtomic( UInt32 mask, volatile UInt32* address ){ return __atomic_fetch_or( address, mask, __ATOMIC_SEQ_CST ); }
+inline UInt32 OSBitAndAtomic( UInt32 mask, volatile UInt32* address ){ return __atomic_fetch_and( address, mask, __ATOMIC_SEQ_CST ); }
+
+inline Boolean OSCompareAndSwap( UInt32 oldValue, UInt32 newValue, volatile UInt32* address )
+{
+    return __atomic_compare_exchange_n( address, &oldValue, newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+}
+
+inline Boolean OSCompareAndSwap64( UInt64 oldValue, UInt64 newValue, volatile UInt64* address )
+{
+    return __atomic_compare_exchange_n( address, &oldValue, newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+}
+
+inline Boolean OSCompareAndSwapPtr( void* oldValue, void* newValue, void* volatile* address )
+{
+    return __atomic_compare_exchange_n( address, &oldValue, newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST );
+}
+
+#define OSAddAtomic( _A_, _P_ )         ( OSAddAtomic( (_A_), (volatile SInt32*)(_P_) ) )
+#define OSIncrementAtomic( _P_ )        ( OSIncrementAtomic( (volatile SInt32*)(_P_) ) )
+#define OSDecrementAtomic( _P_ )        ( OSDecrementAtomic( (volatile SInt32*)(_P_) ) )
+#define OSAddAtomic64( _A_, _P_ )       ( OSAddAtomic64( (_A_), (volatile SInt64*)(_P_) ) )
+#define OSIncrementAtomic64( _P_ )      ( OSIncrementAtomic64( (volatile SInt64*)(_P_) ) )
+#define OSDecrementAtomic64( _P_ )      ( OSDecrementAtomic64( (volatile SInt64*)(_P_) ) )
+#define OSCompareAndSwap( _O_, _N_, _P_ )  ( OSCompareAndSwap( (UInt32)(_O_), (UInt32)(_N_), (volatile UInt32*)(_P_) ) )
+#define OSCompareAndSwapPtr( _O_, _N_, _P_ )  ( OSCompareAndSwapPtr( (void*)(_O_), (void*)(_N_), (void* volatile*)(_P_) ) )
+
+//--------------------------------------------------------------------
+
+class OSMetaClass;
+class OSObject;
+class OSString;
+class OSSymbol;
+class OSDictionary;
+class IORegistryPlane;
+class IOService;
+class IOUserClient;
+class IOMemoryDescriptor;
+
+class OSMetaClassBase
+{
+public:
+
+    typedef void (*_ptf_t)( void );
+
+    virtual const OSMetaClass* getMetaClass() const = 0;
+    virtual void retain() const = 0;
+    virtual void release() const = 0;
+    virtual int  getRetainCount() const = 0;
+    virtual bool isEqualTo( const OSMetaClassBase* object ) const;
+
+    static OSMetaClassBase* safeMetaCast( const OSMetaClassBase* object, const OSMetaClass* toType );
+
+protected:
+    OSMetaClassBase(){};
+    virtual ~OSMetaClassBase(){};
+};
+
+//
+// a class descriptor, the descriptors are registered on construction so
+// they can be found by name as the kernel's loaded classes are found
+//
+class OSMetaClass
+{
+    const char*          ClassName;
+    const OSMetaClass*   SuperClass;
+    unsigned int         ClassSize;
+    volatile SInt32      InstanceCount;
+    const OSMetaClass*   Next;
+
+public:
+
+    OSMetaClass( const char* className, const OSMetaClass* superClass, unsigned int classSize );
+
+    const char*         getClassName() const { return this->ClassName; };
+    const OSMetaClass*  getSuperClass() const { return this->SuperClass; };
+    unsigned int        getClassSize() const { return this->ClassSize; };
+    unsigned int        getInstanceCount() const { return (unsigned int)this->InstanceCount; };
+
+    void instanceConstructed() const;
+    void instanceDestructed() const;
+
+    const OSMetaClassBase* checkMetaCast( const OSMetaClassBase* object ) const;
+
+    static const OSMetaClass* getMetaClassWithName( const OSSymbol* name );
+    static const OSMetaClass* getMetaClassWithName( const char* name );
+    static OSMetaClassBase* checkMetaCastWithName( const char* name, const OSMetaClassBase* object );
+};
+
+#define OSTypeID( _TYPE_ )                  ( _TYPE_::metaClass )
+#define OSTypeIDInst( _INST_ )              ( (_INST_)->getMetaClass() )
+#define OSDynamicCast( _TYPE_, _INST_ )     ( (_TYPE_*)OSMetaClassBase::safeMetaCast( (_INST_), OSTypeID( _TYPE_ ) ) )
+#define OSCheckTypeInst( _TYPEINST_, _INST_ )  ( NULL != OSMetaClassBase::safeMetaCast( (_INST_), OSTypeIDInst( _TYPEINST_ ) ) )
+
+#define OSDeclareCommonStructors( _CLASS_ )                                      \
+    public:                                                                     \
+        static const OSMetaClass         gMetaClass;                            \
+        static const OSMetaClass* const  metaClass;                             \
+        static const OSMetaClass* const  superClass;                            \
+        virtual const OSMetaClass* getMetaClass() const APPLE_KEXT_OVERRIDE;    \
+    protected:                                                                  \
+        virtual ~_CLASS_();
+
+#define OSDeclareDefaultStructors( _CLASS_ )    OSDeclareCommonStructors( _CLASS_ ) public: _CLASS_(); protected:
+#define OSDeclareAbstractStructors( _CLASS_ )   OSDeclareCommonStructors( _CLASS_ ) _CLASS_(); private:
+
+#define OSDefineMetaClassWithSuper( _CLASS_, _SUPER_CLASS_ )                                                    \
+    const OSMetaClass         _CLASS_::gMetaClass( #_CLASS_, &_SUPER_CLASS_::gMetaClass, sizeof( _CLASS_ ) );   \
+    const OSMetaClass* const  _CLASS_::metaClass = &_CLASS_::gMetaClass;                                        \
+    const OSMetaClass* const  _CLASS_::superClass = &_SUPER_CLASS_::gMetaClass;                                 \
+    const OSMetaClass* _CLASS_::getMetaClass() const { return &_CLASS_::gMetaClass; }
+
+#define OSDefineMetaClassAndStructors( _CLASS_, _SUPER_CLASS_ )                 \
+    OSDefineMetaClassWithSuper( _CLASS_, _SUPER_CLASS_ )                        \
+    _CLASS_::_CLASS_(){ _CLASS_::gMetaClass.instanceConstructed(); }            \
+    _CLASS_::~_CLASS_(){ _CLASS_::gMetaClass.instanceDestructed(); }
+
+#define OSDefineMetaClassAndAbstractStructors( _CLASS_, _SUPER_CLASS_ )         \
+    OSDefineMetaClassWithSuper( _CLASS_, _SUPER_CLASS_ )                        \
+    _CLASS_::_CLASS_(){ _CLASS_::gMetaClass.instanceConstructed(); }            \
+    _CLASS_::~_CLASS_(){ _CLASS_::gMetaClass.instanceDestructed(); }
+
+#define OSMetaClassDeclareReservedUnused( _CLASS_, _INDEX_ )
+#define OSMetaClassDefineReservedUnused( _CLASS_, _INDEX_ )
+
+//
+// the root class, the memory is zeroed on allocation and free() deletes
+// the object when the last reference has been released
+//
+class OSObject : public OSMetaClassBase
+{
+public:
+
+    static const OSMetaClass         gMetaClass;
+    static const OSMetaClass* const  metaClass;
+
+    virtual const OSMetaClass* getMetaClass() const APPLE_KEXT_OVERRIDE;
+    virtual void retain() const APPLE_KEXT_OVERRIDE;
+    virtual void release() const APPLE_KEXT_OVERRIDE;
+    virtual int  getRetainCount() const APPLE_KEXT_OVERRIDE;
+
+    virtual bool init();
+    virtual void free();
+
+    static void* operator new( size_t size );
+    static void operator delete( void* memory, size_t size );
+
+protected:
+    OSObject();
+    virtual ~OSObject();
+
+private:
+    mutable volatile SInt32  RetainCount;
+};
+
+class OSString : public OSObject
+{
+    OSDeclareDefaultStructors( OSString )
+
+protected:
+    char*         String;
+    unsigned int  Length;
+
+public:
+    static OSString* withCString( const char* cString );
+
+    virtual bool init( const char* cString );
+    virtual void free() APPLE_KEXT_OVERRIDE;
+
+    const char*   getCStringNoCopy() const { return this->String; };
+    unsigned int  getLength() const { return this->Length; };
+
+    virtual bool isEqualTo( const char* cString ) const;
+    virtual bool isEqualTo( const OSMetaClassBase* object ) const APPLE_KEXT_OVERRIDE;
+};
+
+//
+// the symbols are not unique, they are compared by value
+//
+class OSSymbol : public OSString
+{
+    OSDeclareDefaultStructors( OSSymbol )
+
+public:
+    static const OSSymbol* withCString( const char* cString );
+    static const OSSymbol* withCStringNoCopy( const char* cString ){ return OSSymbol::withCString( cString ); };
+};
+
+//--------------------------------------------------------------------
+
+class IORegistryPlane : public OSObject
+{
+    OSDeclareDefaultStructors( IORegistryPlane )
+};
+
+extern const IORegistryPlane*  gIOServicePlane;
+
+//
+// the registry entries are not connected, the property functions do nothing
+//
+class IORegistryEntry : public OSObject
+{
+    OSDeclareDefaultStructors( IORegistryEntry )
+
+public:
+    virtual bool attachToChild( IORegistryEntry* child, const IORegistryPlane* plane );
+    virtual void setPropertyTable( OSDictionary* dict );
+    virtual bool setProperty( const OSSymbol* aKey, OSObject* anObject );
+    virtual bool setProperty( const OSString* aKey, OSObject* anObject );
+    virtual bool setProperty( const char* aKey, OSObject* anObject );
+    virtual bool setProperty( const char* aKey, const char* aString );
+    virtual bool setProperty( const char* aKey, bool aBoolean );
+    virtual bool setProperty( const char* aKey, unsigned long long aValue, unsigned int aNumberOfBits );
+    virtual bool setProperty( const char* aKey, void* bytes, unsigned int length );
+    virtual void removeProperty( const OSSymbol* aKey );
+    virtual void removeProperty( const OSString* aKey );
+    virtual void removeProperty( const char* aKey );
+    virtual OSObject* getProperty( const char* aKey ) const;
+    virtual const char* getName( const IORegistryPlane* plane = 0 ) const;
+};
+
+class IOService : public IORegistryEntry
+{
+    OSDeclareDefaultStructors( IOService )
+
+public:
+    virtual bool start( IOService* provider );
+    virtual void stop( IOService* provider );
+    virtual bool open( IOService* forClient, IOOptionBits options = 0, void* arg = 0 );
+    virtual void close( IOService* forClient, IOOptionBits options = 0 );
+    virtual bool requestTerminate( IOService* provider, IOOptionBits options );
+    virtual bool willTerminate( IOService* provider, IOOptionBits options );
+    virtual bool didTerminate( IOService* provider, IOOptionBits options, bool* defer );
+    virtual bool terminate( IOOptionBits options = 0 );
+    virtual bool terminateClient( IOService* client, IOOptionBits options );
+    virtual bool finalize( IOOptionBits options );
+    virtual bool attach( IOService* provider );
+    virtual void detach( IOService* provider );
+    virtual IOService* getProvider() const;
+    virtual IOReturn newUserClient( task_t owningTask, void* securityID,
+                                    UInt32 type, OSDictionary* properties,
+                                    IOUserClient** handler );
+    virtual IOReturn newUserClient( task_t owningTask, void* securityID,
+                                    UInt32 type, IOUserClient** handler );
+
+protected:
+    IOService*  Provider;
+};
+
+struct IOExternalMethod;
+struct IOExternalAsyncMethod;
+struct IOExternalTrap;
+struct IOExternalMethodArguments;
+struct IOExternalMethodDispatch;
+
+class IOUserClient : public IOService
+{
+    OSDeclareAbstractStructors( IOUserClient )
+
+public:
+    virtual IOReturn clientClose();
+    virtual IOReturn clientDied();
+    virtual IOExternalMethod* getExternalMethodForIndex( UInt32 index );
+    virtual IOExternalAsyncMethod* getExternalAsyncMethodForIndex( UInt32 index );
+    virtual IOExternalMethod* getTargetAndMethodForIndex( IOService** targetP, UInt32 index );
+    virtual IOExternalAsyncMethod* getAsyncTargetAndMethodForIndex( IOService** targetP, UInt32 index );
+    virtual IOExternalTrap* getExternalTrapForIndex( UInt32 index );
+    virtual IOExternalTrap* getTargetAndTrapForIndex( IOService** targetP, UInt32 index );
+    virtual IOReturn externalMethod( uint32_t selector, IOExternalMethodArguments* arguments,
+                                     IOExternalMethodDispatch* dispatch = 0, OSObject* target = 0, void* reference = 0 );
+    virtual IOReturn registerNotificationPort( mach_port_t port, UInt32 type, io_user_reference_t refCon );
+    virtual IOReturn registerNotificationPort( mach_port_t port, UInt32 type, UInt32 refCon );
+    virtual IOReturn clientMemoryForType( UInt32 type, IOOptionBits* options, IOMemoryDescriptor** memory );
+    virtual IOReturn getNotificationSemaphore( UInt32 notification_type, semaphore_t* semaphore );
+};
+
+//--------------------------------------------------------------------
+
+enum{
+    kIODirectionIn    = 0x1,
+    kIODirectionOut   = 0x2,
+    kIODirectionInOut = kIODirectionIn | kIODirectionOut
+};
+
+enum{
+    kIOMemoryKernelUserShared = 0x00010000
+};
+
+class IOMemoryDescriptor : public OSObject
+{
+    OSDeclareAbstractStructors( IOMemoryDescriptor )
+
+public:
+    virtual IOByteCount getLength() const = 0;
+};
+
+//
+// the buffer is a shared anonymous mapping so a process forked
+// after the allocation sees the memory as a user task mapping it
+//
+class IOBufferMemoryDescriptor : public IOMemoryDescriptor
+{
+    OSDeclareDefaultStructors( IOBufferMemoryDescriptor )
+
+protected:
+    void*        Buffer;
+    vm_size_t    Capacity;
+
+public:
+    static IOBufferMemoryDescriptor* withOptions( IOOptionBits options, vm_size_t capacity, vm_offset_t alignment = 1 );
+
+    virtual void free() APPLE_KEXT_OVERRIDE;
+    virtual IOByteCount getLength() const APPLE_KEXT_OVERRIDE { return this->Capacity; };
+
+    void* getBytesNoCopy(){ return this->Buffer; };
+};
+
+//--------------------------------------------------------------------
+
+//
+// the shared layout of IOKit/IODataQueueShared.h, the consumer
+// is IODataQueueDequeue() from IOKit.framework
+//
+typedef struct _IODataQueueEntry{
+    UInt32  size;
+    UInt8   data[ 4 ];
+} IODataQueueEntry;
+
+typedef struct _IODataQueueMemory{
+    UInt32            queueSize;
+    volatile UInt32   head;
+    volatile UInt32   tail;
+    IODataQueueEntry  queue[ 1 ];
+} IODataQueueMemory;
+
+#define DATA_QUEUE_ENTRY_HEADER_SIZE    ( sizeof( IODataQueueEntry ) - 4 )
+#define DATA_QUEUE_MEMORY_HEADER_SIZE   ( sizeof( IODataQueueMemory ) - sizeof( IODataQueueEntry ) )
+
+//
+// there are no Mach messages in the host build, a notification calls
+// the routine set by setNotificationRoutine() in place of setNotificationPort()
+//
+class IODataQueue : public OSObject
+{
+    OSDeclareDefaultStructors( IODataQueue )
+
+public:
+    typedef void (*NotificationRoutine)( IODataQueue* queue, void* context );
+
+protected:
+    IODataQueueMemory*   dataQueue;
+    NotificationRoutine  notifyRoutine;
+    void*                notifyContext;
+
+    virtual void free() APPLE_KEXT_OVERRIDE;
+
+public:
+    virtual Boolean initWithCapacity( UInt32 size );
+    virtual void sendDataAvailableNotification();
+
+    void setNotificationRoutine( NotificationRoutine routine, void* context );
+
+    //
+    // the consumer's mapping of the memory returned by getMemoryDescriptor()
+    //
+    IODataQueueMemory* getDataQueueMemory(){ return this->dataQueue; };
+};
+
+//--------------------------------------------------------------------
+
+#endif//_DLDHOSTKERNEL_H
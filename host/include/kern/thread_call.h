@@ -0,0 +1,8 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+//
+// the host build's stand-in for the kernel header, see DldHostKernel.h
+//
+#include <DldHostKernel.h>
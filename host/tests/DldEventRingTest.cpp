@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "DldEventRing.h"
+#include "DldEventRingReader.h"
+#include "DldHostTest.h"
+
+//
+// checks the event ring protocol between DldEventRing::write() and the user
+// space reader from userspace/DldEventRingReader.c, the ring's memory is a shared
+// mapping, see IOBufferMemoryDescriptor in DldHostKernel.h, so a forked reader
+// process reads the records as a reader task reads the memory mapped by
+// DldEventRingUserClient, the producers are the threads which are the CPUs
+// of the host build, the reader checks that every record is read at most once,
+// in the order it was written on its CPU, without being torn, and that every
+// record which was not read has been counted as dropped, the test also checks
+// that a reader which corrupts the ring's tails can't make the producer
+// write outside the CPU's ring
+//
+
+#define DLD_TEST_PRODUCERS              (0x4)
+#define DLD_TEST_RECORDS_PER_PRODUCER   (20000)
+#define DLD_TEST_RECORDS_PER_CPU        (100)// rounded up to 128 by the ring
+
+//
+// a page shared by the producers' process and the reader's process
+//
+typedef struct _DldTestShared{
+
+    volatile uint64_t   Written;
+    volatile uint64_t   Attempted;
+    volatile bool       Done;
+
+} DldTestShared;
+
+typedef struct _DldTestProducer{
+
+    DldEventRing*       Ring;
+    unsigned int        Index;
+    uint64_t            Written;
+    pthread_t           Thread;
+
+} DldTestProducer;
+
+//--------------------------------------------------------------------
+
+static
+void
+DldTestFillRecord(
+    __out DldEventRecord* record,
+    __in unsigned int producer,
+    __in uint64_t sequence
+    )
+{
+    bzero( record, sizeof( *record ) );
+
+    //
+    // the fields are related so a torn record is detected
+    //
+    record->Timestamp = sequence;
+    record->Duration = ~sequence;
+    record->Object = producer;
+    record->MetaClass = sequence*0x9E3779B97F4A7C15ULL + producer;
+    record->Type = DLD_EVENT_TYPE_CALL;
+    record->HookIndex = (uint32_t)sequence;
+    record->Hooker = producer;
+}
+
+static
+bool
+DldTestIsRecordValid(
+    __in const DldEventRecord* record
+    )
+{
+    return ( record->Duration == ~record->Timestamp &&
+             record->Object < DLD_TEST_PRODUCERS &&
+             record->MetaClass == record->Timestamp*0x9E3779B97F4A7C15ULL + record->Object &&
+             DLD_EVENT_TYPE_CALL == record->Type &&
+             record->HookIndex == (uint32_t)record->Timestamp &&
+             record->Hooker == record->Object );
+}
+
+//--------------------------------------------------------------------
+
+static
+void
+DldTestLayout()
+{
+    DldEventRing*        ring;
+    DldEventRingHeader*  header;
+    DldEventRingReader   reader;
+    size_t               size;
+
+    ring = DldEventRing::withRecordsPerCpu( DLD_TEST_RECORDS_PER_CPU );
+    DLD_TEST_CHECK( NULL != ring );
+
+    header = (DldEventRingHeader*)( (IOBufferMemoryDescriptor*)ring->getMemoryDescriptor() )->getBytesNoCopy();
+    size = (size_t)ring->getMemoryDescriptor()->getLength();
+
+    DLD_TEST_CHECK( 0x0 == DldEventRingReaderInit( &reader, header, size ) );
+    DLD_TEST_CHECK( 128 == header->RecordsPerCpu );
+    DLD_TEST_CHECK( (uint32_t)ml_get_max_cpus() == header->CpusNumber );
+    DLD_TEST_CHECK( sizeof( DldEventRecord ) == header->RecordSize );
+
+    //
+    // the reader refuses a ring it doesn't understand or which is bigger than the mapping
+    //
+    header->Version = DLD_EVENT_RING_VERSION + 0x1;
+    DLD_TEST_CHECK( 0x0 != DldEventRingReaderInit( &reader, header, size ) );
+    header->Version = DLD_EVENT_RING_VERSION;
+
+    DLD_TEST_CHECK( 0x0 != DldEventRingReaderInit( &reader, header, size - 0x1 ) );
+
+    ring->release();
+}
+
+//--------------------------------------------------------------------
+
+static
+void*
+DldTestProducerRoutine(
+    __in void* context
+    )
+{
+    DldTestProducer*  producer = (DldTestProducer*)context;
+
+    for( uint64_t sequence = 0x1; sequence <= DLD_TEST_RECORDS_PER_PRODUCER; ++sequence ){
+
+        DldEventRecord  record;
+
+        DldTestFillRecord( &record, producer->Index, sequence );
+        if( producer->Ring->write( &record ) )
+            ++producer->Written;
+
+        //
+        // let the reader run now and then on a single CPU machine
+        //
+        if( 0x0 == sequence % 0x100 )
+            sched_yield();
+    }// end for
+
+    return NULL;
+}
+
+//
+// the reader's process body, returns the exit code
+//
+static
+int
+DldTestReaderProcess(
+    __in void* ring,
+    __in size_t size,
+    __in DldTestShared* shared
+    )
+{
+    DldEventRingReader  reader;
+    DldEventRecord      records[ 64 ];
+    uint64_t            lastSequence[ DLD_TEST_PRODUCERS ] = { 0x0 };
+    uint64_t            read = 0x0;
+    bool                done = false;
+
+    if( 0x0 != DldEventRingReaderInit( &reader, ring, size ) ){
+
+        fprintf( stderr, "the reader failed to validate the ring\n" );
+        return 1;
+    }
+
+    while( !done ){
+
+        size_t  count;
+        bool    producersDone = __atomic_load_n( &shared->Done, __ATOMIC_ACQUIRE );
+
+        count = DldEventRingReaderRead( &reader, records, sizeof( records )/sizeof( records[ 0 ] ) );
+
+        for( size_t i = 0x0; i < count; ++i ){
+
+            if( !DldTestIsRecordValid( &records[ i ] ) ){
+
+                fprintf( stderr, "a torn record has been read\n" );
+                return 1;
+            }
+
+            //
+            // a producer's thread doesn't change its CPU so its records are read in order
+            //
+            if( records[ i ].Timestamp <= lastSequence[ records[ i ].Object ] ){
+
+                fprintf( stderr, "a record has been read out of order or twice\n" );
+                return 1;
+            }
+
+            lastSequence[ records[ i ].Object ] = records[ i ].Timestamp;
+        }// end for
+
+        read += count;
+
+        //
+        // the rings are empty after the producers have finished, the rings are
+        // read in a round robin fashion so an empty read is made for all CPUs
+        //
+        if( producersDone && 0x0 == count )
+            done = true;
+        else if( 0x0 == count )
+            sched_yield();
+
+    }// end while
+
+    if( read != shared->Written || read + DldEventRingReaderDropped( &reader ) != shared->Attempted ){
+
+        fprintf( stderr, "read %llu, dropped %llu, written %llu, attempted %llu\n",
+                 (unsigned long long)read,
+                 (unsigned long long)DldEventRingReaderDropped( &reader ),
+                 (unsigned long long)shared->Written,
+                 (unsigned long long)shared->Attempted );
+        return 1;
+    }
+
+    return 0;
+}
+
+static
+void
+DldTestCrossProcess()
+{
+    DldEventRing*     ring;
+    DldTestShared*    shared;
+    DldTestProducer   producers[ DLD_TEST_PRODUCERS ];
+    void*             ringMemory;
+    size_t            size;
+    pid_t             readerPid;
+    int               status;
+
+    ring = DldEventRing::withRecordsPerCpu( DLD_TEST_RECORDS_PER_CPU );
+    DLD_TEST_CHECK( NULL != ring );
+
+    ringMemory = ( (IOBufferMemoryDescriptor*)ring->getMemoryDescriptor() )->getBytesNoCopy();
+    size = (size_t)ring->getMemoryDescriptor()->getLength();
+
+    shared = (DldTestShared*)mmap( NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    DLD_TEST_CHECK( MAP_FAILED != (void*)shared );
+    bzero( shared, sizeof( *shared ) );
+
+    fflush( stdout );
+    fflush( stderr );
+
+    readerPid = fork();
+    DLD_TEST_CHECK( readerPid >= 0x0 );
+
+    if( 0x0 == readerPid )
+        _exit( DldTestReaderProcess( ringMemory, size, shared ) );
+
+    bzero( producers, sizeof( producers ) );
+
+    for( unsigned int i = 0x0; i < DLD_TEST_PRODUCERS; ++i ){
+
+        producers[ i ].Ring = ring;
+        producers[ i ].Index = i;
+        DLD_TEST_CHECK( 0x0 == pthread_create( &producers[ i ].Thread, NULL, DldTestProducerRoutine, &producers[ i ] ) );
+    }// end for
+
+    for( unsigned int i = 0x0; i < DLD_TEST_PRODUCERS; ++i ){
+
+        pthread_join( producers[ i ].Thread, NULL );
+        shared->Written += producers[ i ].Written;
+    }// end for
+
+    shared->Attempted = (uint64_t)DLD_TEST_PRODUCERS*DLD_TEST_RECORDS_PER_PRODUCER;
+    __atomic_store_n( &shared->Done, true, __ATOMIC_RELEASE );
+
+    DLD_TEST_CHECK( readerPid == waitpid( readerPid, &status, 0x0 ) );
+    DLD_TEST_CHECK( WIFEXITED( status ) && 0x0 == WEXITSTATUS( status ) );
+
+    munmap( shared, PAGE_SIZE );
+    ring->release();
+}
+
+//--------------------------------------------------------------------
+
+static
+void
+DldTestCorruptedTails()
+{
+    DldEventRing*        ring;
+    DldEventRingHeader*  header;
+    DldEventRingCpu*     cpuRing;
+    DldEventRecord       record;
+    size_t               size;
+    unsigned int         cpu;
+    uint64_t             tails[] = { 0x0, 0x7, 0xFFFFFFFFFFFFFFFFULL, 0x8000000000000001ULL };
+
+    ring = DldEventRing::withRecordsPerCpu( DLD_TEST_RECORDS_PER_CPU );
+    DLD_TEST_CHECK( NULL != ring );
+
+    header = (DldEventRingHeader*)( (IOBufferMemoryDescriptor*)ring->getMemoryDescriptor() )->getBytesNoCopy();
+    size = (size_t)ring->getMemoryDescriptor()->getLength();
+    cpu = (unsigned int)cpu_number();
+    cpuRing = DLD_EVENT_RING_CPU( header, cpu );
+
+    DldTestFillRecord( &record, 0x0, 0x1 );
+
+    for( unsigned int i = 0x0; i < sizeof( tails )/sizeof( tails[ 0 ] ); ++i ){
+
+        //
+        // a reader sets an arbitrary tail, including one ahead of the head
+        //
+        cpuRing->Tail = tails[ i ];
+
+        for( unsigned int j = 0x0; j < 3*header->RecordsPerCpu; ++j )
+            ring->write( &record );
+
+    }// end for
+
+    //
+    // the other CPUs' rings are intact
+    //
+    for( unsigned int other = 0x0; other < header->CpusNumber; ++other ){
+
+        DldEventRecord*  records = DLD_EVENT_RING_RECORDS( header, other );
+
+        if( other != cpu ){
+
+            DLD_TEST_CHECK( 0x0 == DLD_EVENT_RING_CPU( header, other )->Head );
+
+            for( unsigned int j = 0x0; j < header->RecordsPerCpu; ++j )
+                DLD_TEST_CHECK( 0x0 == records[ j ].Type && 0x0 == records[ j ].Timestamp );
+        }
+    }// end for
+
+    DLD_TEST_CHECK( (uint8_t*)DLD_EVENT_RING_RECORDS( header, header->CpusNumber ) == (uint8_t*)header + size );
+
+    ring->release();
+}
+
+//--------------------------------------------------------------------
+
+int
+main( int argc, char* argv[] )
+{
+    DldTestLayout();
+    DldTestCrossProcess();
+    DldTestCorruptedTails();
+
+    DLD_TEST_PASSED( "DldEventRingTest" );
+}
@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include "DldHostTestClasses.h"
+#include "DldHostTest.h"
+
+//
+// hooks the synthetic classes with the object and vtable hooks, checks that
+// the hooks are called and call the original functions, then unhooks
+//
+
+//
+// a hooker is used either for the object or for the vtable hooks
+//
+typedef DldHookerCommonClass2< DldTestServiceDldHook<DldInheritanceDepth_0,0>, DldTestService >  DldTestHooker0;
+typedef DldHookerCommonClass2< DldTestServiceDldHook<DldInheritanceDepth_0,1>, DldTestService >  DldTestHooker0Vtable;
+typedef DldHookerCommonClass2< DldTestServiceDldHook<DldInheritanceDepth_2,0>, DldTestService >  DldTestHooker2;
+
+//--------------------------------------------------------------------
+
+static
+void
+DldTestObjectHook()
+{
+    DldTestService*  hooked = new DldTestService;
+    DldTestService*  notHooked = new DldTestService;
+    
+    DLD_TEST_CHECK( 0x2 == hooked->testMethod( 0x1 ) );
+    
+    DLD_TEST_CHECK( kIOReturnSuccess == DldTestHooker0::fHookObject( hooked, DldHookTypeObject ) );
+    DLD_TEST_CHECK( 0x2 + DLD_TEST_HOOK_INCREMENT == hooked->testMethod( 0x1 ) );
+    DLD_TEST_CHECK( 0x2 == notHooked->testMethod( 0x1 ) );
+    
+    DLD_TEST_CHECK( kIOReturnSuccess == DldTestHooker0::fUnHookObject( hooked, DldHookTypeObject, DldInheritanceDepth_0 ) );
+    DLD_TEST_CHECK( 0x2 == hooked->testMethod( 0x1 ) );
+    
+    hooked->release();
+    notHooked->release();
+}
+
+//--------------------------------------------------------------------
+
+static
+void
+DldTestUnHookNotification()
+{
+    typedef DldTestServiceDldHook<DldInheritanceDepth_0,0>  DldTestHook;
+    
+    DldTestService*  object = new DldTestService;
+    unsigned int     unHooked = DldTestHook::sUnHookedObjects;
+    
+    //
+    // the hooker is notified when an object is unhooked and when a hooked object is freed
+    //
+    DLD_TEST_CHECK( kIOReturnSuccess == DldTestHooker0::fHookObject( object, DldHookTypeObject ) );
+    DLD_TEST_CHECK( kIOReturnSuccess == DldTestHooker0::fUnHookObject( object, DldHookTypeObject, DldInheritanceDepth_0 ) );
+    DLD_TEST_CHECK( unHooked + 0x1 == DldTestHook::sUnHookedObjects );
+    
+    DLD_TEST_CHECK( kIOReturnSuccess == DldTestHooker0::fHookObject( object, DldHookTypeObject ) );
+    object->release();
+    DLD_TEST_CHECK( unHooked + 0x2 == DldTestHook::sUnHookedObjects );
+}
+
+//--------------------------------------------------------------------
+
+static
+void
+DldTestChainedHooks()
+{
+    DldTestService*  object = new DldTestService;
+    
+    //
+    // an object hook clones the vtable hooked by another hooker,
+    // so the object hook calls the vtable hook which calls the original
+    //
+    DLD_TEST_CHECK( kIOReturnSuccess == DldTestHooker0Vtable::fHookObject( object, DldHookTypeVtable ) );
+    DLD_TEST_CHECK( kIOReturnSuccess == DldTestHooker0::fHookObject( object, DldHookTypeObject ) );
+    DLD_TEST_CHECK( 0x2 + 0x2*DLD_TEST_HOOK_INCREMENT == object->testMethod( 0x1 ) );
+    
+    DLD_TEST_CHECK( kIOReturnSuccess == DldTestHooker0::fUnHookObject( object, DldHookTypeObject, DldInheritanceDepth_0 ) );
+    DLD_TEST_CHECK( 0x2 + DLD_TEST_HOOK_INCREMENT == object->testMethod( 0x1 ) );
+    
+    DLD_TEST_CHECK( kIOReturnSuccess == DldTestHooker0Vtable::fUnHookObject( object, DldHookTypeVtable, DldInheritanceDepth_0 ) );
+    DLD_TEST_CHECK( 0x2 == object->testMethod( 0x1 ) );
+    
+    object->release();
+}
+
+//--------------------------------------------------------------------
+
+static
+void
+DldTestVtableHook()
+{
+    DldTestService*  first = new DldTestService;
+    DldTestService*  second = new DldTestService;
+    
+    //
+    // a vtable hook affects all objects of the class
+    //
+    DLD_TEST_CHECK( kIOReturnSuccess == DldTestHooker0Vtable::fHookObject( first, DldHookTypeVtable ) );
+    DLD_TEST_CHECK( 0x2 + DLD_TEST_HOOK_INCREMENT == first->testMethod( 0x1 ) );
+    DLD_TEST_CHECK( 0x2 + DLD_TEST_HOOK_INCREMENT == second->testMethod( 0x1 ) );
+    
+    DLD_TEST_CHECK( kIOReturnSuccess == DldTestHooker0Vtable::fUnHookObject( first, DldHookTypeVtable, DldInheritanceDepth_0 ) );
+    DLD_TEST_CHECK( 0x2 == first->testMethod( 0x1 ) );
+    DLD_TEST_CHECK( 0x2 == second->testMethod( 0x1 ) );
+    
+    first->release();
+    second->release();
+}
+
+//--------------------------------------------------------------------
+
+static
+void
+DldTestVtableHookedObjects()
+{
+    DldTestService*                    first = new DldTestService;
+    DldTestService*                    second = new DldTestService;
+    DldTestService*                    notHooked = new DldTestService;
+    DldSingleInheritingClassObjectPtr  ObjU;
+    OSMetaClassBase::_ptf_t*           hookedVtable;
+    OSMetaClassBase::_ptf_t*           replacedVtable;
+    int                                vtableSize = DldTestHooker0Vtable::fHookedClassVtaleSize();
+    
+    //
+    // a double hook is not counted, free() of an object which has not been
+    // hooked reaches the hooker through the hooked vtable but doesn't unhook
+    // the vtable
+    //
+    DLD_TEST_CHECK( kIOReturnSuccess == DldTestHooker0Vtable::fHookObject( second, DldHookTypeVtable ) );
+    DLD_TEST_CHECK( kIOReturnSuccess == DldTestHooker0Vtable::fHookObject( second, DldHookTypeVtable ) );
+    notHooked->release();
+    DLD_TEST_CHECK( 0x2 + DLD_TEST_HOOK_INCREMENT == second->testMethod( 0x1 ) );
+    
+    //
+    // the first object's vtable is replaced after hooking, the object
+    // is unhooked by the vtable it was hooked with
+    //
+    DLD_TEST_CHECK( kIOReturnSuccess == DldTestHooker0Vtable::fHookObject( first, DldHookTypeVtable ) );
+    
+    ObjU.fObj = first;
+    hookedVtable = *ObjU.vtablep;
+    
+    replacedVtable = (OSMetaClassBase::_ptf_t*)IOMalloc( vtableSize );
+    DLD_TEST_CHECK( NULL != replacedVtable );
+    memcpy( replacedVtable, hookedVtable, vtableSize );
+    *ObjU.vtablep = replacedVtable;
+    
+    DLD_TEST_CHECK( kIOReturnSuccess == DldTestHooker0Vtable::fUnHookObject( first, DldHookTypeVtable, DldInheritanceDepth_0 ) );
+    *ObjU.vtablep = hookedVtable;
+    DLD_TEST_CHECK( 0x2 + DLD_TEST_HOOK_INCREMENT == second->testMethod( 0x1 ) );
+    
+    //
+    // the last hooked object unhooks the vtable
+    //
+    DLD_TEST_CHECK( kIOReturnSuccess == DldTestHooker0Vtable::fUnHookObject( second, DldHookTypeVtable, DldInheritanceDepth_0 ) );
+    DLD_TEST_CHECK( 0x2 == first->testMethod( 0x1 ) );
+    DLD_TEST_CHECK( 0x2 == second->testMethod( 0x1 ) );
+    
+    IOFree( replacedVtable, vtableSize );
+    first->release();
+    second->release();
+}
+
+//--------------------------------------------------------------------
+
+static
+void
+DldTestDerivedVtableHook()
+{
+    DldTestServiceLevel2*  derived = new DldTestServiceLevel2;
+    
+    //
+    // the hooked class is two levels up the derived class
+    //
+    DLD_TEST_CHECK( 0x4 == derived->testMethod( 0x1 ) );
+    
+    DLD_TEST_CHECK( kIOReturnSuccess == DldTestHooker2::fHookObject( derived, DldHookTypeVtable ) );
+    DLD_TEST_CHECK( 0x4 + DLD_TEST_HOOK_INCREMENT == derived->testMethod( 0x1 ) );
+    
+    DLD_TEST_CHECK( kIOReturnSuccess == DldTestHooker2::fUnHookObject( derived, DldHookTypeVtable, DldInheritanceDepth_2 ) );
+    DLD_TEST_CHECK( 0x4 == derived->testMethod( 0x1 ) );
+    
+    derived->release();
+}
+
+//--------------------------------------------------------------------
+
+static
+void
+DldTestBulkObjectHook()
+{
+    DldTestService*  objects[ 0x28 ];
+    OSObject*        batch[ 0x2A ];
+    
+    for( unsigned int i = 0x0; i < 0x28; ++i ){
+        
+        objects[ i ] = new DldTestService;
+        batch[ i ] = objects[ i ];
+    }// end for
+    
+    //
+    // an object hooked before the call and objects repeated in the same lookup batch
+    //
+    DLD_TEST_CHECK( kIOReturnSuccess == DldTestHooker0::fHookObject( objects[ 0x5 ], DldHookTypeObject ) );
+    batch[ 0x3 ] = objects[ 0x1 ];
+    batch[ 0x28 ] = objects[ 0x26 ];
+    batch[ 0x29 ] = objects[ 0x27 ];
+    
+    DLD_TEST_CHECK( kIOReturnSuccess == DldTestHooker0::fHookObjects( batch, 0x2A, DldHookTypeObject ) );
+    
+    //
+    // objects[ 0x3 ] has been replaced in the batch
+    //
+    for( unsigned int i = 0x0; i < 0x28; ++i )
+        DLD_TEST_CHECK( ( 0x3 == i ? 0x2 : 0x2 + DLD_TEST_HOOK_INCREMENT ) == objects[ i ]->testMethod( 0x1 ) );
+    
+    DLD_TEST_CHECK( kIOReturnSuccess == DldTestHooker0::fHookObject( objects[ 0x3 ], DldHookTypeObject ) );
+    batch[ 0x3 ] = objects[ 0x3 ];
+    
+    DLD_TEST_CHECK( kIOReturnSuccess == DldTestHooker0::fUnHookObjects( batch, 0x28 ) );
+    
+    for( unsigned int i = 0x0; i < 0x28; ++i ){
+        
+        DLD_TEST_CHECK( 0x2 == objects[ i ]->testMethod( 0x1 ) );
+        objects[ i ]->release();
+    }// end for
+}
+
+//--------------------------------------------------------------------
+
+int
+main( int argc, char* argv[] )
+{
+    DLD_TEST_CHECK( DldHookedObjectsHashTable::CreateStaticTableWithSize( 0x100, false ) );
+    
+    DldTestObjectHook();
+    DldTestUnHookNotification();
+    DldTestVtableHook();
+    DldTestChainedHooks();
+    DldTestVtableHookedObjects();
+    DldTestDerivedVtableHook();
+    DldTestBulkObjectHook();
+    
+    DLD_TEST_PASSED( "DldHookSmokeTest" );
+}
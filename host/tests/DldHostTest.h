@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#ifndef _DLDHOSTTEST_H
+#define _DLDHOSTTEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+//
+// the host tests' checks, active in the release build as well as the tests
+// check the behaviour and not the assertions
+//
+#define DLD_TEST_CHECK( _EXPR_ ) do{ \
+    if( !( _EXPR_ ) ){ \
+        fprintf( stderr, "%s:%d: check \"%s\" failed\n", __FILE__, __LINE__, #_EXPR_ ); \
+        exit( 1 ); \
+    } \
+}while(0)
+
+#define DLD_TEST_PASSED( _NAME_ ) do{ \
+    printf( "%s passed\n", ( _NAME_ ) ); \
+    return 0; \
+}while(0)
+
+#endif//_DLDHOSTTEST_H
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include "DldHostTestClasses.h"
+
+//--------------------------------------------------------------------
+
+OSDefineMetaClassAndStructors( DldTestService, IOService )
+
+UInt32
+DldTestService::testMethod( UInt32 value )
+{
+    return value + 0x1;
+}
+
+//--------------------------------------------------------------------
+
+OSDefineMetaClassAndStructors( DldTestServiceLevel1, DldTestService )
+
+UInt32
+DldTestServiceLevel1::testMethod( UInt32 value )
+{
+    return DldTestService::testMethod( value ) + 0x1;
+}
+
+//--------------------------------------------------------------------
+
+OSDefineMetaClassAndStructors( DldTestServiceLevel2, DldTestServiceLevel1 )
+
+UInt32
+DldTestServiceLevel2::testMethod( UInt32 value )
+{
+    return DldTestServiceLevel1::testMethod( value ) + 0x1;
+}
+
+//--------------------------------------------------------------------
+
+OSDefineMetaClassAndStructors( DldTestServiceSibling1, DldTestService )
+
+UInt32
+DldTestServiceSibling1::testMethod( UInt32 value )
+{
+    return DldTestService::testMethod( value ) + 0x1;
+}
+
+//--------------------------------------------------------------------
+
+OSDefineMetaClassAndStructors( DldTestServiceSibling2, DldTestService )
+
+UInt32
+DldTestServiceSibling2::testMethod( UInt32 value )
+{
+    return DldTestService::testMethod( value ) + 0x1;
+}
+
+//--------------------------------------------------------------------
+
+OSDefineMetaClassAndStructors( DldTestServiceSibling3, DldTestService )
+
+UInt32
+DldTestServiceSibling3::testMethod( UInt32 value )
+{
+    return DldTestService::testMethod( value ) + 0x1;
+}
+
+//--------------------------------------------------------------------
+
+OSDefineMetaClassAndStructors( DldTestServiceSibling4, DldTestService )
+
+UInt32
+DldTestServiceSibling4::testMethod( UInt32 value )
+{
+    return DldTestService::testMethod( value ) + 0x1;
+}
+
+//--------------------------------------------------------------------
+
+OSDefineMetaClassAndStructors( DldTestServiceSibling5, DldTestService )
+
+UInt32
+DldTestServiceSibling5::testMethod( UInt32 value )
+{
+    return DldTestService::testMethod( value ) + 0x1;
+}
+
+//--------------------------------------------------------------------
+
+OSDefineMetaClassAndStructors( DldTestServiceSibling6, DldTestService )
+
+UInt32
+DldTestServiceSibling6::testMethod( UInt32 value )
+{
+    return DldTestService::testMethod( value ) + 0x1;
+}
+
+//--------------------------------------------------------------------
+
+OSDefineMetaClassAndStructors( DldTestServiceSibling7, DldTestService )
+
+UInt32
+DldTestServiceSibling7::testMethod( UInt32 value )
+{
+    return DldTestService::testMethod( value ) + 0x1;
+}
+
+//--------------------------------------------------------------------
+
+DldTestService*
+DldTestNewSibling(
+    __in unsigned int index
+    )
+{
+    switch( index ){
+
+        case 0x0:
+            return new DldTestServiceLevel1;
+
+        case 0x1:
+            return new DldTestServiceSibling1;
+
+        case 0x2:
+            return new DldTestServiceSibling2;
+
+        case 0x3:
+            return new DldTestServiceSibling3;
+
+        case 0x4:
+            return new DldTestServiceSibling4;
+
+        case 0x5:
+            return new DldTestServiceSibling5;
+
+        case 0x6:
+            return new DldTestServiceSibling6;
+
+        case 0x7:
+            return new DldTestServiceSibling7;
+
+        default:
+            return NULL;
+    }// end switch
+}
+
+//--------------------------------------------------------------------
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#ifndef _DLDHOSTTESTCLASSES_H
+#define _DLDHOSTTESTCLASSES_H
+
+#include "DldCommon.h"
+#include "DldHookerCommonClass.h"
+#include "DldHookerCommonClass2.h"
+
+//--------------------------------------------------------------------
+
+//
+// a synthetic IOService hierarchy for the host tests and benchmarks,
+// DldTestService is the hooked class, the derived classes call the super
+// class's testMethod() so a call on a DldTestServiceLevel<N> object passes
+// through N+1 implementations
+//
+class DldTestService : public IOService
+{
+    OSDeclareDefaultStructors( DldTestService )
+    
+public:
+    virtual UInt32 testMethod( UInt32 value );
+};
+
+class DldTestServiceLevel1 : public DldTestService
+{
+    OSDeclareDefaultStructors( DldTestServiceLevel1 )
+    
+public:
+    virtual UInt32 testMethod( UInt32 value ) APPLE_KEXT_OVERRIDE;
+};
+
+class DldTestServiceLevel2 : public DldTestServiceLevel1
+{
+    OSDeclareDefaultStructors( DldTestServiceLevel2 )
+    
+public:
+    virtual UInt32 testMethod( UInt32 value ) APPLE_KEXT_OVERRIDE;
+};
+
+//
+// the classes derived from DldTestService at the same depth as DldTestServiceLevel1,
+// a vtable hooker at the depth 1 hooks their vtables so the hooker's calls see
+// DLD_TEST_SIBLING_CLASSES vtables, testMethod() returns the same value
+// as DldTestServiceLevel1's one
+//
+#define DLD_TEST_SIBLING_CLASSES    (0x8)
+
+class DldTestServiceSibling1 : public DldTestService
+{
+    OSDeclareDefaultStructors( DldTestServiceSibling1 )
+    
+public:
+    virtual UInt32 testMethod( UInt32 value ) APPLE_KEXT_OVERRIDE;
+};
+
+class DldTestServiceSibling2 : public DldTestService
+{
+    OSDeclareDefaultStructors( DldTestServiceSibling2 )
+    
+public:
+    virtual UInt32 testMethod( UInt32 value ) APPLE_KEXT_OVERRIDE;
+};
+
+class DldTestServiceSibling3 : public DldTestService
+{
+    OSDeclareDefaultStructors( DldTestServiceSibling3 )
+    
+public:
+    virtual UInt32 testMethod( UInt32 value ) APPLE_KEXT_OVERRIDE;
+};
+
+class DldTestServiceSibling4 : public DldTestService
+{
+    OSDeclareDefaultStructors( DldTestServiceSibling4 )
+    
+public:
+    virtual UInt32 testMethod( UInt32 value ) APPLE_KEXT_OVERRIDE;
+};
+
+class DldTestServiceSibling5 : public DldTestService
+{
+    OSDeclareDefaultStructors( DldTestServiceSibling5 )
+    
+public:
+    virtual UInt32 testMethod( UInt32 value ) APPLE_KEXT_OVERRIDE;
+};
+
+class DldTestServiceSibling6 : public DldTestService
+{
+    OSDeclareDefaultStructors( DldTestServiceSibling6 )
+    
+public:
+    virtual UInt32 testMethod( UInt32 value ) APPLE_KEXT_OVERRIDE;
+};
+
+class DldTestServiceSibling7 : public DldTestService
+{
+    OSDeclareDefaultStructors( DldTestServiceSibling7 )
+    
+public:
+    virtual UInt32 testMethod( UInt32 value ) APPLE_KEXT_OVERRIDE;
+};
+
+//
+// returns a new object of the index'th depth 1 class, the index 0 is DldTestServiceLevel1
+//
+DldTestService* DldTestNewSibling( __in unsigned int index );
+
+//
+// the value added by a DldTestServiceDldHook hook to the original result
+//
+#define DLD_TEST_HOOK_INCREMENT    (0x100)
+
+//--------------------------------------------------------------------
+
+//
+// a hooker for DldTestService's testMethod(), the Chain parameter
+// instantiates independent hookers so the hooks can be chained
+//
+template<DldInheritanceDepth Depth, int Chain>
+class DldTestServiceDldHook : public DldHookerBaseInterface
+{
+    /////////////////////////////////////////////
+    //
+    // start of the required declarations
+    //
+    /////////////////////////////////////////////
+public:
+    enum{
+        kDld_testMethod_hook = 0x0,
+        kDld_NumberOfAddedHooks
+    };
+    
+    friend class DldHookerCommonClass2<DldTestServiceDldHook<Depth,Chain>,DldTestService>;
+    
+    static const char* fGetHookedClassName(){ return "DldTestService"; };
+    
+    //
+    // DldDeclareGetClassNameFunction() writes in __PRETTY_FUNCTION__ which is read only in the user space
+    //
+    virtual const char* fGetClassName(){ return "DldTestServiceDldHook"; };
+    
+protected:
+    
+    static DldInheritanceDepth fGetInheritanceDepth(){ return Depth; };
+    DldHookerCommonClass2<DldTestServiceDldHook<Depth,Chain>,DldTestService>*   mHookerCommon2;
+    
+protected:
+    static DldTestServiceDldHook<Depth,Chain>* newWithDefaultSettings();
+    virtual bool init();
+    virtual void free();
+    
+    /////////////////////////////////////////////
+    //
+    // end of the required declarations
+    //
+    /////////////////////////////////////////////
+    
+public:
+    
+    //
+    // counts the unhook notifications, see DldHookerBaseInterface
+    //
+    static unsigned int  sUnHookedObjects;
+    
+    virtual void fObjectUnHooked( __in OSObject* object ){ ++DldTestServiceDldHook<Depth,Chain>::sUnHookedObjects; };
+    
+protected:
+    
+    virtual UInt32 testMethod_hook( UInt32 value );
+};
+
+template<DldInheritanceDepth Depth, int Chain>
+unsigned int DldTestServiceDldHook<Depth,Chain>::sUnHookedObjects = 0x0;
+
+//--------------------------------------------------------------------
+
+template<DldInheritanceDepth Depth, int Chain>
+DldTestServiceDldHook<Depth,Chain>*
+DldTestServiceDldHook<Depth,Chain>::newWithDefaultSettings()
+{
+    DldTestServiceDldHook<Depth,Chain>*  newObject;
+    
+    newObject = new DldTestServiceDldHook<Depth,Chain>();
+    if( !newObject )
+        return NULL;
+    
+    newObject->mHookerCommon2 = new DldHookerCommonClass2< DldTestServiceDldHook<Depth,Chain>, DldTestService >;
+    assert( newObject->mHookerCommon2 );
+    if( !newObject->mHookerCommon2 ){
+        
+        delete newObject;
+        return NULL;
+    }
+    
+    if( !newObject->init() ){
+        
+        assert( !"newObject->init() failed" );
+        DBG_PRINT_ERROR(("newObject->init() failed"));
+        
+        newObject->free();
+        delete newObject->mHookerCommon2;
+        delete newObject;
+        
+        return NULL;
+    }
+    
+    return newObject;
+}
+
+//--------------------------------------------------------------------
+
+template<DldInheritanceDepth Depth, int Chain>
+bool
+DldTestServiceDldHook<Depth,Chain>::init()
+{
+    assert( this->mHookerCommon2 );
+    
+    if( !this->mHookerCommon2->init( this ) ){
+        
+        DBG_PRINT_ERROR(("this->mHookerCommon2.init( this ) failed\n"));
+        return false;
+    }
+    
+    this->mHookerCommon2->fAddHookingFunctionExternal(
+                                                      DldTestServiceDldHook<Depth,Chain>::kDld_testMethod_hook,
+                                                      DldConvertFunctionToVtableIndex( (void (OSMetaClassBase::*)(void)) &DldTestService::testMethod ),
+                                                      DldHookerCommonClass2<DldTestServiceDldHook<Depth,Chain>,DldTestService>::_ptmf2ptf( this, (void (DldHookerBaseInterface::*)(void)) &DldTestServiceDldHook<Depth,Chain>::testMethod_hook ) );
+    
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+template<DldInheritanceDepth Depth, int Chain>
+void
+DldTestServiceDldHook<Depth,Chain>::free()
+{
+    if( this->mHookerCommon2 )
+        this->mHookerCommon2->free();
+}
+
+//--------------------------------------------------------------------
+
+template<DldInheritanceDepth Depth, int Chain>
+UInt32
+DldTestServiceDldHook<Depth,Chain>::testMethod_hook( UInt32 value )
+{
+    typedef UInt32 (*testMethodFunc)( DldTestService*  __this, UInt32 value );
+    
+    DldHookerCommonClass2<DldTestServiceDldHook<Depth,Chain>,DldTestService>*  commonHooker2;
+    testMethodFunc                                                             Original;
+    
+    commonHooker2 = DldHookerCommonClass2<DldTestServiceDldHook<Depth,Chain>,DldTestService>::fCommonHooker2();
+    assert( commonHooker2 );
+    if( NULL == commonHooker2 )
+        return 0x0;
+    
+    Original = (testMethodFunc)commonHooker2->fGetOriginalFunctionExternal( (OSObject*)this,
+                                                                            DldTestServiceDldHook<Depth,Chain>::kDld_testMethod_hook );
+    assert( Original );
+    if( !Original )
+        return 0x0;
+    
+    return Original( reinterpret_cast<DldTestService*>(this), value ) + DLD_TEST_HOOK_INCREMENT;
+}
+
+//--------------------------------------------------------------------
+
+#endif//_DLDHOSTTESTCLASSES_H
@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include "DldUserClientSelectorPolicy.h"
+#include "DldHostTest.h"
+
+//
+// checks the selector policy compiler, the loading of the rules for
+// the loaded and not loaded classes and the policy replacement under
+// the concurrent checks
+//
+
+//--------------------------------------------------------------------
+
+class DldTestUserClient : public IOUserClient
+{
+    OSDeclareDefaultStructors( DldTestUserClient )
+};
+
+OSDefineMetaClassAndStructors( DldTestUserClient, IOUserClient )
+
+//
+// an object of a class which is loaded after the policy,
+// its metaclass is created by the test
+//
+class DldTestLateUserClient : public DldTestUserClient
+{
+public:
+    static const OSMetaClass*  sLateMetaClass;
+    virtual const OSMetaClass* getMetaClass() const APPLE_KEXT_OVERRIDE { return DldTestLateUserClient::sLateMetaClass; };
+};
+
+const OSMetaClass*  DldTestLateUserClient::sLateMetaClass = NULL;
+
+//--------------------------------------------------------------------
+
+static
+void
+DldTestCompiler()
+{
+    DldSelectorPolicyRule  rules[] = {
+        { "DldTestUserClient", DldSelectorPolicyKindExternalMethod, 0x0, (UInt32)(-1), false },
+        { "DldTestUserClient", DldSelectorPolicyKindExternalMethod, 0x2, 0x3, true },
+        { "DldTestOtherClient", DldSelectorPolicyKindMemoryType, 0x5, 0x5, false },
+        { "DldTestUserClient", DldSelectorPolicyKindExternalMethod, 0x3, 0x3, false },
+    };
+    DldSelectorPolicyRule  badRules[] = {
+        { "DldTestUserClient", DldSelectorPolicyKindMemoryType, 0x0, DLD_SELECTOR_POLICY_MAX_MEMORY_TYPE, false },
+    };
+    vm_size_t              size;
+    DldSelectorPolicy*     policy;
+    DldSelectorPolicyClass* userClient;
+    DldSelectorPolicyClass* otherClient;
+    
+    size = DldSelectorPolicyCompiledSize( rules, sizeof( rules )/sizeof( rules[ 0 ] ) );
+    DLD_TEST_CHECK( 0x0 != size );
+    
+    policy = (DldSelectorPolicy*)malloc( size );
+    DLD_TEST_CHECK( kIOReturnNoSpace == DldSelectorPolicyCompileRules( rules, sizeof( rules )/sizeof( rules[ 0 ] ), policy, size - 0x1 ) );
+    DLD_TEST_CHECK( kIOReturnSuccess == DldSelectorPolicyCompileRules( rules, sizeof( rules )/sizeof( rules[ 0 ] ), policy, size ) );
+    
+    //
+    // the rules for a class are merged, the classes are not bound
+    //
+    DLD_TEST_CHECK( 0x2 == policy->ClassesCount );
+    userClient = &policy->Classes[ 0 ];
+    otherClient = &policy->Classes[ 1 ];
+    DLD_TEST_CHECK( 0x0 == strcmp( userClient->ClassName, "DldTestUserClient" ) );
+    DLD_TEST_CHECK( 0x0 == strcmp( otherClient->ClassName, "DldTestOtherClient" ) );
+    DLD_TEST_CHECK( NULL == userClient->MetaClass && NULL == otherClient->MetaClass );
+    
+    //
+    // a later rule overrides an earlier one, the default is applied outside the bitmap
+    //
+    DLD_TEST_CHECK( !DldSelectorPolicyIsAllowed( userClient, DldSelectorPolicyKindExternalMethod, 0x1 ) );
+    DLD_TEST_CHECK( DldSelectorPolicyIsAllowed( userClient, DldSelectorPolicyKindExternalMethod, 0x2 ) );
+    DLD_TEST_CHECK( !DldSelectorPolicyIsAllowed( userClient, DldSelectorPolicyKindExternalMethod, 0x3 ) );
+    DLD_TEST_CHECK( !DldSelectorPolicyIsAllowed( userClient, DldSelectorPolicyKindExternalMethod, 0x1000 ) );
+    DLD_TEST_CHECK( DldSelectorPolicyIsAllowed( userClient, DldSelectorPolicyKindMethodIndex, 0x1 ) );
+    DLD_TEST_CHECK( DldSelectorPolicyIsAllowed( userClient, DldSelectorPolicyKindMemoryType, 0x5 ) );
+    
+    DLD_TEST_CHECK( !DldSelectorPolicyIsAllowed( otherClient, DldSelectorPolicyKindMemoryType, 0x5 ) );
+    DLD_TEST_CHECK( DldSelectorPolicyIsAllowed( otherClient, DldSelectorPolicyKindMemoryType, 0x6 ) );
+    DLD_TEST_CHECK( DldSelectorPolicyIsAllowed( otherClient, DldSelectorPolicyKindExternalMethod, 0x1000 ) );
+    
+    free( policy );
+    
+    DLD_TEST_CHECK( 0x0 == DldSelectorPolicyCompiledSize( badRules, 0x1 ) );
+    DLD_TEST_CHECK( kIOReturnBadArgument == DldSelectorPolicyCompileRules( badRules, 0x1, NULL, 0x0 ) );
+}
+
+//--------------------------------------------------------------------
+
+static
+void
+DldTestLoadRules()
+{
+    DldSelectorPolicyRule  rules[] = {
+        { "DldTestUserClient", DldSelectorPolicyKindExternalMethod, 0x1, 0x1, false },
+        { "DldTestLateUserClient", DldSelectorPolicyKindExternalMethod, 0x2, 0x2, false },
+    };
+    DldTestUserClient*      client = new DldTestUserClient;
+    DldTestLateUserClient*  lateClient = new DldTestLateUserClient;
+    
+    DLD_TEST_CHECK( kIOReturnSuccess == DldUserClientSelectorPolicy::CheckExternalMethod( client, 0x1 ) );
+    
+    DLD_TEST_CHECK( kIOReturnSuccess == DldUserClientSelectorPolicy::LoadRules( rules, sizeof( rules )/sizeof( rules[ 0 ] ) ) );
+    DLD_TEST_CHECK( kIOReturnNotPermitted == DldUserClientSelectorPolicy::CheckExternalMethod( client, 0x1 ) );
+    DLD_TEST_CHECK( kIOReturnSuccess == DldUserClientSelectorPolicy::CheckExternalMethod( client, 0x2 ) );
+    
+    //
+    // the class is loaded after the policy, the rule is applied after the class
+    // has been bound, a check doesn't match the class by its name
+    //
+    DldTestLateUserClient::sLateMetaClass = new OSMetaClass( "DldTestLateUserClient", &DldTestUserClient::gMetaClass, sizeof( DldTestLateUserClient ) );
+    DLD_TEST_CHECK( kIOReturnSuccess == DldUserClientSelectorPolicy::CheckExternalMethod( lateClient, 0x2 ) );
+    
+    DldUserClientSelectorPolicy::BindPendingClasses();
+    DLD_TEST_CHECK( kIOReturnNotPermitted == DldUserClientSelectorPolicy::CheckExternalMethod( lateClient, 0x2 ) );
+    DLD_TEST_CHECK( kIOReturnNotPermitted == DldUserClientSelectorPolicy::CheckExternalMethod( client, 0x1 ) );
+    DLD_TEST_CHECK( kIOReturnSuccess == DldUserClientSelectorPolicy::CheckExternalMethod( lateClient, 0x1 ) );
+    
+    //
+    // zero rules remove the policy
+    //
+    DLD_TEST_CHECK( kIOReturnSuccess == DldUserClientSelectorPolicy::LoadRules( NULL, 0x0 ) );
+    DLD_TEST_CHECK( kIOReturnSuccess == DldUserClientSelectorPolicy::CheckExternalMethod( client, 0x1 ) );
+    DLD_TEST_CHECK( kIOReturnSuccess == DldUserClientSelectorPolicy::CheckExternalMethod( lateClient, 0x2 ) );
+    
+    client->release();
+    lateClient->release();
+}
+
+//--------------------------------------------------------------------
+
+#define DLD_TEST_READERS       (4)
+#define DLD_TEST_WRITERS       (2)
+#define DLD_TEST_RELOADS       (500)
+
+static volatile bool        gStop = false;
+static DldTestUserClient*   gClient;
+
+static
+void*
+DldTestReader(
+    __in void* context
+    )
+{
+    while( !gStop ){
+        
+        //
+        // a policy either allows or denies all selectors
+        //
+        IOReturn  first = DldUserClientSelectorPolicy::CheckExternalMethod( gClient, 0x1 );
+        
+        DLD_TEST_CHECK( kIOReturnSuccess == first || kIOReturnNotPermitted == first );
+        
+    }// end while
+    
+    return NULL;
+}
+
+static
+void*
+DldTestWriter(
+    __in void* context
+    )
+{
+    DldSelectorPolicyRule  allowRules[] = {
+        { "DldTestUserClient", DldSelectorPolicyKindExternalMethod, 0x0, (UInt32)(-1), true },
+    };
+    DldSelectorPolicyRule  denyRules[] = {
+        { "DldTestPendingClient1", DldSelectorPolicyKindExternalMethod, 0x0, (UInt32)(-1), false },
+        { "DldTestPendingClient2", DldSelectorPolicyKindExternalMethod, 0x0, (UInt32)(-1), false },
+        { "DldTestUserClient", DldSelectorPolicyKindExternalMethod, 0x0, (UInt32)(-1), false },
+    };
+    
+    for( unsigned int i = 0x0; i < DLD_TEST_RELOADS; ++i ){
+        
+        //
+        // the concurrent writers are serialized, not rejected, the policies have different
+        // sizes so a freed policy is not reused at once and a reader which has not been
+        // waited for reads the garbage written by FreePolicy()
+        //
+        if( i & 0x1 )
+            DLD_TEST_CHECK( kIOReturnSuccess == DldUserClientSelectorPolicy::LoadRules( allowRules, sizeof( allowRules )/sizeof( allowRules[ 0 ] ) ) );
+        else
+            DLD_TEST_CHECK( kIOReturnSuccess == DldUserClientSelectorPolicy::LoadRules( denyRules, sizeof( denyRules )/sizeof( denyRules[ 0 ] ) ) );
+        
+        //
+        // let the readers preempted in the section run before the next policy is allocated
+        //
+        sched_yield();
+    }// end for
+    
+    return NULL;
+}
+
+static
+void
+DldTestConcurrentReload()
+{
+    pthread_t  readers[ DLD_TEST_READERS ];
+    pthread_t  writers[ DLD_TEST_WRITERS ];
+    
+    gClient = new DldTestUserClient;
+    
+    for( unsigned int i = 0x0; i < DLD_TEST_READERS; ++i )
+        DLD_TEST_CHECK( 0x0 == pthread_create( &readers[ i ], NULL, DldTestReader, NULL ) );
+    
+    for( unsigned int i = 0x0; i < DLD_TEST_WRITERS; ++i )
+        DLD_TEST_CHECK( 0x0 == pthread_create( &writers[ i ], NULL, DldTestWriter, NULL ) );
+    
+    for( unsigned int i = 0x0; i < DLD_TEST_WRITERS; ++i )
+        pthread_join( writers[ i ], NULL );
+    
+    gStop = true;
+    
+    for( unsigned int i = 0x0; i < DLD_TEST_READERS; ++i )
+        pthread_join( readers[ i ], NULL );
+    
+    DLD_TEST_CHECK( kIOReturnSuccess == DldUserClientSelectorPolicy::LoadRules( NULL, 0x0 ) );
+    gClient->release();
+}
+
+//--------------------------------------------------------------------
+
+int
+main( int argc, char* argv[] )
+{
+    DLD_TEST_CHECK( DldUserClientSelectorPolicy::Initialize() );
+    
+    DldTestCompiler();
+    DldTestLoadRules();
+    DldTestConcurrentReload();
+    
+    DldUserClientSelectorPolicy::Free();
+    
+    //
+    // a restarted driver reinitializes the policy after Free()
+    //
+    DLD_TEST_CHECK( DldUserClientSelectorPolicy::Initialize() );
+    DLD_TEST_CHECK( kIOReturnSuccess == DldUserClientSelectorPolicy::LoadRules( NULL, 0x0 ) );
+    DldUserClientSelectorPolicy::Free();
+    
+    DLD_TEST_PASSED( "DldSelectorPolicyTest" );
+}
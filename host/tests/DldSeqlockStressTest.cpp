@@ -0,0 +1,436 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include "DldHostTestClasses.h"
+#include "DldHostTest.h"
+
+//
+// a stress test for the table's lock free read section, see ReadBegin(),
+// ReadEnd() and BeginWrite(), the protocol's claim is that a reader never
+// sees an entry or an original functions array which a writer has removed,
+// i.e. a writer which has made the sequence odd changes and frees the data
+// only after the readers which could have seen it have left the section,
+//
+// the first part checks the claim directly, a writer adds and removes vtable
+// entries and poisons a removed entry and its array under the lock before
+// releasing them while the readers look the entries up in the read section
+// and validate everything they see, a poisoned or inconsistent value is a
+// failure whether ReadEnd() reports a change or not,
+//
+// the second part checks the hooked calls, the readers call the objects whose
+// vtables are hooked and check the results while a writer hooks and unhooks
+// other objects and vtables so the sequence and the vtable generation change,
+// the calls go through GetOriginalFunction()'s lock free path
+//
+
+typedef DldHookerCommonClass2< DldTestServiceDldHook<DldInheritanceDepth_0,1>, DldTestService >  DldStressVtableHooker;
+typedef DldHookerCommonClass2< DldTestServiceDldHook<DldInheritanceDepth_2,0>, DldTestService >  DldStressVtableHooker2;
+typedef DldHookerCommonClass2< DldTestServiceDldHook<DldInheritanceDepth_1,0>, DldTestService >  DldStressUnHookedVtableHooker;
+typedef DldHookerCommonClass2< DldTestServiceDldHook<DldInheritanceDepth_0,0>, DldTestService >  DldStressUnHookedObjectHooker;
+
+#define DLD_STRESS_READERS          (0x3)
+#define DLD_STRESS_KEYS             (0x40)
+#define DLD_STRESS_TABLE_ROUNDS     (50000)
+#define DLD_STRESS_HOOK_ROUNDS      (2000)
+#define DLD_STRESS_WINDOW           (0x10)
+
+//
+// an original function is the stamp xor'ed with this value, a poisoned
+// array or entry is filled with DLD_STRESS_POISON bytes
+//
+#define DLD_STRESS_MAGIC            (0x5EC10C4B00000000ULL)
+#define DLD_STRESS_POISON           (0xA5)
+
+typedef struct _DldStressContext{
+
+    //
+    // the fake vtables and meta class used as the keys of the first part
+    //
+    OSMetaClassBase::_ptf_t     Vtables[ DLD_STRESS_KEYS ][ 0x2 ];
+    UInt64                      MetaClass;
+
+    volatile bool               WriterDone;
+
+    //
+    // the second part's objects called by the readers
+    //
+    DldTestService*             Object;
+    DldTestService*             DerivedObject;
+
+} DldStressContext;
+
+typedef struct _DldStressReader{
+
+    DldStressContext*   Context;
+    unsigned int        Index;
+    pthread_t           Thread;
+
+    uint64_t            Reads;
+    uint64_t            Found;
+    uint64_t            Retries;
+    uint64_t            Calls;
+
+} DldStressReader;
+
+static DldStressContext  gStressContext;
+
+//--------------------------------------------------------------------
+
+static
+void
+DldStressKey(
+    __in DldStressContext* context,
+    __in unsigned int slot,
+    __out DldHookTypeVtableKey* key
+    )
+{
+    //
+    // the key is compared as a byte array so the padding is zeroed
+    //
+    bzero( key, sizeof( *key ) );
+    key->Vtable = context->Vtables[ slot ];
+    key->metaClass = (const OSMetaClass*)&context->MetaClass;
+    key->InheritanceDepth = DldInheritanceDepth_0;
+}
+
+//--------------------------------------------------------------------
+
+static
+bool
+DldStressAddEntry(
+    __in DldStressContext* context,
+    __in unsigned int slot,
+    __in UInt64 stamp
+    )
+{
+    DldHookTypeVtableKey    key;
+    DldHookedObjectEntry*   entry;
+    DldHookedFunctionInfo*  functionsInfo;
+    bool                    added;
+
+    entry = DldHookedObjectEntry::allocateNew();
+    DLD_TEST_CHECK( NULL != entry );
+
+    functionsInfo = (DldHookedFunctionInfo*)IOMalloc( 0x2*sizeof( DldHookedFunctionInfo ) );
+    DLD_TEST_CHECK( NULL != functionsInfo );
+
+    functionsInfo[ 0 ].VtableIndex = slot;
+    functionsInfo[ 0 ].HookingFunction = (DldVtableFunctionPtr)stamp;
+    functionsInfo[ 0 ].OriginalFunction = (DldVtableFunctionPtr)( stamp ^ DLD_STRESS_MAGIC );
+    functionsInfo[ 1 ].VtableIndex = (unsigned int)(-1);
+    functionsInfo[ 1 ].HookingFunction = NULL;
+    functionsInfo[ 1 ].OriginalFunction = NULL;
+
+    DldStressKey( context, slot, &key );
+
+    entry->Type = DldHookedObjectEntry::DldHookEntryTypeVtable;
+    entry->InheritanceDepth = DldInheritanceDepth_0;
+    entry->Key.VtableHookVtable = key;
+    entry->Parameters.Common.HookedVtableFunctionsInfo = functionsInfo;
+    entry->Parameters.TypeVtable.HookedVtableFunctionsInfoEntriesNumber = 0x2;
+    entry->Parameters.TypeVtable.ReferenceCount = 0x1;
+
+    DldHookedObjectsHashTable::sHashTable->LockExclusive();
+    {// start of the lock
+
+        added = DldHookedObjectsHashTable::sHashTable->AddObject( &key, entry );
+
+    }// end of the lock
+    DldHookedObjectsHashTable::sHashTable->UnLockExclusive();
+
+    //
+    // the table has its own reference
+    //
+    entry->release();
+
+    return added;
+}
+
+static
+void
+DldStressRemoveEntry(
+    __in DldStressContext* context,
+    __in unsigned int slot
+    )
+{
+    DldHookTypeVtableKey    key;
+    DldHookedObjectEntry*   entry;
+
+    DldStressKey( context, slot, &key );
+
+    DldHookedObjectsHashTable::sHashTable->LockExclusive();
+    {// start of the lock
+
+        entry = DldHookedObjectsHashTable::sHashTable->RemoveObject( &key );
+        DLD_TEST_CHECK( NULL != entry );
+
+        //
+        // the readers which could have found the entry have been drained by
+        // LockExclusive() so no reader sees the poison, the array's terminator
+        // is left intact as the entry's free() uses it to calculate the size
+        //
+        memset( &entry->Parameters.Common.HookedVtableFunctionsInfo[ 0 ], DLD_STRESS_POISON, sizeof( DldHookedFunctionInfo ) );
+        memset( &entry->Key, DLD_STRESS_POISON, sizeof( entry->Key ) );
+
+    }// end of the lock
+    DldHookedObjectsHashTable::sHashTable->UnLockExclusive();
+
+    entry->release();
+}
+
+//--------------------------------------------------------------------
+
+static
+void*
+DldStressTableWriterRoutine(
+    __in void* parameter
+    )
+{
+    DldStressContext*  context = (DldStressContext*)parameter;
+    bool               present[ DLD_STRESS_KEYS ] = { false };
+
+    for( UInt64 round = 0x1; round <= DLD_STRESS_TABLE_ROUNDS; ++round ){
+
+        //
+        // a pseudo random slot so the table grows and shrinks unevenly
+        //
+        unsigned int  slot = (unsigned int)( ( round*0x9E3779B1 ) >> 0x7 ) % DLD_STRESS_KEYS;
+
+        if( present[ slot ] )
+            DldStressRemoveEntry( context, slot );
+        else
+            DLD_TEST_CHECK( DldStressAddEntry( context, slot, round ) );
+
+        present[ slot ] = !present[ slot ];
+
+        if( 0x0 == round % 0x40 )
+            sched_yield();
+
+    }// end for
+
+    for( unsigned int slot = 0x0; slot < DLD_STRESS_KEYS; ++slot ){
+
+        if( present[ slot ] )
+            DldStressRemoveEntry( context, slot );
+    }// end for
+
+    __atomic_store_n( &context->WriterDone, true, __ATOMIC_RELEASE );
+    return NULL;
+}
+
+static
+void*
+DldStressTableReaderRoutine(
+    __in void* parameter
+    )
+{
+    DldStressReader*   reader = (DldStressReader*)parameter;
+    DldStressContext*  context = reader->Context;
+    unsigned int       slot = reader->Index;
+
+    while( !__atomic_load_n( &context->WriterDone, __ATOMIC_ACQUIRE ) ){
+
+        DldHashTableReadState   state;
+        DldHookTypeVtableKey    key;
+        DldHookedObjectEntry*   entry;
+
+        slot = ( slot*0x5 + 0x3 ) % DLD_STRESS_KEYS;
+        DldStressKey( context, slot, &key );
+
+        if( !DldHookedObjectsHashTable::sHashTable->ReadBegin( &state ) ){
+
+            reader->Retries += 0x1;
+            sched_yield();
+
+        } else {
+
+            entry = DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &key, false );
+            if( entry ){
+
+                DldHookedFunctionInfo*  functionsInfo = entry->Parameters.Common.HookedVtableFunctionsInfo;
+                UInt64                  stamp = (UInt64)functionsInfo[ 0 ].HookingFunction;
+
+                DLD_TEST_CHECK( 0x0 == memcmp( &entry->Key.VtableHookVtable, &key, sizeof( key ) ) );
+                DLD_TEST_CHECK( DldHookedObjectEntry::DldHookEntryTypeVtable == entry->Type );
+                DLD_TEST_CHECK( slot == functionsInfo[ 0 ].VtableIndex );
+                DLD_TEST_CHECK( (DldVtableFunctionPtr)( stamp ^ DLD_STRESS_MAGIC ) == functionsInfo[ 0 ].OriginalFunction );
+                DLD_TEST_CHECK( (unsigned int)(-1) == functionsInfo[ 1 ].VtableIndex );
+
+                reader->Found += 0x1;
+            }
+
+            if( DldHookedObjectsHashTable::sHashTable->ReadEnd( &state ) )
+                reader->Reads += 0x1;
+            else
+                reader->Retries += 0x1;
+        }
+
+    }// end while
+
+    return NULL;
+}
+
+//--------------------------------------------------------------------
+
+static
+void*
+DldStressHookWriterRoutine(
+    __in void* parameter
+    )
+{
+    DldStressContext*  context = (DldStressContext*)parameter;
+    DldTestService*    objects[ DLD_STRESS_WINDOW ] = { NULL };
+
+    for( unsigned int round = 0x0; round < DLD_STRESS_HOOK_ROUNDS; ++round ){
+
+        unsigned int           slot = round % DLD_STRESS_WINDOW;
+        DldTestServiceLevel1*  derivedObject;
+
+        //
+        // the object which was hooked DLD_STRESS_WINDOW rounds ago is unhooked
+        //
+        if( objects[ slot ] ){
+
+            DLD_TEST_CHECK( kIOReturnSuccess == DldStressUnHookedObjectHooker::fUnHookObject( objects[ slot ], DldHookTypeObject, DldInheritanceDepth_0 ) );
+            DLD_TEST_CHECK( 0x2 + DLD_TEST_HOOK_INCREMENT == objects[ slot ]->testMethod( 0x1 ) );
+
+            objects[ slot ]->release();
+        }
+
+        objects[ slot ] = new DldTestService;
+        DLD_TEST_CHECK( kIOReturnSuccess == DldStressUnHookedObjectHooker::fHookObject( objects[ slot ], DldHookTypeObject ) );
+
+        //
+        // the object hook is chained with the readers' vtable hook
+        //
+        DLD_TEST_CHECK( 0x2 + 0x2*DLD_TEST_HOOK_INCREMENT == objects[ slot ]->testMethod( 0x1 ) );
+
+        //
+        // the DldTestServiceLevel1 vtable is hooked and unhooked every round,
+        // this adds and removes a vtable entry and changes the vtable generation
+        //
+        derivedObject = new DldTestServiceLevel1;
+
+        DLD_TEST_CHECK( kIOReturnSuccess == DldStressUnHookedVtableHooker::fHookObject( derivedObject, DldHookTypeVtable ) );
+        DLD_TEST_CHECK( 0x3 + DLD_TEST_HOOK_INCREMENT == derivedObject->testMethod( 0x1 ) );
+
+        DLD_TEST_CHECK( kIOReturnSuccess == DldStressUnHookedVtableHooker::fUnHookObject( derivedObject, DldHookTypeVtable, DldInheritanceDepth_1 ) );
+        DLD_TEST_CHECK( 0x3 == derivedObject->testMethod( 0x1 ) );
+
+        derivedObject->release();
+
+        if( 0x0 == round % 0x8 )
+            sched_yield();
+
+    }// end for
+
+    for( unsigned int slot = 0x0; slot < DLD_STRESS_WINDOW; ++slot ){
+
+        if( objects[ slot ] ){
+
+            DLD_TEST_CHECK( kIOReturnSuccess == DldStressUnHookedObjectHooker::fUnHookObject( objects[ slot ], DldHookTypeObject, DldInheritanceDepth_0 ) );
+            objects[ slot ]->release();
+        }
+    }// end for
+
+    __atomic_store_n( &context->WriterDone, true, __ATOMIC_RELEASE );
+    return NULL;
+}
+
+static
+void*
+DldStressCallReaderRoutine(
+    __in void* parameter
+    )
+{
+    DldStressReader*   reader = (DldStressReader*)parameter;
+    DldStressContext*  context = reader->Context;
+
+    while( !__atomic_load_n( &context->WriterDone, __ATOMIC_ACQUIRE ) ){
+
+        DLD_TEST_CHECK( 0x2 + DLD_TEST_HOOK_INCREMENT == context->Object->testMethod( 0x1 ) );
+        DLD_TEST_CHECK( 0x4 + DLD_TEST_HOOK_INCREMENT == context->DerivedObject->testMethod( 0x1 ) );
+
+        reader->Calls += 0x2;
+
+    }// end while
+
+    return NULL;
+}
+
+//--------------------------------------------------------------------
+
+static
+void
+DldStressRun(
+    __in DldStressContext* context,
+    __in void* (*writerRoutine)( void* ),
+    __in void* (*readerRoutine)( void* ),
+    __in const char* name
+    )
+{
+    DldStressReader  readers[ DLD_STRESS_READERS ];
+    pthread_t        writer;
+    uint64_t         reads = 0x0;
+    uint64_t         found = 0x0;
+    uint64_t         retries = 0x0;
+    uint64_t         calls = 0x0;
+
+    bzero( readers, sizeof( readers ) );
+    context->WriterDone = false;
+
+    for( unsigned int i = 0x0; i < DLD_STRESS_READERS; ++i ){
+
+        readers[ i ].Context = context;
+        readers[ i ].Index = i;
+        DLD_TEST_CHECK( 0x0 == pthread_create( &readers[ i ].Thread, NULL, readerRoutine, &readers[ i ] ) );
+    }// end for
+
+    DLD_TEST_CHECK( 0x0 == pthread_create( &writer, NULL, writerRoutine, context ) );
+    pthread_join( writer, NULL );
+
+    for( unsigned int i = 0x0; i < DLD_STRESS_READERS; ++i ){
+
+        pthread_join( readers[ i ].Thread, NULL );
+
+        reads += readers[ i ].Reads;
+        found += readers[ i ].Found;
+        retries += readers[ i ].Retries;
+        calls += readers[ i ].Calls;
+    }// end for
+
+    printf( "%s: reads %llu, found %llu, retries %llu, calls %llu\n", name,
+            (unsigned long long)reads, (unsigned long long)found,
+            (unsigned long long)retries, (unsigned long long)calls );
+}
+
+//--------------------------------------------------------------------
+
+int
+main( int argc, char* argv[] )
+{
+    DldStressContext*  context = &gStressContext;
+
+    DLD_TEST_CHECK( DldHookedObjectsHashTable::CreateStaticTableWithSize( 0x10, false ) );
+
+    DldStressRun( context, DldStressTableWriterRoutine, DldStressTableReaderRoutine, "table" );
+
+    context->Object = new DldTestService;
+    context->DerivedObject = new DldTestServiceLevel2;
+
+    DLD_TEST_CHECK( kIOReturnSuccess == DldStressVtableHooker::fHookObject( context->Object, DldHookTypeVtable ) );
+    DLD_TEST_CHECK( kIOReturnSuccess == DldStressVtableHooker2::fHookObject( context->DerivedObject, DldHookTypeVtable ) );
+
+    DldStressRun( context, DldStressHookWriterRoutine, DldStressCallReaderRoutine, "calls" );
+
+    DLD_TEST_CHECK( kIOReturnSuccess == DldStressVtableHooker::fUnHookObject( context->Object, DldHookTypeVtable, DldInheritanceDepth_0 ) );
+    DLD_TEST_CHECK( kIOReturnSuccess == DldStressVtableHooker2::fUnHookObject( context->DerivedObject, DldHookTypeVtable, DldInheritanceDepth_2 ) );
+
+    context->Object->release();
+    context->DerivedObject->release();
+
+    DLD_TEST_PASSED( "DldSeqlockStressTest" );
+}
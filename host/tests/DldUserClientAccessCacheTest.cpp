@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include "DldUserClientAccessCache.h"
+#include "DldHostTest.h"
+
+//
+// checks that a cached decision is not returned after the client has been
+// invalidated, including the decision made by a call that was in flight
+// and the decision for a new client allocated at the freed client's address
+//
+
+//
+// the cache never dereferences the client and task addresses
+//
+#define DLD_TEST_TASK    ((task_t)0x1000)
+
+//--------------------------------------------------------------------
+
+static
+void
+DldTestLookup()
+{
+    IOUserClient*  client = (IOUserClient*)0x345670;
+    IOReturn       decision;
+
+    DLD_TEST_CHECK( !DldUserClientAccessCache::LookupDecision( client, DLD_TEST_TASK, &decision ) );
+
+    DldUserClientAccessCache::SaveDecision( client,
+                                            DLD_TEST_TASK,
+                                            DldUserClientAccessCache::GetPolicyGeneration(),
+                                            DldUserClientAccessCache::GetClientGeneration( client ),
+                                            kIOReturnNotPermitted );
+
+    DLD_TEST_CHECK( DldUserClientAccessCache::LookupDecision( client, DLD_TEST_TASK, &decision ) );
+    DLD_TEST_CHECK( kIOReturnNotPermitted == decision );
+    DLD_TEST_CHECK( !DldUserClientAccessCache::LookupDecision( client, (task_t)0x2000, &decision ) );
+
+    DldUserClientAccessCache::PolicyChanged();
+    DLD_TEST_CHECK( !DldUserClientAccessCache::LookupDecision( client, DLD_TEST_TASK, &decision ) );
+}
+
+//--------------------------------------------------------------------
+
+static
+void
+DldTestInFlightDecision()
+{
+    IOUserClient*  client = (IOUserClient*)0x234560;
+    IOReturn       decision;
+    UInt32         generation;
+    UInt32         clientGeneration;
+
+    //
+    // the call reads the generations, then the client is closed
+    // and only after this the call saves its decision
+    //
+    generation = DldUserClientAccessCache::GetPolicyGeneration();
+    clientGeneration = DldUserClientAccessCache::GetClientGeneration( client );
+
+    DldUserClientAccessCache::InvalidateClient( client );
+
+    DldUserClientAccessCache::SaveDecision( client, DLD_TEST_TASK, generation, clientGeneration, kIOReturnSuccess );
+    DLD_TEST_CHECK( !DldUserClientAccessCache::LookupDecision( client, DLD_TEST_TASK, &decision ) );
+}
+
+//--------------------------------------------------------------------
+
+static
+void
+DldTestReusedAddress()
+{
+    IOUserClient*  client = (IOUserClient*)0x123450;
+    IOReturn       decision;
+
+    //
+    // the first client is freed and a new one is allocated at the same address
+    //
+    DldUserClientAccessCache::SaveDecision( client,
+                                            DLD_TEST_TASK,
+                                            DldUserClientAccessCache::GetPolicyGeneration(),
+                                            DldUserClientAccessCache::GetClientGeneration( client ),
+                                            kIOReturnSuccess );
+    DLD_TEST_CHECK( DldUserClientAccessCache::LookupDecision( client, DLD_TEST_TASK, &decision ) );
+
+    DldUserClientAccessCache::InvalidateClient( client );
+
+    DLD_TEST_CHECK( !DldUserClientAccessCache::LookupDecision( client, DLD_TEST_TASK, &decision ) );
+}
+
+//--------------------------------------------------------------------
+
+int
+main( int argc, char* argv[] )
+{
+    DldTestLookup();
+    DldTestInFlightDecision();
+    DldTestReusedAddress();
+
+    DLD_TEST_PASSED( "DldUserClientAccessCacheTest" );
+}
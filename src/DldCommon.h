@@ -5,13 +5,73 @@
 #ifndef _DLDCOMMON_H
 #define _DLDCOMMON_H
 
-#include <IOKit/IOLib.h>
-#include <libkern/OSAtomic.h>
+#if defined(DLD_HOST_BUILD)
+    #include "DldHostKernel.h"
+#else
+    #include <IOKit/IOLib.h>
+    #include <libkern/OSAtomic.h>
+#endif//DLD_HOST_BUILD
 
 #ifdef DEBUG
     #define DBG
 #endif
 
+//
+// DLD_HOST_BUILD - the hooker's core is compiled as a user space library,
+// the IOKit, libkern and BSD stand-ins, i.e. OSObject, OSMetaClass, IORWLock*,
+// IOMalloc/IOFree, IOMallocAligned/IOFreeAligned, IOLog, mac_kalloc/mac_kfree,
+// cpu_number, ml_get_max_cpus and ml_set_interrupts_enabled, are declared
+// in host/include/DldHostKernel.h which also forwards the kernel headers,
+// cpu_number returns a slot unique for the calling thread as the lock free
+// readers rely on it, the vtables' pages are made writable instead of writing
+// through the physical memory mapping, see DldWriteWiredSrcToWiredDst(),
+// the build target, tests and benchmarks are in host/CMakeLists.txt
+//
+
+//
+// DLD_HOOK_STATS - the hookers count the original function lookups made by
+// the hooking functions and accumulate the time spent for them, i.e. the
+// hooker's tax per hooked call, see DldHookerCommonClass::GetCallStatistics(),
+// the hooked objects hash table collects its lock wait and hold times and
+// the peak number of entries, see DldHookedObjectsHashTable::GetStatistics()
+//
+
+//
+// DLD_HOOK_REPLICAS - the CPUs share a read only copy of the vtable entries,
+// i.e. the ( vtable, meta class, depth ) to DldHookedFunctionInfo* mapping,
+// the copy is withdrawn when a vtable entry has been added or removed and
+// a new one is built and published after the exclusive lock has been released,
+// the hooked calls look up the copy, see DldHookedObjectsHashTable::RebuildReplica()
+//
+
+//
+// DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES - the direct vtable hooks do not add
+// an entry per hooked object, the vtable entry counts the objects, the count
+// is changed with atomic operations in the lock free read section and the
+// exclusive lock is taken only to hook a new vtable or to unhook the vtable
+// when its last object is unhooked, a hooker keeps a table of its hooked
+// objects with their vtables, so a double hook is not counted, an object
+// which has not been hooked is not unhooked and an object which vtable has
+// been replaced is unhooked under the lock by the vtable it was hooked with,
+// see DldHookerCommonClass::ReferenceVtableLockFree()
+//
+
+//
+// DLD_HOOK_INTRUSIVE_ENTRIES - the per object entries embed their hash table
+// linkage and the table compares their keys in place, a hooked object costs
+// a single allocation instead of the entry and the hash table entry with
+// a copy of the key, the vtable entries are not affected as they are added
+// with two keys, see DldHookedObjectEntry::HashLink
+//
+
+//
+// DLD_HOOK_FILTER - the hooked objects table is fronted by a counting Bloom
+// filter of its keys, a lookup of a key which is not in the filter returns
+// without hashing the key by the table's hash function and searching a bucket,
+// the filter is changed by the writers and read without atomic operations
+// as the writers drain the readers, see DldHookedObjectsHashTable::FilterMayContain()
+//
+
 #if !defined(__i386__) && !defined(__x86_64__)
     #error "Unsupported architecture"
 #endif
@@ -299,6 +359,25 @@ AppendTailList(
 
 //--------------------------------------------------------------------
 
+//
+// x86 doesn't reorder loads with other loads and stores with other stores,
+// so for the lock free readers it is enough to prevent the compiler from
+// reordering the memory accesses, the full fence is for store-load ordering
+//
+#define DldCompilerBarrier()   do{ __asm__ __volatile__( "" ::: "memory" ); }while(0);
+#define DldMemoryBarrier()     do{ __asm__ __volatile__( "mfence" ::: "memory" ); }while(0);
+#if defined(DLD_HOST_BUILD)
+//
+// the host's threads are preempted in the sections which the kernel runs
+// with the interrupts disabled, so a waiter gives the CPU to the thread it waits for
+//
+#define DldCpuPause()          do{ usleep( 1 ); }while(0);
+#else
+#define DldCpuPause()          do{ __asm__ __volatile__( "pause" ::: "memory" ); }while(0);
+#endif//DLD_HOST_BUILD
+
+//--------------------------------------------------------------------
+
 #ifndef OSCompareAndSwapPtr
     /*
      10.5 SDK doesn't define OSCompareAndSwapPtr, so this is an easy way to find that this is a 10.5 compilation,
@@ -23,26 +23,42 @@ __END_DECLS
 #define FLAGS_NORMAL   0 /* Normal item. All user-inserted stuff is normal */
 #define FLAGS_INTERNAL 1 /* The item is internal to the hash table */
 
+/* The maximum number of buckets in a bucket page, a power of two */
+#define GHT_PAGE_BUCKETS ( PAGE_SIZE / sizeof(ght_hash_bucket_t) )
+
+/* A hint to bring the memory at p to the caches, the access does not fault */
+#define ght_prefetch(p) __builtin_prefetch( (const void*)(p) )
+
+/* The size of an allocated entry without the key, the key follows the entry */
+#define GHT_ENTRY_HEADER_SIZE(p_ht) ( (p_ht)->b_ordered? sizeof(ght_hash_entry_t) : offsetof(ght_hash_entry_t, p_older) )
+
 /* Prototypes */
-static inline void              transpose(ght_hash_table_t *p_ht, ght_uint32_t l_bucket, ght_hash_entry_t *p_entry);
-static inline void              move_to_front(ght_hash_table_t *p_ht, ght_uint32_t l_bucket, ght_hash_entry_t *p_entry);
+static inline void              transpose(ght_hash_bucket_t *p_bucket, ght_hash_entry_t *p_entry);
+static inline void              move_to_front(ght_hash_bucket_t *p_bucket, ght_hash_entry_t *p_entry);
 static inline void              free_entry_chain(ght_hash_table_t *p_ht, ght_hash_entry_t *p_entry);
 
 #if !defined( DBG )
 static inline
 #endif//!DBG
-ght_hash_entry_t *search_in_bucket(ght_hash_table_t *p_ht, ght_uint32_t l_bucket, ght_hash_key_t *p_key, unsigned char i_heuristics);
+ght_hash_entry_t *search_in_bucket(ght_hash_table_t *p_ht, ght_hash_bucket_t *p_bucket, ght_hash_key_t *p_key, unsigned char i_heuristics);
 
 static inline void              hk_fill(ght_hash_key_t *p_hk, int i_size, const void *p_key);
-static inline ght_hash_entry_t *he_create(ght_hash_table_t *p_ht, void *p_data, unsigned int i_key_size, const void *p_key_data);
+static inline ght_hash_entry_t *he_create(ght_hash_table_t *p_ht, ght_hash_entry_t *p_intrusive, void *p_data, unsigned int i_key_size, const void *p_key_data);
 static inline void              he_finalize(ght_hash_table_t *p_ht, ght_hash_entry_t *p_he);
 
+static ght_hash_buckets_t      *buckets_create(unsigned int i_size, bool non_block);
+static void                     buckets_finalize(ght_hash_table_t *p_ht, ght_hash_buckets_t *p_buckets, bool free_entries);
+static void                     migrate_buckets(ght_hash_table_t *p_ht, unsigned int i_steps);
+
+static inline ght_hash_entry_t *iterator_first(ght_hash_table_t *p_ht, ght_iterator_t *p_iterator);
+static inline ght_hash_entry_t *iterator_next(ght_hash_table_t *p_ht, ght_iterator_t *p_iterator);
+
 //--------------------------------------------------------------------
 
 /* --- private methods --- */
 
 /* Move p_entry one up in its list. */
-static inline void transpose(ght_hash_table_t *p_ht, ght_uint32_t l_bucket, ght_hash_entry_t *p_entry)
+static inline void transpose(ght_hash_bucket_t *p_bucket, ght_hash_entry_t *p_entry)
 {
     /*
      *  __    __    __    __
@@ -64,7 +80,7 @@ static inline void transpose(ght_hash_table_t *p_ht, ght_uint32_t l_bucket, ght_
         }
         else /* This element is now placed first */
         {
-            p_ht->pp_entries[l_bucket] = p_entry;
+            p_bucket->p_head = p_entry;
         }
         
         if (p_b)
@@ -84,7 +100,7 @@ static inline void transpose(ght_hash_table_t *p_ht, ght_uint32_t l_bucket, ght_
 //--------------------------------------------------------------------
 
 /* Move p_entry first */
-static inline void move_to_front(ght_hash_table_t *p_ht, ght_uint32_t l_bucket, ght_hash_entry_t *p_entry)
+static inline void move_to_front(ght_hash_bucket_t *p_bucket, ght_hash_entry_t *p_entry)
 {
     /*
      *  __    __    __
@@ -94,7 +110,7 @@ static inline void move_to_front(ght_hash_table_t *p_ht, ght_uint32_t l_bucket,
      *  __/   __    __
      * |X_|->|A_|->|B_|
      */
-    if (p_entry == p_ht->pp_entries[l_bucket])
+    if (p_entry == p_bucket->p_head)
     {
         return;
     }
@@ -107,15 +123,15 @@ static inline void move_to_front(ght_hash_table_t *p_ht, ght_uint32_t l_bucket,
     }
     
     /* Place p_entry first */
-    p_entry->p_next = p_ht->pp_entries[l_bucket];
+    p_entry->p_next = p_bucket->p_head;
     p_entry->p_prev = NULL;
-    p_ht->pp_entries[l_bucket]->p_prev = p_entry;
-    p_ht->pp_entries[l_bucket] = p_entry;
+    p_bucket->p_head->p_prev = p_entry;
+    p_bucket->p_head = p_entry;
 }
 
 //--------------------------------------------------------------------
 
-static inline void remove_from_chain(ght_hash_table_t *p_ht, ght_uint32_t l_bucket, ght_hash_entry_t *p)
+static inline void remove_from_chain(ght_hash_table_t *p_ht, ght_hash_bucket_t *p_bucket, ght_hash_entry_t *p)
 {
     if (p->p_prev)
     {
@@ -123,13 +139,18 @@ static inline void remove_from_chain(ght_hash_table_t *p_ht, ght_uint32_t l_buck
     }
     else /* first in list */
     {
-        p_ht->pp_entries[l_bucket] = p->p_next;
+        p_bucket->p_head = p->p_next;
     }
     if (p->p_next)
     {
         p->p_next->p_prev = p->p_prev;
     }
     
+    if (!p_ht->b_ordered)
+    {
+        return;
+    }
+    
     if (p->p_older)
     {
         p->p_older->p_newer = p->p_newer;
@@ -150,6 +171,105 @@ static inline void remove_from_chain(ght_hash_table_t *p_ht, ght_uint32_t l_buck
 
 //--------------------------------------------------------------------
 
+/* Place an entry first in the bucket's chain */
+static inline void link_to_bucket(ght_hash_bucket_t *p_bucket, ght_hash_entry_t *p_entry)
+{
+    p_entry->p_next = p_bucket->p_head;
+    p_entry->p_prev = NULL;
+    if (p_bucket->p_head)
+    {
+        p_bucket->p_head->p_prev = p_entry;
+    }
+    p_bucket->p_head = p_entry;
+}
+
+//--------------------------------------------------------------------
+
+/* Get a bucket, NULL is returned if the bucket's page has not been allocated */
+static inline
+ght_hash_bucket_t*
+bucket_get(
+    __in ght_hash_buckets_t *p_buckets,
+    __in ght_uint32_t l_bucket
+    )
+{
+    ght_hash_bucket_t *p_page;
+    
+    assert( l_bucket < p_buckets->i_size );
+    
+    p_page = p_buckets->pp_pages[ l_bucket >> p_buckets->i_page_shift ];
+    if( !p_page )
+        return NULL;
+    
+    return &p_page[ l_bucket & (p_buckets->i_page_buckets - 1) ];
+}
+
+//--------------------------------------------------------------------
+
+/* Get a bucket, the bucket's page is allocated if it has not been allocated yet */
+static
+ght_hash_bucket_t*
+bucket_get_alloc(
+    __in ght_hash_table_t *p_ht,
+    __in ght_hash_buckets_t *p_buckets,
+    __in ght_uint32_t l_bucket
+    )
+{
+    ght_hash_bucket_t **pp_page;
+    vm_size_t page_size;
+    
+    assert( l_bucket < p_buckets->i_size );
+    
+    pp_page = &p_buckets->pp_pages[ l_bucket >> p_buckets->i_page_shift ];
+    if( !(*pp_page) ){
+        
+        page_size = p_buckets->i_page_buckets*sizeof(ght_hash_bucket_t);
+        
+        *pp_page = (ght_hash_bucket_t*)mac_kalloc( page_size, p_ht->non_block? M_NOWAIT : M_WAITOK );
+        if( !(*pp_page) ){
+            
+            DBG_PRINT_ERROR( ( "bucket_get_alloc-> mac_kalloc( %d, %d ) failed\n",
+                               (int)page_size,
+                               p_ht->non_block? M_NOWAIT : M_WAITOK ) );
+            return NULL;
+        }
+        
+        memset( *pp_page, 0, page_size );
+        p_buckets->i_allocated_pages++;
+    }
+    
+    return &(*pp_page)[ l_bucket & (p_buckets->i_page_buckets - 1) ];
+}
+
+//--------------------------------------------------------------------
+
+/*
+ * Find the bucket array and the bucket index where an entry with the hash
+ * value is placed, the old buckets below i_migrated have been moved to the
+ * new bucket array
+ */
+static inline
+ght_hash_buckets_t*
+locate_bucket(
+    __in ght_hash_table_t *p_ht,
+    __in ght_uint32_t i_hash,
+    __out ght_uint32_t *p_l_bucket
+    )
+{
+    ght_hash_buckets_t *p_old = p_ht->p_old_buckets;
+    
+    if( p_old && (i_hash & p_old->i_size_mask) >= p_ht->i_migrated ){
+        
+        *p_l_bucket = i_hash & p_old->i_size_mask;
+        return p_old;
+    }
+    
+    *p_l_bucket = i_hash & p_ht->p_buckets->i_size_mask;
+    return p_ht->p_buckets;
+}
+
+//--------------------------------------------------------------------
+
 /* Search for an element in a bucket */
 #if !defined( DBG )
 static inline
@@ -157,17 +277,21 @@ static inline
 ght_hash_entry_t*
 search_in_bucket(
     __in ght_hash_table_t *p_ht,
-    __in ght_uint32_t l_bucket,
+    __in ght_hash_bucket_t *p_bucket,
     __in ght_hash_key_t *p_key,
     __in unsigned char i_heuristics
     )
 {
     ght_hash_entry_t *p_e;
 #if defined( DBG )
-    int   entries = 0x0;
+    unsigned int   entries = 0x0;
 #endif//DBG
     
-    for (p_e = p_ht->pp_entries[l_bucket];
+    /* the bucket's page has not been allocated */
+    if( !p_bucket )
+        return NULL;
+    
+    for (p_e = p_bucket->p_head;
          p_e;
          p_e = p_e->p_next)
     {
@@ -184,10 +308,10 @@ search_in_bucket(
             switch (i_heuristics)
             {
                 case GHT_HEURISTICS_MOVE_TO_FRONT:
-                    move_to_front(p_ht, l_bucket, p_e);
+                    move_to_front(p_bucket, p_e);
                     break;
                 case GHT_HEURISTICS_TRANSPOSE:
-                    transpose(p_ht, l_bucket, p_e);
+                    transpose(p_bucket, p_e);
                     break;
                 default:
                     break;
@@ -201,7 +325,7 @@ search_in_bucket(
     }
     
 #if defined( DBG )
-    assert( entries == p_ht->p_nr[ l_bucket ] );
+    assert( entries == p_bucket->i_nr );
 #endif//DBG
     
     return NULL;
@@ -240,11 +364,12 @@ static inline void hk_fill(ght_hash_key_t *p_hk, int i_size, const void *p_key)
 
 //--------------------------------------------------------------------
 
-/* Create a hash entry */
+/* Create a hash entry, an intrusive entry is provided by the caller and only initialized */
 static inline
 ght_hash_entry_t*
 he_create(
     __in ght_hash_table_t *p_ht,
+    __in_opt ght_hash_entry_t *p_intrusive,
     __in void *p_data,
     __in unsigned int i_key_size,
     __in const void *p_key_data
@@ -264,13 +389,22 @@ he_create(
      * |____|___|________|
      *
      * That is, the key and the key data is stored "inline" within the
-     * hash entry.
+     * hash entry. The insertion order links are not allocated for
+     * a GHT_NO_INSERTION_ORDER table, so the key follows the size.
      *
      * This saves space since mac_kalloc only is called once and thus avoids
      * some fragmentation. Thanks to Dru Lemley for this idea.
+     *
+     * An intrusive entry is embedded in the caller's data together with
+     * the key, the key is not copied and the entry is not freed, such
+     * an entry has zero size.
      */
-    size = sizeof(ght_hash_entry_t)+i_key_size;
-    if( !(p_he = (ght_hash_entry_t*)p_ht->fn_alloc( size, p_ht->non_block? M_NOWAIT :M_WAITOK ) ) )
+    size = p_intrusive? 0 : GHT_ENTRY_HEADER_SIZE(p_ht)+i_key_size;
+    if( p_intrusive )
+    {
+        p_he = p_intrusive;
+    }
+    else if( !(p_he = (ght_hash_entry_t*)p_ht->fn_alloc( size, p_ht->non_block? M_NOWAIT :M_WAITOK ) ) )
     {
         DBG_PRINT_ERROR( ( "p_he = p_ht->fn_alloc( %d, %d ) failed!\n", (int)size, p_ht->non_block? M_NOWAIT :M_WAITOK ) );
         
@@ -297,7 +431,8 @@ he_create(
     assert( p_he->key_shadow.p_key );
     if( !p_he->key_shadow.p_key ){
         
-        p_ht->fn_free( p_he, size );
+        if( size )
+            p_ht->fn_free( p_he, size );
         return NULL;
     }
     memcpy( (void*)p_he->key_shadow.p_key, p_key_data, i_key_size );
@@ -307,13 +442,24 @@ he_create(
     p_he->p_data  = p_data;
     p_he->p_next  = NULL;
     p_he->p_prev  = NULL;
-    p_he->p_older = NULL;
-    p_he->p_newer = NULL;
+    
+    if( p_ht->b_ordered )
+    {
+        p_he->p_older = NULL;
+        p_he->p_newer = NULL;
+    }
     
     /* Create the key */
     p_he->key.i_size = i_key_size;
-    memcpy(p_he+1, p_key_data, i_key_size);
-    p_he->key.p_key = (void*)(p_he+1);
+    if( size )
+    {
+        p_he->key.p_key = (char*)p_he + GHT_ENTRY_HEADER_SIZE(p_ht);
+        memcpy((void*)p_he->key.p_key, p_key_data, i_key_size);
+    }
+    else
+    {
+        p_he->key.p_key = p_key_data;
+    }
     
     return p_he;
 }
@@ -329,8 +475,11 @@ static inline void he_finalize(ght_hash_table_t *p_ht, ght_hash_entry_t *p_he)
 #if defined(DBG)
     p_he->p_next = NULL;
     p_he->p_prev = NULL;
-    p_he->p_older = NULL;
-    p_he->p_newer = NULL;
+    if( p_ht->b_ordered )
+    {
+        p_he->p_older = NULL;
+        p_he->p_newer = NULL;
+    }
 #endif /* DBG */
     
 #if defined( DBG )
@@ -340,8 +489,9 @@ static inline void he_finalize(ght_hash_table_t *p_ht, ght_hash_entry_t *p_he)
     }
 #endif//DBG
     
-    /* Free the entry */
-    p_ht->fn_free( p_he, p_he->size );
+    /* Free the entry, an intrusive entry is owned by the caller */
+    if( p_he->size )
+        p_ht->fn_free( p_he, p_he->size );
 }
 
 //--------------------------------------------------------------------
@@ -376,16 +526,235 @@ static inline ght_uint32_t get_hash_value(ght_hash_table_t *p_ht, ght_hash_key_t
 
 //--------------------------------------------------------------------
 
+/* Create a bucket array, only the page directory is allocated */
+static
+ght_hash_buckets_t*
+buckets_create(
+    __in unsigned int i_size,
+    __in bool non_block
+    )
+{
+    ght_hash_buckets_t *p_buckets;
+    int i=1;
+    
+    assert( 0x0 == ( GHT_PAGE_BUCKETS & ( GHT_PAGE_BUCKETS - 1 ) ) );
+    
+    if ( !(p_buckets = (ght_hash_buckets_t*)mac_kalloc( sizeof(ght_hash_buckets_t), non_block? M_NOWAIT : M_WAITOK )) )
+    {
+        DBG_PRINT_ERROR( ( "buckets_create-> p_buckets = mac_kalloc( %d, %d ) failed\n",
+                           (int)sizeof(ght_hash_buckets_t),
+                           non_block? M_NOWAIT : M_WAITOK ) );
+        return NULL;
+    }
+    
+    /* Set the size of the hash table to the nearest 2^i higher then i_size */
+    p_buckets->i_size = 1;
+    while(p_buckets->i_size < i_size)
+    {
+        p_buckets->i_size = 1<<i++;
+    }
+    
+    p_buckets->i_size_mask = p_buckets->i_size - 1; /* Mask to & with */
+    
+    /* A small table gets a single page of the table's size */
+    p_buckets->i_page_buckets = ( p_buckets->i_size < GHT_PAGE_BUCKETS )? p_buckets->i_size : (unsigned int)GHT_PAGE_BUCKETS;
+    p_buckets->i_page_shift = 0;
+    while( (1u << p_buckets->i_page_shift) < p_buckets->i_page_buckets )
+    {
+        p_buckets->i_page_shift++;
+    }
+    
+    p_buckets->i_pages = p_buckets->i_size / p_buckets->i_page_buckets;
+    p_buckets->i_allocated_pages = 0;
+    
+    if ( !(p_buckets->pp_pages = (ght_hash_bucket_t**)mac_kalloc( p_buckets->i_pages*sizeof(ght_hash_bucket_t*), non_block? M_NOWAIT : M_WAITOK )) )
+    {
+        DBG_PRINT_ERROR( ( "buckets_create-> p_buckets->pp_pages = mac_kalloc( %d, %d ) failed\n",
+                           (int)(p_buckets->i_pages*sizeof(ght_hash_bucket_t*)),
+                           non_block? M_NOWAIT : M_WAITOK ) );
+        mac_kfree( p_buckets, sizeof(ght_hash_buckets_t) );
+        return NULL;
+    }
+    memset( p_buckets->pp_pages, 0, p_buckets->i_pages*sizeof(ght_hash_bucket_t*) );
+    
+    return p_buckets;
+}
+
+//--------------------------------------------------------------------
+
+/* Free a bucket array, the entries are freed if free_entries is TRUE */
+static
+void
+buckets_finalize(
+    __in ght_hash_table_t *p_ht,
+    __in ght_hash_buckets_t *p_buckets,
+    __in bool free_entries
+    )
+{
+    unsigned int i;
+    unsigned int j;
+    
+    for( i = 0; i < p_buckets->i_pages; i++ )
+    {
+        ght_hash_bucket_t *p_page = p_buckets->pp_pages[i];
+        
+        /* a page which has not been allocated has no entries */
+        if( p_page )
+        {
+            if( free_entries )
+            {
+                for( j = 0; j < p_buckets->i_page_buckets; j++ )
+                {
+                    free_entry_chain( p_ht, p_page[j].p_head );
+                    p_page[j].p_head = NULL;
+                }
+            }
+            
+            mac_kfree( p_page, p_buckets->i_page_buckets*sizeof(ght_hash_bucket_t) );
+            p_buckets->pp_pages[i] = NULL;
+        }
+    }
+    
+    mac_kfree( p_buckets->pp_pages, p_buckets->i_pages*sizeof(ght_hash_bucket_t*) );
+    mac_kfree( p_buckets, sizeof(ght_hash_buckets_t) );
+}
+
+//--------------------------------------------------------------------
+
+/*
+ * Move the entries of an old bucket to the new bucket array. The pages
+ * for the new buckets are allocated before any entry is moved so the
+ * bucket is either migrated entirely or left intact on a failure.
+ */
+static
+bool
+migrate_bucket(
+    __in ght_hash_table_t *p_ht,
+    __in ght_hash_bucket_t *p_old_bucket
+    )
+{
+    ght_hash_buckets_t *p_new = p_ht->p_buckets;
+    ght_hash_entry_t *p_e;
+    
+    for( p_e = p_old_bucket->p_head; p_e; p_e = p_e->p_next )
+    {
+        if( !bucket_get_alloc( p_ht, p_new, get_hash_value(p_ht, &p_e->key) & p_new->i_size_mask ) )
+            return false;
+    }
+    
+    while( (p_e = p_old_bucket->p_head) )
+    {
+        ght_hash_bucket_t *p_new_bucket = bucket_get( p_new, get_hash_value(p_ht, &p_e->key) & p_new->i_size_mask );
+        
+        assert( p_new_bucket );
+        
+        p_old_bucket->p_head = p_e->p_next;
+        p_old_bucket->i_nr--;
+        
+        link_to_bucket( p_new_bucket, p_e );
+        p_new_bucket->i_nr++;
+    }
+    
+    assert( 0 == p_old_bucket->i_nr );
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+/*
+ * Migrate up to i_steps old buckets, a page which has not been allocated
+ * has no entries and is skipped as a single step, the pages of the
+ * migrated buckets are freed, the old bucket array is freed when all
+ * of its buckets have been migrated
+ */
+static
+void
+migrate_buckets(
+    __in ght_hash_table_t *p_ht,
+    __in unsigned int i_steps
+    )
+{
+    ght_hash_buckets_t *p_old = p_ht->p_old_buckets;
+    
+    assert( p_old );
+    
+    while( i_steps && p_ht->i_migrated < p_old->i_size )
+    {
+        unsigned int       i_page = p_ht->i_migrated >> p_old->i_page_shift;
+        ght_hash_bucket_t *p_page = p_old->pp_pages[i_page];
+        
+        --i_steps;
+        
+        if( p_page )
+        {
+            if( !migrate_bucket( p_ht, &p_page[ p_ht->i_migrated & (p_old->i_page_buckets - 1) ] ) )
+            {
+                /* try again on the next insertion or removal */
+                return;
+            }
+            
+            p_ht->i_migrated++;
+            
+            if( 0 == ( p_ht->i_migrated & (p_old->i_page_buckets - 1) ) )
+            {
+                /* the page has been migrated */
+                mac_kfree( p_page, p_old->i_page_buckets*sizeof(ght_hash_bucket_t) );
+                p_old->pp_pages[i_page] = NULL;
+                p_old->i_allocated_pages--;
+            }
+        }
+        else
+        {
+            p_ht->i_migrated = (i_page + 1) << p_old->i_page_shift;
+        }
+    }
+    
+    if( p_ht->i_migrated == p_old->i_size )
+    {
+        buckets_finalize( p_ht, p_old, FALSE );
+        p_ht->p_old_buckets = NULL;
+        p_ht->i_migrated = 0;
+    }
+}
+
+//--------------------------------------------------------------------
+
+/* Start a migration to a bucket array of the new size */
+static
+bool
+start_migration(
+    __in ght_hash_table_t *p_ht,
+    __in unsigned int i_size
+    )
+{
+    ght_hash_buckets_t *p_new;
+    
+    assert( !p_ht->p_old_buckets );
+    
+    p_new = buckets_create( i_size, p_ht->non_block );
+    if( !p_new )
+        return false;
+    
+    p_ht->p_old_buckets = p_ht->p_buckets;
+    p_ht->p_buckets = p_new;
+    p_ht->i_migrated = 0;
+    p_ht->i_size = p_new->i_size;
+    
+    return true;
+}
+
+//--------------------------------------------------------------------
+
 /* --- Exported methods --- */
 /* Create a new hash table */
 ght_hash_table_t*
 ght_create(
     __in unsigned int i_size,
-    __in bool   non_block
+    __in bool   non_block,
+    __in unsigned int i_flags
     )
 {
     ght_hash_table_t *p_ht;
-    int i=1;
     
     assert( non_block || preemption_enabled() );
      
@@ -397,14 +766,6 @@ ght_create(
         return NULL;
     }
     
-    /* Set the size of the hash table to the nearest 2^i higher then i_size */
-    p_ht->i_size = 1;
-    while(p_ht->i_size < i_size)
-    {
-        p_ht->i_size = 1<<i++;
-    }
-    
-    p_ht->i_size_mask = (1<<(i-1))-1; /* Mask to & with */
     p_ht->i_items = 0;
     
     p_ht->fn_hash = ght_one_at_a_time_hash;
@@ -421,31 +782,18 @@ ght_create(
     p_ht->fn_bucket_free = NULL;
     
     p_ht->non_block = non_block;
+    p_ht->b_ordered = !(i_flags & GHT_NO_INSERTION_ORDER);
     
-    /* Create an empty bucket list. */
-    if ( !(p_ht->pp_entries = (ght_hash_entry_t**)mac_kalloc( p_ht->i_size*sizeof(ght_hash_entry_t*), non_block? M_NOWAIT : M_WAITOK ) ) )
+    /* Create an empty bucket array, the bucket pages are allocated on insertion */
+    if ( !(p_ht->p_buckets = buckets_create( i_size, non_block )) )
     {
-        DBG_PRINT_ERROR( ( "ght_create-> p_ht->pp_entries = mac_kalloc( %d, %d ) failed\n",
-                           (int)(p_ht->i_size*sizeof(ght_hash_entry_t*)),
-                           non_block? M_NOWAIT : M_WAITOK ) );
-        mac_kfree( p_ht, sizeof(ght_hash_table_t) );
-        return NULL;
-    }
-    memset(p_ht->pp_entries, 0, p_ht->i_size*sizeof(ght_hash_entry_t*));
-    
-    /* Initialise the number of entries in each bucket to zero */
-    if ( !(p_ht->p_nr = (int*)mac_kalloc( p_ht->i_size*sizeof(int), non_block? M_NOWAIT : M_WAITOK ) ) )
-    {
-        DBG_PRINT_ERROR( ( "ght_create-> p_ht->p_nr = mac_kalloc( %d, %d ) failed\n",
-                           (int)(p_ht->i_size*sizeof(int)),
-                           non_block? M_NOWAIT : M_WAITOK ) );
-
-        mac_kfree( p_ht->pp_entries, p_ht->i_size*sizeof(ght_hash_entry_t*) );
         mac_kfree( p_ht, sizeof(ght_hash_table_t) );
         return NULL;
     }
     
-    memset( p_ht->p_nr, 0, p_ht->i_size*sizeof(int) );
+    p_ht->i_size = p_ht->p_buckets->i_size;
+    p_ht->p_old_buckets = NULL;
+    p_ht->i_migrated = 0;
     
     p_ht->p_oldest = NULL;
     p_ht->p_newest = NULL;
@@ -517,55 +865,124 @@ unsigned int ght_table_size(ght_hash_table_t *p_ht)
 
 //--------------------------------------------------------------------
 
-/* Insert an entry into the hash table */
+static inline vm_size_t buckets_memory_usage(ght_hash_buckets_t *p_buckets)
+{
+    return sizeof(ght_hash_buckets_t) +
+           p_buckets->i_pages*sizeof(ght_hash_bucket_t*) +
+           p_buckets->i_allocated_pages*p_buckets->i_page_buckets*sizeof(ght_hash_bucket_t);
+}
+
+//--------------------------------------------------------------------
+
+/* Get the memory used by the hash table */
+void
+ght_memory_usage(
+    __in ght_hash_table_t *p_ht,
+    __out vm_size_t *p_table_bytes,
+    __out vm_size_t *p_entries_bytes
+    )
+{
+    ght_iterator_t iterator;
+    ght_hash_entry_t *p_e;
+    vm_size_t entries_bytes = 0;
+    
+    *p_table_bytes = sizeof(ght_hash_table_t) + buckets_memory_usage( p_ht->p_buckets );
+    if( p_ht->p_old_buckets )
+        *p_table_bytes += buckets_memory_usage( p_ht->p_old_buckets );
+    
+    /* the entries are allocated with the keys, see he_create(), the intrusive entries are the callers' memory */
+    for( p_e = iterator_first(p_ht, &iterator); p_e; p_e = iterator_next(p_ht, &iterator) ){
+        
+        entries_bytes += p_e->size;
+        
+#if defined( DBG )
+        entries_bytes += p_e->key_shadow.i_size;
+#endif//DBG
+    }
+    
+    *p_entries_bytes = entries_bytes;
+}
+
+//--------------------------------------------------------------------
+
+/*
+ * Hash the key once and either return the existing entry's data or insert
+ * a new entry, the new entry's data is p_entry_data or is provided by
+ * fn_compute if it is not NULL, the callback is called only when the key
+ * is absent and must not modify the table, the new entry is p_intrusive
+ * if it is not NULL
+ */
+static
 GHT_STATUS_CODE
-ght_insert(
+get_or_insert(
     __in ght_hash_table_t *p_ht,
-    __in void *p_entry_data,
+    __in_opt ght_hash_entry_t *p_intrusive,
+    __in_opt void *p_entry_data,
     __in unsigned int i_key_size,
-    __in const void *p_key_data
+    __in const void *p_key_data,
+    __in_opt ght_fn_compute_t fn_compute,
+    __in_opt void *p_context,
+    __out_opt void **pp_data
     )
 {
     ght_hash_entry_t *p_entry;
+    ght_hash_buckets_t *p_buckets;
+    ght_hash_bucket_t *p_bucket;
+    ght_uint32_t i_hash;
     ght_uint32_t l_key;
     ght_hash_key_t key;
     
     assert(p_ht);
     
+    /* Grow if the load factor is too high, the entries are moved by the following operations */
+    if( p_ht->i_automatic_rehash &&
+        !p_ht->p_old_buckets &&
+        p_ht->i_items >= GHT_MAX_LOAD_FACTOR*p_ht->i_size )
+    {
+        start_migration( p_ht, 2*p_ht->i_size );
+    }
+    
+    if( p_ht->p_old_buckets )
+        migrate_buckets( p_ht, GHT_MIGRATION_STEP );
+    
     hk_fill(&key, i_key_size, p_key_data);
-    l_key = get_hash_value(p_ht, &key) & p_ht->i_size_mask;
-    if (search_in_bucket(p_ht, l_key, &key, 0))
+    i_hash = get_hash_value(p_ht, &key);
+    p_buckets = locate_bucket(p_ht, i_hash, &l_key);
+    p_bucket = bucket_get(p_buckets, l_key);
+    if ((p_entry = search_in_bucket(p_ht, p_bucket, &key, 0)))
     {
         /* Don't insert if the key is already present. */
+        if (pp_data)
+            *pp_data = p_entry->p_data;
+        
         return GHT_ALREADY_IN_HASH;
     }
-    if (!(p_entry = he_create( p_ht, p_entry_data,
-                               i_key_size, p_key_data)))
+    
+    if (fn_compute && !(p_entry_data = fn_compute(p_context, p_key_data, i_key_size)))
     {
-        DBG_PRINT_ERROR( ( "ght_insert-> he_create failed\n" ) );
         return GHT_ERROR;
     }
     
-    /* Rehash if the number of items inserted is too high. */
-    if( p_ht->i_automatic_rehash && ( p_ht->i_items > 2*p_ht->i_size ) )
+    if (!(p_entry = he_create( p_ht, p_intrusive, p_entry_data,
+                               i_key_size, p_key_data)))
     {
-        ght_rehash( p_ht, 2*p_ht->i_size );
-        /* Recalculate l_key after ght_rehash has updated i_size_mask */
-        l_key = get_hash_value(p_ht, &key) & p_ht->i_size_mask;
+        DBG_PRINT_ERROR( ( "get_or_insert-> he_create failed\n" ) );
+        return GHT_ERROR;
     }
     
-    /* Place the entry first in the list. */
-    p_entry->p_next = p_ht->pp_entries[l_key];
-    p_entry->p_prev = NULL;
-    if (p_ht->pp_entries[l_key])
+    if (!p_bucket && !(p_bucket = bucket_get_alloc(p_ht, p_buckets, l_key)))
     {
-        p_ht->pp_entries[l_key]->p_prev = p_entry;
+        DBG_PRINT_ERROR( ( "get_or_insert-> bucket_get_alloc failed\n" ) );
+        he_finalize( p_ht, p_entry );
+        return GHT_ERROR;
     }
-    p_ht->pp_entries[l_key] = p_entry;
+    
+    /* Place the entry first in the list. */
+    link_to_bucket( p_bucket, p_entry );
     
     /* If this is a limited bucket hash table, potentially remove the last item */
     if( p_ht->bucket_limit != 0 &&
-        p_ht->p_nr[l_key] >= p_ht->bucket_limit)
+        p_bucket->i_nr >= p_ht->bucket_limit)
     {
         ght_hash_entry_t *p;
         
@@ -573,44 +990,116 @@ ght_insert(
          *
          * FIXME: Better with a pointer to the last entry
          */
-        for (p = p_ht->pp_entries[l_key];
+        for (p = p_bucket->p_head;
              p->p_next != NULL;
              p = p->p_next);
         
         assert(p && p->p_next == NULL);
         
-        remove_from_chain(p_ht, l_key, p); /* To allow it to be reinserted in fn_bucket_free */
+        remove_from_chain(p_ht, p_bucket, p); /* To allow it to be reinserted in fn_bucket_free */
         p_ht->fn_bucket_free(p->p_data, p->key.p_key);
         
         he_finalize( p_ht, p );
     }
     else
     {
-        p_ht->p_nr[l_key]++;
+        p_bucket->i_nr++;
         
-        assert( p_ht->pp_entries[l_key]?p_ht->pp_entries[l_key]->p_prev == NULL:1 );
+        assert( p_bucket->p_head?p_bucket->p_head->p_prev == NULL:1 );
         
         p_ht->i_items++;
     }
     
-    if (p_ht->p_oldest == NULL)
-    {
-        p_ht->p_oldest = p_entry;
-    }
-    p_entry->p_older = p_ht->p_newest;
-    
-    if (p_ht->p_newest != NULL)
+    if (p_ht->b_ordered)
     {
-        p_ht->p_newest->p_newer = p_entry;
+        if (p_ht->p_oldest == NULL)
+        {
+            p_ht->p_oldest = p_entry;
+        }
+        p_entry->p_older = p_ht->p_newest;
+        
+        if (p_ht->p_newest != NULL)
+        {
+            p_ht->p_newest->p_newer = p_entry;
+        }
+        
+        p_ht->p_newest = p_entry;
     }
     
-    p_ht->p_newest = p_entry;
+    if (pp_data)
+        *pp_data = p_entry_data;
     
     return GHT_OK;
 }
 
 //--------------------------------------------------------------------
 
+/* Insert an entry into the hash table */
+GHT_STATUS_CODE
+ght_insert(
+    __in ght_hash_table_t *p_ht,
+    __in void *p_entry_data,
+    __in unsigned int i_key_size,
+    __in const void *p_key_data
+    )
+{
+    return get_or_insert( p_ht, NULL, p_entry_data, i_key_size, p_key_data, NULL, NULL, NULL );
+}
+
+//--------------------------------------------------------------------
+
+/* Insert an entry provided by the caller, the key is not copied */
+GHT_STATUS_CODE
+ght_insert_intrusive(
+    __in ght_hash_table_t *p_ht,
+    __in ght_hash_entry_t *p_he,
+    __in void *p_entry_data,
+    __in unsigned int i_key_size,
+    __in const void *p_key_data
+    )
+{
+    assert( p_he );
+    
+    return get_or_insert( p_ht, p_he, p_entry_data, i_key_size, p_key_data, NULL, NULL, NULL );
+}
+
+//--------------------------------------------------------------------
+
+/* Get an entry or insert it if the key is absent, the key is hashed once */
+GHT_STATUS_CODE
+ght_get_or_insert(
+    __in ght_hash_table_t *p_ht,
+    __in void *p_entry_data,
+    __in unsigned int i_key_size,
+    __in const void *p_key_data,
+    __out void **pp_data
+    )
+{
+    assert( pp_data );
+    
+    return get_or_insert( p_ht, NULL, p_entry_data, i_key_size, p_key_data, NULL, NULL, pp_data );
+}
+
+//--------------------------------------------------------------------
+
+/* Get an entry or insert the data provided by fn_compute if the key is absent */
+GHT_STATUS_CODE
+ght_compute_if_absent(
+    __in ght_hash_table_t *p_ht,
+    __in unsigned int i_key_size,
+    __in const void *p_key_data,
+    __in ght_fn_compute_t fn_compute,
+    __in_opt void *p_context,
+    __out void **pp_data
+    )
+{
+    assert( fn_compute && pp_data );
+    
+    return get_or_insert( p_ht, NULL, NULL, i_key_size, p_key_data, fn_compute, p_context, pp_data );
+}
+
+//--------------------------------------------------------------------
+
 /* Get an entry from the hash table. The entry is returned, or NULL if it wasn't found */
 void*
 ght_get(
@@ -620,6 +1109,8 @@ ght_get(
     )
 {
     ght_hash_entry_t *p_e;
+    ght_hash_buckets_t *p_buckets;
+    ght_hash_bucket_t *p_bucket;
     ght_hash_key_t key;
     ght_uint32_t l_key;
     
@@ -627,26 +1118,113 @@ ght_get(
     
     hk_fill(&key, i_key_size, p_key_data);
     
-    l_key = get_hash_value(p_ht, &key) & p_ht->i_size_mask;
+    p_buckets = locate_bucket(p_ht, get_hash_value(p_ht, &key), &l_key);
+    p_bucket = bucket_get(p_buckets, l_key);
     
     /* Check that the first element in the list really is the first. */
-    assert( p_ht->pp_entries[l_key]?p_ht->pp_entries[l_key]->p_prev == NULL:1 );
+    assert( (p_bucket && p_bucket->p_head)?p_bucket->p_head->p_prev == NULL:1 );
     
-    /* LOCK: p_ht->pp_entries[l_key] */
-    p_e = search_in_bucket(p_ht, l_key, &key, p_ht->i_heuristics);
-    /* UNLOCK: p_ht->pp_entries[l_key] */
+    /* LOCK: p_bucket */
+    p_e = search_in_bucket(p_ht, p_bucket, &key, p_ht->i_heuristics);
+    /* UNLOCK: p_bucket */
     
     return (p_e?p_e->p_data:NULL);
 }
 
 //--------------------------------------------------------------------
 
+/* Get an entry from the hash table without relinking it */
+void*
+ght_get_ro(
+    __in ght_hash_table_t *p_ht,
+    __in unsigned int i_key_size,
+    __in const void *p_key_data
+    )
+{
+    ght_hash_entry_t *p_e;
+    ght_hash_buckets_t *p_buckets;
+    ght_hash_key_t key;
+    ght_uint32_t l_key;
+    
+    assert(p_ht);
+    
+    hk_fill(&key, i_key_size, p_key_data);
+    
+    p_buckets = locate_bucket(p_ht, get_hash_value(p_ht, &key), &l_key);
+    
+    p_e = search_in_bucket(p_ht, bucket_get(p_buckets, l_key), &key, GHT_HEURISTICS_NONE);
+    
+    return (p_e?p_e->p_data:NULL);
+}
+
+//--------------------------------------------------------------------
+
+/* Get several entries, the keys of a batch are hashed and their buckets are prefetched first */
+void
+ght_get_many(
+    __in ght_hash_table_t *p_ht,
+    __in unsigned int i_key_size,
+    __in const void* const* pp_keys,
+    __in unsigned int i_count,
+    __out void** pp_data
+    )
+{
+    ght_hash_bucket_t *p_buckets[GHT_GET_MANY_BATCH];
+    unsigned int i_base;
+    unsigned int i_batch;
+    unsigned int i;
+    
+    assert(p_ht);
+    
+    for( i_base = 0; i_base < i_count; i_base += i_batch )
+    {
+        ght_hash_key_t key;
+        ght_uint32_t l_key;
+        
+        i_batch = ( i_count - i_base < GHT_GET_MANY_BATCH )? i_count - i_base : GHT_GET_MANY_BATCH;
+        
+        /* hash the keys and prefetch the buckets */
+        for( i = 0; i < i_batch; i++ )
+        {
+            ght_hash_buckets_t *p_array;
+            
+            hk_fill(&key, i_key_size, pp_keys[i_base + i]);
+            p_array = locate_bucket(p_ht, get_hash_value(p_ht, &key), &l_key);
+            p_buckets[i] = bucket_get(p_array, l_key);
+            if( p_buckets[i] )
+                ght_prefetch( p_buckets[i] );
+        }
+        
+        /* prefetch the first entries */
+        for( i = 0; i < i_batch; i++ )
+        {
+            if( p_buckets[i] && p_buckets[i]->p_head )
+                ght_prefetch( p_buckets[i]->p_head );
+        }
+        
+        /* search the buckets */
+        for( i = 0; i < i_batch; i++ )
+        {
+            ght_hash_entry_t *p_e;
+            
+            hk_fill(&key, i_key_size, pp_keys[i_base + i]);
+            p_e = search_in_bucket(p_ht, p_buckets[i], &key, GHT_HEURISTICS_NONE);
+            
+            pp_data[i_base + i] = p_e? p_e->p_data : NULL;
+        }
+    }
+}
+
+//--------------------------------------------------------------------
+
 /* Replace an entry from the hash table. The entry is returned, or NULL if it wasn't found */
 void *ght_replace(ght_hash_table_t *p_ht,
                   void *p_entry_data,
                   unsigned int i_key_size, const void *p_key_data)
 {
     ght_hash_entry_t *p_e;
+    ght_hash_buckets_t *p_buckets;
+    ght_hash_bucket_t *p_bucket;
     ght_hash_key_t key;
     ght_uint32_t l_key;
     void *p_old;
@@ -655,14 +1233,15 @@ void *ght_replace(ght_hash_table_t *p_ht,
     
     hk_fill(&key, i_key_size, p_key_data);
     
-    l_key = get_hash_value(p_ht, &key) & p_ht->i_size_mask;
+    p_buckets = locate_bucket(p_ht, get_hash_value(p_ht, &key), &l_key);
+    p_bucket = bucket_get(p_buckets, l_key);
     
     /* Check that the first element in the list really is the first. */
-    assert( p_ht->pp_entries[l_key]?p_ht->pp_entries[l_key]->p_prev == NULL:1 );
+    assert( (p_bucket && p_bucket->p_head)?p_bucket->p_head->p_prev == NULL:1 );
     
-    /* LOCK: p_ht->pp_entries[l_key] */
-    p_e = search_in_bucket(p_ht, l_key, &key, p_ht->i_heuristics);
-    /* UNLOCK: p_ht->pp_entries[l_key] */
+    /* LOCK: p_bucket */
+    p_e = search_in_bucket(p_ht, p_bucket, &key, p_ht->i_heuristics);
+    /* UNLOCK: p_bucket */
     
     if ( !p_e )
         return NULL;
@@ -681,31 +1260,37 @@ void *ght_remove(ght_hash_table_t *p_ht,
                  unsigned int i_key_size, const void *p_key_data)
 {
     ght_hash_entry_t *p_out;
+    ght_hash_buckets_t *p_buckets;
+    ght_hash_bucket_t *p_bucket;
     ght_hash_key_t key;
     ght_uint32_t l_key;
     void *p_ret=NULL;
     
     assert(p_ht);
     
+    if( p_ht->p_old_buckets )
+        migrate_buckets( p_ht, GHT_MIGRATION_STEP );
+    
     hk_fill(&key, i_key_size, p_key_data);
-    l_key = get_hash_value(p_ht, &key) & p_ht->i_size_mask;
+    p_buckets = locate_bucket(p_ht, get_hash_value(p_ht, &key), &l_key);
+    p_bucket = bucket_get(p_buckets, l_key);
     
     /* Check that the first element really is the first */
-    assert( (p_ht->pp_entries[l_key]?p_ht->pp_entries[l_key]->p_prev == NULL:1) );
+    assert( ((p_bucket && p_bucket->p_head)?p_bucket->p_head->p_prev == NULL:1) );
     
-    /* LOCK: p_ht->pp_entries[l_key] */
-    p_out = search_in_bucket(p_ht, l_key, &key, 0);
+    /* LOCK: p_bucket */
+    p_out = search_in_bucket(p_ht, p_bucket, &key, 0);
     
     /* Link p_out out of the list. */
     if (p_out)
     {
-        remove_from_chain(p_ht, l_key, p_out);
+        remove_from_chain(p_ht, p_bucket, p_out);
         
         /* This should ONLY be done for normal items (for now all items) */
         p_ht->i_items--;
         
-        p_ht->p_nr[l_key]--;
-        /* UNLOCK: p_ht->pp_entries[l_key] */
+        p_bucket->i_nr--;
+        /* UNLOCK: p_bucket */
 #if !defined(NDEBUG)
         p_out->p_next = NULL;
         p_out->p_prev = NULL;
@@ -714,23 +1299,107 @@ void *ght_remove(ght_hash_table_t *p_ht,
         p_ret = p_out->p_data;
         he_finalize(p_ht, p_out);
     }
-    /* else: UNLOCK: p_ht->pp_entries[l_key] */
+    /* else: UNLOCK: p_bucket */
     
     return p_ret;
 }
 
 //--------------------------------------------------------------------
 
+/*
+ * Get the head of the next non empty bucket of an iteration in the bucket order,
+ * the old buckets are walked first, the migrated ones are empty
+ */
+static
+ght_hash_entry_t*
+next_bucket_head(
+    __in ght_hash_table_t *p_ht,
+    __inout ght_iterator_t *p_iterator
+    )
+{
+    while( p_iterator->p_buckets )
+    {
+        ght_hash_buckets_t *p_buckets = p_iterator->p_buckets;
+        
+        while( p_iterator->i_bucket < p_buckets->i_size )
+        {
+            ght_hash_bucket_t *p_page = p_buckets->pp_pages[ p_iterator->i_bucket >> p_buckets->i_page_shift ];
+            
+            if( !p_page )
+            {
+                /* a page which has not been allocated has no entries */
+                p_iterator->i_bucket = ( (p_iterator->i_bucket >> p_buckets->i_page_shift) + 1 ) << p_buckets->i_page_shift;
+            }
+            else
+            {
+                ght_hash_entry_t *p_head = p_page[ p_iterator->i_bucket & (p_buckets->i_page_buckets - 1) ].p_head;
+                
+                p_iterator->i_bucket++;
+                if( p_head )
+                    return p_head;
+            }
+        }
+        
+        p_iterator->p_buckets = ( p_buckets == p_ht->p_old_buckets )? p_ht->p_buckets : NULL;
+        p_iterator->i_bucket = 0;
+    }
+    
+    return NULL;
+}
+
+//--------------------------------------------------------------------
+
+/* Get the entry following p_e in an iteration */
+static inline ght_hash_entry_t *iterator_successor(ght_hash_table_t *p_ht, ght_iterator_t *p_iterator, ght_hash_entry_t *p_e)
+{
+    if (p_ht->b_ordered)
+        return p_e->p_newer;
+    
+    return p_e->p_next? p_e->p_next : next_bucket_head(p_ht, p_iterator);
+}
+
+//--------------------------------------------------------------------
+
+/* Start an iteration, the first entry is returned */
+static inline ght_hash_entry_t *iterator_first(ght_hash_table_t *p_ht, ght_iterator_t *p_iterator)
+{
+    if (p_ht->b_ordered)
+    {
+        p_iterator->p_buckets = NULL;
+        p_iterator->p_entry = p_ht->p_oldest;
+    }
+    else
+    {
+        p_iterator->p_buckets = p_ht->p_old_buckets? p_ht->p_old_buckets : p_ht->p_buckets;
+        p_iterator->i_bucket = 0;
+        p_iterator->p_entry = next_bucket_head(p_ht, p_iterator);
+    }
+    
+    p_iterator->p_next = p_iterator->p_entry? iterator_successor(p_ht, p_iterator, p_iterator->p_entry) : NULL;
+    
+    return p_iterator->p_entry;
+}
+
+//--------------------------------------------------------------------
+
+/* Continue an iteration, the next entry is returned */
+static inline ght_hash_entry_t *iterator_next(ght_hash_table_t *p_ht, ght_iterator_t *p_iterator)
+{
+    p_iterator->p_entry = p_iterator->p_next;
+    p_iterator->p_next = p_iterator->p_entry? iterator_successor(p_ht, p_iterator, p_iterator->p_entry) : NULL;
+    
+    return p_iterator->p_entry;
+}
+
+//--------------------------------------------------------------------
+
 static inline void *first_keysize(ght_hash_table_t *p_ht, ght_iterator_t *p_iterator, const void **pp_key, unsigned int *size)
 {
     assert(p_ht && p_iterator);
     
     /* Fill the iterator */
-    p_iterator->p_entry = p_ht->p_oldest;
-    
-    if (p_iterator->p_entry)
+    if (iterator_first(p_ht, p_iterator))
     {
-        p_iterator->p_next = p_iterator->p_entry->p_newer;
         *pp_key = p_iterator->p_entry->key.p_key;
         if (size != NULL)
             *size = p_iterator->p_entry->key.i_size;
@@ -738,7 +1407,6 @@ static inline void *first_keysize(ght_hash_table_t *p_ht, ght_iterator_t *p_iter
         return p_iterator->p_entry->p_data;
     }
     
-    p_iterator->p_next = NULL;
     *pp_key = NULL;
     if (size != NULL)
         *size = 0;
@@ -767,12 +1435,9 @@ static inline void *next_keysize(ght_hash_table_t *p_ht, ght_iterator_t *p_itera
 {
     assert(p_ht && p_iterator);
     
-    if (p_iterator->p_next)
+    if (iterator_next(p_ht, p_iterator))
     {
         /* More entries */
-        p_iterator->p_entry = p_iterator->p_next;
-        p_iterator->p_next = p_iterator->p_next->p_newer;
-        
         *pp_key = p_iterator->p_entry->key.p_key;
         if (size != NULL)
             *size = p_iterator->p_entry->key.i_size;
@@ -781,9 +1446,6 @@ static inline void *next_keysize(ght_hash_table_t *p_ht, ght_iterator_t *p_itera
     }
     
     /* Last entry */
-    p_iterator->p_entry = NULL;
-    p_iterator->p_next = NULL;
-    
     *pp_key = NULL;
     if (size != NULL)
         *size = 0;
@@ -815,27 +1477,19 @@ ght_finalize(
     __in ght_hash_table_t *p_ht
     )
 {
-    int i;
-    
     assert(p_ht);
     
-    if (p_ht->pp_entries)
+    /* For each bucket, free all entries */
+    if (p_ht->p_old_buckets)
     {
-        /* For each bucket, free all entries */
-        for (i=0; i<p_ht->i_size; i++)
-        {
-            free_entry_chain( p_ht, p_ht->pp_entries[i] );
-            p_ht->pp_entries[i] = NULL;
-        }
-        
-        mac_kfree( p_ht->pp_entries, p_ht->i_size*sizeof(ght_hash_entry_t*) );
-        p_ht->pp_entries = NULL;
-        
+        buckets_finalize( p_ht, p_ht->p_old_buckets, TRUE );
+        p_ht->p_old_buckets = NULL;
     }
-    if (p_ht->p_nr)
+    
+    if (p_ht->p_buckets)
     {
-        mac_kfree( p_ht->p_nr, p_ht->i_size*sizeof(int) );
-        p_ht->p_nr = NULL;
+        buckets_finalize( p_ht, p_ht->p_buckets, TRUE );
+        p_ht->p_buckets = NULL;
     }
     
     mac_kfree( p_ht, sizeof(ght_hash_table_t) );
@@ -852,67 +1506,24 @@ ght_rehash(
     __in unsigned int i_size
     )
 {
-    ght_hash_table_t *p_tmp;
-    ght_iterator_t iterator;
-    const void *p_key;
-    void *p;
-    int i;
-    
     assert(p_ht);
     
-    /* Recreate the hash table with the new size */
-    p_tmp = ght_create(i_size, p_ht->non_block );
-    assert(p_tmp);
+    /* Complete a started migration */
+    if (p_ht->p_old_buckets)
+        migrate_buckets( p_ht, (unsigned int)(-1) );
     
-    /* Set the flags for the new hash table */
-    ght_set_hash(p_tmp, p_ht->fn_hash);
-    ght_set_alloc(p_tmp, p_ht->fn_alloc, p_ht->fn_free);
-    ght_set_heuristics(p_tmp, GHT_HEURISTICS_NONE);
-    ght_set_rehash(p_tmp, FALSE);
-    
-    /* Walk through all elements in the table and insert them into the temporary one. */
-    for (p = ght_first(p_ht, &iterator, &p_key); p; p = ght_next(p_ht, &iterator, &p_key))
+    if (p_ht->p_old_buckets || !start_migration( p_ht, i_size ))
     {
-        assert(iterator.p_entry);
-        
-        /* Insert the entry into the new table */
-        if (ght_insert(p_tmp,
-                       iterator.p_entry->p_data,
-                       iterator.p_entry->key.i_size, iterator.p_entry->key.p_key) < 0)
-        {
-            DBG_PRINT_ERROR( ( "DldCommonHashTable.cpp ERROR: Out of memory error or entry already in hash table\n"
-                                "when rehashing (internal error)\n" ) );
-        }
+        DBG_PRINT_ERROR( ( "DldCommonHashTable.cpp ERROR: Out of memory error when rehashing\n" ) );
+        return;
     }
     
-    /* Remove the old table... */
-    for (i=0; i<p_ht->i_size; i++)
+    migrate_buckets( p_ht, (unsigned int)(-1) );
+    
+    if (p_ht->p_old_buckets)
     {
-        if (p_ht->pp_entries[i])
-        {
-            /* Delete the entries in the bucket */
-            free_entry_chain (p_ht, p_ht->pp_entries[i]);
-            p_ht->pp_entries[i] = NULL;
-        }
+        DBG_PRINT_ERROR( ( "DldCommonHashTable.cpp ERROR: Out of memory error when rehashing, the rehashing is continued incrementally\n" ) );
     }
-    
-    mac_kfree( p_ht->pp_entries, p_ht->i_size*sizeof(ght_hash_entry_t*) );
-    mac_kfree( p_ht->p_nr, p_ht->i_size*sizeof(int) );
-    
-    /* ... and replace it with the new */
-    p_ht->i_size = p_tmp->i_size;
-    p_ht->i_size_mask = p_tmp->i_size_mask;
-    p_ht->i_items = p_tmp->i_items;
-    p_ht->pp_entries = p_tmp->pp_entries;
-    p_ht->p_nr = p_tmp->p_nr;
-    
-    p_ht->p_oldest = p_tmp->p_oldest;
-    p_ht->p_newest = p_tmp->p_newest;
-    
-    /* Clean up */
-    p_tmp->pp_entries = NULL;
-    p_tmp->p_nr = NULL;
-    mac_kfree( p_tmp, sizeof(ght_hash_table_t) );
 }
 
 //--------------------------------------------------------------------
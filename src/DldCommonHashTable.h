@@ -50,6 +50,31 @@ Copyright (C) 2010,  Slava Imameev
 #define GHT_HEURISTICS_MOVE_TO_FRONT 2
 #define GHT_AUTOMATIC_REHASH         4
 
+/*
+ * the ght_create() flags
+ */
+#define GHT_FLAGS_NONE               0x0
+#define GHT_NO_INSERTION_ORDER       0x1  /* the entries are not linked in the insertion order, see ght_create() */
+
+/*
+ * the automatic rehashing doubles the number of buckets when the
+ * number of items exceeds the number of buckets multiplied by this factor
+ */
+#define GHT_MAX_LOAD_FACTOR          1
+
+/*
+ * the number of the old buckets migrated to the new bucket array
+ * by an insertion or removal during the incremental rehashing
+ */
+#define GHT_MIGRATION_STEP           8
+
+/*
+ * the number of keys ght_get_many() hashes and prefetches before
+ * searching the buckets, the memory accesses for the keys of a batch
+ * overlap
+ */
+#define GHT_GET_MANY_BATCH           16
+
 #ifndef TRUE
 #define TRUE 1
 #endif
@@ -99,14 +124,20 @@ typedef struct s_hash_entry
     ght_hash_key_t       key;
     void*                p_data;
     
-    struct s_hash_entry* p_older;
-    struct s_hash_entry* p_newer;
-    
     //
-    // size of the alocation = sizeof(ght_hash_entry_t) + key_size
+    // size of the alocation = sizeof(ght_hash_entry_t) + key_size,
+    // zero for an intrusive entry, see ght_insert_intrusive()
     //
     size_t               size;
     
+    //
+    // the insertion order links must be the last members, an allocated
+    // entry of a table created with GHT_NO_INSERTION_ORDER does not have
+    // them and its key follows the size member
+    //
+    struct s_hash_entry* p_older;
+    struct s_hash_entry* p_newer;
+    
 } ght_hash_entry_t;
 
 /*
@@ -118,6 +149,10 @@ typedef struct
 {
     ght_hash_entry_t *p_entry; /* The current entry */
     ght_hash_entry_t *p_next;  /* The next entry */
+    
+    /* the bucket order iteration of a GHT_NO_INSERTION_ORDER table */
+    struct s_hash_buckets *p_buckets; /* The buckets being iterated */
+    unsigned int i_bucket;            /* The next bucket */
 } ght_iterator_t;
 
 /**
@@ -172,6 +207,40 @@ __END_DECLS
  */
 typedef void (*ght_fn_bucket_free_callback_t)(void *data, const void *key);
 
+/**
+ * Definition of the callback which provides the data for an absent key
+ * in ght_compute_if_absent(). The callback is called with the table
+ * locked by the caller and must not modify the table. Returning NULL
+ * fails the insertion.
+ */
+typedef void* (*ght_fn_compute_t)(void *p_context, const void *p_key_data, unsigned int i_key_size);
+
+/*
+ * A bucket, the head of the entries chain and the number of entries in the chain.
+ */
+typedef struct s_hash_bucket
+{
+    ght_hash_entry_t* p_head;
+    unsigned int      i_nr;
+} ght_hash_bucket_t;
+
+/*
+ * An array of buckets. The buckets are allocated lazily in pages, a page
+ * is allocated on the first insertion in any of its buckets, so a table
+ * created with a big size costs only the page directory till the entries
+ * are inserted.
+ */
+typedef struct s_hash_buckets
+{
+    unsigned int        i_size;             /* The number of buckets, a power of two */
+    unsigned int        i_size_mask;        /* i_size - 1 */
+    unsigned int        i_page_buckets;     /* The number of buckets in a page, a power of two */
+    unsigned int        i_page_shift;       /* log2( i_page_buckets ) */
+    unsigned int        i_pages;            /* The page directory size */
+    unsigned int        i_allocated_pages;  /* The number of allocated pages */
+    ght_hash_bucket_t** pp_pages;           /* The page directory */
+} ght_hash_buckets_t;
+
 /**
  * The hash table structure.
  */
@@ -187,12 +256,13 @@ typedef struct
     int i_automatic_rehash;            /**< TRUE if automatic rehashing is used */
     
     /* private: */
-    ght_hash_entry_t **pp_entries;
-    int *p_nr;                         /* The number of entries in each bucket */
-    int i_size_mask;                   /* The number of bits used in the size */
+    ght_hash_buckets_t *p_buckets;     /* The current buckets */
+    ght_hash_buckets_t *p_old_buckets; /* The buckets being migrated to p_buckets, NULL if there is no migration */
+    unsigned int i_migrated;           /* The number of the old buckets which have been migrated */
     unsigned int bucket_limit;
     
     bool non_block;                    /* TRUE if the allocations shoud not block */
+    bool b_ordered;                    /* FALSE if created with GHT_NO_INSERTION_ORDER */
     
     ght_hash_entry_t *p_oldest;        /* The entry inserted the earliest. */
     ght_hash_entry_t *p_newest;        /* The entry inserted the latest. */
@@ -202,15 +272,24 @@ typedef struct
  * Create a new hash table. The number of buckets should be about as
  * big as the number of elements you wish to store in the table for
  * good performance. The number of buckets is rounded to the next
- * higher power of two.
+ * higher power of two. The buckets are allocated in pages on the
+ * first insertion in a page so a generous size hint is cheap.
  *
  * The hash table is created with @c ght_one_at_a_time_hash() as hash
  * function, automatic rehashing disabled, @c malloc() as the memory
  * allocator and no heuristics.
  *
+ * A table created with GHT_NO_INSERTION_ORDER does not link its entries
+ * in the insertion order, the insertions and removals do not update the
+ * oldest and newest entries and an allocated entry is two pointers
+ * smaller, the iteration walks the buckets so its order is arbitrary
+ * and the table must not be changed during an iteration.
+ *
  * @param i_size the number of buckets in the hash table. Giving a
  *        non-power of two here will round the size up to the next
  *        power of two.
+ * @param non_block TRUE if the allocations should not block.
+ * @param i_flags GHT_FLAGS_NONE or GHT_NO_INSERTION_ORDER.
  *
  * @see ght_set_hash(), ght_set_heuristics(), ght_set_rehash(),
  * @see ght_set_alloc()
@@ -220,7 +299,8 @@ typedef struct
 ght_hash_table_t*
 ght_create(
     __in unsigned int i_size,
-    __in bool   non_block
+    __in bool   non_block,
+    __in unsigned int i_flags
     );
 
 /**
@@ -270,6 +350,9 @@ void ght_set_hash(ght_hash_table_t *p_ht, ght_fn_hash_t fn_hash);
  *   heuristics. An accessed element will be moved the front of the
  *   bucket list with this method.
  *
+ * The heuristics are applied by ght_get() and ght_replace() which change
+ * the bucket lists. ght_get_ro() does not apply them.
+ *
  * @param p_ht the hash table set the heuristics for.
  * @param i_heuristics the heuristics to use.
  */
@@ -278,12 +361,13 @@ void ght_set_heuristics(ght_hash_table_t *p_ht, int i_heuristics);
 /**
  * Enable or disable automatic rehashing.
  *
- * With automatic rehashing, the table will rehash itself when the
- * number of elements in the table are twice as many as the number of
- * buckets. You should note that automatic rehashing will cause your
- * application to be really slow when the table is rehashing (which
- * might happen at times when you need speed), you should therefore be
- * careful with this in time-constrainted applications.
+ * With automatic rehashing, the table doubles the number of buckets
+ * when the number of elements exceeds GHT_MAX_LOAD_FACTOR times the
+ * number of buckets. The elements are not rehashed at once, each
+ * insertion and removal migrates GHT_MIGRATION_STEP buckets from the
+ * old bucket array to the new one, so the cost of a rehash is spread
+ * over the following operations and an insertion never walks the
+ * whole table.
  *
  * @param p_ht the hash table to set rehashing for.
  * @param b_rehash TRUE if rehashing should be used or FALSE if it
@@ -332,6 +416,18 @@ unsigned int ght_size(ght_hash_table_t *p_ht);
  */
 unsigned int ght_table_size(ght_hash_table_t *p_ht);
 
+/**
+ * Get the memory used by the hash table. The data pointed by the
+ * entries is owned by the caller and is not accounted.
+ *
+ * @param p_ht the hash table to get the memory usage for.
+ * @param p_table_bytes returns the size of the table structure and
+ * the bucket arrays.
+ * @param p_entries_bytes returns the size of the hash entries
+ * including the keys which are allocated together with the entries.
+ */
+void ght_memory_usage(ght_hash_table_t *p_ht, vm_size_t *p_table_bytes, vm_size_t *p_entries_bytes);
+
 
 /**
  * Insert an entry into the hash table. Prior to inserting anything,
@@ -378,6 +474,87 @@ ght_insert(
     __in const void *p_key_data
     );
 
+/**
+ * Insert an entry which is embedded in the caller's data. The table
+ * neither allocates nor frees such an entry and does not copy the key,
+ * the key must be stored in the caller's data and both must stay
+ * unchanged till the entry is removed with ght_remove(), so an object
+ * and its hash linkage are a single allocation and a lookup compares
+ * the key in place. The intrusive and allocated entries can be mixed
+ * in a table, an entry can be in a single table under a single key.
+ *
+ * @param p_ht the hash table to insert into.
+ * @param p_he the caller's entry, its content is initialized by the call.
+ * @param p_entry_data the data to insert.
+ * @param i_key_size the size of the key (in bytes).
+ * @param p_key_data the key, must be valid while the entry is in the table.
+ *
+ * @returns
+ *          0  if the element could be inserted,
+ *          -2 if the elemnt is already in the hash
+ *          -1 if there is an error ( mac_kalloc failed for a bucket page )
+ */
+GHT_STATUS_CODE
+ght_insert_intrusive(
+    __in ght_hash_table_t *p_ht,
+    __in ght_hash_entry_t *p_he,
+    __in void *p_entry_data,
+    __in unsigned int i_key_size,
+    __in const void *p_key_data
+    );
+
+/**
+ * Lookup an entry in the hash table and insert it if it is absent, the key
+ * is hashed and the bucket is searched once, this replaces a ght_get()
+ * followed by ght_insert().
+ *
+ * @param p_ht the hash table to insert into.
+ * @param p_entry_data the data to insert if the key is absent.
+ * @param i_key_size the size of the key (in bytes).
+ * @param p_key_data the key.
+ * @param pp_data receives the existing data or p_entry_data if it has been inserted.
+ *
+ * @returns
+ *          0  if the element has been inserted,
+ *          -2 if the element is already in the hash, *pp_data is the existing data
+ *          -1 if there is an error ( mac_kalloc failed )
+ */
+GHT_STATUS_CODE
+ght_get_or_insert(
+    __in ght_hash_table_t *p_ht,
+    __in void *p_entry_data,
+    __in unsigned int i_key_size,
+    __in const void *p_key_data,
+    __out void **pp_data
+    );
+
+/**
+ * Same as ght_get_or_insert() but the data is provided by fn_compute
+ * which is called only if the key is absent, so the caller does not
+ * allocate the data for a key which is already in the hash.
+ *
+ * @param p_ht the hash table to insert into.
+ * @param i_key_size the size of the key (in bytes).
+ * @param p_key_data the key.
+ * @param fn_compute the callback providing the data for an absent key.
+ * @param p_context the callback's context.
+ * @param pp_data receives the existing or the inserted data.
+ *
+ * @returns
+ *          0  if the element has been inserted,
+ *          -2 if the element is already in the hash, *pp_data is the existing data
+ *          -1 if fn_compute returned NULL or there is an error ( mac_kalloc failed )
+ */
+GHT_STATUS_CODE
+ght_compute_if_absent(
+    __in ght_hash_table_t *p_ht,
+    __in unsigned int i_key_size,
+    __in const void *p_key_data,
+    __in ght_fn_compute_t fn_compute,
+    __in_opt void *p_context,
+    __out void **pp_data
+    );
+
 /**
  * Replace an entry in the hash table. This function will return an
  * error if the entry to be replaced does not exist, i.e. it cannot be
@@ -413,6 +590,51 @@ ght_get(
     __in const void *p_key_data
     );
 
+/**
+ * Lookup an entry in the hash table without changing the table, so
+ * the concurrent calls are safe if the table is not being changed,
+ * e.g. under a shared lock. ght_get() applies the heuristics which
+ * relink the found entry and therefore requires the exclusive access
+ * when the heuristics are used. The call does not write to the table's
+ * memory.
+ *
+ * @param p_ht the hash table to search in.
+ * @param i_key_size the size of the key to search with (in bytes).
+ * @param p_key_data the key to search for.
+ *
+ * @return a pointer to the found entry or NULL if no entry could be found.
+ */
+void*
+ght_get_ro(
+    __in ght_hash_table_t *p_ht,
+    __in unsigned int i_key_size,
+    __in const void *p_key_data
+    );
+
+/**
+ * Lookup several keys of the same size, the result is the same as calling
+ * ght_get_ro() for every key but the keys are processed in batches of
+ * GHT_GET_MANY_BATCH, the keys of a batch are hashed and their buckets
+ * and the first entries are prefetched before the buckets are searched,
+ * so the cache misses of a batch are served in parallel instead of one
+ * after another, this pays off for a table bigger than the caches.
+ * The table is not changed, see ght_get_ro().
+ *
+ * @param p_ht the hash table to search in.
+ * @param i_key_size the size of every key (in bytes).
+ * @param pp_keys the keys to search for.
+ * @param i_count the number of keys.
+ * @param pp_data receives i_count pointers to the found entries, NULL for the keys not found.
+ */
+void
+ght_get_many(
+    __in ght_hash_table_t *p_ht,
+    __in unsigned int i_key_size,
+    __in const void* const* pp_keys,
+    __in unsigned int i_count,
+    __out void** pp_data
+    );
+
 /**
  * Remove an entry from the hash table. The entry is removed from the
  * table, but not freed (that is, the data stored is not freed).
@@ -434,7 +656,9 @@ ght_remove(
  * Return the first entry in the hash table. This function should be
  * used for iteration and is used together with ght_next(). The order
  * of the entries will be from the oldest inserted entry to the newest
- * inserted entry. If an entry is inserted during an iteration, the entry
+ * inserted entry, the order is arbitrary and the table must not be
+ * changed during an iteration if the table has been created with
+ * GHT_NO_INSERTION_ORDER. If an entry is inserted during an iteration, the entry
  * might or might not occur in the iteration. Note that removal during
  * an iteration is only safe for the <I>current</I> entry or an entry
  * which has <I>already been iterated over</I>.
@@ -548,11 +772,10 @@ void *ght_next_keysize(ght_hash_table_t *p_ht, ght_iterator_t *p_iterator, const
  *
  * Rehashing will change the size of the hash table, retaining all
  * elements. This is very costly and should be avoided unless really
- * needed. If <TT>GHT_AUTOMATIC_REHASH</TT> is specified in the flag
- * parameter when ght_create() is called, the hash table is
- * automatically rehashed when the number of stored elements exceeds
- * two times the number of buckets in the table (making calls to this
- * function unessessary).
+ * needed. Unlike the automatic rehashing, which is incremental, this
+ * function completes the migration of all elements before returning,
+ * if the memory for the new buckets can't be allocated the migration
+ * is continued by the following insertions and removals.
  *
  * @param p_ht the hash table to rehash.
  * @param i_size the new size of the table.
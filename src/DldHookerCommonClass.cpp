@@ -8,6 +8,14 @@
 
 //--------------------------------------------------------------------
 
+extern "C" {
+    extern int cpu_number( void );
+    extern boolean_t ml_set_interrupts_enabled( boolean_t enable );
+    extern int ml_get_max_cpus( void );
+}
+
+//--------------------------------------------------------------------
+
 extern
 bool
 DldAddNewIORegistryEntryToDldPlane(
@@ -17,11 +25,13 @@ DldAddNewIORegistryEntryToDldPlane(
 //--------------------------------------------------------------------
 
 DldHookedObjectsHashTable* DldHookedObjectsHashTable::sHashTable = NULL;
+volatile UInt32 DldHookedObjectsHashTable::sVtableGeneration = 0x0;
 
-//--------------------------------------------------------------------
+DldHookTraceCallback volatile  gHookTraceCallback = NULL;
 
-OSDefineMetaClassAndStructors( DldHookedObjectEntry, OSObject )
+volatile SInt32  DldHookerCommonClass::sHookersCounter = 0x0;
 
+//--------------------------------------------------------------------
 
 DldHookedObjectEntry* DldHookedObjectEntry::allocateNew(){
     
@@ -30,13 +40,11 @@ DldHookedObjectEntry* DldHookedObjectEntry::allocateNew(){
     if( !newEntry )
         return NULL;
     
-    if( !newEntry->init() ){
-        
-        assert( !"newEntry->init() failed" );
-        
-        newEntry->release();
-        return NULL;
-    }
+    newEntry->Type = DldHookEntryTypeUnknown;
+    newEntry->InheritanceDepth = DldInheritanceDepth_0;
+    bzero( &newEntry->Key, sizeof( newEntry->Key ) );
+    bzero( &newEntry->Parameters, sizeof( newEntry->Parameters ) );
+    newEntry->ClassHookerObject = NULL;
     
     return newEntry;
 };
@@ -48,6 +56,12 @@ void DldHookedObjectEntry::free()
     
     switch( this->Type ) {
             
+        case DldHookEntryTypeUnknown:
+            //
+            // an entry preallocated by HookObjects() and not used
+            //
+            break;
+            
         case DldHookEntryTypeObject:
             {
             }
@@ -88,6 +102,8 @@ void DldHookedObjectEntry::free()
             break;
             
     }// end switch
+    
+    delete this;
 }
 
 
@@ -113,10 +129,34 @@ DldHookedObjectsHashTable::withSize( int size, bool non_block )
         return NULL;
     }
     
-    objHashTable->HashTable = ght_create( size, non_block );
+    objHashTable->CpusNumber = (unsigned int)ml_get_max_cpus();
+    assert( objHashTable->CpusNumber > 0x0 );
+    
+    objHashTable->ReaderCpus = (DldHashTableReaderCpu*)IOMallocAligned( objHashTable->CpusNumber*sizeof( DldHashTableReaderCpu ),
+                                                                        sizeof( DldHashTableReaderCpu ) );
+    assert( objHashTable->ReaderCpus );
+    if( !objHashTable->ReaderCpus ){
+        
+        IORWLockFree( objHashTable->RWLock );
+        objHashTable->RWLock = NULL;
+        
+        delete objHashTable;
+        return NULL;
+    }
+    
+    bzero( objHashTable->ReaderCpus, objHashTable->CpusNumber*sizeof( DldHashTableReaderCpu ) );
+    
+    //
+    // the table is iterated only under the exclusive lock or with the writers
+    // excluded and the order does not matter, so the insertion order is not kept
+    //
+    objHashTable->HashTable = ght_create( size, non_block, GHT_NO_INSERTION_ORDER );
     assert( objHashTable->HashTable );
     if( !objHashTable->HashTable ){
         
+        IOFreeAligned( objHashTable->ReaderCpus, objHashTable->CpusNumber*sizeof( DldHashTableReaderCpu ) );
+        objHashTable->ReaderCpus = NULL;
+        
         IORWLockFree( objHashTable->RWLock );
         objHashTable->RWLock = NULL;
         
@@ -124,6 +164,26 @@ DldHookedObjectsHashTable::withSize( int size, bool non_block )
         return NULL;
     }
     
+    //
+    // the table grows incrementally when the number of hooked objects exceeds
+    // the number of buckets, so the initial size is a hint and not a limit
+    //
+    ght_set_rehash( objHashTable->HashTable, TRUE );
+    
+#if defined(DLD_HOOK_FILTER)
+    {
+        UInt32  countersNumber = DLD_HOOK_FILTER_MIN_COUNTERS;
+        
+        while( size > 0x0 && countersNumber < (UInt32)size*DLD_HOOK_FILTER_COUNTERS_PER_KEY )
+            countersNumber = countersNumber << 0x1;
+        
+        //
+        // the table works without the filter, an allocation is retried when a key is added
+        //
+        objHashTable->FilterRebuild( countersNumber );
+    }
+#endif//DLD_HOOK_FILTER
+    
     return objHashTable;
 }
 
@@ -177,873 +237,1443 @@ DldHookedObjectsHashTable::free()
         assert( !"Non emprty hash!" );
         DBG_PRINT_ERROR( ("DldHookedObjectsHashTable::free() found an entry for an object(0x%p)\n", *(void**)p_key ) );
         
-        p_table->fn_free( p_e, p_e->size );
+        //
+        // the iteration returns the DldHookedObjectEntry data, not the hash entries,
+        // the data is leaked as it might embed the hash linkage walked by ght_finalize()
+        //
     }
     
     ght_finalize( p_table );
     
+#if defined(DLD_HOOK_REPLICAS)
+    assert( NULL == this->WithdrawnReplica );
+    if( NULL != this->Replica ){
+        
+        DldHookedObjectsHashTable::FreeReplica( this->Replica );
+        this->Replica = NULL;
+    }
+#endif//DLD_HOOK_REPLICAS
+    
+#if defined(DLD_HOOK_FILTER)
+    if( this->FilterCounters )
+        IOFree( this->FilterCounters, this->FilterMask + 0x1 );
+    this->FilterCounters = NULL;
+#endif//DLD_HOOK_FILTER
+    
+    IOFreeAligned( this->ReaderCpus, this->CpusNumber*sizeof( DldHashTableReaderCpu ) );
+    this->ReaderCpus = NULL;
+    
     IORWLockFree( this->RWLock );
     this->RWLock = NULL;
 }
 
 //--------------------------------------------------------------------
 
-bool
-DldHookedObjectsHashTable::AddObject(
-    __in OSObject* obj,
-    __in DldHookedObjectEntry* objEntry,
-    __in bool errorIfPresent
-    )
-/*
- the caller must alloacte space for the entry and
- free it only after removing the entry from the hash
- */
+void
+DldHookedObjectsHashTable::BeginWrite()
 {
-    GHT_STATUS_CODE RC;
-    
-    assert( DldHookedObjectEntry::DldHookEntryTypeObject == objEntry->Type );
-    assert( objEntry->Parameters.Common.HookedVtableFunctionsInfo );
-#if defined(DBG)
-    assert( current_thread() == this->ExclusiveThread );
-#endif//DBG
+    assert( 0x0 == ( this->Sequence & 0x1 ) );
     
-    RC = ght_insert( this->HashTable, objEntry, sizeof( obj ), &obj );
-    if( !errorIfPresent && GHT_ALREADY_IN_HASH == RC )
-        return true;
+    //
+    // the new readers see the odd sequence and do not enter the table,
+    // the full barrier orders the sequence store with the loads of the
+    // readers' states, the readers use the barrier in the opposite order
+    //
+    this->Sequence = this->Sequence + 0x1;
+    DldMemoryBarrier();
     
-    assert( GHT_OK == RC );
-    if( GHT_OK != RC ){
+    //
+    // wait for the readers which have entered the table before the sequence
+    // was changed, a reader's section is short as it runs with the interrupts
+    // disabled, a CPU which has left and reentered the section has seen the
+    // odd sequence so a change of the value is enough
+    //
+    for( unsigned int cpu = 0x0; cpu < this->CpusNumber; ++cpu ){
         
-        DBG_PRINT_ERROR( ( "DldHookedObjectsHashTable::AddObject->ght_insert( 0x%p, (OSObject)0x%p ) failed RC = 0x%X\n",
-                          (void*)this->HashTable, (void*)obj, RC ) );
-    } else {
+        UInt32  readerSequence = this->ReaderCpus[ cpu ].Sequence;
         
-        objEntry->retain();
-    }
-
-    return ( GHT_OK == RC );
+        if( readerSequence & 0x1 ){
+            
+            while( readerSequence == this->ReaderCpus[ cpu ].Sequence )
+                DldCpuPause();
+        }
+    }// end for
 }
 
 //--------------------------------------------------------------------
 
-bool
-DldHookedObjectsHashTable::AddObject(
-    __in DldHookTypeVtableObjKey* vtableHookObj,
-    __in DldHookedObjectEntry* objEntry,
-    __in bool errorIfPresent
-    )
-/*
- the caller must alloacte space for the entry and
- free it only after removing the entry from the hash
- */
+void
+DldHookedObjectsHashTable::EndWrite()
 {
-    GHT_STATUS_CODE RC;
-    
-    assert( DldHookedObjectEntry::DldHookEntryTypeVtableObj == objEntry->Type );
-    assert( objEntry->Parameters.Common.HookedVtableFunctionsInfo );
-#if defined(DBG)
-    assert( current_thread() == this->ExclusiveThread );
-#endif//DBG
-    
-    RC = ght_insert( this->HashTable, objEntry, sizeof( *vtableHookObj ), vtableHookObj );
-    if( !errorIfPresent && GHT_ALREADY_IN_HASH == RC )
-        return true;
+    assert( 0x1 == ( this->Sequence & 0x1 ) );
     
-    assert( GHT_OK == RC );
-    if( GHT_OK != RC ){
-        
-        DBG_PRINT_ERROR( ( "DldHookedObjectsHashTable::AddObject->ght_insert( 0x%p, (DldHookTypeVtableObjKey::Object)0x%p ) failed RC = 0x%X\n",
-                          (void*)this->HashTable, (void*)vtableHookObj->Object, RC ) );
-    } else {
+#if defined(DLD_HOOK_REPLICAS)
+    //
+    // the readers have been drained by BeginWrite() so the replica can be withdrawn,
+    // the readers which enter after the sequence has been changed use the hash table
+    // till a new replica is published
+    //
+    if( this->ReplicaStale ){
         
-        objEntry->retain();
-    }    
+        assert( NULL == this->WithdrawnReplica );
+        this->WithdrawnReplica = this->Replica;
+        this->Replica = NULL;
+    }
+#endif//DLD_HOOK_REPLICAS
     
-    return ( GHT_OK == RC );
+    //
+    // the table's changes must be visible before the sequence, the x86 doesn't reorder stores
+    //
+    DldCompilerBarrier();
+    this->Sequence = this->Sequence + 0x1;
 }
 
 //--------------------------------------------------------------------
 
 bool
-DldHookedObjectsHashTable::AddObject(
-    __in DldHookTypeVtableKey* vtableHookVtable,
-    __in DldHookedObjectEntry* objEntry,
-    __in bool errorIfPresent
+DldHookedObjectsHashTable::ReadBegin(
+    __out DldHashTableReadState* state
     )
-/*
- the caller must alloacte space for the entry and
- free it only after removing the entry from the hash
- */
 {
-    GHT_STATUS_CODE RC;
+    DldHashTableReaderCpu*  readerCpu;
     
-    assert( DldHookedObjectEntry::DldHookEntryTypeVtable == objEntry->Type );
-    assert( objEntry->Parameters.Common.HookedVtableFunctionsInfo );
-#if defined(DBG)
-    assert( current_thread() == this->ExclusiveThread );
-#endif//DBG
+    //
+    // the interrupts are disabled so the CPU's state is changed only by this reader
+    //
+    state->InterruptsState = ml_set_interrupts_enabled( FALSE );
+    state->Cpu = cpu_number();
     
-    RC = ght_insert( this->HashTable, objEntry, sizeof( *vtableHookVtable ), vtableHookVtable );
-    if( !errorIfPresent && GHT_ALREADY_IN_HASH == RC )
-        return true;
+    assert( state->Cpu < this->CpusNumber );
+    if( state->Cpu >= this->CpusNumber ){
+        
+        ml_set_interrupts_enabled( state->InterruptsState );
+        return false;
+    }
     
-    assert( GHT_OK == RC );
-    if( GHT_OK != RC ){
+    readerCpu = &this->ReaderCpus[ state->Cpu ];
+    
+    //
+    // enter the section before checking the sequence, see BeginWrite()
+    //
+    readerCpu->Sequence = readerCpu->Sequence + 0x1;
+    DldMemoryBarrier();
+    
+    state->Sequence = this->Sequence;
+    if( state->Sequence & 0x1 ){
         
-        DBG_PRINT_ERROR( ( "DldHookedObjectsHashTable::AddObject->ght_insert( 0x%p, (DldHookTypeVtableKey::Vtable)0x%p ) failed RC = 0x%X\n",
-                          (void*)this->HashTable, (void*)vtableHookVtable->Vtable, RC ) );
-    } else {
+        //
+        // a writer is active
+        //
+        readerCpu->Sequence = readerCpu->Sequence + 0x1;
         
-        objEntry->retain();
+#if defined(DLD_HOOK_STATS)
+        readerCpu->LockFreeReadsFailed += 0x1;
+#endif//DLD_HOOK_STATS
+        
+        ml_set_interrupts_enabled( state->InterruptsState );
+        return false;
     }
     
-    return ( GHT_OK == RC );
+    DldCompilerBarrier();
+    return true;
 }
 
 //--------------------------------------------------------------------
 
-#if defined( DBG )
 bool
-DldHookedObjectsHashTable::AddObject(
-    __in OSMetaClassBase::_ptf_t*    key,
-    __in DldDbgVtableHookToObject*   DbgEntry,
-    __in bool errorIfPresent
+DldHookedObjectsHashTable::ReadEnd(
+    __in DldHashTableReadState* state
     )
-/*
- the caller must alloacte space for the entry and
- free it only after removing the entry from the hash
- */
 {
-    GHT_STATUS_CODE RC;
+    bool  unchanged;
     
-#if defined(DBG)
-    assert( current_thread() == this->ExclusiveThread );
-#endif//DBG
+    assert( state->Cpu < this->CpusNumber );
+    assert( 0x1 == ( this->ReaderCpus[ state->Cpu ].Sequence & 0x1 ) );
     
-    RC = ght_insert( this->HashTable, DbgEntry, sizeof( key ), &key );
-    if( !errorIfPresent && GHT_ALREADY_IN_HASH == RC )
-        return true;
+    //
+    // the data must be read before the section is left
+    //
+    DldCompilerBarrier();
+    unchanged = ( state->Sequence == this->Sequence );
+    this->ReaderCpus[ state->Cpu ].Sequence = this->ReaderCpus[ state->Cpu ].Sequence + 0x1;
     
-    assert( GHT_OK == RC );
+#if defined(DLD_HOOK_STATS)
+    if( unchanged )
+        this->ReaderCpus[ state->Cpu ].LockFreeReads += 0x1;
+    else
+        this->ReaderCpus[ state->Cpu ].LockFreeReadsFailed += 0x1;
+#endif//DLD_HOOK_STATS
     
-    return ( GHT_OK == RC );
+    ml_set_interrupts_enabled( state->InterruptsState );
+    
+    return unchanged;
 }
-#endif//#if defined( DBG )
 
 //--------------------------------------------------------------------
 
-DldHookedObjectEntry*
-DldHookedObjectsHashTable::RemoveObject(
-    __in OSObject* obj
+#if defined(DLD_HOOK_REPLICAS)
+
+static
+UInt32
+DldHookReplicaHash(
+    __in DldHookTypeVtableKey* key
     )
 {
-    DldHookedObjectEntry* objEntry;
-    
-#if defined(DBG)
-    assert( current_thread() == this->ExclusiveThread );
-#endif//DBG
+    UInt32  hash;
     
     //
-    // the object was referenced by AddObject
+    // the vtables and meta classes are aligned so the low bits are dropped
     //
-    objEntry = (DldHookedObjectEntry*)ght_remove( this->HashTable, sizeof( obj ), &obj );
-    if( objEntry ){
-        
-        assert( DldHookedObjectEntry::DldHookEntryTypeObject == objEntry->Type );
-    }
+    hash = (UInt32)( ( (uintptr_t)key->Vtable >> 0x3 ) ^ ( (uintptr_t)key->metaClass >> 0x3 ) ^ (uintptr_t)key->InheritanceDepth );
+    hash = hash * 0x9E3779B1;
     
-    return objEntry;
+    return hash ^ ( hash >> 16 );
 }
 
 //--------------------------------------------------------------------
 
-DldHookedObjectEntry*
-DldHookedObjectsHashTable::RemoveObject(
-    __in DldHookTypeVtableObjKey* vtableHookObj
+void
+DldHookedObjectsHashTable::FreeReplica(
+    __in DldHookReplica* replica
     )
 {
-    DldHookedObjectEntry* objEntry;
-    
-#if defined(DBG)
-    assert( current_thread() == this->ExclusiveThread );
-#endif//DBG
-    
-    //
-    // the object was referenced by AddObject
-    //
-    objEntry = (DldHookedObjectEntry*)ght_remove( this->HashTable, sizeof( *vtableHookObj ), vtableHookObj );
-    if( objEntry ){
-        
-        assert( DldHookedObjectEntry::DldHookEntryTypeVtableObj == objEntry->Type );
-    }
+    assert( preemption_enabled() );
     
-    return objEntry;
+    IOFreeAligned( replica, replica->Size );
 }
 
 //--------------------------------------------------------------------
 
-DldHookedObjectEntry*
-DldHookedObjectsHashTable::RemoveObject(
-    __in DldHookTypeVtableKey* vtableHookVtable
-    )
+void
+DldHookedObjectsHashTable::RebuildReplica()
+/*
+ called after the exclusive lock has been released, the table doesn't change
+ under the shared lock so a single walk fills the replica, the replica is
+ published by a compare and swap as a concurrent writer might be rebuilding
+ too, a writer which has withdrawn the replica in the meantime has made
+ its own rebuild, if the replica can't be allocated the readers use the
+ hash table till the next write
+ */
 {
-    DldHookedObjectEntry* objEntry;
+    ght_iterator_t          iterator;
+    const void*             p_key;
+    DldHookedObjectEntry*   objEntry;
+    DldHookReplica*         replica;
+    UInt32                  entriesNumber = 0x2;
+    vm_size_t               size;
     
-#if defined(DBG)
-    assert( current_thread() == this->ExclusiveThread );
-#endif//DBG
+    assert( preemption_enabled() );
     
-    //
-    // the object was referenced by AddObject
-    //
-    objEntry = (DldHookedObjectEntry*)ght_remove( this->HashTable, sizeof( *vtableHookVtable ), vtableHookVtable );
-    if( objEntry ){
+    this->LockShared();
+    {// start of the lock
         
-        assert( DldHookedObjectEntry::DldHookEntryTypeVtable == objEntry->Type );
-    }
-    
-    return objEntry;
+        if( NULL == this->Replica && 0x0 != this->ReplicaKeys ){
+            
+            //
+            // at least a half of the entries are empty so a lookup always terminates,
+            // a vtable entry is in the table under two keys, the real vtable and NULL
+            //
+            while( entriesNumber < 0x2*this->ReplicaKeys )
+                entriesNumber = entriesNumber << 0x1;
+            
+            //
+            // the size is rounded to a cache line so the replica doesn't share a line with written data
+            //
+            size = sizeof( DldHookReplica ) + ( entriesNumber - 0x1 )*sizeof( DldHookReplicaEntry );
+            size = ( size + sizeof( DldHashTableReaderCpu ) - 0x1 ) & ~( (vm_size_t)sizeof( DldHashTableReaderCpu ) - 0x1 );
+            
+            replica = (DldHookReplica*)IOMallocAligned( size, sizeof( DldHashTableReaderCpu ) );
+            assert( replica );
+            if( NULL != replica ){
+                
+                bzero( replica, size );
+                replica->Size = size;
+                replica->EntriesMask = entriesNumber - 0x1;
+                
+                for( objEntry = (DldHookedObjectEntry*)ght_first( this->HashTable, &iterator, &p_key );
+                     NULL != objEntry;
+                     objEntry = (DldHookedObjectEntry*)ght_next( this->HashTable, &iterator, &p_key ) ){
+                    
+                    if( DldHookedObjectEntry::DldHookEntryTypeVtable == objEntry->Type ){
+                        
+                        DldHookTypeVtableKey*  key = (DldHookTypeVtableKey*)p_key;
+                        UInt32                 i = DldHookReplicaHash( key ) & replica->EntriesMask;
+                        
+                        while( NULL != replica->Entries[ i ].Key.metaClass )
+                            i = ( i + 0x1 ) & replica->EntriesMask;
+                        
+                        replica->Entries[ i ].Key = *key;
+                        replica->Entries[ i ].HookedVtableFunctionsInfo = objEntry->Parameters.Common.HookedVtableFunctionsInfo;
+                    }
+                }// end for
+                
+                //
+                // the compare and swap is a full barrier, the replica is filled before it is published
+                //
+                if( !OSCompareAndSwapPtr( NULL, replica, &this->Replica ) )
+                    DldHookedObjectsHashTable::FreeReplica( replica );
+                
+            } else {
+                
+                DBG_PRINT_ERROR(( "IOMallocAligned( %u ) failed for a replica\n", (unsigned int)size ));
+            }
+        }
+        
+    }// end of the lock
+    this->UnLockShared();
 }
 
 //--------------------------------------------------------------------
 
-DldHookedObjectEntry*
-DldHookedObjectsHashTable::RetrieveObjectEntry(
-    __in OSObject* obj,
-    __in bool reference
+DldHookedFunctionInfo*
+DldHookedObjectsHashTable::RetrieveReplicaFunctionsInfo(
+    __in DldHashTableReadState* state,
+    __in DldHookTypeVtableKey* vtableHookVtable
     )
 {
-    DldHookedObjectEntry* objEntry;
+    DldHookReplica*  replica;
+    UInt32           i;
     
-    objEntry = (DldHookedObjectEntry*)ght_get( this->HashTable, sizeof( obj ), &obj );
-    if( objEntry ){
+    assert( state->Cpu < this->CpusNumber );
+    assert( 0x1 == ( this->ReaderCpus[ state->Cpu ].Sequence & 0x1 ) );
+    assert( NULL != vtableHookVtable->metaClass );
+    
+    replica = this->Replica;
+    if( NULL == replica )
+        return NULL;
+    
+    i = DldHookReplicaHash( vtableHookVtable ) & replica->EntriesMask;
+    
+    while( NULL != replica->Entries[ i ].Key.metaClass ){
         
-        assert( DldHookedObjectEntry::DldHookEntryTypeObject == objEntry->Type );
+        if( replica->Entries[ i ].Key.Vtable == vtableHookVtable->Vtable &&
+            replica->Entries[ i ].Key.metaClass == vtableHookVtable->metaClass &&
+            replica->Entries[ i ].Key.InheritanceDepth == vtableHookVtable->InheritanceDepth )
+            return replica->Entries[ i ].HookedVtableFunctionsInfo;
         
-        if( reference )
-            objEntry->retain();
-    }
+        i = ( i + 0x1 ) & replica->EntriesMask;
+    }// end while
     
-    return objEntry;
+    return NULL;
 }
 
+#endif//DLD_HOOK_REPLICAS
+
 //--------------------------------------------------------------------
 
-DldHookedObjectEntry*
-DldHookedObjectsHashTable::RetrieveObjectEntry(
-    __in DldHookTypeVtableObjKey* vtableHookObj,
-    __in bool reference
+#if defined(DLD_HOOK_FILTER)
+
+UInt32
+DldHookedObjectsHashTable::FilterHash(
+    __in const void* key,
+    __in unsigned int keySize
     )
+/*
+ the keys are pointers and enums bzero'ed before being filled, see Comment 1: in
+ HookVtableIntWoLock(),
+ so they are hashed by 32 bit words which is cheaper than the table's hash
+ */
 {
-    DldHookedObjectEntry* objEntry;
+    const UInt32*  words = (const UInt32*)key;
+    UInt32         hash = (UInt32)keySize;
     
-    assert( NULL != vtableHookObj->Object && NULL != vtableHookObj->metaClass );
+    assert( 0x0 == keySize % sizeof( UInt32 ) && 0x0 == (uintptr_t)key % sizeof( UInt32 ) );
     
-    objEntry = (DldHookedObjectEntry*)ght_get( this->HashTable, sizeof( *vtableHookObj ), vtableHookObj );
-    if( objEntry ){
-        
-        assert( DldHookedObjectEntry::DldHookEntryTypeVtableObj == objEntry->Type );
+    for( unsigned int i = 0x0; i < keySize/sizeof( UInt32 ); ++i ){
         
-        if( reference )
-            objEntry->retain();
-    }
+        hash = ( hash ^ words[ i ] )*0x9E3779B1;
+        hash = hash ^ ( hash >> 15 );
+    }// end for
     
-    return objEntry;
+    hash = ( hash ^ ( hash >> 16 ) )*0x85EBCA6B;
+    
+    return hash ^ ( hash >> 13 );
 }
 
 //--------------------------------------------------------------------
 
-DldHookedObjectEntry*
-DldHookedObjectsHashTable::RetrieveObjectEntry(
-    __in DldHookTypeVtableKey* vtableHookVtable,
-    __in bool reference
+bool
+DldHookedObjectsHashTable::FilterMayContain(
+    __in const void* key,
+    __in unsigned int keySize
     )
+/*
+ called by the readers and the writers, false means the key is definitely not in the table,
+ the positions are derived from two halves of a single hash
+ */
 {
-    DldHookedObjectEntry* objEntry;
+    UInt32  hash;
+    UInt32  step;
     
-    assert( NULL != vtableHookVtable->metaClass );
-
-    objEntry = (DldHookedObjectEntry*)ght_get( this->HashTable, sizeof( *vtableHookVtable ), vtableHookVtable );
-    if( objEntry ){
-        
-        assert( DldHookedObjectEntry::DldHookEntryTypeVtable == objEntry->Type );
+    if( NULL == this->FilterCounters )
+        return true;
+    
+    hash = DldHookedObjectsHashTable::FilterHash( key, keySize );
+    step = ( ( hash >> 16 ) | ( hash << 16 ) ) | 0x1;
+    
+    for( unsigned int i = 0x0; i < DLD_HOOK_FILTER_HASHES; ++i ){
         
-        if( reference )
-            objEntry->retain();
-    }
+        if( 0x0 == this->FilterCounters[ ( hash + i*step ) & this->FilterMask ] )
+            return false;
+    }// end for
     
-    return objEntry;
+    return true;
 }
+
 //--------------------------------------------------------------------
 
-#if defined( DBG )
-DldDbgVtableHookToObject*
-DldHookedObjectsHashTable::RetrieveObjectEntry(
-    __in OSMetaClassBase::_ptf_t*    key
+void
+DldHookedObjectsHashTable::FilterAdd(
+    __in const void* key,
+    __in unsigned int keySize
     )
+/*
+ called by a writer after the key has been added to the table, so
+ the key is accounted if the filter is rebuilt
+ */
 {
-    DldDbgVtableHookToObject* dbgEntry;
+    UInt32  hash;
+    UInt32  step;
+    
+#if defined(DBG)
+    assert( current_thread() == this->ExclusiveThread );
+#endif//DBG
     
-    dbgEntry = (DldDbgVtableHookToObject*)ght_get( this->HashTable, sizeof( key ), &key );
+    if( NULL == this->FilterCounters ||
+        (UInt64)ght_size( this->HashTable )*DLD_HOOK_FILTER_COUNTERS_PER_KEY > (UInt64)this->FilterMask + 0x1 ){
         
-    return dbgEntry;
+        UInt32  countersNumber = this->FilterCounters ? 0x2*( this->FilterMask + 0x1 ) : DLD_HOOK_FILTER_MIN_COUNTERS;
+        
+        if( this->FilterRebuild( countersNumber ) )
+            return;
+        
+        //
+        // keep the old filter with a higher false positive rate
+        //
+        if( NULL == this->FilterCounters )
+            return;
+    }
+    
+    hash = DldHookedObjectsHashTable::FilterHash( key, keySize );
+    step = ( ( hash >> 16 ) | ( hash << 16 ) ) | 0x1;
+    
+    for( unsigned int i = 0x0; i < DLD_HOOK_FILTER_HASHES; ++i ){
+        
+        UInt8*  counter = &this->FilterCounters[ ( hash + i*step ) & this->FilterMask ];
+        
+        if( 0xFF != *counter )
+            *counter += 0x1;
+    }// end for
 }
-#endif//#if defined( DBG )
 
 //--------------------------------------------------------------------
 
-DldHookerCommonClass::DldHookerCommonClass()
+void
+DldHookedObjectsHashTable::FilterRemove(
+    __in const void* key,
+    __in unsigned int keySize
+    )
+/*
+ called by a writer after the key has been removed from the table
+ */
 {
+    UInt32  hash;
+    UInt32  step;
     
-    this->ClassHookerObject = NULL;
-    this->OriginalVtable    = NULL;
-    this->HookClassVtable   = NULL;
-    this->HookedObjectsCounter = 0x0;
-    this->HookType = DldHookTypeUnknown;
+#if defined(DBG)
+    assert( current_thread() == this->ExclusiveThread );
+#endif//DBG
     
-};
-
-DldHookerCommonClass::~DldHookerCommonClass()
-{ 
-    if( this->ClassName )
-        this->ClassName->release();
+    if( NULL == this->FilterCounters )
+        return;
     
-    assert( 0x0 == this->HookedObjectsCounter );
-};
-
-//--------------------------------------------------------------------
+    hash = DldHookedObjectsHashTable::FilterHash( key, keySize );
+    step = ( ( hash >> 16 ) | ( hash << 16 ) ) | 0x1;
     
-//
-// saves an object pointer, the object is not referenced
-//
-void
-DldHookerCommonClass::SetClassHookerObject(
-    __in DldHookerBaseInterface*  ClassHookerObject
-   )
-{
-    assert( NULL == this->ClassHookerObject );
-    this->ClassHookerObject = ClassHookerObject;
+    for( unsigned int i = 0x0; i < DLD_HOOK_FILTER_HASHES; ++i ){
+        
+        UInt8*  counter = &this->FilterCounters[ ( hash + i*step ) & this->FilterMask ];
+        
+        //
+        // a saturated counter lost the number of keys
+        //
+        assert( 0x0 != *counter );
+        if( 0xFF != *counter && 0x0 != *counter )
+            *counter -= 0x1;
+    }// end for
 }
 
 //--------------------------------------------------------------------
 
-void
-DldHookerCommonClass::SetHookedVtableSize(
-    __in unsigned int HookedVtableSize
+bool
+DldHookedObjectsHashTable::FilterRebuild(
+    __in UInt32 countersNumber
     )
+/*
+ allocates a filter with countersNumber counters, a power of two, and adds all
+ keys in the table, called on creation or by a writer after the readers have
+ been drained so the old filter can be freed, the old filter is retained
+ if the allocation fails
+ */
 {
-    assert( 0x0 == this->HookedVtableSize );
-    assert( 0x0 < HookedVtableSize && HookedVtableSize < 0xFFFF );
+    UInt8*          counters;
+    ght_iterator_t  iterator;
+    const void*     key;
+    unsigned int    keySize;
     
-    this->HookedVtableSize = HookedVtableSize;
+    assert( preemption_enabled() );
+    assert( 0x0 == ( countersNumber & ( countersNumber - 0x1 ) ) );
+    
+    counters = (UInt8*)IOMalloc( countersNumber );
+    assert( counters );
+    if( NULL == counters ){
+        
+        DBG_PRINT_ERROR(( "IOMalloc( %u ) failed for the filter\n", (unsigned int)countersNumber ));
+        return false;
+    }
+    
+    bzero( counters, countersNumber );
+    
+    if( this->FilterCounters )
+        IOFree( this->FilterCounters, this->FilterMask + 0x1 );
+    
+    this->FilterCounters = counters;
+    this->FilterMask = countersNumber - 0x1;
+    
+    for( void* data = ght_first_keysize( this->HashTable, &iterator, &key, &keySize );
+         NULL != data;
+         data = ght_next_keysize( this->HashTable, &iterator, &key, &keySize ) ){
+        
+        UInt32  hash = DldHookedObjectsHashTable::FilterHash( key, keySize );
+        UInt32  step = ( ( hash >> 16 ) | ( hash << 16 ) ) | 0x1;
+        
+        for( unsigned int i = 0x0; i < DLD_HOOK_FILTER_HASHES; ++i ){
+            
+            UInt8*  counter = &this->FilterCounters[ ( hash + i*step ) & this->FilterMask ];
+            
+            if( 0xFF != *counter )
+                *counter += 0x1;
+        }// end for
+        
+    }// end for
+    
+    return true;
 }
 
+#endif//DLD_HOOK_FILTER
+
 //--------------------------------------------------------------------
 
-void
-DldHookerCommonClass::SetInheritanceDepth(
-    __in DldInheritanceDepth   Depth
+bool
+DldHookedObjectsHashTable::AddObject(
+    __in OSObject* obj,
+    __in DldHookedObjectEntry* objEntry,
+    __in bool errorIfPresent
     )
+/*
+ the caller must alloacte space for the entry and
+ free it only after removing the entry from the hash
+ */
 {
-    assert( DldInheritanceDepth_0 == this->InheritanceDepth );
-    this->InheritanceDepth = Depth;
+    GHT_STATUS_CODE RC;
+    
+    assert( DldHookedObjectEntry::DldHookEntryTypeObject == objEntry->Type );
+    assert( objEntry->Parameters.Common.HookedVtableFunctionsInfo );
+#if defined(DBG)
+    assert( current_thread() == this->ExclusiveThread );
+#endif//DBG
+    
+#if defined(DLD_HOOK_INTRUSIVE_ENTRIES)
+    objEntry->Key.Object = obj;
+    RC = ght_insert_intrusive( this->HashTable, &objEntry->HashLink, objEntry, sizeof( objEntry->Key.Object ), &objEntry->Key.Object );
+#else
+    RC = ght_insert( this->HashTable, objEntry, sizeof( obj ), &obj );
+#endif//DLD_HOOK_INTRUSIVE_ENTRIES
+    if( !errorIfPresent && GHT_ALREADY_IN_HASH == RC )
+        return true;
+    
+    assert( GHT_OK == RC );
+    if( GHT_OK != RC ){
+        
+        DBG_PRINT_ERROR( ( "DldHookedObjectsHashTable::AddObject->ght_insert( 0x%p, (OSObject)0x%p ) failed RC = 0x%X\n",
+                          (void*)this->HashTable, (void*)obj, RC ) );
+    } else {
+        
+        objEntry->retain();
+        
+#if defined(DLD_HOOK_FILTER)
+        this->FilterAdd( &obj, sizeof( obj ) );
+#endif//DLD_HOOK_FILTER
+    }
+
+    return ( GHT_OK == RC );
 }
 
 //--------------------------------------------------------------------
 
-void
-DldHookerCommonClass::SetHookedVtableFunctionsInfo(
-    __in DldHookedFunctionInfo* HookedFunctonsInfo,
-    __in unsigned int NumberOfEntries
+bool
+DldHookedObjectsHashTable::AddObject(
+    __in DldHookTypeVtableObjKey* vtableHookObj,
+    __in DldHookedObjectEntry* objEntry,
+    __in bool errorIfPresent
     )
+/*
+ the caller must alloacte space for the entry and
+ free it only after removing the entry from the hash
+ */
 {
-    assert( NULL == this->HookedFunctonsInfo );
-    assert( NULL != HookedFunctonsInfo );
+    GHT_STATUS_CODE RC;
     
-    this->HookedFunctonsInfo = HookedFunctonsInfo;
-    this->HookedFunctonsInfoEntriesNumber = NumberOfEntries;
+    assert( DldHookedObjectEntry::DldHookEntryTypeVtableObj == objEntry->Type );
+    assert( objEntry->Parameters.Common.HookedVtableFunctionsInfo );
+#if defined(DBG)
+    assert( current_thread() == this->ExclusiveThread );
+#endif//DBG
     
-    assert( (unsigned int)(-1) ==  this->HookedFunctonsInfo[ this->HookedFunctonsInfoEntriesNumber - 0x1 ].VtableIndex );
+#if defined(DLD_HOOK_INTRUSIVE_ENTRIES)
+    //
+    // copy the padding too, see Comment 1: in HookVtableIntWoLock()
+    //
+    memcpy( &objEntry->Key.VtableHookObj, vtableHookObj, sizeof( *vtableHookObj ) );
+    RC = ght_insert_intrusive( this->HashTable, &objEntry->HashLink, objEntry, sizeof( objEntry->Key.VtableHookObj ), &objEntry->Key.VtableHookObj );
+#else
+    RC = ght_insert( this->HashTable, objEntry, sizeof( *vtableHookObj ), vtableHookObj );
+#endif//DLD_HOOK_INTRUSIVE_ENTRIES
+    if( !errorIfPresent && GHT_ALREADY_IN_HASH == RC )
+        return true;
+    
+    assert( GHT_OK == RC );
+    if( GHT_OK != RC ){
+        
+        DBG_PRINT_ERROR( ( "DldHookedObjectsHashTable::AddObject->ght_insert( 0x%p, (DldHookTypeVtableObjKey::Object)0x%p ) failed RC = 0x%X\n",
+                          (void*)this->HashTable, (void*)vtableHookObj->Object, RC ) );
+    } else {
+        
+        objEntry->retain();
+        
+#if defined(DLD_HOOK_FILTER)
+        this->FilterAdd( vtableHookObj, sizeof( *vtableHookObj ) );
+#endif//DLD_HOOK_FILTER
+    }    
+    
+    return ( GHT_OK == RC );
 }
 
 //--------------------------------------------------------------------
 
-//
-// called after the original IOService starts successfully,
-// so this si more  a start postcallback!
-//
 bool
-DldHookerCommonClass::start(
-    __in IOService* serviceObject,
-    __in IOService* provider
+DldHookedObjectsHashTable::AddObject(
+    __in DldHookTypeVtableKey* vtableHookVtable,
+    __in DldHookedObjectEntry* objEntry,
+    __in bool errorIfPresent
     )
+/*
+ the caller must alloacte space for the entry and
+ free it only after removing the entry from the hash
+ */
 {
-    assert( NULL != this->ClassHookerObject );
-    assert( NULL != provider );
-    DBG_PRINT( ( "%s->%s::start( object=0x%p ) \n",
-                this->ClassHookerObject->fGetClassName(),
-                serviceObject->getMetaClass()->getClassName(),
-                (void*)serviceObject ) );
+    GHT_STATUS_CODE RC;
     
-    return true;
-}
-
-//--------------------------------------------------------------------
-
-bool DldHookerCommonClass::open(
-    __in IOService*    serviceObject,
-    __in IOService *   forClient,
-    __in IOOptionBits  options,
-    __in void *		   arg )
-{
-    assert( NULL != this->ClassHookerObject );
-    DBG_PRINT( ( "%s->%s::open( object=0x%p ) \n",
-                this->ClassHookerObject->fGetClassName(),
-                serviceObject->getMetaClass()->getClassName(),
-                (void*)serviceObject ) );
-
-    return true;
+    assert( DldHookedObjectEntry::DldHookEntryTypeVtable == objEntry->Type );
+    assert( objEntry->Parameters.Common.HookedVtableFunctionsInfo );
+#if defined(DBG)
+    assert( current_thread() == this->ExclusiveThread );
+#endif//DBG
+    
+    RC = ght_insert( this->HashTable, objEntry, sizeof( *vtableHookVtable ), vtableHookVtable );
+    if( !errorIfPresent && GHT_ALREADY_IN_HASH == RC )
+        return true;
+    
+    assert( GHT_OK == RC );
+    if( GHT_OK != RC ){
+        
+        DBG_PRINT_ERROR( ( "DldHookedObjectsHashTable::AddObject->ght_insert( 0x%p, (DldHookTypeVtableKey::Vtable)0x%p ) failed RC = 0x%X\n",
+                          (void*)this->HashTable, (void*)vtableHookVtable->Vtable, RC ) );
+    } else {
+        
+        objEntry->retain();
+        
+#if defined(DLD_HOOK_FILTER)
+        this->FilterAdd( vtableHookVtable, sizeof( *vtableHookVtable ) );
+#endif//DLD_HOOK_FILTER
+        
+        OSIncrementAtomic( (volatile SInt32*)&DldHookedObjectsHashTable::sVtableGeneration );
+        
+#if defined(DLD_HOOK_REPLICAS)
+        this->ReplicaStale = true;
+        this->ReplicaKeys += 0x1;
+#endif//DLD_HOOK_REPLICAS
+    }
+    
+    return ( GHT_OK == RC );
 }
 
 //--------------------------------------------------------------------
 
-void
-DldHookerCommonClass::free(
-    __in IOService* serviceObject
+DldHookedObjectEntry*
+DldHookedObjectsHashTable::RetrieveOrAddObject(
+    __in DldHookTypeVtableKey* vtableHookVtable,
+    __in DldHookedObjectEntry* objEntry,
+    __out bool* added
     )
+/*
+ the caller must alloacte space for the entry and
+ free it only after removing the entry from the hash,
+ the returned entry is referenced
+ */
 {
-    assert( NULL != this->ClassHookerObject );
-    assert( NULL != serviceObject );
-    DBG_PRINT( ( "%s->%s::free( object=0x%p ) \n",
-                 this->ClassHookerObject->fGetClassName(),
-                 serviceObject->getMetaClass()->getClassName(),
-                 (void*)serviceObject ) );
+    GHT_STATUS_CODE         RC;
+    DldHookedObjectEntry*   entry = NULL;
     
-    this->UnHookObject( serviceObject );
+    assert( DldHookedObjectEntry::DldHookEntryTypeVtable == objEntry->Type );
+    assert( objEntry->Parameters.Common.HookedVtableFunctionsInfo );
+    assert( NULL != vtableHookVtable->metaClass );
+#if defined(DBG)
+    assert( current_thread() == this->ExclusiveThread );
+#endif//DBG
+    
+    *added = false;
+    
+    RC = ght_get_or_insert( this->HashTable, objEntry, sizeof( *vtableHookVtable ), vtableHookVtable, (void**)&entry );
+    if( GHT_ALREADY_IN_HASH == RC ){
+        
+        assert( entry );
+        assert( DldHookedObjectEntry::DldHookEntryTypeVtable == entry->Type );
+        
+        entry->retain();
+        return entry;
+    }
+    
+    assert( GHT_OK == RC );
+    if( GHT_OK != RC ){
+        
+        DBG_PRINT_ERROR( ( "DldHookedObjectsHashTable::RetrieveOrAddObject->ght_get_or_insert( 0x%p, (DldHookTypeVtableKey::Vtable)0x%p ) failed RC = 0x%X\n",
+                          (void*)this->HashTable, (void*)vtableHookVtable->Vtable, RC ) );
+        return NULL;
+    }
+    
+    assert( objEntry == entry );
+    
+    //
+    // a reference for the hash and a reference for the caller
+    //
+    objEntry->retain();
+    objEntry->retain();
+    *added = true;
+    
+#if defined(DLD_HOOK_FILTER)
+    this->FilterAdd( vtableHookVtable, sizeof( *vtableHookVtable ) );
+#endif//DLD_HOOK_FILTER
+    
+    OSIncrementAtomic( (volatile SInt32*)&DldHookedObjectsHashTable::sVtableGeneration );
+    
+#if defined(DLD_HOOK_REPLICAS)
+    this->ReplicaStale = true;
+    this->ReplicaKeys += 0x1;
+#endif//DLD_HOOK_REPLICAS
+    
+    return objEntry;
 }
 
 //--------------------------------------------------------------------
 
+#if defined( DBG )
 bool
-DldHookerCommonClass::requestTerminate(
-    __in IOService* serviceObject,
-    __in IOService* provider,
-    __in IOOptionBits options
+DldHookedObjectsHashTable::AddObject(
+    __in OSMetaClassBase::_ptf_t*    key,
+    __in DldDbgVtableHookToObject*   DbgEntry,
+    __in bool errorIfPresent
     )
+/*
+ the caller must alloacte space for the entry and
+ free it only after removing the entry from the hash
+ */
 {
-    assert( NULL != this->ClassHookerObject );
-    assert( NULL != serviceObject );
-    DBG_PRINT( ( "%s->%s::requestTerminate( object=0x%p, provider=0x%p (%s) ) \n",
-                this->ClassHookerObject->fGetClassName(),
-                serviceObject->getMetaClass()->getClassName(),
-                (void*)serviceObject, (void*)provider,
-                provider->getMetaClass()->getClassName() ) );
+    GHT_STATUS_CODE RC;
     
-    return true;
+#if defined(DBG)
+    assert( current_thread() == this->ExclusiveThread );
+#endif//DBG
+    
+    RC = ght_insert( this->HashTable, DbgEntry, sizeof( key ), &key );
+    if( !errorIfPresent && GHT_ALREADY_IN_HASH == RC )
+        return true;
+    
+    assert( GHT_OK == RC );
+    
+    return ( GHT_OK == RC );
 }
+#endif//#if defined( DBG )
 
 //--------------------------------------------------------------------
 
-bool
-DldHookerCommonClass::willTerminate(
-    __in IOService* serviceObject,
-    __in IOService* provider,
-    __in IOOptionBits options
+DldHookedObjectEntry*
+DldHookedObjectsHashTable::RemoveObject(
+    __in OSObject* obj
     )
 {
-    assert( NULL != this->ClassHookerObject );
-    assert( NULL != serviceObject );
-    DBG_PRINT( ( "%s->%s::willTerminate( object=0x%p, provider=0x%p (%s) ) \n",
-                this->ClassHookerObject->fGetClassName(),
-                serviceObject->getMetaClass()->getClassName(),
-                (void*)serviceObject, (void*)provider,
-                provider->getMetaClass()->getClassName() ) );
+    DldHookedObjectEntry* objEntry;
     
-    return true;
+#if defined(DBG)
+    assert( current_thread() == this->ExclusiveThread );
+#endif//DBG
+    
+    //
+    // the object was referenced by AddObject
+    //
+    objEntry = (DldHookedObjectEntry*)ght_remove( this->HashTable, sizeof( obj ), &obj );
+    if( objEntry ){
+        
+        assert( DldHookedObjectEntry::DldHookEntryTypeObject == objEntry->Type );
+        
+#if defined(DLD_HOOK_FILTER)
+        this->FilterRemove( &obj, sizeof( obj ) );
+#endif//DLD_HOOK_FILTER
+    }
+    
+    return objEntry;
 }
 
 //--------------------------------------------------------------------
 
-bool
-DldHookerCommonClass::didTerminate(
-    __in    IOService* serviceObject,
-    __in    IOService* provider,
-    __in    IOOptionBits options,
-    __inout bool * defer
-   )
+DldHookedObjectEntry*
+DldHookedObjectsHashTable::RemoveObject(
+    __in DldHookTypeVtableObjKey* vtableHookObj
+    )
 {
-    assert( NULL != this->ClassHookerObject );
-    assert( NULL != serviceObject );
-    DBG_PRINT( ( "%s->%s::didTerminate( object=0x%p, provider=0x%p (%s) ) \n",
-                this->ClassHookerObject->fGetClassName(),
-                serviceObject->getMetaClass()->getClassName(),
-                (void*)serviceObject, (void*)provider,
-                provider->getMetaClass()->getClassName() ) );
+    DldHookedObjectEntry* objEntry;
     
-    return true;
+#if defined(DBG)
+    assert( current_thread() == this->ExclusiveThread );
+#endif//DBG
+    
+    //
+    // the object was referenced by AddObject
+    //
+    objEntry = (DldHookedObjectEntry*)ght_remove( this->HashTable, sizeof( *vtableHookObj ), vtableHookObj );
+    if( objEntry ){
+        
+        assert( DldHookedObjectEntry::DldHookEntryTypeVtableObj == objEntry->Type );
+        
+#if defined(DLD_HOOK_FILTER)
+        this->FilterRemove( vtableHookObj, sizeof( *vtableHookObj ) );
+#endif//DLD_HOOK_FILTER
+    }
+    
+    return objEntry;
 }
 
 //--------------------------------------------------------------------
 
-bool
-DldHookerCommonClass::terminate(
-    __in IOService*   serviceObject,
-    __in IOOptionBits options
+DldHookedObjectEntry*
+DldHookedObjectsHashTable::RemoveObject(
+    __in DldHookTypeVtableKey* vtableHookVtable
     )
 {
-    assert( NULL != this->ClassHookerObject );
-    assert( NULL != serviceObject );
-    DBG_PRINT( ( "%s->%s::terminate( object=0x%p ) \n",
-                 this->ClassHookerObject->fGetClassName(),
-                 serviceObject->getMetaClass()->getClassName(),
-                 (void*)serviceObject ) );
+    DldHookedObjectEntry* objEntry;
     
-    return true;
+#if defined(DBG)
+    assert( current_thread() == this->ExclusiveThread );
+#endif//DBG
+    
+    //
+    // the object was referenced by AddObject
+    //
+    objEntry = (DldHookedObjectEntry*)ght_remove( this->HashTable, sizeof( *vtableHookVtable ), vtableHookVtable );
+    if( objEntry ){
+        
+        assert( DldHookedObjectEntry::DldHookEntryTypeVtable == objEntry->Type );
+        
+#if defined(DLD_HOOK_FILTER)
+        this->FilterRemove( vtableHookVtable, sizeof( *vtableHookVtable ) );
+#endif//DLD_HOOK_FILTER
+        
+        OSIncrementAtomic( (volatile SInt32*)&DldHookedObjectsHashTable::sVtableGeneration );
+        
+#if defined(DLD_HOOK_REPLICAS)
+        this->ReplicaStale = true;
+        this->ReplicaKeys -= 0x1;
+#endif//DLD_HOOK_REPLICAS
+    }
+    
+    return objEntry;
 }
 
 //--------------------------------------------------------------------
 
-bool
-DldHookerCommonClass::terminateClient(
-    __in IOService* serviceObject,
-    __in IOService* client,
-    __in IOOptionBits options
+DldHookedObjectEntry*
+DldHookedObjectsHashTable::RetrieveObjectEntry(
+    __in OSObject* obj,
+    __in bool reference
     )
 {
-    assert( NULL != this->ClassHookerObject );
-    assert( NULL != serviceObject );
-    DBG_PRINT( ( "%s->%s::terminateClient( object=0x%p, client=0x%p (%s) ) \n",
-                this->ClassHookerObject->fGetClassName(),
-                serviceObject->getMetaClass()->getClassName(),
-                (void*)serviceObject, (void*)client,
-                client->getMetaClass()->getClassName() ) );
+    DldHookedObjectEntry* objEntry;
     
-    return true;
-}
-
-//--------------------------------------------------------------------
+#if defined(DLD_HOOK_FILTER)
+    if( !this->FilterMayContain( &obj, sizeof( obj ) ) )
+        return NULL;
+#endif//DLD_HOOK_FILTER
     
-bool
-DldHookerCommonClass::finalize(
-    __in IOService* serviceObject,
-    __in IOOptionBits options
-    )
-{
-    assert( NULL != this->ClassHookerObject );
-    assert( NULL != serviceObject );
-    DBG_PRINT( ( "%s->%s::finalize( object=0x%p ) \n",
-                this->ClassHookerObject->fGetClassName(),
-                serviceObject->getMetaClass()->getClassName(),
-                (void*)serviceObject ) );
+    objEntry = (DldHookedObjectEntry*)ght_get_ro( this->HashTable, sizeof( obj ), &obj );
+    if( objEntry ){
+        
+        assert( DldHookedObjectEntry::DldHookEntryTypeObject == objEntry->Type );
+        
+        if( reference )
+            objEntry->retain();
+    }
     
-    return true;
+    return objEntry;
 }
 
 //--------------------------------------------------------------------
 
-bool
-DldHookerCommonClass::attach(
-    __in IOService* serviceObject,
-    __in IOService* provider
+void
+DldHookedObjectsHashTable::RetrieveObjectEntries(
+    __in OSObject** objects,
+    __in unsigned int count,
+    __out DldHookedObjectEntry** entries
     )
-/*
- this function has an idempotent symantic!
- */
 {
-    assert( NULL != this->ClassHookerObject );
-    assert( NULL != serviceObject );
-    DBG_PRINT( ( "%s->%s::attach( object=0x%p, provider=0x%p (%s) ) \n",
-                this->ClassHookerObject->fGetClassName(),
-                serviceObject->getMetaClass()->getClassName(),
-                (void*)serviceObject, (void*)provider,
-                provider->getMetaClass()->getClassName() ) );
+    const void*   keys[ GHT_GET_MANY_BATCH ];
+    unsigned int  batch;
+#if defined(DLD_HOOK_FILTER)
+    void*         found[ GHT_GET_MANY_BATCH ];
+    unsigned int  indices[ GHT_GET_MANY_BATCH ];
+    unsigned int  probed;
+#endif//DLD_HOOK_FILTER
     
-    return true;
+    for( unsigned int base = 0x0; base < count; base += batch ){
+        
+        batch = ( count - base < GHT_GET_MANY_BATCH ) ? ( count - base ) : GHT_GET_MANY_BATCH;
+        
+#if defined(DLD_HOOK_FILTER)
+        //
+        // only the keys passed through the filter are searched in the table
+        //
+        probed = 0x0;
+        for( unsigned int i = 0x0; i < batch; ++i ){
+            
+            entries[ base + i ] = NULL;
+            
+            if( this->FilterMayContain( &objects[ base + i ], sizeof( objects[ 0 ] ) ) ){
+                
+                keys[ probed ] = &objects[ base + i ];
+                indices[ probed ] = base + i;
+                ++probed;
+            }
+        }// end for
+        
+        if( 0x0 != probed ){
+            
+            ght_get_many( this->HashTable, sizeof( objects[ 0 ] ), keys, probed, found );
+            
+            for( unsigned int i = 0x0; i < probed; ++i )
+                entries[ indices[ i ] ] = (DldHookedObjectEntry*)found[ i ];
+        }
+#else
+        //
+        // the key is the object pointer, see AddObject()
+        //
+        for( unsigned int i = 0x0; i < batch; ++i )
+            keys[ i ] = &objects[ base + i ];
+        
+        ght_get_many( this->HashTable, sizeof( objects[ 0 ] ), keys, batch, (void**)&entries[ base ] );
+#endif//DLD_HOOK_FILTER
+        
+    }// end for
+    
+#if defined(DBG)
+    for( unsigned int i = 0x0; i < count; ++i )
+        assert( NULL == entries[ i ] || DldHookedObjectEntry::DldHookEntryTypeObject == entries[ i ]->Type );
+#endif//DBG
 }
 
 //--------------------------------------------------------------------
 
-bool
-DldHookerCommonClass::attachToChild(
-    __in IOService* serviceObject,
-    __in IORegistryEntry * child,
-    __in const IORegistryPlane * plane
+DldHookedObjectEntry*
+DldHookedObjectsHashTable::RetrieveObjectEntry(
+    __in DldHookTypeVtableObjKey* vtableHookObj,
+    __in bool reference
     )
 {
-    assert( NULL != this->ClassHookerObject );
-    assert( NULL != serviceObject );
-    DBG_PRINT( ( "%s->%s::attachToChild( object=0x%p, child=0x%p (%s) ) \n",
-                this->ClassHookerObject->fGetClassName(),
-                serviceObject->getMetaClass()->getClassName(),
-                (void*)serviceObject, (void*)child,
-                child->getMetaClass()->getClassName() ) );
-    
-    if( plane != gIOServicePlane )
-        return true;
-    
-    IOService* childObject;
+    DldHookedObjectEntry* objEntry;
     
-    childObject = OSDynamicCast( IOService, child );
-    if( !childObject )
-        return true;
+    assert( NULL != vtableHookObj->Object && NULL != vtableHookObj->metaClass );
     
+#if defined(DLD_HOOK_FILTER)
     //
-    // attach is an idempotent function
+    // the object entries are absent for the objects of a class hooked only at the vtable level
     //
-    return this->attach( childObject, serviceObject );
+    if( !this->FilterMayContain( vtableHookObj, sizeof( *vtableHookObj ) ) )
+        return NULL;
+#endif//DLD_HOOK_FILTER
+    
+    objEntry = (DldHookedObjectEntry*)ght_get_ro( this->HashTable, sizeof( *vtableHookObj ), vtableHookObj );
+    if( objEntry ){
+        
+        assert( DldHookedObjectEntry::DldHookEntryTypeVtableObj == objEntry->Type );
+        
+        if( reference )
+            objEntry->retain();
+    }
+    
+    return objEntry;
 }
 
 //--------------------------------------------------------------------
 
-void
-DldHookerCommonClass::detach(
-    __in IOService* serviceObject,
-    __in IOService* provider
+DldHookedObjectEntry*
+DldHookedObjectsHashTable::RetrieveObjectEntry(
+    __in DldHookTypeVtableKey* vtableHookVtable,
+    __in bool reference
     )
 {
-    assert( NULL != this->ClassHookerObject );
-    assert( NULL != serviceObject );
-    DBG_PRINT( ( "%s->%s::detach( object=0x%p, provider=0x%p (%s) ) \n",
-                this->ClassHookerObject->fGetClassName(),
-                serviceObject->getMetaClass()->getClassName(),
-                (void*)serviceObject, (void*)provider,
-                provider->getMetaClass()->getClassName() ) );
+    DldHookedObjectEntry* objEntry;
+    
+    assert( NULL != vtableHookVtable->metaClass );
+    
+#if defined(DLD_HOOK_FILTER)
+    if( !this->FilterMayContain( vtableHookVtable, sizeof( *vtableHookVtable ) ) )
+        return NULL;
+#endif//DLD_HOOK_FILTER
+    
+    objEntry = (DldHookedObjectEntry*)ght_get_ro( this->HashTable, sizeof( *vtableHookVtable ), vtableHookVtable );
+    if( objEntry ){
+        
+        assert( DldHookedObjectEntry::DldHookEntryTypeVtable == objEntry->Type );
+        
+        if( reference )
+            objEntry->retain();
+    }
     
+    return objEntry;
 }
-
 //--------------------------------------------------------------------
 
+#if defined(DLD_HOOK_STATS)
+
 void
-DldHookerCommonClass::setPropertyTable(
-    __in IOService* serviceObject,
-    __in OSDictionary * dict
+DldHookedObjectsHashTable::AddSharedLockWait(
+    __in SInt64 waitTime
     )
 {
-    assert( NULL != this->ClassHookerObject );
-    assert( NULL != serviceObject );
-    DBG_PRINT( ( "%s->%s::setProperty1( object=0x%p ) \n",
-                this->ClassHookerObject->fGetClassName(),
-                serviceObject->getMetaClass()->getClassName(),
-                (void*)serviceObject ) );
+    DldHashTableReaderCpu*  readerCpu;
+    unsigned int            cpu;
     
-}
-
-//--------------------------------------------------------------------
-
-bool
-DldHookerCommonClass::setProperty1(
-    __in IOService* serviceObject,
-    __in const OSSymbol * aKey,
-    __in OSObject * anObject
-    )
-{
-    assert( NULL != this->ClassHookerObject );
-    assert( NULL != serviceObject );
-    DBG_PRINT( ( "%s->%s::setProperty1( object=0x%p, aKey=%s ) \n",
-                this->ClassHookerObject->fGetClassName(),
-                serviceObject->getMetaClass()->getClassName(),
-                (void*)serviceObject, aKey->getCStringNoCopy() ) );
+    cpu = (unsigned int)cpu_number();
+    assert( cpu < this->CpusNumber );
+    if( cpu >= this->CpusNumber )
+        return;
     
-    return true;
+    readerCpu = &this->ReaderCpus[ cpu ];
+    
+    OSIncrementAtomic64( &readerCpu->SharedLocks );
+    OSAddAtomic64( waitTime, &readerCpu->SharedWaitTime );
+    UpdateMaximum( &readerCpu->MaxSharedWaitTime, waitTime );
 }
 
 //--------------------------------------------------------------------
 
-bool
-DldHookerCommonClass::setProperty2(
-    __in IOService* serviceObject,
-    __in const OSString * aKey,
-    __in OSObject * anObject
+void
+DldHookedObjectsHashTable::GetStatistics(
+    __out DldHashTableStatistics* statistics
     )
 {
-    assert( NULL != this->ClassHookerObject );
-    assert( NULL != serviceObject );
-    DBG_PRINT( ( "%s->%s::setProperty2( object=0x%p, aKey=%s ) \n",
-                this->ClassHookerObject->fGetClassName(),
-                serviceObject->getMetaClass()->getClassName(),
-                (void*)serviceObject, aKey->getCStringNoCopy() ) );
+    this->LockExclusive();
+    {// start of the lock
+        
+        *statistics = this->Statistics;
+        
+    }// end of the lock
+    this->UnLockExclusive();
     
-    return true;
+    //
+    // the readers' counters are not read atomically as a whole, this is acceptable for statistics
+    //
+    for( unsigned int cpu = 0x0; cpu < this->CpusNumber; ++cpu ){
+        
+        DldHashTableReaderCpu*  readerCpu = &this->ReaderCpus[ cpu ];
+        
+        statistics->SharedLocks += readerCpu->SharedLocks;
+        statistics->SharedWaitTime += readerCpu->SharedWaitTime;
+        if( readerCpu->MaxSharedWaitTime > statistics->MaxSharedWaitTime )
+            statistics->MaxSharedWaitTime = readerCpu->MaxSharedWaitTime;
+        
+        statistics->LockFreeReads += readerCpu->LockFreeReads;
+        statistics->LockFreeReadsFailed += readerCpu->LockFreeReadsFailed;
+        
+    }// end for
 }
 
+#endif//DLD_HOOK_STATS
+
 //--------------------------------------------------------------------
 
-bool
-DldHookerCommonClass::setProperty3(
-    __in IOService* serviceObject,
-    __in const char * aKey,
-    __in OSObject * anObject
+void
+DldHookedObjectsHashTable::GetMemoryUsage(
+    __out DldHashTableMemoryUsage* usage
     )
 {
-    assert( NULL != this->ClassHookerObject );
-    assert( NULL != serviceObject );
-    DBG_PRINT( ( "%s->%s::setProperty3( object=0x%p, aKey=%s ) \n",
-                this->ClassHookerObject->fGetClassName(),
-                serviceObject->getMetaClass()->getClassName(),
-                (void*)serviceObject, aKey ) );
+    bzero( usage, sizeof( *usage ) );
     
-    return true;
+    this->LockShared();
+    {// start of the lock
+        
+        usage->Buckets = ght_table_size( this->HashTable );
+        usage->Items = ght_size( this->HashTable );
+        ght_memory_usage( this->HashTable, &usage->TableBytes, &usage->EntriesBytes );
+        
+        usage->TableBytes += this->CpusNumber*sizeof( DldHashTableReaderCpu );
+        
+#if defined(DLD_HOOK_FILTER)
+        if( NULL != this->FilterCounters )
+            usage->TableBytes += this->FilterMask + 0x1;
+#endif//DLD_HOOK_FILTER
+        
+#if defined(DLD_HOOK_REPLICAS)
+        if( NULL != this->Replica )
+            usage->TableBytes += this->Replica->Size;
+#endif//DLD_HOOK_REPLICAS
+        
+    }// end of the lock
+    this->UnLockShared();
 }
 
 //--------------------------------------------------------------------
 
-bool
-DldHookerCommonClass::setProperty4(
-    __in IOService* serviceObject,
-    __in const char * aKey,
-    __in const char * aString
+void
+DldHookedObjectsHashTable::AddHookerMemoryUsage(
+    __in DldHookerBaseInterface* hooker,
+    __in DldInheritanceDepth depth,
+    __inout DldHookerMemoryUsage* usage
     )
+/*
+ the function walks through the whole table so it is intended
+ for diagnostics, not for a frequent usage
+ */
 {
-    assert( NULL != this->ClassHookerObject );
-    assert( NULL != serviceObject );
-    DBG_PRINT( ( "%s->%s::setProperty4( object=0x%p, aKey=%s ) \n",
-                this->ClassHookerObject->fGetClassName(),
-                serviceObject->getMetaClass()->getClassName(),
-                (void*)serviceObject, aKey ) );
+    ght_iterator_t         iterator;
+    const void*            key;
+    DldHookedObjectEntry*  entry;
     
-    return true;
+    this->LockShared();
+    {// start of the lock
+        
+        //
+        // all entries are DldHookedObjectEntry objects as the DBG only
+        // DldDbgVtableHookToObject entries are not added to the table
+        //
+        for( entry = (DldHookedObjectEntry*)ght_first( this->HashTable, &iterator, &key );
+             NULL != entry;
+             entry = (DldHookedObjectEntry*)ght_next( this->HashTable, &iterator, &key ) ){
+            
+            if( entry->ClassHookerObject != hooker || entry->InheritanceDepth != depth )
+                entry = NULL;
+            
+            //
+            // a vtable entry is also added with a NULL vtable key, account it only once
+            //
+            if( entry &&
+                DldHookedObjectEntry::DldHookEntryTypeVtable == entry->Type &&
+                ((const DldHookTypeVtableKey*)key)->Vtable != entry->Key.VtableHookVtable.Vtable )
+                entry = NULL;
+            
+            if( entry ){
+                
+                if( DldHookedObjectEntry::DldHookEntryTypeVtable == entry->Type )
+                    usage->VtableFunctionsInfoBytes += entry->Parameters.TypeVtable.HookedVtableFunctionsInfoEntriesNumber *
+                                                       sizeof( entry->Parameters.Common.HookedVtableFunctionsInfo[ 0 ] );
+                
+                usage->Entries += 0x1;
+                usage->EntriesBytes += sizeof( *entry );
+            }
+            
+        }// end for
+        
+    }// end of the lock
+    this->UnLockShared();
 }
 
 //--------------------------------------------------------------------
 
-bool
-DldHookerCommonClass::setProperty5(
-    __in IOService* serviceObject,
-    __in const char * aKey,
-    __in bool aBoolean
+#if defined( DBG )
+DldDbgVtableHookToObject*
+DldHookedObjectsHashTable::RetrieveObjectEntry(
+    __in OSMetaClassBase::_ptf_t*    key
     )
 {
-    assert( NULL != this->ClassHookerObject );
-    assert( NULL != serviceObject );
-    DBG_PRINT( ( "%s->%s::setProperty5( object=0x%p, aKey=%s ) \n",
-                this->ClassHookerObject->fGetClassName(),
-                serviceObject->getMetaClass()->getClassName(),
-                (void*)serviceObject, aKey ) );
+    DldDbgVtableHookToObject* dbgEntry;
     
-    return true;
+    dbgEntry = (DldDbgVtableHookToObject*)ght_get_ro( this->HashTable, sizeof( key ), &key );
+        
+    return dbgEntry;
 }
+#endif//#if defined( DBG )
 
 //--------------------------------------------------------------------
 
-bool
-DldHookerCommonClass::setProperty6(
-    __in IOService* serviceObject,
-    __in const char * aKey,
-    __in unsigned long long aValue,
-    __in unsigned int aNumberOfBits
-    )
+DldHookerCommonClass::DldHookerCommonClass()
 {
-    assert( NULL != this->ClassHookerObject );
-    assert( NULL != serviceObject );
-    DBG_PRINT( ( "%s->%s::setProperty6( object=0x%p, aKey=%s ) \n",
-                this->ClassHookerObject->fGetClassName(),
-                serviceObject->getMetaClass()->getClassName(),
-                (void*)serviceObject, aKey ) );
     
-    return true;
-}
-
-//--------------------------------------------------------------------
+    this->ClassHookerObject = NULL;
+    this->OriginalVtable    = NULL;
+    this->HookClassVtable   = NULL;
+    this->HookedObjectsCounter = 0x0;
+    this->HookType = DldHookTypeUnknown;
+    this->HookerId = (UInt32)OSIncrementAtomic( &DldHookerCommonClass::sHookersCounter ) + 0x1;
+    this->Buffer = NULL;
+    this->BufferSize = 0x0;
+    this->PreallocatedEntries = NULL;
+    this->PreallocatedEntriesNumber = 0x0;
+    this->HookedVtables = NULL;
+    this->HookedVtablesSize = 0x0;
+    this->HookedVtablesCount = 0x0;
+#if defined(DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES)
+    this->HookedObjectSlots = NULL;
+    this->HookedObjectSlotsSize = 0x0;
+    this->HookedObjectSlotsUsed = 0x0;
+#endif//DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES
+    this->CallCache = NULL;
+    
+#if defined(DLD_HOOK_STATS)
+    this->CpuStatistics = NULL;
+    this->StatisticsCpusNumber = 0x0;
+#endif//DLD_HOOK_STATS
+    
+};
 
+DldHookerCommonClass::~DldHookerCommonClass()
+{ 
+    if( this->ClassName )
+        this->ClassName->release();
+    
+    if( this->HookedVtables )
+        IOFree( this->HookedVtables, this->HookedVtablesSize*sizeof( this->HookedVtables[ 0 ] ) );
+    
+#if defined(DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES)
+    if( this->HookedObjectSlots )
+        IOFree( this->HookedObjectSlots, this->HookedObjectSlotsSize*sizeof( this->HookedObjectSlots[ 0 ] ) );
+#endif//DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES
+    
+    if( this->CallCache )
+        IOFree( this->CallCache, this->HookedFunctonsInfoEntriesNumber*DLD_CALL_CACHE_WAYS*sizeof( this->CallCache[ 0 ] ) );
+    
+#if defined(DLD_HOOK_STATS)
+    if( this->CpuStatistics )
+        IOFreeAligned( this->CpuStatistics, this->StatisticsCpusNumber*sizeof( DldHookerCpuStatistics ) );
+#endif//DLD_HOOK_STATS
+    
+    assert( 0x0 == this->HookedObjectsCounter );
+};
+
+//--------------------------------------------------------------------
+    
+//
+// saves an object pointer, the object is not referenced
+//
+void
+DldHookerCommonClass::SetClassHookerObject(
+    __in DldHookerBaseInterface*  ClassHookerObject
+   )
+{
+    assert( NULL == this->ClassHookerObject );
+    this->ClassHookerObject = ClassHookerObject;
+}
+
+//--------------------------------------------------------------------
+
+void
+DldHookerCommonClass::SetHookedVtableSize(
+    __in unsigned int HookedVtableSize
+    )
+{
+    assert( 0x0 == this->HookedVtableSize );
+    assert( 0x0 < HookedVtableSize && HookedVtableSize < 0xFFFF );
+    
+    this->HookedVtableSize = HookedVtableSize;
+}
+
+//--------------------------------------------------------------------
+
+void
+DldHookerCommonClass::SetInheritanceDepth(
+    __in DldInheritanceDepth   Depth
+    )
+{
+    assert( DldInheritanceDepth_0 == this->InheritanceDepth );
+    this->InheritanceDepth = Depth;
+}
+
+//--------------------------------------------------------------------
+
+void
+DldHookerCommonClass::SetHookedVtableFunctionsInfo(
+    __in DldHookedFunctionInfo* HookedFunctonsInfo,
+    __in unsigned int NumberOfEntries
+    )
+{
+    assert( NULL == this->HookedFunctonsInfo );
+    assert( NULL != HookedFunctonsInfo );
+    
+    this->HookedFunctonsInfo = HookedFunctonsInfo;
+    this->HookedFunctonsInfoEntriesNumber = NumberOfEntries;
+    
+    assert( (unsigned int)(-1) ==  this->HookedFunctonsInfo[ this->HookedFunctonsInfoEntriesNumber - 0x1 ].VtableIndex );
+    
+    //
+    // the hook type is not known yet, a hooker without the cache works as well
+    //
+    assert( NULL == this->CallCache );
+    this->CallCache = (DldCallCacheEntry*)IOMalloc( this->HookedFunctonsInfoEntriesNumber*DLD_CALL_CACHE_WAYS*sizeof( this->CallCache[ 0 ] ) );
+    assert( this->CallCache );
+    if( this->CallCache )
+        bzero( this->CallCache, this->HookedFunctonsInfoEntriesNumber*DLD_CALL_CACHE_WAYS*sizeof( this->CallCache[ 0 ] ) );
+    
+#if defined(DLD_HOOK_STATS)
+    assert( NULL == this->CpuStatistics );
+    this->StatisticsCpusNumber = (unsigned int)ml_get_max_cpus();
+    this->CpuStatistics = (DldHookerCpuStatistics*)IOMallocAligned( this->StatisticsCpusNumber*sizeof( DldHookerCpuStatistics ),
+                                                                     sizeof( DldHookerCpuStatistics ) );
+    assert( this->CpuStatistics );
+    if( this->CpuStatistics )
+        bzero( this->CpuStatistics, this->StatisticsCpusNumber*sizeof( DldHookerCpuStatistics ) );
+#endif//DLD_HOOK_STATS
+}
+
+//--------------------------------------------------------------------
+
+//
+// called after the original IOService starts successfully,
+// so this si more  a start postcallback!
+//
 bool
-DldHookerCommonClass::setProperty7(
+DldHookerCommonClass::start(
     __in IOService* serviceObject,
-    __in const char * aKey,
-    __in void * bytes,
-    __in unsigned int length
+    __in IOService* provider
     )
 {
     assert( NULL != this->ClassHookerObject );
-    assert( NULL != serviceObject );
-    DBG_PRINT( ( "%s->%s::setProperty7( object=0x%p, aKey=%s ) \n",
+    assert( NULL != provider );
+    DBG_PRINT( ( "%s->%s::start( object=0x%p ) \n",
                 this->ClassHookerObject->fGetClassName(),
                 serviceObject->getMetaClass()->getClassName(),
-                (void*)serviceObject, aKey ) );
+                (void*)serviceObject ) );
     
     return true;
 }
 
 //--------------------------------------------------------------------
 
+bool DldHookerCommonClass::open(
+    __in IOService*    serviceObject,
+    __in IOService *   forClient,
+    __in IOOptionBits  options,
+    __in void *		   arg )
+{
+    assert( NULL != this->ClassHookerObject );
+    DBG_PRINT( ( "%s->%s::open( object=0x%p ) \n",
+                this->ClassHookerObject->fGetClassName(),
+                serviceObject->getMetaClass()->getClassName(),
+                (void*)serviceObject ) );
+
+    return true;
+}
+
+//--------------------------------------------------------------------
+
 void
-DldHookerCommonClass::removeProperty1(
-    __in IOService* serviceObject,
-    __in const OSSymbol * aKey
+DldHookerCommonClass::free(
+    __in IOService* serviceObject
     )
 {
     assert( NULL != this->ClassHookerObject );
     assert( NULL != serviceObject );
-    DBG_PRINT( ( "%s->%s::removeProperty1( object=0x%p, aKey=%s ) \n",
-                this->ClassHookerObject->fGetClassName(),
-                serviceObject->getMetaClass()->getClassName(),
-                (void*)serviceObject, aKey->getCStringNoCopy() ) );
+    DBG_PRINT( ( "%s->%s::free( object=0x%p ) \n",
+                 this->ClassHookerObject->fGetClassName(),
+                 serviceObject->getMetaClass()->getClassName(),
+                 (void*)serviceObject ) );
     
+    this->UnHookObject( serviceObject );
 }
 
 //--------------------------------------------------------------------
 
-void
-DldHookerCommonClass::removeProperty2(
+bool
+DldHookerCommonClass::requestTerminate(
     __in IOService* serviceObject,
-    __in const OSString * aKey
+    __in IOService* provider,
+    __in IOOptionBits options
     )
 {
     assert( NULL != this->ClassHookerObject );
     assert( NULL != serviceObject );
-    DBG_PRINT( ( "%s->%s::removeProperty2( object=0x%p, aKey=%s ) \n",
+    DBG_PRINT( ( "%s->%s::requestTerminate( object=0x%p, provider=0x%p (%s) ) \n",
                 this->ClassHookerObject->fGetClassName(),
                 serviceObject->getMetaClass()->getClassName(),
-                (void*)serviceObject, aKey->getCStringNoCopy() ) );
+                (void*)serviceObject, (void*)provider,
+                provider->getMetaClass()->getClassName() ) );
+    
+    return true;
 }
 
 //--------------------------------------------------------------------
 
-void
-DldHookerCommonClass::removeProperty3(
+bool
+DldHookerCommonClass::willTerminate(
     __in IOService* serviceObject,
-    __in const char * aKey
+    __in IOService* provider,
+    __in IOOptionBits options
     )
 {
     assert( NULL != this->ClassHookerObject );
     assert( NULL != serviceObject );
-    DBG_PRINT( ( "%s->%s::removeProperty3( object=0x%p, aKey=%s ) \n",
+    DBG_PRINT( ( "%s->%s::willTerminate( object=0x%p, provider=0x%p (%s) ) \n",
                 this->ClassHookerObject->fGetClassName(),
                 serviceObject->getMetaClass()->getClassName(),
-                (void*)serviceObject, aKey ) );
+                (void*)serviceObject, (void*)provider,
+                provider->getMetaClass()->getClassName() ) );
+    
+    return true;
 }
 
 //--------------------------------------------------------------------
 
-/*
- an excerpt of the call stack for newUserClient call
- #0  DldHookerCommonClass::newUserClient1 (this=0x59fdc08, serviceObject=0x5571200, owningTask=0xc5419c4, securityID=0xc5419c4, type=0, properties=0x0, handler=0x318a3d08) at /work/DeviceLockProject/DeviceLockIOKitDriver/DldHookerCommonClass.cpp:1413
- #1  0x463f5e1f in DldHookerCommonClass2<IOServiceDldHook2<(_DldInheritanceDepth)1>, IOService>::newUserClient1_hook (this=0x5571200, owningTask=0xc5419c4, securityID=0xc5419c4, type=0, properties=0x0, handler=0x318a3d08) at DldHookerCommonClass2.h:1608
- #2  0x0064ae67 in is_io_service_open_extended (_service=0x5571200, owningTask=0xc5419c4, connect_type=0, ndr={mig_vers = 0 '\0', if_vers = 0 '\0', reserved1 = 0 '\0', mig_encoding = 0 '\0', int_rep = 1 '\001', char_rep = 0 '\0', float_rep = 0 '\0', reserved2 = 0 '\0'}, properties=0x0, propertiesCnt=0, result=0xc71c5b8, connection=0x318a3d80) at /work/Mac_OS_X_kernel/10_6_4/xnu-1504.7.4/iokit/Kernel/IOUserClient.cpp:2395
- #3  0x002c1bbb in _Xio_service_open_extended (InHeadP=0x6c17568, OutHeadP=0xc71c584) at device/device_server.c:14130
- #4  0x00226d74 in ipc_kobject_server (request=0x6c17500) at /work/Mac_OS_X_kernel/10_6_4/xnu-1504.7.4/osfmk/kern/ipc_kobject.c:339
- #5  0x002126b1 in ipc_kmsg_send (kmsg=0x6c17500, option=0, send_timeout=0) at /work/Mac_OS_X_kernel/10_6_4/xnu-1504.7.4/osfmk/ipc/ipc_kmsg.c:1371
- #6  0x0021e193 in mach_msg_overwrite_trap (args=0x719d4c8) at /work/Mac_OS_X_kernel/10_6_4/xnu-1504.7.4/osfmk/ipc/mach_msg.c:505
- #7  0x0021e37d in mach_msg_trap (args=0x719d4c8) at /work/Mac_OS_X_kernel/10_6_4/xnu-1504.7.4/osfmk/ipc/mach_msg.c:572
- #8  0x002d8b06 in mach_call_munger64 (state=0x719d4c4) at /work/Mac_OS_X_kernel/10_6_4/xnu-1504.7.4/osfmk/i386/bsd_i386.c:765 
- */
-IOReturn
-DldHookerCommonClass::newUserClient1( __in IOService* serviceObject, task_t owningTask, void * securityID,
-                                     UInt32 type,  OSDictionary * properties, IOUserClient ** handler )
+bool
+DldHookerCommonClass::didTerminate(
+    __in    IOService* serviceObject,
+    __in    IOService* provider,
+    __in    IOOptionBits options,
+    __inout bool * defer
+   )
 {
+    assert( NULL != this->ClassHookerObject );
+    assert( NULL != serviceObject );
+    DBG_PRINT( ( "%s->%s::didTerminate( object=0x%p, provider=0x%p (%s) ) \n",
+                this->ClassHookerObject->fGetClassName(),
+                serviceObject->getMetaClass()->getClassName(),
+                (void*)serviceObject, (void*)provider,
+                provider->getMetaClass()->getClassName() ) );
     
-    return kIOReturnSuccess;
+    return true;
 }
 
 //--------------------------------------------------------------------
 
 bool
-DldHookerCommonClass::ObjectFirstPublishCallback(
-    __in IOService* newService
+DldHookerCommonClass::terminate(
+    __in IOService*   serviceObject,
+    __in IOOptionBits options
     )
 {
-    DBG_PRINT( ( "%s->DldHookerCommonClass::ObjectFirstPublishCallback( object=0x%p ) \n",
-                this->ClassHookerObject->fGetClassName(),
-                (void*)newService ) );
+    assert( NULL != this->ClassHookerObject );
+    assert( NULL != serviceObject );
+    DBG_PRINT( ( "%s->%s::terminate( object=0x%p ) \n",
+                 this->ClassHookerObject->fGetClassName(),
+                 serviceObject->getMetaClass()->getClassName(),
+                 (void*)serviceObject ) );
+    
+    this->ClassHookerObject->fObjectTerminated( serviceObject );
     
     return true;
 }
@@ -1051,39 +1681,386 @@ DldHookerCommonClass::ObjectFirstPublishCallback(
 //--------------------------------------------------------------------
 
 bool
-DldHookerCommonClass::ObjectTerminatedCallback(
-    __in IOService* terminatedService
+DldHookerCommonClass::terminateClient(
+    __in IOService* serviceObject,
+    __in IOService* client,
+    __in IOOptionBits options
     )
 {
-    DBG_PRINT( ( "%s->DldHookerCommonClass::ObjectTerminatedCallback( object=0x%p ) \n",
+    assert( NULL != this->ClassHookerObject );
+    assert( NULL != serviceObject );
+    DBG_PRINT( ( "%s->%s::terminateClient( object=0x%p, client=0x%p (%s) ) \n",
                 this->ClassHookerObject->fGetClassName(),
-                (void*)terminatedService ) );
+                serviceObject->getMetaClass()->getClassName(),
+                (void*)serviceObject, (void*)client,
+                client->getMetaClass()->getClassName() ) );
     
     return true;
 }
 
 //--------------------------------------------------------------------
+    
+bool
+DldHookerCommonClass::finalize(
+    __in IOService* serviceObject,
+    __in IOOptionBits options
+    )
+{
+    assert( NULL != this->ClassHookerObject );
+    assert( NULL != serviceObject );
+    DBG_PRINT( ( "%s->%s::finalize( object=0x%p ) \n",
+                this->ClassHookerObject->fGetClassName(),
+                serviceObject->getMetaClass()->getClassName(),
+                (void*)serviceObject ) );
+    
+    return true;
+}
 
-//static bool gEnterDebugger = false;
+//--------------------------------------------------------------------
 
-void
-DldHookerCommonClass::DldHookVtableFunctions(
-    __in    OSObject*                     object,
-    __inout DldHookedFunctionInfo*        HookedFunctonsInfo,
-    __inout OSMetaClassBase::_ptf_t*      VtableToHook,
-    __inout OSMetaClassBase::_ptf_t*      NewVtable
-)
+bool
+DldHookerCommonClass::attach(
+    __in IOService* serviceObject,
+    __in IOService* provider
+    )
+/*
+ this function has an idempotent symantic!
+ */
 {
+    assert( NULL != this->ClassHookerObject );
+    assert( NULL != serviceObject );
+    DBG_PRINT( ( "%s->%s::attach( object=0x%p, provider=0x%p (%s) ) \n",
+                this->ClassHookerObject->fGetClassName(),
+                serviceObject->getMetaClass()->getClassName(),
+                (void*)serviceObject, (void*)provider,
+                provider->getMetaClass()->getClassName() ) );
     
-    DldHookedFunctionInfo* PtrHookInfo = HookedFunctonsInfo;
-    
-    while( (unsigned int)(-1) != PtrHookInfo->VtableIndex ){
-        
-        assert( 0x0  != PtrHookInfo->VtableIndex );
-        assert( NULL != PtrHookInfo->HookingFunction );
-        assert( NULL == PtrHookInfo->OriginalFunction );
-        
-        unsigned int   Bytes;
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+bool
+DldHookerCommonClass::attachToChild(
+    __in IOService* serviceObject,
+    __in IORegistryEntry * child,
+    __in const IORegistryPlane * plane
+    )
+{
+    assert( NULL != this->ClassHookerObject );
+    assert( NULL != serviceObject );
+    DBG_PRINT( ( "%s->%s::attachToChild( object=0x%p, child=0x%p (%s) ) \n",
+                this->ClassHookerObject->fGetClassName(),
+                serviceObject->getMetaClass()->getClassName(),
+                (void*)serviceObject, (void*)child,
+                child->getMetaClass()->getClassName() ) );
+    
+    if( plane != gIOServicePlane )
+        return true;
+    
+    IOService* childObject;
+    
+    childObject = OSDynamicCast( IOService, child );
+    if( !childObject )
+        return true;
+    
+    //
+    // attach is an idempotent function
+    //
+    return this->attach( childObject, serviceObject );
+}
+
+//--------------------------------------------------------------------
+
+void
+DldHookerCommonClass::detach(
+    __in IOService* serviceObject,
+    __in IOService* provider
+    )
+{
+    assert( NULL != this->ClassHookerObject );
+    assert( NULL != serviceObject );
+    DBG_PRINT( ( "%s->%s::detach( object=0x%p, provider=0x%p (%s) ) \n",
+                this->ClassHookerObject->fGetClassName(),
+                serviceObject->getMetaClass()->getClassName(),
+                (void*)serviceObject, (void*)provider,
+                provider->getMetaClass()->getClassName() ) );
+    
+}
+
+//--------------------------------------------------------------------
+
+void
+DldHookerCommonClass::setPropertyTable(
+    __in IOService* serviceObject,
+    __in OSDictionary * dict
+    )
+{
+    assert( NULL != this->ClassHookerObject );
+    assert( NULL != serviceObject );
+    DBG_PRINT( ( "%s->%s::setProperty1( object=0x%p ) \n",
+                this->ClassHookerObject->fGetClassName(),
+                serviceObject->getMetaClass()->getClassName(),
+                (void*)serviceObject ) );
+    
+}
+
+//--------------------------------------------------------------------
+
+bool
+DldHookerCommonClass::setProperty1(
+    __in IOService* serviceObject,
+    __in const OSSymbol * aKey,
+    __in OSObject * anObject
+    )
+{
+    assert( NULL != this->ClassHookerObject );
+    assert( NULL != serviceObject );
+    DBG_PRINT( ( "%s->%s::setProperty1( object=0x%p, aKey=%s ) \n",
+                this->ClassHookerObject->fGetClassName(),
+                serviceObject->getMetaClass()->getClassName(),
+                (void*)serviceObject, aKey->getCStringNoCopy() ) );
+    
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+bool
+DldHookerCommonClass::setProperty2(
+    __in IOService* serviceObject,
+    __in const OSString * aKey,
+    __in OSObject * anObject
+    )
+{
+    assert( NULL != this->ClassHookerObject );
+    assert( NULL != serviceObject );
+    DBG_PRINT( ( "%s->%s::setProperty2( object=0x%p, aKey=%s ) \n",
+                this->ClassHookerObject->fGetClassName(),
+                serviceObject->getMetaClass()->getClassName(),
+                (void*)serviceObject, aKey->getCStringNoCopy() ) );
+    
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+bool
+DldHookerCommonClass::setProperty3(
+    __in IOService* serviceObject,
+    __in const char * aKey,
+    __in OSObject * anObject
+    )
+{
+    assert( NULL != this->ClassHookerObject );
+    assert( NULL != serviceObject );
+    DBG_PRINT( ( "%s->%s::setProperty3( object=0x%p, aKey=%s ) \n",
+                this->ClassHookerObject->fGetClassName(),
+                serviceObject->getMetaClass()->getClassName(),
+                (void*)serviceObject, aKey ) );
+    
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+bool
+DldHookerCommonClass::setProperty4(
+    __in IOService* serviceObject,
+    __in const char * aKey,
+    __in const char * aString
+    )
+{
+    assert( NULL != this->ClassHookerObject );
+    assert( NULL != serviceObject );
+    DBG_PRINT( ( "%s->%s::setProperty4( object=0x%p, aKey=%s ) \n",
+                this->ClassHookerObject->fGetClassName(),
+                serviceObject->getMetaClass()->getClassName(),
+                (void*)serviceObject, aKey ) );
+    
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+bool
+DldHookerCommonClass::setProperty5(
+    __in IOService* serviceObject,
+    __in const char * aKey,
+    __in bool aBoolean
+    )
+{
+    assert( NULL != this->ClassHookerObject );
+    assert( NULL != serviceObject );
+    DBG_PRINT( ( "%s->%s::setProperty5( object=0x%p, aKey=%s ) \n",
+                this->ClassHookerObject->fGetClassName(),
+                serviceObject->getMetaClass()->getClassName(),
+                (void*)serviceObject, aKey ) );
+    
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+bool
+DldHookerCommonClass::setProperty6(
+    __in IOService* serviceObject,
+    __in const char * aKey,
+    __in unsigned long long aValue,
+    __in unsigned int aNumberOfBits
+    )
+{
+    assert( NULL != this->ClassHookerObject );
+    assert( NULL != serviceObject );
+    DBG_PRINT( ( "%s->%s::setProperty6( object=0x%p, aKey=%s ) \n",
+                this->ClassHookerObject->fGetClassName(),
+                serviceObject->getMetaClass()->getClassName(),
+                (void*)serviceObject, aKey ) );
+    
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+bool
+DldHookerCommonClass::setProperty7(
+    __in IOService* serviceObject,
+    __in const char * aKey,
+    __in void * bytes,
+    __in unsigned int length
+    )
+{
+    assert( NULL != this->ClassHookerObject );
+    assert( NULL != serviceObject );
+    DBG_PRINT( ( "%s->%s::setProperty7( object=0x%p, aKey=%s ) \n",
+                this->ClassHookerObject->fGetClassName(),
+                serviceObject->getMetaClass()->getClassName(),
+                (void*)serviceObject, aKey ) );
+    
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+void
+DldHookerCommonClass::removeProperty1(
+    __in IOService* serviceObject,
+    __in const OSSymbol * aKey
+    )
+{
+    assert( NULL != this->ClassHookerObject );
+    assert( NULL != serviceObject );
+    DBG_PRINT( ( "%s->%s::removeProperty1( object=0x%p, aKey=%s ) \n",
+                this->ClassHookerObject->fGetClassName(),
+                serviceObject->getMetaClass()->getClassName(),
+                (void*)serviceObject, aKey->getCStringNoCopy() ) );
+    
+}
+
+//--------------------------------------------------------------------
+
+void
+DldHookerCommonClass::removeProperty2(
+    __in IOService* serviceObject,
+    __in const OSString * aKey
+    )
+{
+    assert( NULL != this->ClassHookerObject );
+    assert( NULL != serviceObject );
+    DBG_PRINT( ( "%s->%s::removeProperty2( object=0x%p, aKey=%s ) \n",
+                this->ClassHookerObject->fGetClassName(),
+                serviceObject->getMetaClass()->getClassName(),
+                (void*)serviceObject, aKey->getCStringNoCopy() ) );
+}
+
+//--------------------------------------------------------------------
+
+void
+DldHookerCommonClass::removeProperty3(
+    __in IOService* serviceObject,
+    __in const char * aKey
+    )
+{
+    assert( NULL != this->ClassHookerObject );
+    assert( NULL != serviceObject );
+    DBG_PRINT( ( "%s->%s::removeProperty3( object=0x%p, aKey=%s ) \n",
+                this->ClassHookerObject->fGetClassName(),
+                serviceObject->getMetaClass()->getClassName(),
+                (void*)serviceObject, aKey ) );
+}
+
+//--------------------------------------------------------------------
+
+/*
+ an excerpt of the call stack for newUserClient call
+ #0  DldHookerCommonClass::newUserClient1 (this=0x59fdc08, serviceObject=0x5571200, owningTask=0xc5419c4, securityID=0xc5419c4, type=0, properties=0x0, handler=0x318a3d08) at /work/DeviceLockProject/DeviceLockIOKitDriver/DldHookerCommonClass.cpp:1413
+ #1  0x463f5e1f in DldHookerCommonClass2<IOServiceDldHook2<(_DldInheritanceDepth)1>, IOService>::newUserClient1_hook (this=0x5571200, owningTask=0xc5419c4, securityID=0xc5419c4, type=0, properties=0x0, handler=0x318a3d08) at DldHookerCommonClass2.h:1608
+ #2  0x0064ae67 in is_io_service_open_extended (_service=0x5571200, owningTask=0xc5419c4, connect_type=0, ndr={mig_vers = 0 '\0', if_vers = 0 '\0', reserved1 = 0 '\0', mig_encoding = 0 '\0', int_rep = 1 '\001', char_rep = 0 '\0', float_rep = 0 '\0', reserved2 = 0 '\0'}, properties=0x0, propertiesCnt=0, result=0xc71c5b8, connection=0x318a3d80) at /work/Mac_OS_X_kernel/10_6_4/xnu-1504.7.4/iokit/Kernel/IOUserClient.cpp:2395
+ #3  0x002c1bbb in _Xio_service_open_extended (InHeadP=0x6c17568, OutHeadP=0xc71c584) at device/device_server.c:14130
+ #4  0x00226d74 in ipc_kobject_server (request=0x6c17500) at /work/Mac_OS_X_kernel/10_6_4/xnu-1504.7.4/osfmk/kern/ipc_kobject.c:339
+ #5  0x002126b1 in ipc_kmsg_send (kmsg=0x6c17500, option=0, send_timeout=0) at /work/Mac_OS_X_kernel/10_6_4/xnu-1504.7.4/osfmk/ipc/ipc_kmsg.c:1371
+ #6  0x0021e193 in mach_msg_overwrite_trap (args=0x719d4c8) at /work/Mac_OS_X_kernel/10_6_4/xnu-1504.7.4/osfmk/ipc/mach_msg.c:505
+ #7  0x0021e37d in mach_msg_trap (args=0x719d4c8) at /work/Mac_OS_X_kernel/10_6_4/xnu-1504.7.4/osfmk/ipc/mach_msg.c:572
+ #8  0x002d8b06 in mach_call_munger64 (state=0x719d4c4) at /work/Mac_OS_X_kernel/10_6_4/xnu-1504.7.4/osfmk/i386/bsd_i386.c:765 
+ */
+IOReturn
+DldHookerCommonClass::newUserClient1( __in IOService* serviceObject, task_t owningTask, void * securityID,
+                                     UInt32 type,  OSDictionary * properties, IOUserClient ** handler )
+{
+    
+    return kIOReturnSuccess;
+}
+
+//--------------------------------------------------------------------
+
+bool
+DldHookerCommonClass::ObjectFirstPublishCallback(
+    __in IOService* newService
+    )
+{
+    DBG_PRINT( ( "%s->DldHookerCommonClass::ObjectFirstPublishCallback( object=0x%p ) \n",
+                this->ClassHookerObject->fGetClassName(),
+                (void*)newService ) );
+    
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+bool
+DldHookerCommonClass::ObjectTerminatedCallback(
+    __in IOService* terminatedService
+    )
+{
+    DBG_PRINT( ( "%s->DldHookerCommonClass::ObjectTerminatedCallback( object=0x%p ) \n",
+                this->ClassHookerObject->fGetClassName(),
+                (void*)terminatedService ) );
+    
+    return true;
+}
+
+//--------------------------------------------------------------------
+
+//static bool gEnterDebugger = false;
+
+void
+DldHookerCommonClass::DldHookVtableFunctions(
+    __in    OSObject*                     object,
+    __inout DldHookedFunctionInfo*        HookedFunctonsInfo,
+    __inout OSMetaClassBase::_ptf_t*      VtableToHook,
+    __inout OSMetaClassBase::_ptf_t*      NewVtable
+)
+{
+    
+    DldHookedFunctionInfo* PtrHookInfo = HookedFunctonsInfo;
+    
+    while( (unsigned int)(-1) != PtrHookInfo->VtableIndex ){
+        
+        assert( 0x0  != PtrHookInfo->VtableIndex );
+        assert( NULL != PtrHookInfo->HookingFunction );
+        assert( NULL == PtrHookInfo->OriginalFunction );
+        
+        unsigned int   Bytes;
         
 #if defined( DBG )
         /*
@@ -1220,6 +2197,244 @@ DldHookerCommonClass::GetOriginalFunction(
     __in OSObject* hookedObject,
     __in unsigned int indx
     )
+{
+    DldHookTraceCallback  traceCallback = gHookTraceCallback;
+    
+    if( traceCallback )
+        traceCallback( DldHookTraceEventCall, this, hookedObject, indx );
+    
+#if defined(DLD_HOOK_STATS)
+    
+    OSMetaClassBase::_ptf_t    OriginalFunction;
+    DldHookerCallStatistics*   statistics;
+    uint64_t                   startTime;
+    uint64_t                   endTime;
+    
+    clock_get_uptime( &startTime );
+    
+    OriginalFunction = this->GetOriginalFunctionCached( hookedObject, indx );
+    
+    clock_get_uptime( &endTime );
+    
+    statistics = this->GetCpuStatistics();
+    if( NULL == statistics )
+        return OriginalFunction;
+    
+    if( DldHookTypeObject == this->HookType ){
+        
+        OSIncrementAtomic64( &statistics->ObjectCalls );
+        OSAddAtomic64( (SInt64)( endTime - startTime ), &statistics->ObjectTime );
+        
+    } else {
+        
+        OSIncrementAtomic64( &statistics->VtableCalls );
+        OSAddAtomic64( (SInt64)( endTime - startTime ), &statistics->VtableTime );
+    }
+    
+    return OriginalFunction;
+    
+#else
+    
+    return this->GetOriginalFunctionCached( hookedObject, indx );
+    
+#endif//DLD_HOOK_STATS
+}
+
+//--------------------------------------------------------------------
+
+OSMetaClassBase::_ptf_t
+DldHookerCommonClass::GetOriginalFunctionCached(
+    __in OSObject* hookedObject,
+    __in unsigned int indx
+    )
+/*
+ a direct vtable hook's original function is defined by the object's vtable,
+ the cache skips GetOriginalFunctionInt() for the recently seen vtables
+ */
+{
+    DldSingleInheritingClassObjectPtr  ObjU;
+    OSMetaClassBase::_ptf_t*           vtable;
+    OSMetaClassBase::_ptf_t            OriginalFunction;
+    DldCallCacheEntry*                 ways;
+    UInt32                             generation;
+    UInt32                             sequence;
+    unsigned int                       way;
+    
+    if( DldHookTypeVtable != this->HookType || NULL == this->CallCache )
+        return this->GetOriginalFunctionInt( hookedObject, indx );
+    
+    assert( indx < this->HookedFunctonsInfoEntriesNumber );
+    
+    ObjU.fObj = hookedObject;
+    vtable = *ObjU.vtablep;
+    ways = &this->CallCache[ indx*DLD_CALL_CACHE_WAYS ];
+    
+    //
+    // the generation is read before the lookup so an entry filled with a result
+    // which is concurrent with a hook or unhook is invalidated by the change,
+    // the x86 doesn't reorder loads so the compiler barriers are enough
+    //
+    generation = DldHookedObjectsHashTable::sVtableGeneration;
+    DldCompilerBarrier();
+    
+    for( way = 0x0; way < DLD_CALL_CACHE_WAYS; ++way ){
+        
+        sequence = ways[ way ].Sequence;
+        DldCompilerBarrier();
+        
+        if( 0x0 == ( sequence & 0x1 ) && vtable == ways[ way ].Vtable && generation == ways[ way ].Generation ){
+            
+            OriginalFunction = ways[ way ].OriginalFunction;
+            DldCompilerBarrier();
+            
+            if( sequence == ways[ way ].Sequence ){
+                
+#if defined(DLD_HOOK_STATS)
+                DldHookerCallStatistics*  statistics = this->GetCpuStatistics();
+                
+                if( statistics )
+                    OSIncrementAtomic64( &statistics->CallCacheHits );
+#endif//DLD_HOOK_STATS
+                assert( OriginalFunction );
+                return OriginalFunction;
+            }
+        }
+    }// end for
+    
+#if defined(DLD_HOOK_STATS)
+    DldHookerCallStatistics*  statistics = this->GetCpuStatistics();
+    
+    if( statistics )
+        OSIncrementAtomic64( &statistics->CallCacheMisses );
+#endif//DLD_HOOK_STATS
+    
+    OriginalFunction = this->GetOriginalFunctionInt( hookedObject, indx );
+    if( NULL == OriginalFunction )
+        return OriginalFunction;
+    
+    //
+    // replace a stale way or the vtable's way, a concurrent filler wins
+    //
+    way = (unsigned int)( ( (uintptr_t)vtable >> 0x4 ) % DLD_CALL_CACHE_WAYS );
+    for( unsigned int i = 0x0; i < DLD_CALL_CACHE_WAYS; ++i ){
+        
+        if( generation != ways[ i ].Generation ){
+            
+            way = i;
+            break;
+        }
+    }// end for
+    
+    sequence = ways[ way ].Sequence;
+    if( 0x0 == ( sequence & 0x1 ) && OSCompareAndSwap( sequence, sequence + 0x1, &ways[ way ].Sequence ) ){
+        
+        ways[ way ].Generation = generation;
+        ways[ way ].Vtable = vtable;
+        ways[ way ].OriginalFunction = OriginalFunction;
+        
+        DldCompilerBarrier();
+        ways[ way ].Sequence = sequence + 0x2;
+    }
+    
+    return OriginalFunction;
+}
+
+//--------------------------------------------------------------------
+
+#if defined(DLD_HOOK_STATS)
+
+DldHookerCallStatistics*
+DldHookerCommonClass::GetCpuStatistics()
+{
+    unsigned int  cpu;
+    
+    if( NULL == this->CpuStatistics )
+        return NULL;
+    
+    cpu = (unsigned int)cpu_number();
+    assert( cpu < this->StatisticsCpusNumber );
+    if( cpu >= this->StatisticsCpusNumber )
+        return NULL;
+    
+    return &this->CpuStatistics[ cpu ].Statistics;
+}
+
+//--------------------------------------------------------------------
+
+void
+DldHookerCommonClass::GetCallStatistics(
+    __out DldHookerCallStatistics* statistics
+    )
+{
+    bzero( statistics, sizeof( *statistics ) );
+    
+    if( NULL == this->CpuStatistics )
+        return;
+    
+    //
+    // the counters are not read atomically as a whole, this is acceptable for statistics
+    //
+    for( unsigned int cpu = 0x0; cpu < this->StatisticsCpusNumber; ++cpu ){
+        
+        DldHookerCallStatistics*  cpuStatistics = &this->CpuStatistics[ cpu ].Statistics;
+        
+        statistics->ObjectCalls += cpuStatistics->ObjectCalls;
+        statistics->ObjectTime += cpuStatistics->ObjectTime;
+        statistics->VtableCalls += cpuStatistics->VtableCalls;
+        statistics->VtableTime += cpuStatistics->VtableTime;
+        statistics->VtableSuperCalls += cpuStatistics->VtableSuperCalls;
+        statistics->CallCacheHits += cpuStatistics->CallCacheHits;
+        statistics->CallCacheMisses += cpuStatistics->CallCacheMisses;
+        
+    }// end for
+}
+
+#endif//DLD_HOOK_STATS
+
+//--------------------------------------------------------------------
+
+void
+DldHookerCommonClass::GetMemoryUsage(
+    __out DldHookerMemoryUsage* usage
+    )
+{
+    bzero( usage, sizeof( *usage ) );
+    
+    usage->HookedObjects = this->HookedObjectsCounter;
+    usage->VtableBufferBytes = ( NULL != this->Buffer ) ? this->BufferSize : 0x0;
+    usage->VtableFunctionsInfoBytes = this->HookedVtablesSize*sizeof( this->HookedVtables[ 0 ] );
+    
+    if( NULL != this->CallCache )
+        usage->VtableFunctionsInfoBytes += this->HookedFunctonsInfoEntriesNumber*DLD_CALL_CACHE_WAYS*sizeof( this->CallCache[ 0 ] );
+    
+#if defined(DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES)
+    usage->VtableFunctionsInfoBytes += this->HookedObjectSlotsSize*sizeof( this->HookedObjectSlots[ 0 ] );
+#endif//DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES
+    
+#if defined(DLD_HOOK_STATS)
+    if( NULL != this->CpuStatistics )
+        usage->VtableFunctionsInfoBytes += this->StatisticsCpusNumber*sizeof( DldHookerCpuStatistics );
+#endif//DLD_HOOK_STATS
+    
+    //
+    // a hooker which has not hooked any object has no entries
+    //
+    if( NULL != this->ClassHookerObject && NULL != DldHookedObjectsHashTable::sHashTable )
+        DldHookedObjectsHashTable::sHashTable->AddHookerMemoryUsage( this->ClassHookerObject, this->InheritanceDepth, usage );
+}
+
+//--------------------------------------------------------------------
+
+//
+// the number of the lock free reads before the shared lock is taken
+//
+#define DLD_LOCK_FREE_READ_ATTEMPTS  (0x3)
+
+OSMetaClassBase::_ptf_t
+DldHookerCommonClass::GetOriginalFunctionInt(
+    __in OSObject* hookedObject,
+    __in unsigned int indx
+    )
 {   
     
     assert( this->HookedFunctonsInfo );
@@ -1249,6 +2464,30 @@ DldHookerCommonClass::GetOriginalFunction(
     //
     assert( NULL == this->HookedFunctonsInfo[ indx ].OriginalFunction );
     
+    //
+    // a call through a vtable hooked by this hooker, i.e. not a super::Foo() call
+    //
+    {
+        DldSingleInheritingClassObjectPtr  ObjU;
+        DldHashTableReadState              readState;
+        DldHookedFunctionInfo*             HookedVtableFunctionsInfo;
+        
+        ObjU.fObj = hookedObject;
+        
+        if( DldHookedObjectsHashTable::sHashTable->ReadBegin( &readState ) ){
+            
+            HookedVtableFunctionsInfo = this->RetrieveHookedVtable( *ObjU.vtablep );
+            if( NULL != HookedVtableFunctionsInfo )
+                OriginalFunction = HookedVtableFunctionsInfo[ indx ].OriginalFunction;
+            
+            if( DldHookedObjectsHashTable::sHashTable->ReadEnd( &readState ) && NULL != HookedVtableFunctionsInfo ){
+                
+                assert( OriginalFunction );
+                return OriginalFunction;
+            }
+        }// end if( ReadBegin )
+    }
+    
     //
     // the class doesn't contain the original functons, it is pretty normal
     // if for example a vtable was hooked directly instead of vtable
@@ -1258,14 +2497,12 @@ DldHookerCommonClass::GetOriginalFunction(
     //
     // check the cache table
     //
-    DldSingleInheritingClassObjectPtr ObjU;
     const OSMetaClass*  objectMetaClass;
     const OSMetaClass*  hookedMetaClass;
     const OSMetaClass*  parentMetaClass;
     const OSMetaClass*  keyMetaClass;
     unsigned int currentObjectDepth;
     
-    ObjU.fObj = hookedObject;
     objectMetaClass = hookedObject->getMetaClass();
     assert( objectMetaClass );
     
@@ -1394,6 +2631,13 @@ DldHookerCommonClass::GetOriginalFunction(
         
         assert( objectMetaClass != parentMetaClass );
         
+#if defined(DLD_HOOK_STATS)
+        DldHookerCallStatistics*  statistics = this->GetCpuStatistics();
+        
+        if( statistics )
+            OSIncrementAtomic64( &statistics->VtableSuperCalls );
+#endif//DLD_HOOK_STATS
+        
     } else {
         
         //
@@ -1405,85 +2649,155 @@ DldHookerCommonClass::GetOriginalFunction(
         keyMetaClass = objectMetaClass;
     }
     
-    assert( keyMetaClass == parentMetaClass );
+    assert( keyMetaClass == parentMetaClass );
+    
+    //
+    // the lock free read is retried if a writer has changed the table, the shared
+    // lock is taken if a writer is active as the hooking can take a long time
+    //
+    DldHashTableReadState  readState;
+    bool                   retrieved = false;
+    
+    for( unsigned int attempt = 0x0; !retrieved && attempt < DLD_LOCK_FREE_READ_ATTEMPTS; ++attempt ){
+        
+        if( !DldHookedObjectsHashTable::sHashTable->ReadBegin( &readState ) )
+            break;
+        
+#if defined(DLD_HOOK_REPLICAS)
+        //
+        // a leaf call is resolved by the object's vtable and a super::Foo() call by the
+        // NULL vtable key, the same as RetrieveOriginalFunction() does if there is no
+        // object entry, an object entry shares the functions array with the entry for
+        // the vtable it had when it was hooked, so the result is the same until
+        // the object's vtable has been replaced, the replica misses in that case
+        //
+        DldSingleInheritingClassObjectPtr  ObjU;
+        DldHookTypeVtableKey               VtableHookKey;
+        DldHookedFunctionInfo*             HookedVtableFunctionsInfo;
+        
+        ObjU.fObj = hookedObject;
+        
+        bzero( &VtableHookKey, sizeof( VtableHookKey ) );// see Comment 1:
+        VtableHookKey.Vtable = ( objectMetaClass != parentMetaClass ) ? NULL : *ObjU.vtablep;
+        VtableHookKey.metaClass = keyMetaClass;
+        VtableHookKey.InheritanceDepth = this->InheritanceDepth;
+        
+        HookedVtableFunctionsInfo = DldHookedObjectsHashTable::sHashTable->RetrieveReplicaFunctionsInfo( &readState, &VtableHookKey );
+        if( NULL != HookedVtableFunctionsInfo )
+            OriginalFunction = HookedVtableFunctionsInfo[ indx ].OriginalFunction;
+        else
+            OriginalFunction = this->RetrieveOriginalFunction( hookedObject, keyMetaClass, objectMetaClass != parentMetaClass, indx );
+#else
+        OriginalFunction = this->RetrieveOriginalFunction( hookedObject, keyMetaClass, objectMetaClass != parentMetaClass, indx );
+#endif//DLD_HOOK_REPLICAS
+        
+        retrieved = DldHookedObjectsHashTable::sHashTable->ReadEnd( &readState );
+    }// end for
+    
+    if( !retrieved ){
+        
+        DldHookedObjectsHashTable::sHashTable->LockShared();
+        {// start of the lock
+            
+            OriginalFunction = this->RetrieveOriginalFunction( hookedObject, keyMetaClass, objectMetaClass != parentMetaClass, indx );
+            
+        }// end of the lock
+        DldHookedObjectsHashTable::sHashTable->UnLockShared();
+    }
+    
+    assert( OriginalFunction );
+    return OriginalFunction;
+}
+
+//--------------------------------------------------------------------
+
+OSMetaClassBase::_ptf_t
+DldHookerCommonClass::RetrieveOriginalFunction(
+    __in const OSObject* hookedObject,
+    __in const OSMetaClass* keyMetaClass,
+    __in bool superCall,
+    __in unsigned int indx
+    )
+{
+    DldSingleInheritingClassObjectPtr ObjU;
+    OSMetaClassBase::_ptf_t           OriginalFunction;
+    DldHookedObjectEntry*             VtableHookEntry;
+    
+    ObjU.fObj = hookedObject;
+    
+    //
+    // there are a lot possibilities for an optimization, see assert()s,
+    // the entries are not referenced as they can't be removed till
+    // the read section is left or the lock is released
+    //
     
+#if defined(DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES)
+    VtableHookEntry = NULL;
+#else
     DldHookTypeVtableObjKey  VtableHookObjKey;
     bzero( &VtableHookObjKey, sizeof( VtableHookObjKey ) );// see Comment 1:
     VtableHookObjKey.Object = ObjU.fObj;
     VtableHookObjKey.metaClass = keyMetaClass;
     VtableHookObjKey.InheritanceDepth = this->InheritanceDepth;
     
-    DldHookedObjectEntry*    VtableHookEntry;
-    
-    DldHookedObjectsHashTable::sHashTable->LockShared();
-    {// start of the lock
+    VtableHookEntry = DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookObjKey, false );
+    assert( !( superCall && NULL != VtableHookEntry ) );
+#endif//DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES
+    if( NULL == VtableHookEntry ){
         
         //
-        // there are a lot possibilities for an optimization, see assert()s
+        // the first check is for non null table entry
         //
+        DldHookTypeVtableKey  VtableHookKey1;
+        bzero( &VtableHookKey1, sizeof( VtableHookKey1 ) );// see Comment 1:
+        VtableHookKey1.Vtable = *ObjU.vtablep;
+        VtableHookKey1.metaClass = keyMetaClass;
+        VtableHookKey1.InheritanceDepth = this->InheritanceDepth;
+        
         
-        VtableHookEntry = DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookObjKey );
-        assert( !( parentMetaClass != objectMetaClass && NULL != VtableHookEntry ) );
+        VtableHookEntry = DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookKey1, false );
+        assert( !( superCall && NULL != VtableHookEntry ) );
         if( NULL == VtableHookEntry ){
             
             //
-            // the first check is for non null table entry
+            // resort to a null vtable entry, this can happen only when the object table has been replaced
+            // or this is a super::Foo() call
             //
-            DldHookTypeVtableKey  VtableHookKey1;
-            bzero( &VtableHookKey1, sizeof( VtableHookKey1 ) );// see Comment 1:
-            VtableHookKey1.Vtable = *ObjU.vtablep;
-            VtableHookKey1.metaClass = keyMetaClass;
-            VtableHookKey1.InheritanceDepth = this->InheritanceDepth;
+            DldHookTypeVtableKey  VtableHookKey2;
+            bzero( &VtableHookKey2, sizeof( VtableHookKey2 ) );// see Comment 1:
+            VtableHookKey2.Vtable = NULL;
+            VtableHookKey2.metaClass = keyMetaClass;
+            VtableHookKey2.InheritanceDepth = this->InheritanceDepth;
             
             
-            VtableHookEntry = DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookKey1 );
-            assert( !( parentMetaClass != objectMetaClass && NULL != VtableHookEntry ) );
-            if( NULL == VtableHookEntry ){
-                
-                //
-                // resort to a null vtable entry, this can happen only when the object table has been replaced
-                // or this is a super::Foo() call
-                //
-                DldHookTypeVtableKey  VtableHookKey2;
-                bzero( &VtableHookKey2, sizeof( VtableHookKey2 ) );// see Comment 1:
-                VtableHookKey2.Vtable = NULL;
-                VtableHookKey2.metaClass = keyMetaClass;
-                VtableHookKey2.InheritanceDepth = this->InheritanceDepth;
-                
-                
-                VtableHookEntry = DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookKey2 );
-                
-            }// end if( NULL == VtableHookEntry )
+            VtableHookEntry = DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookKey2, false );
             
         }// end if( NULL == VtableHookEntry )
         
-        //assert( VtableHookEntry );
-        if( NULL == VtableHookEntry ){
-            
-            //
-            // this is a special case for an object about which the driver was not aware
-            // but the object's the vtable had been hooked directly
-            // and unhooked after the hooking function had been called - the hooking
-            // function waited on the lock when the vtable was being unhooked,
-            // in that case we have an already unhooked object and can use a value
-            // from the current object's vtable, the hooking object is never removed
-            // so we can safely use "this" pointer,
-            // N.B. this vtable access must be done under the lock to prevent
-            // a race conditions on the same vtable from a concurrent hooking thread
-            //
-            unsigned int VtableIndx = this->HookedFunctonsInfo[ indx ].VtableIndex;
-            assert( 0x0 != VtableIndx );
-            OriginalFunction = (*ObjU.vtablep)[ VtableIndx - 0x1 ];
-            
-            assert( OriginalFunction != this->HookedFunctonsInfo[ indx ].HookingFunction && 
-                    NULL == this->HookedFunctonsInfo[ indx ].OriginalFunction );
-            
-        }//end if( NULL == VtableHookEntry )
-        
-    }// end of the lock
-    DldHookedObjectsHashTable::sHashTable->UnLockShared();
+    }// end if( NULL == VtableHookEntry )
     
-    if( NULL != VtableHookEntry ){
+    //assert( VtableHookEntry );
+    if( NULL == VtableHookEntry ){
+        
+        //
+        // this is a special case for an object about which the driver was not aware
+        // but the object's the vtable had been hooked directly
+        // and unhooked after the hooking function had been called - the hooking
+        // function waited on the lock when the vtable was being unhooked,
+        // in that case we have an already unhooked object and can use a value
+        // from the current object's vtable, the hooking object is never removed
+        // so we can safely use "this" pointer,
+        // N.B. this vtable access must be done under the lock or in the read section
+        // to prevent a race conditions on the same vtable from a concurrent hooking thread
+        //
+        unsigned int VtableIndx = this->HookedFunctonsInfo[ indx ].VtableIndex;
+        assert( 0x0 != VtableIndx );
+        OriginalFunction = (*ObjU.vtablep)[ VtableIndx - 0x1 ];
+        
+        assert( OriginalFunction != this->HookedFunctonsInfo[ indx ].HookingFunction && 
+                NULL == this->HookedFunctonsInfo[ indx ].OriginalFunction );
+        
+    } else {
         
         assert( VtableHookEntry->InheritanceDepth == this->InheritanceDepth );
         assert( indx < VtableHookEntry->Parameters.TypeVtable.HookedVtableFunctionsInfoEntriesNumber );
@@ -1491,12 +2805,9 @@ DldHookerCommonClass::GetOriginalFunction(
                 VtableHookEntry->Parameters.Common.HookedVtableFunctionsInfo[ indx ].HookingFunction );
         
         OriginalFunction = VtableHookEntry->Parameters.Common.HookedVtableFunctionsInfo[ indx ].OriginalFunction;
-        VtableHookEntry->release();
         
-    }// end if( NULL != VtableHookObjEntry )
+    }// end if( NULL == VtableHookEntry )
     
-    
-    assert( OriginalFunction );
     return OriginalFunction;
 }
 
@@ -1520,7 +2831,8 @@ unsigned int gObjCapacity = 0x0;
 
 IOReturn
 DldHookerCommonClass::HookObjectIntWoLock(
-    __inout OSObject* object
+    __inout OSObject* object,
+    __in bool checkHooked
     )
 {
     IOReturn RC = kIOReturnSuccess;
@@ -1529,12 +2841,12 @@ DldHookerCommonClass::HookObjectIntWoLock(
     assert( NULL != object );
     assert( preemption_enabled() );
     assert( DldHookedObjectsHashTable::sHashTable );
-    //assert( !DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( object, false ) );
+    assert( checkHooked || !DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( object, false ) );
     
     //
     // check that the object has not been already hooked ( a rare case )
     //
-    if( DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( object, false ) ){
+    if( checkHooked && DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( object, false ) ){
         
         RC = kIOReturnSuccess;
         return RC;
@@ -1668,7 +2980,7 @@ DldHookerCommonClass::HookObjectIntWoLock(
                      (void*)object ) );
         
         DldHookedObjectEntry*    HookEntry;
-        HookEntry = DldHookedObjectEntry::allocateNew();
+        HookEntry = this->AllocateEntry();
         assert( HookEntry );
         if( HookEntry ){
             
@@ -1928,56 +3240,290 @@ DldHookerCommonClass::HookVtableIntWoLock(
     VtableHookKey2.InheritanceDepth = this->InheritanceDepth;
     
     
-    DldHookTypeVtableObjKey  VtableHookObjKey;
-    bzero( &VtableHookObjKey, sizeof( VtableHookObjKey ) );// see Comment 1:
-    VtableHookObjKey.Object = ObjU.fObj;
-    VtableHookObjKey.metaClass = keyMetaClass;
-    VtableHookObjKey.InheritanceDepth = this->InheritanceDepth;
-        
+    DldHookTypeVtableObjKey  VtableHookObjKey;
+    bzero( &VtableHookObjKey, sizeof( VtableHookObjKey ) );// see Comment 1:
+    VtableHookObjKey.Object = ObjU.fObj;
+    VtableHookObjKey.metaClass = keyMetaClass;
+    VtableHookObjKey.InheritanceDepth = this->InheritanceDepth;
+        
+#if !defined(DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES)
+    //
+    // check that the object has not been already hooked( a rare case )
+    //
+    //assert( !DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookObjKey, false ) );
+    
+    if( DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookObjKey, false ) ){
+        
+        RC = kIOReturnSuccess;
+        return RC;
+    }
+#else
+    //
+    // check that the object has not been already hooked( a rare case ), the object
+    // is not counted twice as it is unhooked once, see ReferenceVtableLockFree()
+    //
+    if( NULL != this->RetrieveHookedObject( object ) ){
+        
+        RC = kIOReturnSuccess;
+        return RC;
+    }
+    
+    //
+    // provide a free slot for the object, an insertion can't fail under the lock after this
+    //
+    if( !this->GrowHookedObjects() ){
+        
+        RC = kIOReturnNoMemory;
+        return RC;
+    }
+#endif//DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES
+    
+    //
+    // search the entry by the first key, if an entry was not found then either the default
+    // vtabe has been replaced and a new entry is needed for a new vtable or the vtable has
+    // not been hooked yet
+    //
+    DldHookedObjectEntry*    VtableHookEntry;
+    if( NULL != ( VtableHookEntry = DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookKey1 ) ) ){
+        
+        assert( DldHookedObjectEntry::DldHookEntryTypeVtable == VtableHookEntry->Type );
+        assert( kIOReturnSuccess == RC );
+        assert( 0x0 != VtableHookEntry->Parameters.TypeVtable.ReferenceCount );
+        
+#if defined(DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES)
+        bool  alreadyAdded;
+        
+        //
+        // the vtable has been hooked, only the object is counted, see ReferenceVtableLockFree()
+        //
+        this->AddHookedObject( object, *ObjU.vtablep, &alreadyAdded );
+        
+        VtableHookEntry->Parameters.TypeVtable.ReferenceCount += 0x1;
+        this->HookedObjectsCounter += 0x1;
+#else
+        //
+        // the vtable has been hooked, add an entry for the object
+        //
+        DldHookedObjectEntry*   newObjectEntry;
+        newObjectEntry = this->AllocateEntry();
+        assert( newObjectEntry );
+        if( newObjectEntry ){
+            
+            bool InHash = false;
+            
+            newObjectEntry->Type = DldHookedObjectEntry::DldHookEntryTypeVtableObj;
+            newObjectEntry->ClassHookerObject = this->ClassHookerObject;
+            newObjectEntry->InheritanceDepth = this->InheritanceDepth;
+            newObjectEntry->Parameters.Common.HookedVtableFunctionsInfo = VtableHookEntry->Parameters.Common.HookedVtableFunctionsInfo;
+            newObjectEntry->Parameters.TypeVatbleObj.OriginalVtable = *ObjU.vtablep;
+            newObjectEntry->Parameters.TypeVatbleObj.VtableEntry = VtableHookEntry;
+            newObjectEntry->Parameters.TypeVatbleObj.VtableEntry->retain();
+            newObjectEntry->Key.VtableHookObj = VtableHookObjKey;
+            
+            VtableHookEntry->Parameters.TypeVtable.ReferenceCount += 0x1;
+            
+            //
+            // be cautious! In case of vtable hooks the HookedObjectsCounter only counts
+            // the number of objects we observed, there might be object that did not get
+            // under our radar with the same vtable, in case of vtable hooks the
+            // HookedObjectsCounter value is used as a heuristic to update the MetaClass
+            // pointer
+            //
+            this->HookedObjectsCounter += 0x1;
+            
+            InHash = DldHookedObjectsHashTable::sHashTable->AddObject( &VtableHookObjKey, newObjectEntry );
+            assert( InHash );
+            if( !InHash ){
+                
+                //
+                // decrement the reference count and set pointer to NULL
+                // to avoid a normal case processing in free() which
+                // assumes that the entries have been inserted successfully
+                //
+                
+                newObjectEntry->Parameters.TypeVatbleObj.VtableEntry->release();
+                newObjectEntry->Parameters.TypeVatbleObj.VtableEntry = NULL;
+                
+                VtableHookEntry->Parameters.TypeVtable.ReferenceCount -= 0x1;
+                this->HookedObjectsCounter -= 0x1;
+                assert( 0x0 != VtableHookEntry->Parameters.TypeVtable.ReferenceCount );
+                
+                RC = kIOReturnNoMemory;
+                
+            } else {
+                
+                assert( newObjectEntry == DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookObjKey, false ) );
+            }
+            
+            //
+            // release in any case, if the entry is in the hash it has been retained by the AddObject
+            // else it must be removed
+            //
+            newObjectEntry->release();
+            
+        } else {
+            
+            RC = kIOReturnNoMemory;
+        }
+#endif//DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES
+        
+        //
+        // was referenced by RetrieveObjectEntry
+        //
+        VtableHookEntry->release();
+        
+        assert( kIOReturnSuccess == RC );
+        return RC;
+        
+    }// end if( VtableHookEntry = ...
+    
+    
+    assert( NULL == VtableHookEntry );
+    assert( kIOReturnSuccess == RC );
+    
+    
+    //
+    // the vtable must be hooked
+    //
+    
+    //
+    // check for an erroneous double hook, the reason might be a destroyed of the hash table consistency
+    //
+    if( this->HookedFunctonsInfoEntriesNumber >0x0 &&
+        (-1) != this->HookedFunctonsInfo[0].VtableIndex &&
+        this->HookedFunctonsInfo[0].HookingFunction == (*ObjU.vtablep)[ this->HookedFunctonsInfo[0].VtableIndex - 1] ){
+        
+#if defined( DBG )
+        //
+        // a double hook, an entry for VtableHookKey1 should have been found!
+        // call a debugger and trace the RetrieveObjectEntry function
+        //
+        __asm__ volatile( "int $0x3" );
+        VtableHookEntry = DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookKey1, false );
+        VtableHookEntry = NULL;
+#endif//DBG
+        
+        DBG_PRINT_ERROR(("A double hook for 0x%p(%s), an extremely serious error!\n", object, object->getMetaClass()->getClassName()));
+        
+        //
+        // exit and pray that the system will carry on
+        //
+        return kIOReturnError;
+    }
+    
+    //
+    // create an object and table entries
+    //
+    DldHookedObjectEntry*   newObjectEntry;
+    DldHookedObjectEntry*   newVtableEntry;
+    DldHookedFunctionInfo*  HookedFunctonsInfo;
+    
+    //
+    // allocate a private function info for the hooked vtable, the common
+    // hook class can be used for hooking more than one class so it's an
+    // error to assume that the class' HookedFunctonsInfo array can be used
+    // to save the hooked function info such as original address
+    //
+    HookedFunctonsInfo = (DldHookedFunctionInfo*)IOMalloc( this->HookedFunctonsInfoEntriesNumber*sizeof( HookedFunctonsInfo[ 0 ] ) );
+    assert( HookedFunctonsInfo );
+    if( !HookedFunctonsInfo ){
+        
+        RC = kIOReturnNoMemory;
+        return RC;
+    }
+    
+    //
+    // copy a function info from the common class
+    //
+    memcpy( HookedFunctonsInfo,
+            this->HookedFunctonsInfo,
+            this->HookedFunctonsInfoEntriesNumber*sizeof( HookedFunctonsInfo[ 0 ] ) );
+    
+    //
+    // allocate new entries
+    //
+    newObjectEntry = this->AllocateEntry();
+    newVtableEntry = this->AllocateEntry();
+    assert( newObjectEntry && newVtableEntry );
+    if( !( newObjectEntry && newVtableEntry ) ){
+        
+        if( newObjectEntry )
+            newObjectEntry->release();
+        
+        if( newVtableEntry )
+            newVtableEntry->release();
+        
+        IOFree( HookedFunctonsInfo, this->HookedFunctonsInfoEntriesNumber*sizeof( HookedFunctonsInfo[ 0 ] ) );
+        
+        RC = kIOReturnNoMemory;
+        return RC;
+        
+    }// end if
+    
+    //
+    // initialize the new hash entries
+    //
+    
+    newVtableEntry->Type = DldHookedObjectEntry::DldHookEntryTypeVtable;
+    newVtableEntry->ClassHookerObject = this->ClassHookerObject;
+    newVtableEntry->InheritanceDepth = this->InheritanceDepth;
+    newVtableEntry->Parameters.Common.HookedVtableFunctionsInfo = HookedFunctonsInfo;
+    newVtableEntry->Parameters.TypeVtable.HookedVtableFunctionsInfoEntriesNumber = this->HookedFunctonsInfoEntriesNumber;
+    newVtableEntry->Parameters.TypeVtable.ReferenceCount = 0x1;
+    newVtableEntry->Key.VtableHookVtable = VtableHookKey1;
+    
+    
+    newObjectEntry->Type = DldHookedObjectEntry::DldHookEntryTypeVtableObj;
+    newObjectEntry->ClassHookerObject = this->ClassHookerObject;
+    newObjectEntry->InheritanceDepth = this->InheritanceDepth;
+    newObjectEntry->Parameters.Common.HookedVtableFunctionsInfo = HookedFunctonsInfo;
+    newObjectEntry->Parameters.TypeVatbleObj.OriginalVtable = *ObjU.vtablep;
+    newObjectEntry->Parameters.TypeVatbleObj.VtableEntry = newVtableEntry;
+    newObjectEntry->Parameters.TypeVatbleObj.VtableEntry->retain();
+    newObjectEntry->Key.VtableHookObj = VtableHookObjKey;
+    
     //
-    // check that the object has not been already hooked( a rare case )
+    // add the new entries in the hash, the first is for the vtable, then the objets's one
     //
-    //assert( !DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookObjKey, false ) );
     
-    if( DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookObjKey, false ) ){
-        
-        RC = kIOReturnSuccess;
-        return RC;
-    }
+    bool InHash = false;
+    bool Added = false;
+    DldHookedObjectEntry* ExistingSecondKeyEntry;
     
     //
-    // search the entry by the first key, if an entry was not found then either the default
-    // vtabe has been replaced and a new entry is needed for a new vtable or the vtable has
-    // not been hooked yet
+    // the entry associated with the first key must not be in the hash, the entry associated
+    // with the second key might be in the has if the object vtable has been changed, the
+    // null vtable entry is either retrieved or added by a single hash table lookup
     //
-    DldHookedObjectEntry*    VtableHookEntry;
-    if( NULL != ( VtableHookEntry = DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookKey1 ) ) ){
+    ExistingSecondKeyEntry = DldHookedObjectsHashTable::sHashTable->RetrieveOrAddObject( &VtableHookKey2, newVtableEntry, &Added );
+    if( ExistingSecondKeyEntry && !Added ){
+     
+        assert( 0x0 != ExistingSecondKeyEntry->Parameters.TypeVtable.ReferenceCount );
+        ExistingSecondKeyEntry->Parameters.TypeVtable.ReferenceCount += 0x1;
+        InHash = true;
         
-        assert( DldHookedObjectEntry::DldHookEntryTypeVtable == VtableHookEntry->Type );
-        assert( kIOReturnSuccess == RC );
-        assert( 0x0 != VtableHookEntry->Parameters.TypeVtable.ReferenceCount );
+    } else if( ExistingSecondKeyEntry ){
         
         //
-        // the vtable has been hooked, add an entry for the object
+        // a new null vtable entry has been added, the code below
+        // processes only an existing entry
         //
-        DldHookedObjectEntry*   newObjectEntry;
-        newObjectEntry = DldHookedObjectEntry::allocateNew();
-        assert( newObjectEntry );
-        if( newObjectEntry ){
-            
-            bool InHash = false;
-            
-            newObjectEntry->Type = DldHookedObjectEntry::DldHookEntryTypeVtableObj;
-            newObjectEntry->ClassHookerObject = this->ClassHookerObject;
-            newObjectEntry->InheritanceDepth = this->InheritanceDepth;
-            newObjectEntry->Parameters.Common.HookedVtableFunctionsInfo = VtableHookEntry->Parameters.Common.HookedVtableFunctionsInfo;
-            newObjectEntry->Parameters.TypeVatbleObj.OriginalVtable = *ObjU.vtablep;
-            newObjectEntry->Parameters.TypeVatbleObj.VtableEntry = VtableHookEntry;
-            newObjectEntry->Parameters.TypeVatbleObj.VtableEntry->retain();
-            newObjectEntry->Key.VtableHookObj = VtableHookObjKey;
-            
-            VtableHookEntry->Parameters.TypeVtable.ReferenceCount += 0x1;
-            
+        assert( newVtableEntry == ExistingSecondKeyEntry );
+        ExistingSecondKeyEntry->release();
+        ExistingSecondKeyEntry = NULL;
+        InHash = true;
+    }
+    
+    assert( InHash );
+    
+    //
+    // add a new non null vtable entry
+    //
+    if( InHash ){
+        
+        InHash = DldHookedObjectsHashTable::sHashTable->AddObject( &VtableHookKey1, newVtableEntry );
+        
+        if( InHash ){
             //
             // be cautious! In case of vtable hooks the HookedObjectsCounter only counts
             // the number of objects we observed, there might be object that did not get
@@ -1986,366 +3532,722 @@ DldHookerCommonClass::HookVtableIntWoLock(
             // pointer
             //
             this->HookedObjectsCounter += 0x1;
+        }
+    }
+    
+    assert( InHash );
+    
+#if !defined(DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES)
+    //
+    // add the object entry, without the object entries the allocated
+    // one is released at the exit, this happens once per vtable
+    //
+    if( InHash ){
+        
+        InHash = DldHookedObjectsHashTable::sHashTable->AddObject( &VtableHookObjKey, newObjectEntry );
+    }
+#endif//DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES
+    
+    assert( InHash );
+    
+    if( InHash ){
+        
+#if defined(DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES)
+        bool  alreadyAdded;
+        
+        this->AddHookedObject( object, *ObjU.vtablep, &alreadyAdded );
+#endif//DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES
+        
+        DldHookerCommonClass::DldHookVtableFunctions( object,
+                                                      HookedFunctonsInfo,
+                                                      *ObjU.vtablep,
+                                                      *ObjU.vtablep );
+        
+        this->AddHookedVtable( *ObjU.vtablep, HookedFunctonsInfo );
+        
+    }// end if( InHash )
+    
+
+    if( !InHash ){
+        
+        //
+        // something went wrong, undo
+        //
+        
+        DldHookedObjectEntry*  removedVtableEntry;
+        
+        RC = kIOReturnError;
+        
+        //
+        // decrement the reference count and set the pointer to NULL
+        // to avoid a normal case processing in free() which
+        // assumes that the entries have been inserted successfully
+        //
+        
+        newVtableEntry->Parameters.TypeVtable.ReferenceCount = 0x0;
+        
+        newObjectEntry->Parameters.TypeVatbleObj.VtableEntry->release();
+        newObjectEntry->Parameters.TypeVatbleObj.VtableEntry = NULL;
+        
+        //
+        // remove the vtable entries for non null and null vtable entries( if required )
+        //
+        removedVtableEntry = DldHookedObjectsHashTable::sHashTable->RemoveObject( &VtableHookKey1 );
+        if( removedVtableEntry ){
             
-            InHash = DldHookedObjectsHashTable::sHashTable->AddObject( &VtableHookObjKey, newObjectEntry );
-            assert( InHash );
-            if( !InHash ){
-                
-                //
-                // decrement the reference count and set pointer to NULL
-                // to avoid a normal case processing in free() which
-                // assumes that the entries have been inserted successfully
-                //
-                
-                newObjectEntry->Parameters.TypeVatbleObj.VtableEntry->release();
-                newObjectEntry->Parameters.TypeVatbleObj.VtableEntry = NULL;
-                
-                VtableHookEntry->Parameters.TypeVtable.ReferenceCount -= 0x1;
-                this->HookedObjectsCounter -= 0x1;
-                assert( 0x0 != VtableHookEntry->Parameters.TypeVtable.ReferenceCount );
-                
-                RC = kIOReturnNoMemory;
+            assert( newVtableEntry == removedVtableEntry );
+            removedVtableEntry->release();
+            this->HookedObjectsCounter -= 0x1;
+            
+        }// end if( removedVtableEntry )
+        
+        
+        if( !ExistingSecondKeyEntry ){
+            
+            removedVtableEntry = DldHookedObjectsHashTable::sHashTable->RemoveObject( &VtableHookKey2 );
+            if( removedVtableEntry ){
                 
-            } else {
+                assert( newVtableEntry == removedVtableEntry );
+                removedVtableEntry->release();
                 
-                assert( newObjectEntry == DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookObjKey, false ) );
-            }
-            
-            //
-            // release in any case, if the entry is in the hash it has been retained by the AddObject
-            // else it must be removed
-            //
-            newObjectEntry->release();
+            }// end if( removedVtableEntry )
             
         } else {
             
-            RC = kIOReturnNoMemory;
+            //
+            // the vtable entry referencing the null vtable entry has been removed from the hash
+            //
+            ExistingSecondKeyEntry->Parameters.TypeVtable.ReferenceCount -= 0x1;
+            assert( 0x0 != ExistingSecondKeyEntry->Parameters.TypeVtable.ReferenceCount );
         }
+
         
-        //
-        // was referenced by RetrieveObjectEntry
-        //
-        VtableHookEntry->release();
+    } else {
         
-        assert( kIOReturnSuccess == RC );
-        return RC;
+        assert( InHash );
+        assert( newVtableEntry == DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookKey2, false ) ||
+                ExistingSecondKeyEntry == DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookKey2, false ) );
+        assert( newVtableEntry == DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookKey1, false ) );
+#if !defined(DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES)
+        assert( newObjectEntry == DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookObjKey, false ) );
+#endif//DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES
         
-    }// end if( VtableHookEntry = ...
+    }// end else for if( InHash )
     
     
-    assert( NULL == VtableHookEntry );
-    assert( kIOReturnSuccess == RC );
+    if( ExistingSecondKeyEntry )
+        ExistingSecondKeyEntry->release();
     
     
-    //
-    // the vtable must be hooked
-    //
+    newObjectEntry->release();
+    newVtableEntry->release();
     
-    //
-    // check for an erroneous double hook, the reason might be a destroyed of the hash table consistency
-    //
-    if( this->HookedFunctonsInfoEntriesNumber >0x0 &&
-        (-1) != this->HookedFunctonsInfo[0].VtableIndex &&
-        this->HookedFunctonsInfo[0].HookingFunction == (*ObjU.vtablep)[ this->HookedFunctonsInfo[0].VtableIndex - 1] ){
+    assert( kIOReturnSuccess == RC );
+    
+#if defined(DBG)
+    /*
+    if( kIOReturnSuccess == RC ){
         
-#if defined( DBG )
-        //
-        // a double hook, an entry for VtableHookKey1 should have been found!
-        // call a debugger and trace the RetrieveObjectEntry function
-        //
-        __asm__ volatile( "int $0x3" );
-        VtableHookEntry = DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookKey1, false );
-        VtableHookEntry = NULL;
-#endif//DBG
+        if( NULL == gVtableHookedObjects ){
+            
+            gVtCount = 0x0;
+            gVtCapacity = 1024;
+            gVtableHookedObjects = (DldVtObjHook*)IOMalloc( gVtCapacity*sizeof(gVtableHookedObjects[0]) );
+            
+            if( gVtableHookedObjects )
+                gVtableHookedObjects[ 0 ].object = NULL;
+            else
+                gVtCapacity = 0x0;
+
+        }// end if( NULL == gVtableHookedObjects )
         
-        DBG_PRINT_ERROR(("A double hook for 0x%p(%s), an extremely serious error!\n", object, object->getMetaClass()->getClassName()));
         
-        //
-        // exit and pray that the system will carry on
-        //
-        return kIOReturnError;
+        if( NULL != gVtableHookedObjects && gVtCount < gVtCapacity ){
+            
+            int i;
+            
+            for( i = 0x0; i < gVtCount; ++i ){
+                
+                if( object <= gVtableHookedObjects[ i ].object )
+                    break;
+            }// end for
+            
+            if( object != gVtableHookedObjects[ i ].object ){
+                
+                if( i != gVtCount && gVtCount > 0x0 ){
+                    
+                    assert( i < gVtCount );
+                    memmove( &gVtableHookedObjects[ i+1 ], &gVtableHookedObjects[ i ], ( gVtCount - i )*sizeof(gVtableHookedObjects[0]) );
+                }
+                
+                gVtableHookedObjects[ i ].object = object;
+                gVtableHookedObjects[i].vtableKey = VtableHookKey1;
+                ++gVtCount;
+                
+            }// end if( object != gVtableHookedObjects[ i ] )
+            
+        }// end if( NULL != gVtableHookedObjects )
+        
     }
+     */
+#endif//defined(DBG)
+    
+    return RC;
+}
+    
+
+//--------------------------------------------------------------------
+
+IOReturn
+DldHookerCommonClass::HookObject(
+    __inout OSObject* object,
+    __in DldHookType type
+    )
+{
+    IOReturn  RC = kIOReturnSuccess;
     
-    //
-    // create an object and table entries
-    //
-    DldHookedObjectEntry*   newObjectEntry;
-    DldHookedObjectEntry*   newVtableEntry;
-    DldHookedFunctionInfo*  HookedFunctonsInfo;
+    assert( ( DldHookTypeUnknown < type ) && ( type < DldHookTypeMaximum ) );
     
-    //
-    // allocate a private function info for the hooked vtable, the common
-    // hook class can be used for hooking more than one class so it's an
-    // error to assume that the class' HookedFunctonsInfo array can be used
-    // to save the hooked function info such as original address
-    //
-    HookedFunctonsInfo = (DldHookedFunctionInfo*)IOMalloc( this->HookedFunctonsInfoEntriesNumber*sizeof( HookedFunctonsInfo[ 0 ] ) );
-    assert( HookedFunctonsInfo );
-    if( !HookedFunctonsInfo ){
+    if( DldHookTypeUnknown == this->HookType ){
         
-        RC = kIOReturnNoMemory;
-        return RC;
+        this->HookType = type;
     }
     
     //
-    // copy a function info from the common class
+    // the class can't wear multiple hats
     //
-    memcpy( HookedFunctonsInfo,
-            this->HookedFunctonsInfo,
-            this->HookedFunctonsInfoEntriesNumber*sizeof( HookedFunctonsInfo[ 0 ] ) );
+    assert( type == this->HookType );
     
-    //
-    // allocate new entries
-    //
-    newObjectEntry = DldHookedObjectEntry::allocateNew();
-    newVtableEntry = DldHookedObjectEntry::allocateNew();
-    assert( newObjectEntry && newVtableEntry );
-    if( !( newObjectEntry && newVtableEntry ) ){
+#if defined(DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES)
+    if( DldHookTypeVtable == type && this->ReferenceVtableLockFree( object, true ) ){
         
-        if( newObjectEntry )
-            newObjectEntry->release();
+        DldHookTraceCallback  traceCallback = gHookTraceCallback;
         
-        if( newVtableEntry )
-            newVtableEntry->release();
+        if( traceCallback )
+            traceCallback( DldHookTraceEventHook, this, object, 0x0 );
         
-        IOFree( HookedFunctonsInfo, this->HookedFunctonsInfoEntriesNumber*sizeof( HookedFunctonsInfo[ 0 ] ) );
+        return kIOReturnSuccess;
+    }
+#endif//DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES
+    
+    DldHookedObjectsHashTable::sHashTable->LockExclusive();
+    {// start of the lock
         
-        RC = kIOReturnNoMemory;
-        return RC;
+        switch( type ){
+                
+            case DldHookTypeObject:
+                RC = this->HookObjectIntWoLock( object );
+                assert( kIOReturnSuccess == RC );
+                break;
+            case DldHookTypeVtable:
+                RC = this->HookVtableIntWoLock( object );
+                assert( kIOReturnSuccess == RC );
+                break;
+            default:
+                panic( "HookObject( 0x%p, 0x%X ) for an unimplemented type", (void*)object, (int)type );
+                break;
+    }
         
-    }// end if
-    
-    //
-    // initialize the new hash entries
-    //
-    
-    newVtableEntry->Type = DldHookedObjectEntry::DldHookEntryTypeVtable;
-    newVtableEntry->ClassHookerObject = this->ClassHookerObject;
-    newVtableEntry->InheritanceDepth = this->InheritanceDepth;
-    newVtableEntry->Parameters.Common.HookedVtableFunctionsInfo = HookedFunctonsInfo;
-    newVtableEntry->Parameters.TypeVtable.HookedVtableFunctionsInfoEntriesNumber = this->HookedFunctonsInfoEntriesNumber;
-    newVtableEntry->Parameters.TypeVtable.ReferenceCount = 0x1;
-    newVtableEntry->Key.VtableHookVtable = VtableHookKey1;
-    
+    }// end of the lock
+    DldHookedObjectsHashTable::sHashTable->UnLockExclusive();
     
-    newObjectEntry->Type = DldHookedObjectEntry::DldHookEntryTypeVtableObj;
-    newObjectEntry->ClassHookerObject = this->ClassHookerObject;
-    newObjectEntry->InheritanceDepth = this->InheritanceDepth;
-    newObjectEntry->Parameters.Common.HookedVtableFunctionsInfo = HookedFunctonsInfo;
-    newObjectEntry->Parameters.TypeVatbleObj.OriginalVtable = *ObjU.vtablep;
-    newObjectEntry->Parameters.TypeVatbleObj.VtableEntry = newVtableEntry;
-    newObjectEntry->Parameters.TypeVatbleObj.VtableEntry->retain();
-    newObjectEntry->Key.VtableHookObj = VtableHookObjKey;
+    DldHookTraceCallback  traceCallback = gHookTraceCallback;
     
-    //
-    // add the new entries in the hash, the first is for the vtable, then the objets's one
-    //
+    if( traceCallback && kIOReturnSuccess == RC )
+        traceCallback( DldHookTraceEventHook, this, object, 0x0 );
     
-    bool InHash = false;
-    DldHookedObjectEntry* ExistingSecondKeyEntry;
+    return RC;
+}
+
+//--------------------------------------------------------------------
+
+DldHookedObjectEntry*
+DldHookerCommonClass::AllocateEntry()
+{
+    assert( preemption_enabled() );
     
     //
-    // the entry associated with the first key must not be in the hash, the entry associated
-    // with the second key might be in the has if the object vtable has been changed
+    // the preallocated entries are accessed under the exclusive lock
     //
-    ExistingSecondKeyEntry = DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookKey2 );
-    if( ExistingSecondKeyEntry ){
-     
-        assert( 0x0 != ExistingSecondKeyEntry->Parameters.TypeVtable.ReferenceCount );
-        ExistingSecondKeyEntry->Parameters.TypeVtable.ReferenceCount += 0x1;
-        InHash = true;
+    if( 0x0 != this->PreallocatedEntriesNumber ){
         
-    } else {
+        assert( this->PreallocatedEntries );
         
-        //
-        // add a new null vtable entry
-        //
-        InHash = DldHookedObjectsHashTable::sHashTable->AddObject( &VtableHookKey2, newVtableEntry );
-        assert( newVtableEntry == DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookKey2, false ) );
+        this->PreallocatedEntriesNumber -= 0x1;
+        return this->PreallocatedEntries[ this->PreallocatedEntriesNumber ];
     }
     
-    assert( InHash );
-    
-    //
-    // add a new non null vtable entry
-    //
-    if( InHash ){
-        
-        InHash = DldHookedObjectsHashTable::sHashTable->AddObject( &VtableHookKey1, newVtableEntry );
-        assert( newVtableEntry == DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookKey1, false ) );
-        
-        if( InHash ){
-            //
-            // be cautious! In case of vtable hooks the HookedObjectsCounter only counts
-            // the number of objects we observed, there might be object that did not get
-            // under our radar with the same vtable, in case of vtable hooks the
-            // HookedObjectsCounter value is used as a heuristic to update the MetaClass
-            // pointer
-            //
-            this->HookedObjectsCounter += 0x1;
-        }
-    }
+    return DldHookedObjectEntry::allocateNew();
+}
+
+//--------------------------------------------------------------------
+
+static
+unsigned int
+DldHookedVtableHash(
+    __in OSMetaClassBase::_ptf_t* vtable
+    )
+{
+    UInt32  hash = (UInt32)( (uintptr_t)vtable >> 0x3 )*0x9E3779B1;
     
-    assert( InHash );
+    return (unsigned int)( hash ^ ( hash >> 16 ) );
+}
+
+//--------------------------------------------------------------------
+
+DldHookedFunctionInfo*
+DldHookerCommonClass::RetrieveHookedVtable(
+    __in OSMetaClassBase::_ptf_t* vtable
+    )
+/*
+ must be called in the lock free read section or under the lock
+ */
+{
+    unsigned int  mask;
+    unsigned int  i;
     
-    //
-    // add the object entry
-    //
-    if( InHash ){
-        
-        InHash = DldHookedObjectsHashTable::sHashTable->AddObject( &VtableHookObjKey, newObjectEntry );
-        assert( newObjectEntry == DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookObjKey, false ) );
-    }
+    if( 0x0 == this->HookedVtablesCount )
+        return NULL;
     
-    assert( InHash );
+    mask = this->HookedVtablesSize - 0x1;
     
-    if( InHash ){
+    for( i = DldHookedVtableHash( vtable ) & mask; NULL != this->HookedVtables[ i ].Vtable; i = ( i + 0x1 ) & mask ){
         
-        DldHookerCommonClass::DldHookVtableFunctions( object,
-                                                      HookedFunctonsInfo,
-                                                      *ObjU.vtablep,
-                                                      *ObjU.vtablep );
+        if( vtable == this->HookedVtables[ i ].Vtable )
+            return this->HookedVtables[ i ].HookedVtableFunctionsInfo;
         
-    }// end if( InHash )
+    }// end for
     
+    return NULL;
+}
 
-    if( !InHash ){
+//--------------------------------------------------------------------
+
+void
+DldHookerCommonClass::AddHookedVtable(
+    __in OSMetaClassBase::_ptf_t* vtable,
+    __in DldHookedFunctionInfo* HookedVtableFunctionsInfo
+    )
+/*
+ called under the exclusive lock, the readers have been drained so the table
+ can be reallocated, an allocation failure is not fatal as the calls through
+ the vtable are resolved by the hash table
+ */
+{
+    unsigned int  mask;
+    unsigned int  i;
+    
+    assert( preemption_enabled() );
+    assert( NULL != vtable && NULL != HookedVtableFunctionsInfo );
+    assert( NULL == this->RetrieveHookedVtable( vtable ) );
+    
+    if( 0x2*( this->HookedVtablesCount + 0x1 ) > this->HookedVtablesSize ){
         
-        //
-        // something went wrong, undo
-        //
+        DldHookedVtableSlot*  newVtables;
+        unsigned int          newSize = ( 0x0 != this->HookedVtablesSize ) ? 0x2*this->HookedVtablesSize : 0x8;
         
-        DldHookedObjectEntry*  removedVtableEntry;
+        newVtables = (DldHookedVtableSlot*)IOMalloc( newSize*sizeof( newVtables[ 0 ] ) );
+        assert( newVtables );
+        if( NULL == newVtables ){
+            
+            DBG_PRINT_ERROR(( "IOMalloc() failed for %u hooked vtables\n", newSize ));
+            return;
+        }
         
-        RC = kIOReturnError;
+        bzero( newVtables, newSize*sizeof( newVtables[ 0 ] ) );
+        mask = newSize - 0x1;
         
-        //
-        // decrement the reference count and set the pointer to NULL
-        // to avoid a normal case processing in free() which
-        // assumes that the entries have been inserted successfully
-        //
+        for( unsigned int j = 0x0; j < this->HookedVtablesSize; ++j ){
+            
+            if( NULL != this->HookedVtables[ j ].Vtable ){
+                
+                for( i = DldHookedVtableHash( this->HookedVtables[ j ].Vtable ) & mask;
+                     NULL != newVtables[ i ].Vtable;
+                     i = ( i + 0x1 ) & mask ){}
+                
+                newVtables[ i ] = this->HookedVtables[ j ];
+            }
+        }// end for
         
-        newVtableEntry->Parameters.TypeVtable.ReferenceCount = 0x0;
+        if( this->HookedVtables )
+            IOFree( this->HookedVtables, this->HookedVtablesSize*sizeof( this->HookedVtables[ 0 ] ) );
         
-        newObjectEntry->Parameters.TypeVatbleObj.VtableEntry->release();
-        newObjectEntry->Parameters.TypeVatbleObj.VtableEntry = NULL;
+        this->HookedVtables = newVtables;
+        this->HookedVtablesSize = newSize;
+    }
+    
+    mask = this->HookedVtablesSize - 0x1;
+    
+    for( i = DldHookedVtableHash( vtable ) & mask; NULL != this->HookedVtables[ i ].Vtable; i = ( i + 0x1 ) & mask ){}
+    
+    this->HookedVtables[ i ].Vtable = vtable;
+    this->HookedVtables[ i ].HookedVtableFunctionsInfo = HookedVtableFunctionsInfo;
+    this->HookedVtablesCount += 0x1;
+}
+
+//--------------------------------------------------------------------
+
+void
+DldHookerCommonClass::RemoveHookedVtable(
+    __in OSMetaClassBase::_ptf_t* vtable
+    )
+/*
+ called under the exclusive lock, the following entries of the cluster
+ are shifted back so the lookup stops only at an empty slot
+ */
+{
+    unsigned int  mask;
+    unsigned int  i;
+    unsigned int  j;
+    
+    if( 0x0 == this->HookedVtablesCount )
+        return;
+    
+    mask = this->HookedVtablesSize - 0x1;
+    
+    for( i = DldHookedVtableHash( vtable ) & mask;
+         NULL != this->HookedVtables[ i ].Vtable && vtable != this->HookedVtables[ i ].Vtable;
+         i = ( i + 0x1 ) & mask ){}
+    
+    if( NULL == this->HookedVtables[ i ].Vtable )
+        return;
+    
+    bzero( &this->HookedVtables[ i ], sizeof( this->HookedVtables[ i ] ) );
+    this->HookedVtablesCount -= 0x1;
+    
+    for( j = ( i + 0x1 ) & mask; NULL != this->HookedVtables[ j ].Vtable; j = ( j + 0x1 ) & mask ){
+        
+        unsigned int  k = DldHookedVtableHash( this->HookedVtables[ j ].Vtable ) & mask;
         
         //
-        // remove the vtable entries for non null and null vtable entries( if required )
+        // move the entry to the empty slot if its home slot is not in the ( i, j ] cyclic range
         //
-        removedVtableEntry = DldHookedObjectsHashTable::sHashTable->RemoveObject( &VtableHookKey1 );
-        if( removedVtableEntry ){
-            
-            assert( newVtableEntry == removedVtableEntry );
-            removedVtableEntry->release();
-            this->HookedObjectsCounter -= 0x1;
+        if( ( i <= j ) ? ( k <= i || k > j ) : ( k <= i && k > j ) ){
             
-        }// end if( removedVtableEntry )
+            this->HookedVtables[ i ] = this->HookedVtables[ j ];
+            bzero( &this->HookedVtables[ j ], sizeof( this->HookedVtables[ j ] ) );
+            i = j;
+        }
+    }// end for
+}
+
+//--------------------------------------------------------------------
+
+#if defined(DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES)
+
+static
+unsigned int
+DldHookedObjectHash(
+    __in OSObject* object
+    )
+{
+    UInt32  hash = (UInt32)( (uintptr_t)object >> 0x4 )*0x9E3779B1;
+    
+    return (unsigned int)( hash ^ ( hash >> 16 ) );
+}
+
+//--------------------------------------------------------------------
+
+DldHookedObjectSlot*
+DldHookerCommonClass::RetrieveHookedObject(
+    __in OSObject* object
+    )
+/*
+ must be called in the lock free read section or under the lock
+ */
+{
+    unsigned int  mask;
+    unsigned int  i;
+    
+    if( 0x0 == this->HookedObjectSlotsSize )
+        return NULL;
+    
+    mask = this->HookedObjectSlotsSize - 0x1;
+    
+    for( i = DldHookedObjectHash( object ) & mask; NULL != this->HookedObjectSlots[ i ].Object; i = ( i + 0x1 ) & mask ){
+        
+        if( object == this->HookedObjectSlots[ i ].Object )
+            return &this->HookedObjectSlots[ i ];
+        
+    }// end for
+    
+    return NULL;
+}
+
+//--------------------------------------------------------------------
+
+bool
+DldHookerCommonClass::AddHookedObject(
+    __in OSObject* object,
+    __in OSMetaClassBase::_ptf_t* vtable,
+    __out bool* alreadyAdded
+    )
+/*
+ must be called in the lock free read section or under the lock, a slot
+ is reserved before the search so an empty slot is always found, a removed
+ object's slot is not reused as the object might be further in the cluster,
+ returns false if there is no free slot and the table must be rebuilt
+ under the lock, see GrowHookedObjects()
+ */
+{
+    UInt32        used;
+    unsigned int  mask;
+    unsigned int  i;
+    bool          added = false;
+    
+    *alreadyAdded = false;
+    
+    do{
         
+        used = this->HookedObjectSlotsUsed;
+        if( 0x2*( used + 0x1 ) > this->HookedObjectSlotsSize )
+            return false;
         
-        if( !ExistingSecondKeyEntry ){
+    } while( !OSCompareAndSwap( used, used + 0x1, &this->HookedObjectSlotsUsed ) );
+    
+    mask = this->HookedObjectSlotsSize - 0x1;
+    i = DldHookedObjectHash( object ) & mask;
+    
+    while( !added && !( *alreadyAdded ) ){
+        
+        OSObject*  current = this->HookedObjectSlots[ i ].Object;
+        
+        if( object == current ){
             
-            removedVtableEntry = DldHookedObjectsHashTable::sHashTable->RemoveObject( &VtableHookKey2 );
-            if( removedVtableEntry ){
-                
-                assert( newVtableEntry == removedVtableEntry );
-                removedVtableEntry->release();
-                
-            }// end if( removedVtableEntry )
+            *alreadyAdded = true;
             
-        } else {
+        } else if( NULL == current ){
             
             //
-            // the vtable entry referencing the null vtable entry has been removed from the hash
+            // the slot is read again if another object has taken it
             //
-            ExistingSecondKeyEntry->Parameters.TypeVtable.ReferenceCount -= 0x1;
-            assert( 0x0 != ExistingSecondKeyEntry->Parameters.TypeVtable.ReferenceCount );
+            added = OSCompareAndSwapPtr( NULL, object, (void* volatile*)&this->HookedObjectSlots[ i ].Object );
+            
+        } else {
+            
+            i = ( i + 0x1 ) & mask;
         }
+    }// end while
+    
+    if( added )
+        this->HookedObjectSlots[ i ].Vtable = vtable;
+    else
+        OSDecrementAtomic( (volatile SInt32*)&this->HookedObjectSlotsUsed );
+    
+    return true;
+}
 
-        
-    } else {
-        
-        assert( InHash );
-        assert( newVtableEntry == DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookKey2, false ) ||
-                ExistingSecondKeyEntry == DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookKey2, false ) );
-        assert( newVtableEntry == DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookKey1, false ) );
-        assert( newObjectEntry == DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookObjKey, false ) );
-        
-    }// end else for if( InHash )
+//--------------------------------------------------------------------
+
+bool
+DldHookerCommonClass::GrowHookedObjects()
+/*
+ called under the exclusive lock, the readers have been drained so the table
+ can be reallocated, the table is rebuilt without the removed objects when
+ there is no free slot, so at most a quarter of the new table's slots are used
+ */
+{
+    DldHookedObjectSlot*  newSlots;
+    unsigned int          newSize = 0x8;
+    unsigned int          objects = 0x0;
+    unsigned int          mask;
+    unsigned int          i;
     
+    assert( preemption_enabled() );
     
-    if( ExistingSecondKeyEntry )
-        ExistingSecondKeyEntry->release();
+    if( 0x2*( this->HookedObjectSlotsUsed + 0x1 ) <= this->HookedObjectSlotsSize )
+        return true;
     
+    for( unsigned int j = 0x0; j < this->HookedObjectSlotsSize; ++j ){
+        
+        if( NULL != this->HookedObjectSlots[ j ].Object && DLD_REMOVED_HOOKED_OBJECT != this->HookedObjectSlots[ j ].Object )
+            ++objects;
+    }// end for
     
-    newObjectEntry->release();
-    newVtableEntry->release();
+    while( 0x4*( objects + 0x1 ) > newSize )
+        newSize = 0x2*newSize;
     
-    assert( kIOReturnSuccess == RC );
+    newSlots = (DldHookedObjectSlot*)IOMalloc( newSize*sizeof( newSlots[ 0 ] ) );
+    assert( newSlots );
+    if( NULL == newSlots ){
+        
+        DBG_PRINT_ERROR(( "IOMalloc() failed for %u hooked objects\n", newSize ));
+        return false;
+    }
     
-#if defined(DBG)
-    /*
-    if( kIOReturnSuccess == RC ){
+    bzero( newSlots, newSize*sizeof( newSlots[ 0 ] ) );
+    mask = newSize - 0x1;
+    
+    for( unsigned int j = 0x0; j < this->HookedObjectSlotsSize; ++j ){
         
-        if( NULL == gVtableHookedObjects ){
+        if( NULL != this->HookedObjectSlots[ j ].Object && DLD_REMOVED_HOOKED_OBJECT != this->HookedObjectSlots[ j ].Object ){
             
-            gVtCount = 0x0;
-            gVtCapacity = 1024;
-            gVtableHookedObjects = (DldVtObjHook*)IOMalloc( gVtCapacity*sizeof(gVtableHookedObjects[0]) );
+            for( i = DldHookedObjectHash( this->HookedObjectSlots[ j ].Object ) & mask;
+                 NULL != newSlots[ i ].Object;
+                 i = ( i + 0x1 ) & mask ){}
             
-            if( gVtableHookedObjects )
-                gVtableHookedObjects[ 0 ].object = NULL;
-            else
-                gVtCapacity = 0x0;
+            newSlots[ i ] = this->HookedObjectSlots[ j ];
+        }
+    }// end for
+    
+    if( this->HookedObjectSlots )
+        IOFree( this->HookedObjectSlots, this->HookedObjectSlotsSize*sizeof( this->HookedObjectSlots[ 0 ] ) );
+    
+    this->HookedObjectSlots = newSlots;
+    this->HookedObjectSlotsSize = newSize;
+    this->HookedObjectSlotsUsed = objects;
+    
+    return true;
+}
 
-        }// end if( NULL == gVtableHookedObjects )
+//--------------------------------------------------------------------
+
+bool
+DldHookerCommonClass::ReferenceVtableLockFree(
+    __in OSObject* object,
+    __in bool reference
+    )
+/*
+ adds or removes an object's reference to the entry for its hooked vtable in
+ the lock free read section, the object is added to or removed from the hooker's
+ table of the hooked objects so a double hook is not counted and an object
+ which has not been hooked is not unhooked, returns true if the object has been
+ processed, returns false if the exclusive lock is required, i.e. the vtable
+ has not been hooked, the last reference is being removed, the object's vtable
+ has been replaced after hooking, the objects table is full or a writer is active
+ */
+{
+    DldSingleInheritingClassObjectPtr  ObjU;
+    DldHashTableReadState              readState;
+    DldHookedObjectEntry*              VtableHookEntry;
+    DldHookedObjectSlot*               slot = NULL;
+    bool                               processed = false;
+    
+    assert( DldHookTypeVtable == this->HookType );
+    
+    ObjU.fObj = object;
+    
+    DldHookTypeVtableKey  VtableHookKey1;
+    bzero( &VtableHookKey1, sizeof( VtableHookKey1 ) );// see Comment 1:
+    VtableHookKey1.Vtable = *ObjU.vtablep;
+    VtableHookKey1.metaClass = object->getMetaClass();
+    VtableHookKey1.InheritanceDepth = this->InheritanceDepth;
+    
+    if( !DldHookedObjectsHashTable::sHashTable->ReadBegin( &readState ) )
+        return false;
+    
+    if( !reference ){
         
+        slot = this->RetrieveHookedObject( object );
         
-        if( NULL != gVtableHookedObjects && gVtCount < gVtCapacity ){
-            
-            int i;
+        //
+        // free() is called for all objects with the hooked vtable, an object
+        // which has not been hooked doesn't reference the vtable entry
+        //
+        processed = ( NULL == slot );
+    }
+    
+    VtableHookEntry = NULL;
+    if( reference || ( NULL != slot && *ObjU.vtablep == slot->Vtable ) )
+        VtableHookEntry = DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookKey1, false );
+    
+    if( NULL != VtableHookEntry && VtableHookEntry->ClassHookerObject == this->ClassHookerObject ){
+        
+        volatile UInt32*  referenceCount = (volatile UInt32*)&VtableHookEntry->Parameters.TypeVtable.ReferenceCount;
+        
+        if( reference ){
             
-            for( i = 0x0; i < gVtCount; ++i ){
-                
-                if( object <= gVtableHookedObjects[ i ].object )
-                    break;
-            }// end for
+            bool  alreadyAdded;
             
-            if( object != gVtableHookedObjects[ i ].object ){
+            if( this->AddHookedObject( object, *ObjU.vtablep, &alreadyAdded ) ){
                 
-                if( i != gVtCount && gVtCount > 0x0 ){
+                //
+                // a double hook is not counted
+                //
+                if( !alreadyAdded ){
                     
-                    assert( i < gVtCount );
-                    memmove( &gVtableHookedObjects[ i+1 ], &gVtableHookedObjects[ i ], ( gVtCount - i )*sizeof(gVtableHookedObjects[0]) );
+                    OSIncrementAtomic( (volatile SInt32*)referenceCount );
+                    OSIncrementAtomic( (volatile SInt32*)&this->HookedObjectsCounter );
                 }
                 
-                gVtableHookedObjects[ i ].object = object;
-                gVtableHookedObjects[i].vtableKey = VtableHookKey1;
-                ++gVtCount;
+                processed = true;
+            }
+            
+        } else if( 0x1 < *referenceCount &&
+                   OSCompareAndSwapPtr( object, DLD_REMOVED_HOOKED_OBJECT, (void* volatile*)&slot->Object ) ){
+            
+            UInt32  current;
+            
+            //
+            // the last reference is removed under the lock as the vtable is unhooked,
+            // so the sum of the vtables' counters, i.e. HookedObjectsCounter,
+            // doesn't drop to zero here, the slot is returned to the object
+            // if other objects have removed their references meanwhile
+            //
+            do{
                 
-            }// end if( object != gVtableHookedObjects[ i ] )
+                current = *referenceCount;
+                assert( 0x0 != current );
+                
+                if( 0x1 == current )
+                    break;
+                
+                processed = OSCompareAndSwap( current, current - 0x1, referenceCount );
+                
+            } while( !processed );
             
-        }// end if( NULL != gVtableHookedObjects )
-        
-    }
-     */
-#endif//defined(DBG)
+            if( processed )
+                OSDecrementAtomic( (volatile SInt32*)&this->HookedObjectsCounter );
+            else
+                slot->Object = object;
+            
+        } else if( DLD_REMOVED_HOOKED_OBJECT == slot->Object ){
+            
+            //
+            // a concurrent unhook has removed the object
+            //
+            processed = true;
+        }
+    }// end if( NULL != VtableHookEntry ... )
     
-    return RC;
-}
+    //
+    // the section's result is ignored, a writer waits for the readers
+    // to leave the section before changing the counters, the objects
+    // table or removing the entry, so they have been changed consistently
+    //
+    DldHookedObjectsHashTable::sHashTable->ReadEnd( &readState );
     
+    return processed;
+}
+
+#endif//DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES
 
 //--------------------------------------------------------------------
 
 IOReturn
-DldHookerCommonClass::HookObject(
-    __inout OSObject* object,
+DldHookerCommonClass::HookObjects(
+    __inout OSObject** objects,
+    __in unsigned int count,
     __in DldHookType type
     )
+/*
+ hooks the objects under a single exclusive lock hold, a vtable is patched
+ only for the first object with this vtable as the following objects find
+ the vtable entry, the object entries are allocated before the lock is taken,
+ returns the first error but tries to hook all objects
+ */
 {
-    IOReturn  RC = kIOReturnSuccess;
+    IOReturn                RC = kIOReturnSuccess;
+    DldHookedObjectEntry**  entries = NULL;
+    unsigned int            entriesNumber = 0x0;
+    unsigned int            preallocate = count;
+    unsigned int            i;
     
     assert( ( DldHookTypeUnknown < type ) && ( type < DldHookTypeMaximum ) );
+    assert( preemption_enabled() );
+    
+    if( 0x0 == count )
+        return kIOReturnSuccess;
     
     if( DldHookTypeUnknown == this->HookType ){
         
@@ -2357,27 +4259,107 @@ DldHookerCommonClass::HookObject(
     //
     assert( type == this->HookType );
     
+    //
+    // an entry per object, the first object for a vtable takes an additional
+    // entry from allocateNew() under the lock, an allocation failure is not
+    // fatal as AllocateEntry() resorts to allocateNew()
+    //
+#if defined(DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES)
+    if( DldHookTypeVtable == type )
+        preallocate = 0x0;
+#endif//DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES
+    
+    if( 0x0 != preallocate ){
+        
+        entries = (DldHookedObjectEntry**)IOMalloc( preallocate*sizeof( entries[ 0 ] ) );
+        assert( entries );
+        if( entries ){
+            
+            while( entriesNumber < preallocate && NULL != ( entries[ entriesNumber ] = DldHookedObjectEntry::allocateNew() ) )
+                ++entriesNumber;
+        }
+    }// end if( 0x0 != preallocate )
+    
     DldHookedObjectsHashTable::sHashTable->LockExclusive();
     {// start of the lock
         
-        switch( type ){
-                
-            case DldHookTypeObject:
-                RC = this->HookObjectIntWoLock( object );
-                assert( kIOReturnSuccess == RC );
-                break;
-            case DldHookTypeVtable:
-                RC = this->HookVtableIntWoLock( object );
-                assert( kIOReturnSuccess == RC );
-                break;
-            default:
-                panic( "HookObject( 0x%p, 0x%X ) for an unimplemented type", (void*)object, (int)type );
-                break;
-    }
+        DldHookTraceCallback  traceCallback = gHookTraceCallback;
+        DldHookedObjectEntry* hookedEntries[ GHT_GET_MANY_BATCH ];
+        
+        assert( NULL == this->PreallocatedEntries && 0x0 == this->PreallocatedEntriesNumber );
+        
+        this->PreallocatedEntries = entries;
+        this->PreallocatedEntriesNumber = entriesNumber;
+        
+        for( i = 0x0; i < count; ++i ){
+            
+            IOReturn  objectRC = kIOReturnSuccess;
+            
+            //
+            // the already hooked objects are found by a batched lookup
+            //
+            if( DldHookTypeObject == type && 0x0 == i % GHT_GET_MANY_BATCH )
+                DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntries( &objects[ i ],
+                                                                            ( count - i < GHT_GET_MANY_BATCH ) ? ( count - i ) : GHT_GET_MANY_BATCH,
+                                                                            hookedEntries );
+            
+            switch( type ){
+                    
+                case DldHookTypeObject:
+                    if( NULL == hookedEntries[ i % GHT_GET_MANY_BATCH ] ){
+                        
+                        bool  checkHooked = false;
+                        
+                        //
+                        // the batch's result is stale for an object which is repeated in the batch
+                        // and has been hooked for its first occurrence, only such an object
+                        // is looked up again
+                        //
+                        for( unsigned int j = i - i % GHT_GET_MANY_BATCH; j < i && !checkHooked; ++j )
+                            checkHooked = ( objects[ j ] == objects[ i ] );
+                        
+                        objectRC = this->HookObjectIntWoLock( objects[ i ], checkHooked );
+                    }
+                    assert( kIOReturnSuccess == objectRC );
+                    break;
+                case DldHookTypeVtable:
+                    objectRC = this->HookVtableIntWoLock( objects[ i ] );
+                    assert( kIOReturnSuccess == objectRC );
+                    break;
+                default:
+                    panic( "HookObjects( 0x%p, 0x%X ) for an unimplemented type", (void*)objects[ i ], (int)type );
+                    break;
+            }
+            
+            if( kIOReturnSuccess != objectRC && kIOReturnSuccess == RC )
+                RC = objectRC;
+            
+            //
+            // the callback doesn't block so it is called under the lock
+            // to avoid saving the status for every object
+            //
+            if( traceCallback && kIOReturnSuccess == objectRC )
+                traceCallback( DldHookTraceEventHook, this, objects[ i ], 0x0 );
+            
+        }// end for
+        
+        entriesNumber = this->PreallocatedEntriesNumber;
+        
+        this->PreallocatedEntries = NULL;
+        this->PreallocatedEntriesNumber = 0x0;
         
     }// end of the lock
     DldHookedObjectsHashTable::sHashTable->UnLockExclusive();
     
+    //
+    // release the unused entries, e.g. for the already hooked objects
+    //
+    for( i = 0x0; i < entriesNumber; ++i )
+        entries[ i ]->release();
+    
+    if( entries )
+        IOFree( entries, preallocate*sizeof( entries[ 0 ] ) );
+    
     return RC;
 }
 
@@ -2506,6 +4488,31 @@ DldHookerCommonClass::UnHookObjectIntWoLock(
     DldHookedObjectEntry*  NullVtableHookEntry = NULL;
     
     
+#if defined(DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES)
+    //
+    // there is no object entry, the vtable entry is found by the vtable the object
+    // was hooked with as the object's vtable might have been replaced after hooking,
+    // an object which has not been hooked is not in the hooker's objects table
+    //
+    DldHookedObjectSlot*  HookedObjectSlot;
+    
+    ObjHookEntry = NULL;
+    
+    HookedObjectSlot = this->RetrieveHookedObject( object );
+    if( HookedObjectSlot ){
+        
+        DldHookTypeVtableKey  VtableHookKey1;
+        bzero( &VtableHookKey1, sizeof( VtableHookKey1 ) );// see Comment 1:
+        VtableHookKey1.Vtable = HookedObjectSlot->Vtable;
+        VtableHookKey1.metaClass = ObjU.fObj->getMetaClass();
+        VtableHookKey1.InheritanceDepth = Depth;
+        
+        HookedObjectSlot->Object = DLD_REMOVED_HOOKED_OBJECT;
+        
+        NonNullVtableHookEntry = DldHookedObjectsHashTable::sHashTable->RetrieveObjectEntry( &VtableHookKey1 );
+        assert( NonNullVtableHookEntry );
+    }
+#else
     DldHookTypeVtableObjKey  VtableHookObjKey;
     bzero( &VtableHookObjKey, sizeof( VtableHookObjKey ) );// see Comment 1:
     VtableHookObjKey.Object = ObjU.fObj;
@@ -2522,6 +4529,7 @@ DldHookerCommonClass::UnHookObjectIntWoLock(
         NonNullVtableHookEntry->retain();
         
     }
+#endif//DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES
     
     
     if( NonNullVtableHookEntry ){
@@ -2568,6 +4576,8 @@ DldHookerCommonClass::UnHookObjectIntWoLock(
             DldHookerCommonClass::DldUnHookVtableFunctions( NonNullVtableHookEntry->Parameters.Common.HookedVtableFunctionsInfo,
                                                             NonNullVtableHookEntry->Key.VtableHookVtable.Vtable );
             
+            this->RemoveHookedVtable( NonNullVtableHookEntry->Key.VtableHookVtable.Vtable );
+            
         }
         
     }
@@ -2672,6 +4682,20 @@ DldHookerCommonClass::UnHookObject(
     
     IOReturn RC;
     
+#if defined(DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES)
+    if( DldHookTypeVtable == this->HookType && this->ReferenceVtableLockFree( object, false ) ){
+        
+        DldHookTraceCallback  traceCallback = gHookTraceCallback;
+        
+        if( traceCallback )
+            traceCallback( DldHookTraceEventUnHook, this, object, 0x0 );
+        
+        this->ClassHookerObject->fObjectUnHooked( object );
+        
+        return kIOReturnSuccess;
+    }
+#endif//DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES
+    
     DldHookedObjectsHashTable::sHashTable->LockExclusive();
     {// start of the lock
         
@@ -2680,6 +4704,67 @@ DldHookerCommonClass::UnHookObject(
     }//end of the lock
     DldHookedObjectsHashTable::sHashTable->UnLockExclusive();
     
+    DldHookTraceCallback  traceCallback = gHookTraceCallback;
+    
+    if( traceCallback && kIOReturnSuccess == RC )
+        traceCallback( DldHookTraceEventUnHook, this, object, 0x0 );
+    
+    //
+    // the hooker is notified even if the object has not been found as
+    // free() is called for all objects that reached the hooking functions,
+    // e.g. for the objects of a derived class sharing a hooked vtable
+    //
+    this->ClassHookerObject->fObjectUnHooked( object );
+    
+    return RC;
+}
+
+//--------------------------------------------------------------------
+
+IOReturn
+DldHookerCommonClass::UnHookObjects(
+    __inout OSObject** objects,
+    __in unsigned int count
+    )
+/*
+ unhooks the objects under a single exclusive lock hold,
+ returns the first error but tries to unhook all objects
+ */
+{
+    IOReturn  RC = kIOReturnSuccess;
+    
+    assert( preemption_enabled() );
+    
+    if( 0x0 == count )
+        return kIOReturnSuccess;
+    
+    DldHookedObjectsHashTable::sHashTable->LockExclusive();
+    {// start of the lock
+        
+        DldHookTraceCallback  traceCallback = gHookTraceCallback;
+        
+        for( unsigned int i = 0x0; i < count; ++i ){
+            
+            IOReturn  objectRC;
+            
+            objectRC = this->UnHookObjectIntWoLock( objects[ i ] );
+            if( kIOReturnSuccess != objectRC && kIOReturnSuccess == RC )
+                RC = objectRC;
+            
+            //
+            // see HookObjects()
+            //
+            if( traceCallback && kIOReturnSuccess == objectRC )
+                traceCallback( DldHookTraceEventUnHook, this, objects[ i ], 0x0 );
+            
+        }// end for
+        
+    }// end of the lock
+    DldHookedObjectsHashTable::sHashTable->UnLockExclusive();
+    
+    for( unsigned int i = 0x0; i < count; ++i )
+        this->ClassHookerObject->fObjectUnHooked( objects[ i ] );
+    
     return RC;
 }
 
@@ -27,6 +27,15 @@ protected:
     
 public:
     virtual const char* fGetClassName() = 0;
+    
+    //
+    // notifications for a hooker that caches a per object state, both are called
+    // without the hooked objects table lock held, fObjectUnHooked() is called after
+    // the object has been unhooked or before a hooked object is freed, the
+    // hooking functions might still be running for the object when it is called
+    //
+    virtual void fObjectTerminated( __in OSObject* object ){};
+    virtual void fObjectUnHooked( __in OSObject* object ){};
 };
 
 //--------------------------------------------------------------------
@@ -134,21 +143,58 @@ typedef struct _DldDbgVtableHookToObject{
 } DldDbgVtableHookToObject;
 
 //
-// this is more a structure than a class, the OSObject as a base class is used for a purpose of reference counting
+// this is more a structure than a class, an entry is allocated for each hooked object
+// so it has no vtable and OSObject's overhead, the reference counter is intrusive,
+// the retain() and release() are single atomic operations, the fields are ordered
+// so the entry fits a cache line on a 64 bit kernel
 //
-class DldHookedObjectEntry: public OSObject{
+class DldHookedObjectEntry{
+    
+private:
     
-    OSDeclareDefaultStructors( DldHookedObjectEntry )
+    volatile SInt32   RetainCount;
+    
+    //
+    // an entry is allocated by allocateNew() and destroyed by the last release()
+    //
+    DldHookedObjectEntry(){ this->RetainCount = 0x1; };
+    ~DldHookedObjectEntry(){ assert( 0x0 == this->RetainCount ); };
+    
+    void free();
     
 public:
     
     static DldHookedObjectEntry* allocateNew();
     
-protected:
+    void retain()
+    {
+        assert( this->RetainCount > 0x0 );
+        OSIncrementAtomic( &this->RetainCount );
+    };
     
-    virtual void free();
+    void release()
+    {
+        assert( this->RetainCount > 0x0 );
+        if( 0x1 == OSDecrementAtomic( &this->RetainCount ) )
+            this->free();
+    };
     
-public:
+    typedef enum _DldEntryType{
+        DldHookEntryTypeUnknown = 0x0,
+        DldHookEntryTypeObject,   // OSObject* key
+        DldHookEntryTypeVtableObj,// DldHookTypeVtableObjKey key
+        DldHookEntryTypeVtable    // DldHookTypeVtableKey key
+    } DldEntryType;
+    
+    //
+    // the type and the depth share a word with the reference counter
+    //
+    DldEntryType          Type : 16;
+    
+    //
+    // an inheritance depth
+    //
+    DldInheritanceDepth   InheritanceDepth : 16;
     
     union{
         
@@ -170,15 +216,6 @@ public:
         
     } Key;
     
-    typedef enum _DldEntryType{
-        DldHookEntryTypeUnknown = 0x0,
-        DldHookEntryTypeObject,   // OSObject* key
-        DldHookEntryTypeVtableObj,// DldHookTypeVtableObjKey key
-        DldHookEntryTypeVtable    // DldHookTypeVtableKey key
-    } DldEntryType;
-    
-    DldEntryType   Type;
-    
     union{
         
         struct CommonHeader{
@@ -284,18 +321,214 @@ public:
     } Parameters;
     
     //
-    // an inheritance depth
+    // a hooking class object, not referenced
     //
-    DldInheritanceDepth    InheritanceDepth;
+    DldHookerBaseInterface* ClassHookerObject;
     
+#if defined(DLD_HOOK_INTRUSIVE_ENTRIES)
     //
-    // a hooking class object, not referenced
+    // the hash table linkage of the DldHookEntryTypeObject and DldHookEntryTypeVtableObj
+    // entries, the table compares Key in place, a DldHookEntryTypeVtable entry is added
+    // with two keys so it is linked by the entries allocated by the table
     //
-    DldHookerBaseInterface* ClassHookerObject;
+    ght_hash_entry_t        HashLink;
+#endif//DLD_HOOK_INTRUSIVE_ENTRIES
 };
 
+//
+// an entry fits a cache line, the intrusive entry's hash table linkage is on the next line
+//
+#if defined(__LP64__)
+#if defined(DLD_HOOK_INTRUSIVE_ENTRIES)
+static_assert( sizeof( DldHookedObjectEntry ) <= 64 + sizeof( ght_hash_entry_t ),
+               "DldHookedObjectEntry doesn't fit a cache line" );
+#else
+static_assert( sizeof( DldHookedObjectEntry ) <= 64,
+               "DldHookedObjectEntry doesn't fit a cache line" );
+#endif//DLD_HOOK_INTRUSIVE_ENTRIES
+#endif// __LP64__
+
+//--------------------------------------------------------------------
+
+//
+// the memory used by the hooked objects hash table itself, the entries'
+// data are accounted per hooker, see DldHookerMemoryUsage
+//
+typedef struct _DldHashTableMemoryUsage{
+    
+    UInt32       Buckets;
+    UInt32       Items;
+    
+    //
+    // the table structure, the bucket pages of the current and the old bucket
+    // arrays and the lock free readers' per CPU states
+    //
+    vm_size_t    TableBytes;
+    
+    //
+    // the ght entries with the inline keys
+    //
+    vm_size_t    EntriesBytes;
+    
+} DldHashTableMemoryUsage;
+
+//
+// the memory used by a hooker, i.e. by a hooked class at an inheritance depth
+//
+typedef struct _DldHookerMemoryUsage{
+    
+    UInt32       HookedObjects;
+    
+    //
+    // DldHookedObjectEntry objects created by the hooker, an entry for
+    // a vtable is accounted once even if it is in the table with two keys
+    //
+    UInt32       Entries;
+    vm_size_t    EntriesBytes;
+    
+    //
+    // HookedVtableFunctionsInfo arrays owned by DldHookEntryTypeVtable entries,
+    // the hooker's table of the hooked vtables, its call cache and its
+    // table of the hooked objects for DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES
+    //
+    vm_size_t    VtableFunctionsInfoBytes;
+    
+    //
+    // a cloned vtable for DldHookTypeObject
+    //
+    vm_size_t    VtableBufferBytes;
+    
+    //
+    // the static hooker instance including its HookedFunctonsInfo array,
+    // set by DldHookerCommonClass2 as only it knows the instance's type
+    //
+    vm_size_t    HookerInstanceBytes;
+    
+} DldHookerMemoryUsage;
+
 //--------------------------------------------------------------------
 
+#if defined(DLD_HOOK_STATS)
+
+//
+// the number of buckets in the exclusive lock hold time histogram,
+// a bucket N counts the hold times in the [2^N, 2^(N+1)) nanoseconds range
+//
+#define DLD_LOCK_HISTOGRAM_BUCKETS  (32)
+
+//
+// the hash table lock statistics, the exclusive lock is taken by the hooking
+// and unhooking, the shared lock is taken by the hooked calls, so the shared
+// lock wait time is the hooked calls stall caused by hooking and unhooking
+//
+typedef struct _DldHashTableStatistics{
+    
+    SInt64    ExclusiveLocks;
+    SInt64    ExclusiveWaitTime;// ns
+    SInt64    ExclusiveHoldTime;// ns
+    SInt64    MaxExclusiveHoldTime;// ns
+    SInt64    ExclusiveHoldTimeHistogram[ DLD_LOCK_HISTOGRAM_BUCKETS ];
+    
+    SInt64    SharedLocks;
+    SInt64    SharedWaitTime;// ns
+    SInt64    MaxSharedWaitTime;// ns
+    
+    //
+    // the lock free reads, the failed ones found a writer and
+    // were retried or fell back to the shared lock
+    //
+    SInt64    LockFreeReads;
+    SInt64    LockFreeReadsFailed;
+    
+    UInt32    Entries;
+    UInt32    PeakEntries;
+    
+} DldHashTableStatistics;
+
+#endif//DLD_HOOK_STATS
+
+//--------------------------------------------------------------------
+
+#if defined(DLD_HOOK_REPLICAS)
+
+//
+// a read only replica of the vtable entries, i.e. the ( vtable, meta class, depth )
+// to the original functions array mapping, the replica is an open addressing
+// table which is never changed after it has been published, it is replaced
+// when a vtable entry has been added or removed, the CPUs share the replica
+// as nobody writes to it, the hooked calls do not touch the hash table entries
+// which reference counts are changed by hooking and unhooking
+//
+typedef struct _DldHookReplicaEntry{
+    
+    //
+    // a NULL metaClass marks an empty entry
+    //
+    DldHookTypeVtableKey    Key;
+    DldHookedFunctionInfo*  HookedVtableFunctionsInfo;
+    
+} DldHookReplicaEntry;
+
+typedef struct _DldHookReplica{
+    
+    vm_size_t            Size;// the allocation size
+    UInt32               EntriesMask;// the number of entries minus one, the number is a power of 2
+    DldHookReplicaEntry  Entries[ 1 ];
+    
+} DldHookReplica;
+
+#endif//DLD_HOOK_REPLICAS
+
+//
+// a CPU's lock free reader state, the Sequence is odd while the CPU
+// is in the read section, only the CPU itself changes the value,
+// the structure is on its own cache line so the readers on different
+// CPUs do not share a written cache line
+//
+typedef struct _DldHashTableReaderCpu{
+    
+    volatile UInt32  Sequence;
+    
+#if defined(DLD_HOOK_STATS)
+    //
+    // the CPU's share of the DldHashTableStatistics reader counters, the lock
+    // free read counters are changed with the interrupts disabled, the shared
+    // lock counters are changed atomically as a thread might be moved to
+    // another CPU, see DldHookedObjectsHashTable::GetStatistics()
+    //
+    volatile SInt64  SharedLocks;
+    volatile SInt64  SharedWaitTime;
+    volatile SInt64  MaxSharedWaitTime;
+    SInt64           LockFreeReads;
+    SInt64           LockFreeReadsFailed;
+#endif//DLD_HOOK_STATS
+    
+} __attribute__((aligned(64))) DldHashTableReaderCpu;
+
+//
+// the reader's state between ReadBegin() and ReadEnd()
+//
+typedef struct _DldHashTableReadState{
+    
+    UInt32       Sequence;
+    unsigned int Cpu;
+    boolean_t    InterruptsState;
+    
+} DldHashTableReadState;
+
+//--------------------------------------------------------------------
+
+#if defined(DLD_HOOK_FILTER)
+//
+// the counting Bloom filter's parameters, the false positive rate
+// is about 3% with 3 hashes and 8 counters per key, the filter
+// is doubled when the number of keys exceeds this ratio
+//
+#define DLD_HOOK_FILTER_HASHES            (3)
+#define DLD_HOOK_FILTER_COUNTERS_PER_KEY  (8)
+#define DLD_HOOK_FILTER_MIN_COUNTERS      (4096)
+#endif//DLD_HOOK_FILTER
+
 class DldHookedObjectsHashTable
 {
     
@@ -304,12 +537,107 @@ private:
     ght_hash_table_t* HashTable;
     IORWLock*         RWLock;
     
+    //
+    // the write sequence, odd while a writer holds the exclusive lock,
+    // the lock free readers do not enter the table when it is odd and
+    // retry if it has been changed during the read
+    //
+    volatile UInt32         Sequence;
+    
+    //
+    // the per CPU lock free reader states, a writer waits for the readers
+    // which entered the table before the Sequence had been made odd, so
+    // the writer never changes or frees the data being read
+    //
+    DldHashTableReaderCpu*  ReaderCpus;
+    unsigned int            CpusNumber;
+    
+    void BeginWrite();
+    void EndWrite();
+    
+#if defined(DLD_HOOK_REPLICAS)
+    //
+    // the published replica, NULL if there is no vtable entry or the replica
+    // has not been built yet, the readers use the hash table in that case,
+    // a writer which has added or removed a vtable entry sets ReplicaStale,
+    // EndWrite() withdraws the replica as the readers have been drained,
+    // UnLockExclusive() frees it and builds a new one after the exclusive lock
+    // has been released, see RebuildReplica()
+    //
+    DldHookReplica* volatile  Replica;
+    DldHookReplica*           WithdrawnReplica;
+    bool                      ReplicaStale;
+    
+    //
+    // the number of the DldHookTypeVtableKey keys in the table, changed by the writers
+    //
+    UInt32                    ReplicaKeys;
+    
+    void RebuildReplica();
+    static void FreeReplica( __in DldHookReplica* replica );
+#endif//DLD_HOOK_REPLICAS
+    
+#if defined(DLD_HOOK_FILTER)
+    //
+    // the counting Bloom filter of all keys in the table, a counter saturates
+    // at 0xFF and is not decremented after that till the filter is rebuilt,
+    // NULL if the filter could not be allocated, then every key may be
+    // in the table, the filter is changed only by a writer
+    //
+    UInt8*  FilterCounters;
+    UInt32  FilterMask;
+    
+    static UInt32 FilterHash( __in const void* key, __in unsigned int keySize );
+    bool FilterMayContain( __in const void* key, __in unsigned int keySize );
+    void FilterAdd( __in const void* key, __in unsigned int keySize );
+    void FilterRemove( __in const void* key, __in unsigned int keySize );
+    bool FilterRebuild( __in UInt32 countersNumber );
+#endif//DLD_HOOK_FILTER
+    
 #if defined(DBG)
     thread_t ExclusiveThread;
 #endif//DBG
     
+#if defined(DLD_HOOK_STATS)
+    
+    //
+    // the exclusive lock's fields are changed only by the lock owner,
+    // the reader counters are in ReaderCpus
+    //
+    uint64_t                ExclusiveAcquiredTime;
+    DldHashTableStatistics  Statistics;
+    
+    void AddSharedLockWait( __in SInt64 waitTime );
+    
+    static uint64_t ElapsedNanoseconds( __in uint64_t startTime )
+    {
+        uint64_t  endTime;
+        uint64_t  ns;
+        
+        clock_get_uptime( &endTime );
+        absolutetime_to_nanoseconds( endTime - startTime, &ns );
+        
+        return ns;
+    };
+    
+    static void UpdateMaximum( __inout volatile SInt64* maximum, __in SInt64 value )
+    {
+        SInt64  current;
+        
+        do{
+            
+            current = *maximum;
+            if( current >= value )
+                break;
+            
+        } while( !OSCompareAndSwap64( (UInt64)current, (UInt64)value, (volatile UInt64*)maximum ) );
+    };
+    
+#endif//DLD_HOOK_STATS
+    
     //
-    // returns an allocated hash table object
+    // returns an allocated hash table object, the size is the initial number
+    // of buckets, the table grows with the number of entries
     //
     static DldHookedObjectsHashTable* withSize( int size, bool non_block );
     
@@ -326,16 +654,36 @@ private:
     DldHookedObjectsHashTable()
     {
         this->HashTable = NULL;
+        this->RWLock = NULL;
+        this->Sequence = 0x0;
+        this->ReaderCpus = NULL;
+        this->CpusNumber = 0x0;
+        
+#if defined(DLD_HOOK_REPLICAS)
+        this->Replica = NULL;
+        this->WithdrawnReplica = NULL;
+        this->ReplicaStale = false;
+        this->ReplicaKeys = 0x0;
+#endif//DLD_HOOK_REPLICAS
+        
+#if defined(DLD_HOOK_FILTER)
+        this->FilterCounters = NULL;
+        this->FilterMask = 0x0;
+#endif//DLD_HOOK_FILTER
         
 #if defined(DBG)
         this->ExclusiveThread = NULL;
 #endif//DBG
+        
+#if defined(DLD_HOOK_STATS)
+        bzero( &this->Statistics, sizeof( this->Statistics ) );
+#endif//DLD_HOOK_STATS
     }
     
     //
     // the destructor checks that the free() has been called
     //
-    ~DldHookedObjectsHashTable(){ assert( !this->HashTable && !this->RWLock ); };
+    ~DldHookedObjectsHashTable(){ assert( !this->HashTable && !this->RWLock && !this->ReaderCpus ); };
     
 public:
     
@@ -350,6 +698,14 @@ public:
     bool   AddObject( __in DldHookTypeVtableKey* vtableHookVtable, __in DldHookedObjectEntry* objEntry, __in bool errorIfPresent = true );
     bool   AddObject( __in DldHookTypeVtableObjKey* vtableHookObj, __in DldHookedObjectEntry* objEntry, __in bool errorIfPresent = true );
     
+    //
+    // hashes the key once and returns either the existing entry or objEntry
+    // after inserting it, *added is set to true in the latter case, the returned
+    // entry is referenced and the caller must release it, NULL is returned
+    // if the insertion failed
+    //
+    DldHookedObjectEntry*   RetrieveOrAddObject( __in DldHookTypeVtableKey* vtableHookVtable, __in DldHookedObjectEntry* objEntry, __out bool* added );
+    
     //
     // removes the entry from the hash and returns the removed entry, NULL if there
     // is no entry for an object or vtable, the returned entry is referenced!
@@ -360,11 +716,26 @@ public:
     
     //
     // the returned object is referenced if the reference parameter is true! the caller must release the object!
+    // the lookups do not change the table, see ght_get_ro(), so they are safe under the shared lock
     //
     DldHookedObjectEntry*   RetrieveObjectEntry( __in OSObject* obj, __in bool reference = true );
     DldHookedObjectEntry*   RetrieveObjectEntry( __in DldHookTypeVtableKey* vtableHookVtable, __in bool reference = true );
     DldHookedObjectEntry*   RetrieveObjectEntry( __in DldHookTypeVtableObjKey* vtableHookObj, __in bool reference = true );
     
+    //
+    // looks up the entries for count objects with the memory accesses overlapped, see ght_get_many(),
+    // entries receives count entries or NULLs, the entries are not referenced so the lock must be held
+    //
+    void   RetrieveObjectEntries( __in OSObject** objects, __in unsigned int count, __out DldHookedObjectEntry** entries );
+    
+    //
+    // the functions acquire the lock
+    //
+    void GetMemoryUsage( __out DldHashTableMemoryUsage* usage );
+    void AddHookerMemoryUsage( __in DldHookerBaseInterface* hooker,
+                               __in DldInheritanceDepth depth,
+                               __inout DldHookerMemoryUsage* usage );
+    
 #if defined( DBG )
     //
     // used only for the debug, leaks memory in the release
@@ -373,12 +744,46 @@ public:
     DldDbgVtableHookToObject* RetrieveObjectEntry( __in OSMetaClassBase::_ptf_t*    key );
 #endif//DBG
     
+    //
+    // the lock free read section, the hooked calls retrieve the entries
+    // without the lock and without referencing them, the entries and
+    // their data are valid till ReadEnd(), the section is entered with
+    // the interrupts disabled so it must be short and must not block,
+    // ReadBegin() returns false if a writer is active, ReadEnd() returns
+    // false if the table has been changed, in both cases the caller
+    // retries or falls back to LockShared()
+    //
+    bool ReadBegin( __out DldHashTableReadState* state );
+    bool ReadEnd( __in DldHashTableReadState* state );
+    
+#if defined(DLD_HOOK_REPLICAS)
+    //
+    // looks up the vtable entry's original functions array in the published
+    // replica, must be called in the read section, returns NULL if there is
+    // no entry for the key or the replica has not been built
+    //
+    DldHookedFunctionInfo* RetrieveReplicaFunctionsInfo( __in DldHashTableReadState* state,
+                                                         __in DldHookTypeVtableKey* vtableHookVtable );
+#endif//DLD_HOOK_REPLICAS
+    
     void
     LockShared()
     {   assert( this->RWLock );
         assert( preemption_enabled() );
         
+#if defined(DLD_HOOK_STATS)
+        uint64_t  startTime;
+        SInt64    waitTime;
+        
+        clock_get_uptime( &startTime );
+#endif//DLD_HOOK_STATS
+        
         IORWLockRead( this->RWLock );
+        
+#if defined(DLD_HOOK_STATS)
+        waitTime = (SInt64)ElapsedNanoseconds( startTime );
+        this->AddSharedLockWait( waitTime );
+#endif//DLD_HOOK_STATS
     };
     
     
@@ -401,13 +806,27 @@ public:
         assert( current_thread() != this->ExclusiveThread );
 #endif//DBG
         
+#if defined(DLD_HOOK_STATS)
+        uint64_t  startTime;
+        
+        clock_get_uptime( &startTime );
+#endif//DLD_HOOK_STATS
+        
         IORWLockWrite( this->RWLock );
         
+        this->BeginWrite();
+        
 #if defined(DBG)
         assert( NULL == this->ExclusiveThread );
         this->ExclusiveThread = current_thread();
 #endif//DBG
         
+#if defined(DLD_HOOK_STATS)
+        this->Statistics.ExclusiveLocks += 0x1;
+        this->Statistics.ExclusiveWaitTime += ElapsedNanoseconds( startTime );
+        clock_get_uptime( &this->ExclusiveAcquiredTime );
+#endif//DLD_HOOK_STATS
+        
     };
     
     
@@ -422,11 +841,66 @@ public:
         this->ExclusiveThread = NULL;
 #endif//DBG
         
+#if defined(DLD_HOOK_STATS)
+        {
+            SInt64        holdTime = (SInt64)ElapsedNanoseconds( this->ExclusiveAcquiredTime );
+            unsigned int  bucket = 0x0;
+            
+            while( ( holdTime >> ( bucket + 0x1 ) ) && bucket < ( DLD_LOCK_HISTOGRAM_BUCKETS - 0x1 ) )
+                ++bucket;
+            
+            this->Statistics.ExclusiveHoldTime += holdTime;
+            this->Statistics.ExclusiveHoldTimeHistogram[ bucket ] += 0x1;
+            if( holdTime > this->Statistics.MaxExclusiveHoldTime )
+                this->Statistics.MaxExclusiveHoldTime = holdTime;
+            
+            this->Statistics.Entries = ght_size( this->HashTable );
+            if( this->Statistics.Entries > this->Statistics.PeakEntries )
+                this->Statistics.PeakEntries = this->Statistics.Entries;
+        }
+#endif//DLD_HOOK_STATS
+        
+        this->EndWrite();
+        
+#if defined(DLD_HOOK_REPLICAS)
+        //
+        // the replica is freed and rebuilt outside of the exclusive section
+        //
+        DldHookReplica*  withdrawnReplica = this->WithdrawnReplica;
+        bool             rebuildReplica = this->ReplicaStale;
+        
+        this->WithdrawnReplica = NULL;
+        this->ReplicaStale = false;
+#endif//DLD_HOOK_REPLICAS
+        
         IORWLockUnlock( this->RWLock );
+        
+#if defined(DLD_HOOK_REPLICAS)
+        if( NULL != withdrawnReplica )
+            DldHookedObjectsHashTable::FreeReplica( withdrawnReplica );
+        
+        if( rebuildReplica )
+            this->RebuildReplica();
+#endif//DLD_HOOK_REPLICAS
     };
     
+#if defined(DLD_HOOK_STATS)
+    //
+    // the statistics are copied under the exclusive lock and the readers'
+    // counters are summed, the histogram is used to calculate the hold
+    // time percentiles
+    //
+    void GetStatistics( __out DldHashTableStatistics* statistics );
+#endif//DLD_HOOK_STATS
+    
     
     static DldHookedObjectsHashTable* sHashTable;
+    
+    //
+    // changed when a vtable entry is added or removed, i.e. when a vtable
+    // is hooked or unhooked, validates the hookers' call caches
+    //
+    static volatile UInt32 sVtableGeneration;
 };
 
 //--------------------------------------------------------------------
@@ -626,6 +1100,124 @@ virtual const char* fGetClassName()\
 
 //--------------------------------------------------------------------
 
+#if defined(DLD_HOOK_STATS)
+
+//
+// the original function lookup statistics, the time is in absolute time units
+//
+typedef struct _DldHookerCallStatistics{
+    
+    //
+    // the lookups for DldHookTypeObject hooks, they don't touch the hash table
+    //
+    SInt64    ObjectCalls;
+    SInt64    ObjectTime;
+    
+    //
+    // the lookups for DldHookTypeVtable hooks, a subset of them
+    // are super::Foo() calls from a derived class's function
+    //
+    SInt64    VtableCalls;
+    SInt64    VtableTime;
+    SInt64    VtableSuperCalls;
+    
+    //
+    // the DldHookTypeVtable lookups resolved by the call cache and the rest
+    //
+    SInt64    CallCacheHits;
+    SInt64    CallCacheMisses;
+    
+} DldHookerCallStatistics;
+
+//
+// a CPU's counters, the hooked calls running on different CPUs
+// update different cache lines, see DldHookerCommonClass::GetCpuStatistics()
+//
+typedef struct _DldHookerCpuStatistics{
+    
+    DldHookerCallStatistics   Statistics;
+    
+} __attribute__((aligned(64))) DldHookerCpuStatistics;
+
+#endif//DLD_HOOK_STATS
+
+//--------------------------------------------------------------------
+
+typedef enum _DldHookTraceEvent{
+    DldHookTraceEventCall = 0x0,// a hooking function requested the original function
+    DldHookTraceEventHook,// an object has been hooked
+    DldHookTraceEventUnHook// an object has been unhooked
+} DldHookTraceEvent;
+
+class DldHookerCommonClass;
+
+//
+// a callback to capture the hooker's workload, called without any lock held,
+// the hooker is the one which hooked, unhooked or called the object, see
+// DldHookerCommonClass::GetHookerId(), for DldHookTraceEventCall the index is
+// an index in the hooker's functions info array and the callback is called
+// from a hooking function so it must be cheap, for the other events the index is 0x0
+//
+typedef void (*DldHookTraceCallback)( __in DldHookTraceEvent event,
+                                      __in DldHookerCommonClass* hooker,
+                                      __in const OSObject* object,
+                                      __in unsigned int indx );
+
+//
+// NULL if the tracing is disabled
+//
+extern DldHookTraceCallback volatile  gHookTraceCallback;
+
+//--------------------------------------------------------------------
+
+//
+// a hooked call's original function cached by the object's vtable, an entry is
+// valid if its Generation is DldHookedObjectsHashTable::sVtableGeneration, the
+// Sequence is odd while the entry is being filled, a reader which sees the
+// Sequence changed treats the entry as a miss
+//
+typedef struct _DldCallCacheEntry{
+    
+    volatile UInt32           Sequence;
+    UInt32                    Generation;
+    OSMetaClassBase::_ptf_t*  Vtable;
+    OSMetaClassBase::_ptf_t   OriginalFunction;
+    
+} DldCallCacheEntry;
+
+//
+// the number of vtables cached for a hooked function, most hooked
+// calls see one or two vtables
+//
+#define DLD_CALL_CACHE_WAYS  (2)
+
+//
+// a vtable hooked directly by a hooker, see DldHookerCommonClass::HookedVtables,
+// a NULL Vtable marks an empty slot
+//
+typedef struct _DldHookedVtableSlot{
+    
+    OSMetaClassBase::_ptf_t*  Vtable;
+    DldHookedFunctionInfo*    HookedVtableFunctionsInfo;
+    
+} DldHookedVtableSlot;
+
+#if defined(DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES)
+//
+// an object hooked by a direct vtable hook, see DldHookerCommonClass::HookedObjectSlots,
+// a NULL Object marks an empty slot, DLD_REMOVED_HOOKED_OBJECT marks a removed object,
+// the Vtable is the object's vtable at the time it was hooked
+//
+typedef struct _DldHookedObjectSlot{
+    
+    OSObject*                 Object;
+    OSMetaClassBase::_ptf_t*  Vtable;
+    
+} DldHookedObjectSlot;
+
+#define DLD_REMOVED_HOOKED_OBJECT  ((OSObject*)(uintptr_t)0x1)
+#endif//DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES
+
 //
 // the class is just a container for data and functions common for
 // all hookers to avoid code duplication accross all hokers, it
@@ -639,14 +1231,45 @@ class DldHookerCommonClass
 private:
     
     IOReturn HookVtableIntWoLock( __inout OSObject* object );
-    IOReturn HookObjectIntWoLock( __inout OSObject* object );
+    
+    //
+    // checkHooked is false if the caller has already found that the object is not hooked
+    //
+    IOReturn HookObjectIntWoLock( __inout OSObject* object, __in bool checkHooked = true );
     IOReturn UnHookObjectIntWoLock( __inout OSObject* object );
     
+    //
+    // the entries allocated by HookObjects() before taking the lock,
+    // the fields are accessed under the exclusive lock
+    //
+    DldHookedObjectEntry**       PreallocatedEntries;
+    unsigned int                 PreallocatedEntriesNumber;
+    
+    //
+    // returns a preallocated entry or allocates a new one
+    //
+    DldHookedObjectEntry* AllocateEntry();
+    
+#if defined(DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES)
+    bool ReferenceVtableLockFree( __in OSObject* object, __in bool reference );
+    
+    DldHookedObjectSlot* RetrieveHookedObject( __in OSObject* object );
+    bool AddHookedObject( __in OSObject* object, __in OSMetaClassBase::_ptf_t* vtable, __out bool* alreadyAdded );
+    bool GrowHookedObjects();
+#endif//DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES
+    
     //
     // a type of the hook performed by the class
     //
     DldHookType                  HookType;
     
+    //
+    // a non zero identifier assigned by the constructor, unique for the driver's lifetime
+    //
+    UInt32                       HookerId;
+    
+    static volatile SInt32       sHookersCounter;
+    
     //
     // an inheritance depth of the hooked class
     //
@@ -707,6 +1330,74 @@ private:
     //
     unsigned int                  HookedFunctonsInfoEntriesNumber;
     
+    //
+    // the vtables hooked directly by this hooker with their original functions,
+    // an open addressing table with linear probing, the size is a power of 2
+    // and at least a half of the slots are empty, the table is changed under
+    // the exclusive lock and read in the lock free read section, a vtable defines
+    // the object's class so a call through a vtable from the table is resolved
+    // without the meta class walk and the hash table lookups
+    //
+    DldHookedVtableSlot*          HookedVtables;
+    unsigned int                  HookedVtablesSize;
+    unsigned int                  HookedVtablesCount;
+    
+#if defined(DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES)
+    //
+    // the objects hooked by the direct vtable hooks as there are no object
+    // entries, an open addressing table with linear probing, the size is
+    // a power of 2 and at most a half of the slots are used, the objects
+    // are added and removed in the lock free read section, a removed object
+    // leaves its slot marked until the table is rebuilt under the exclusive
+    // lock, HookedObjectSlotsUsed counts the added and the removed objects
+    //
+    DldHookedObjectSlot*          HookedObjectSlots;
+    unsigned int                  HookedObjectSlotsSize;
+    volatile UInt32               HookedObjectSlotsUsed;
+#endif//DLD_VTABLE_HOOK_NO_OBJECT_ENTRIES
+    
+    //
+    // DLD_CALL_CACHE_WAYS entries for each HookedFunctonsInfo entry, used only
+    // for DldHookTypeVtable, NULL if the allocation failed
+    //
+    DldCallCacheEntry*            CallCache;
+    
+    OSMetaClassBase::_ptf_t GetOriginalFunctionCached( __in OSObject* hookedObject, __in unsigned int indx );
+    
+    void AddHookedVtable( __in OSMetaClassBase::_ptf_t* vtable, __in DldHookedFunctionInfo* HookedVtableFunctionsInfo );
+    void RemoveHookedVtable( __in OSMetaClassBase::_ptf_t* vtable );
+    DldHookedFunctionInfo* RetrieveHookedVtable( __in OSMetaClassBase::_ptf_t* vtable );
+    
+#if defined(DLD_HOOK_STATS)
+    
+    //
+    // ml_get_max_cpus() entries, NULL if the allocation failed, then
+    // the statistics are not collected
+    //
+    DldHookerCpuStatistics*       CpuStatistics;
+    unsigned int                  StatisticsCpusNumber;
+    
+    //
+    // returns the counters of the CPU the caller is running on or NULL,
+    // the thread might be moved to another CPU before the counters are
+    // updated so the updates are atomic, but they rarely touch a cache
+    // line shared with another CPU
+    //
+    DldHookerCallStatistics* GetCpuStatistics();
+    
+#endif//DLD_HOOK_STATS
+    
+    OSMetaClassBase::_ptf_t GetOriginalFunctionInt( __in OSObject* hookedObject, __in unsigned int indx );
+    
+    //
+    // looks up the vtable hook entries, must be called in the hash table's
+    // lock free read section or with the shared lock held
+    //
+    OSMetaClassBase::_ptf_t RetrieveOriginalFunction( __in const OSObject* hookedObject,
+                                                      __in const OSMetaClass* keyMetaClass,
+                                                      __in bool superCall,
+                                                      __in unsigned int indx );
+    
 public:
     
     DldHookerCommonClass();   
@@ -737,6 +1428,11 @@ public:
     
     DldInheritanceDepth GetInheritanceDepth(){ return this->InheritanceDepth; };
     
+    //
+    // used by the trace to tell the hookers apart without disclosing their addresses
+    //
+    UInt32 GetHookerId(){ return this->HookerId; };
+    
     //
     // callbacks called by hooking functions ( the name defines the corresponding IOService hook )
     //
@@ -794,8 +1490,25 @@ public:
     
     IOReturn UnHookObject( __inout OSObject* object );
     
+    //
+    // the bulk versions of HookObject() and UnHookObject(), the objects
+    // are processed under a single lock hold, the first error is returned
+    //
+    IOReturn HookObjects( __inout OSObject** objects, __in unsigned int count, __in DldHookType type );
+    
+    IOReturn UnHookObjects( __inout OSObject** objects, __in unsigned int count );
+    
     OSMetaClassBase::_ptf_t GetOriginalFunction( __in OSObject* hookedObject, __in unsigned int indx );
     
+#if defined(DLD_HOOK_STATS)
+    void GetCallStatistics( __out DldHookerCallStatistics* statistics );
+#endif//DLD_HOOK_STATS
+    
+    //
+    // fills all fields but HookerInstanceBytes
+    //
+    void GetMemoryUsage( __out DldHookerMemoryUsage* usage );
+    
     //
     // the VtableToHook and NewVtable vtables might be the same in case of a direct hook ( DldHookTypeVtable )
     //
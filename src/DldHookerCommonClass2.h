@@ -222,6 +222,9 @@ public:
     
     static IOReturn fHookObject( __inout OSObject* object, __in DldHookType type );
     static IOReturn fUnHookObject( __inout OSObject* object, __in DldHookType type, __in DldInheritanceDepth Depth );
+    static IOReturn fHookObjects( __inout OSObject** objects, __in unsigned int count, __in DldHookType type );
+    static IOReturn fUnHookObjects( __inout OSObject** objects, __in unsigned int count );
+    static bool fGetMemoryUsage( __out DldHookerMemoryUsage* usage );
     
     static bool fObjectFirstPublishCallback( __in IOService * newService );
     static bool fObjectTerminatedCallback( __in IOService * terminatedService );
@@ -263,6 +266,10 @@ public:
     
     OSMetaClassBase::_ptf_t fGetOriginalFunctionExternal( __in OSObject* hookedObject, __in unsigned int indx );
     
+#if defined(DLD_HOOK_STATS)
+    void fGetCallStatistics( __out DldHookerCallStatistics* statistics ){ mHookerCommon.GetCallStatistics( statistics ); };
+#endif//DLD_HOOK_STATS
+    
     //
     // adds a new hooked function'd definition,
     // the index has a base 0x0 and should be smaller than ADDED_FUNCTIONS,
@@ -1697,6 +1704,61 @@ DldHookerCommonClass2<CC,HC>::fUnHookObject( __inout OSObject* object, __in DldH
 
 //--------------------------------------------------------------------
 
+template <class CC, class HC>
+IOReturn
+DldHookerCommonClass2<CC,HC>::fHookObjects( __inout OSObject** objects, __in unsigned int count, __in DldHookType type )
+{
+    DldHookerCommonClass2<CC,HC>*  commonHooker2;
+    
+    commonHooker2 = DldHookerCommonClass2<CC,HC>::fCommonHooker2();
+    assert( commonHooker2 );
+    if( NULL == commonHooker2 )
+        return kIOReturnNoMemory;
+    
+    return commonHooker2->mHookerCommon.HookObjects( objects, count, type );
+}
+
+//--------------------------------------------------------------------
+
+template <class CC, class HC>
+IOReturn
+DldHookerCommonClass2<CC,HC>::fUnHookObjects( __inout OSObject** objects, __in unsigned int count )
+{
+    DldHookerCommonClass2<CC,HC>*  commonHooker2;
+    
+    commonHooker2 = DldHookerCommonClass2<CC,HC>::fCommonHooker2();
+    assert( commonHooker2 );
+    if( NULL == commonHooker2 )
+        return kIOReturnNoMemory;
+    
+    return commonHooker2->mHookerCommon.UnHookObjects( objects, count );
+}
+
+//--------------------------------------------------------------------
+
+template <class CC, class HC>
+bool
+DldHookerCommonClass2<CC,HC>::fGetMemoryUsage( __out DldHookerMemoryUsage* usage )
+{
+    DldHookerCommonClass2<CC,HC>*  commonHooker2;
+    
+    commonHooker2 = DldHookerCommonClass2<CC,HC>::fCommonHooker2();
+    assert( commonHooker2 );
+    if( NULL == commonHooker2 )
+        return false;
+    
+    commonHooker2->mHookerCommon.GetMemoryUsage( usage );
+    
+    //
+    // the static container instance and this object, the latter includes the HookedFunctonsInfo array
+    //
+    usage->HookerInstanceBytes = sizeof( CC ) + sizeof( *commonHooker2 );
+    
+    return true;
+}
+
+//--------------------------------------------------------------------
+
 //
 // a definiton for a first publish callback
 //
@@ -11,6 +11,44 @@
     #error "Unsupported architecture"
 #endif
 
+#if defined(DLD_HOST_BUILD)
+
+addr64_t
+DldVirtToPhys(
+    __in vm_offset_t addr
+    )
+/*
+    a user space stand-in, there is no physical address, the address is
+    returned for a mapped page as the callers only check for zero
+ */
+{
+    return DldHostIsAddressMapped( addr ) ? (addr64_t)addr : 0x0;
+}
+
+//--------------------------------------------------------------------
+
+unsigned int
+DldWriteWiredSrcToWiredDst(
+    __in vm_offset_t  src,
+    __in vm_offset_t  dst,
+    __in vm_size_t    len
+    )
+/*
+    a user space stand-in, the vtables are in the read only data so
+    the pages are made writable for the write, see DldHostWriteProtectedMemory()
+ */
+{
+    if( !DldHostWriteProtectedMemory( dst, src, len ) ){
+        
+        DBG_PRINT_ERROR(("DldHostWriteProtectedMemory( 0x%p, 0x%p, %u ) failed\n", (void*)dst, (void*)src, (unsigned int)len ));
+        return 0x0;
+    }
+    
+    return (unsigned int)len;
+}
+
+#else//DLD_HOST_BUILD
+
 addr64_t
 DldVirtToPhys(
    __in vm_offset_t addr
@@ -103,3 +141,5 @@ DldWriteWiredSrcToWiredDst(
 }
 
 //--------------------------------------------------------------------
+
+#endif//DLD_HOST_BUILD
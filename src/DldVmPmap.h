@@ -8,6 +8,8 @@
 
 #include "DldCommon.h"
 
+#if !defined(DLD_HOST_BUILD)
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -42,6 +44,11 @@ extern "C" {
 }
 #endif
 
+#endif//DLD_HOST_BUILD
+
+//
+// returns zero for an unmapped address, the host build returns the address
+//
 addr64_t
 DldVirtToPhys(
     __in vm_offset_t addr
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#include "DldEventRingReader.h"
+
+//--------------------------------------------------------------------
+
+int
+DldEventRingReaderInit(
+    DldEventRingReader*  reader,
+    void*                base,
+    size_t               size
+    )
+{
+    DldEventRingHeader*  header = (DldEventRingHeader*)base;
+
+    if( NULL == reader || NULL == base || size < sizeof( *header ) )
+        return -1;
+
+    //
+    // the kernel writes the magic after the rest of the header
+    //
+    if( DLD_EVENT_RING_MAGIC != __atomic_load_n( &header->Magic, __ATOMIC_ACQUIRE ) )
+        return -1;
+
+    if( DLD_EVENT_RING_VERSION != header->Version ||
+        sizeof( DldEventRecord ) != header->RecordSize ||
+        0x0 == header->CpusNumber ||
+        0x0 == header->RecordsPerCpu ||
+        0x0 != ( header->RecordsPerCpu & ( header->RecordsPerCpu - 0x1 ) ) ||
+        header->TotalSize != DLD_EVENT_RING_SIZE( header->CpusNumber, header->RecordsPerCpu ) ||
+        header->TotalSize > size )
+        return -1;
+
+    reader->Header = header;
+    reader->Size = size;
+    reader->NextCpu = 0x0;
+
+    return 0;
+}
+
+//--------------------------------------------------------------------
+
+size_t
+DldEventRingReaderRead(
+    DldEventRingReader*  reader,
+    DldEventRecord*      records,
+    size_t               maxRecords
+    )
+{
+    DldEventRingHeader*  header = reader->Header;
+    uint32_t             mask = header->RecordsPerCpu - 0x1;
+    size_t               count = 0x0;
+
+    for( uint32_t i = 0x0; i < header->CpusNumber && count < maxRecords; ++i ){
+
+        uint32_t          cpu = ( reader->NextCpu + i ) % header->CpusNumber;
+        DldEventRingCpu*  cpuRing = DLD_EVENT_RING_CPU( header, cpu );
+        DldEventRecord*   ringRecords = DLD_EVENT_RING_RECORDS( header, cpu );
+        uint64_t          head;
+        uint64_t          tail;
+
+        //
+        // the acquire pairs with the kernel's store of the Head made after the record's copy
+        //
+        head = __atomic_load_n( &cpuRing->Head, __ATOMIC_ACQUIRE );
+        tail = cpuRing->Tail;
+
+        while( tail != head && count < maxRecords ){
+
+            records[ count++ ] = ringRecords[ tail & mask ];
+            ++tail;
+        }// end while
+
+        //
+        // the release guarantees the records have been copied before the slots are reused
+        //
+        __atomic_store_n( &cpuRing->Tail, tail, __ATOMIC_RELEASE );
+
+    }// end for
+
+    reader->NextCpu = ( reader->NextCpu + 0x1 ) % header->CpusNumber;
+
+    return count;
+}
+
+//--------------------------------------------------------------------
+
+uint64_t
+DldEventRingReaderDropped(
+    DldEventRingReader*  reader
+    )
+{
+    uint64_t  dropped = 0x0;
+
+    for( uint32_t cpu = 0x0; cpu < reader->Header->CpusNumber; ++cpu )
+        dropped += __atomic_load_n( &DLD_EVENT_RING_CPU( reader->Header, cpu )->Dropped, __ATOMIC_RELAXED );
+
+    return dropped;
+}
+
+//--------------------------------------------------------------------
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+#ifndef _DLDEVENTRINGREADER_H
+#define _DLDEVENTRINGREADER_H
+
+//
+// a user space reader for the event ring, the reader depends only on the
+// shared layout so it works with any mapping of the ring's memory, e.g. a
+// mapping returned by IOConnectMapMemory64() or an mmap()-ed file
+//
+
+#include <stddef.h>
+#include <stdint.h>
+#include "../example/DldEventRingShared.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//--------------------------------------------------------------------
+
+typedef struct _DldEventRingReader{
+
+    DldEventRingHeader*  Header;
+    size_t               Size;
+
+    //
+    // a CPU to start the next read from, the rings are read in
+    // a round robin fashion so a busy CPU doesn't starve the others
+    //
+    uint32_t             NextCpu;
+
+} DldEventRingReader;
+
+//--------------------------------------------------------------------
+
+//
+// validates the ring's header, returns 0 on success and -1 if the
+// memory doesn't contain a ring of a supported version
+//
+int
+DldEventRingReaderInit(
+    DldEventRingReader*  reader,
+    void*                base,
+    size_t               size
+    );
+
+//
+// copies at most maxRecords records in the provided array and frees
+// the ring slots, returns the number of the copied records
+//
+size_t
+DldEventRingReaderRead(
+    DldEventRingReader*  reader,
+    DldEventRecord*      records,
+    size_t               maxRecords
+    );
+
+//
+// returns the number of records dropped by the kernel as the rings were full
+//
+uint64_t
+DldEventRingReaderDropped(
+    DldEventRingReader*  reader
+    );
+
+//--------------------------------------------------------------------
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif//_DLDEVENTRINGREADER_H
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2016 Slava Imameev. All rights reserved.
+ */
+
+//
+// prints the hooker's memory usage and, if the driver has been built with
+// DLD_HOOK_STATS, the hooked objects table statistics, the tool opens
+// DldEventRingUserClient through a service which creates it in newUserClient(),
+// the service's class name is an optional parameter, the default is
+// DLD_EVENT_RING_SERVICE_CLASS, i.e. the example's DldHookExampleService, e.g.
+//   DldMemoryUsageDump
+//   DldMemoryUsageDump com_example_HookingDriver
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <IOKit/IOKitLib.h>
+#include "../example/DldEventRingShared.h"
+#include "../example/DldMemoryUsageShared.h"
+#include "../example/DldHookStatisticsShared.h"
+
+//--------------------------------------------------------------------
+
+#define DLD_MAX_REPORTED_HOOKERS    (32)
+
+static const char*
+DldHookTypeName(
+    uint32_t  hookType
+    )
+{
+    switch( hookType ){
+
+        case 0x1:
+            return "object";
+        case 0x2:
+            return "vtable";
+        default:
+            return "unknown";
+    }
+}
+
+//--------------------------------------------------------------------
+
+//
+// returns the upper bound of the histogram bucket containing the percentile
+//
+static uint64_t
+DldHoldTimePercentile(
+    const DldHookStatisticsReport*  statistics,
+    unsigned int                    percentile
+    )
+{
+    uint64_t  count = 0x0;
+    uint64_t  threshold;
+
+    threshold = ( statistics->ExclusiveLocks*percentile + 99 )/100;
+
+    for( unsigned int i = 0x0; i < DLD_HOOK_STATISTICS_HISTOGRAM_BUCKETS; ++i ){
+
+        count += statistics->ExclusiveHoldTimeHistogram[ i ];
+        if( count >= threshold && 0x0 != count )
+            return 1ull << ( i + 0x1 );
+    }// end for
+
+    return statistics->MaxExclusiveHoldTime;
+}
+
+//--------------------------------------------------------------------
+
+static void
+DldPrintHookStatistics(
+    io_connect_t  connection
+    )
+{
+    DldHookStatisticsReport  statistics;
+    size_t                   statisticsSize = sizeof( statistics );
+    kern_return_t            kr;
+
+    kr = IOConnectCallStructMethod( connection,
+                                    DLD_EVENT_RING_METHOD_GET_HOOK_STATISTICS,
+                                    NULL,
+                                    0x0,
+                                    &statistics,
+                                    &statisticsSize );
+    if( kIOReturnUnsupported == kr ){
+
+        printf( "statistics: the driver has been built without DLD_HOOK_STATS\n" );
+        return;
+    }
+
+    if( KERN_SUCCESS != kr || DLD_HOOK_STATISTICS_VERSION != statistics.Version ){
+
+        fprintf( stderr, "IOConnectCallStructMethod() failed with 0x%x\n", kr );
+        return;
+    }
+
+    printf( "exclusive lock: %llu locks, wait %llu ns, hold %llu ns, hold p50 < %llu ns, p99 < %llu ns, max %llu ns\n",
+            (unsigned long long)statistics.ExclusiveLocks,
+            (unsigned long long)statistics.ExclusiveWaitTime,
+            (unsigned long long)statistics.ExclusiveHoldTime,
+            (unsigned long long)DldHoldTimePercentile( &statistics, 50 ),
+            (unsigned long long)DldHoldTimePercentile( &statistics, 99 ),
+            (unsigned long long)statistics.MaxExclusiveHoldTime );
+
+    printf( "readers: %llu shared locks, wait %llu ns, max wait %llu ns, %llu lock free reads, %llu failed\n",
+            (unsigned long long)statistics.SharedLocks,
+            (unsigned long long)statistics.SharedWaitTime,
+            (unsigned long long)statistics.MaxSharedWaitTime,
+            (unsigned long long)statistics.LockFreeReads,
+            (unsigned long long)statistics.LockFreeReadsFailed );
+
+    printf( "entries: %u, peak %u\n", statistics.Entries, statistics.PeakEntries );
+}
+
+//--------------------------------------------------------------------
+
+int
+main(
+    int    argc,
+    char*  argv[]
+    )
+{
+    io_service_t           service;
+    io_connect_t           connection;
+    kern_return_t          kr;
+    DldMemoryUsageReport*  report;
+    size_t                 reportSize = DLD_MEMORY_USAGE_REPORT_SIZE( DLD_MAX_REPORTED_HOOKERS );
+    const char*            serviceClass = DLD_EVENT_RING_SERVICE_CLASS;
+
+    if( argc > 2 ){
+
+        fprintf( stderr, "usage: %s [service class name]\n", argv[ 0 ] );
+        return EXIT_FAILURE;
+    }
+
+    if( 2 == argc )
+        serviceClass = argv[ 1 ];
+
+    service = IOServiceGetMatchingService( kIOMasterPortDefault, IOServiceMatching( serviceClass ) );
+    if( IO_OBJECT_NULL == service ){
+
+        fprintf( stderr, "the %s service has not been found\n", serviceClass );
+        return EXIT_FAILURE;
+    }
+
+    kr = IOServiceOpen( service, mach_task_self(), DLD_EVENT_RING_USER_CLIENT_TYPE, &connection );
+    IOObjectRelease( service );
+    if( KERN_SUCCESS != kr ){
+
+        fprintf( stderr, "IOServiceOpen() failed with 0x%x\n", kr );
+        return EXIT_FAILURE;
+    }
+
+    report = (DldMemoryUsageReport*)calloc( 1, reportSize );
+    if( NULL == report ){
+
+        IOServiceClose( connection );
+        return EXIT_FAILURE;
+    }
+
+    kr = IOConnectCallStructMethod( connection,
+                                    DLD_EVENT_RING_METHOD_GET_MEMORY_USAGE,
+                                    NULL,
+                                    0x0,
+                                    report,
+                                    &reportSize );
+
+    if( KERN_SUCCESS != kr || DLD_MEMORY_USAGE_VERSION != report->Version ){
+
+        fprintf( stderr, "IOConnectCallStructMethod() failed with 0x%x\n", kr );
+        IOServiceClose( connection );
+        free( report );
+        return EXIT_FAILURE;
+    }
+
+    printf( "table: %u buckets, %u items, %llu bytes, entries %llu bytes\n",
+            report->TableBuckets,
+            report->TableItems,
+            (unsigned long long)report->TableBytes,
+            (unsigned long long)report->TableEntriesBytes );
+
+    printf( "%-40s %-7s %5s %8s %8s %12s %12s %12s %12s\n",
+            "class", "type", "depth", "objects", "entries",
+            "entries", "vtinfo", "vtbuffer", "instance" );
+
+    for( uint32_t i = 0x0; i < report->HookersNumber; ++i ){
+
+        DldMemoryUsageHooker*  hooker = &DLD_MEMORY_USAGE_HOOKERS( report )[ i ];
+
+        printf( "%-40.*s %-7s %5u %8u %8u %12llu %12llu %12llu %12llu\n",
+                (int)sizeof( hooker->ClassName ), hooker->ClassName,
+                DldHookTypeName( hooker->HookType ),
+                hooker->Depth,
+                hooker->HookedObjects,
+                hooker->Entries,
+                (unsigned long long)hooker->EntriesBytes,
+                (unsigned long long)hooker->VtableFunctionsInfoBytes,
+                (unsigned long long)hooker->VtableBufferBytes,
+                (unsigned long long)hooker->HookerInstanceBytes );
+    }// end for
+
+    if( report->HookersNumber != report->TotalHookersNumber )
+        printf( "... %u more hookers are not shown\n", report->TotalHookersNumber - report->HookersNumber );
+
+    printf( "total: %llu bytes\n", (unsigned long long)report->TotalBytes );
+
+    DldPrintHookStatistics( connection );
+    IOServiceClose( connection );
+
+    free( report );
+
+    return EXIT_SUCCESS;
+}
+
+//--------------------------------------------------------------------